@@ -23,6 +23,8 @@ stADCHandles_t stADCHandle1 =
 //Add as needed for more ADC channels
 
 /* --------------------------- Definitions ----------------------------- */
+#define ADC_TAG "ADC"
+#define ADC_BENCH_CONVERSIONS 1000
 
 
 /* --------------------------- Functions ------------------------------- */
@@ -120,7 +122,7 @@ float read_sensor(stADCHandles_t *stADCHandle, stSensorMap_t *stSensorMap)
 *   Takes:  stADCHandle: Pointer to ADC handle structure, contains unit and calibration handles
 *           stSensorMap: Pointer to sensor map structure for lookup table and limits
 * 
-*   Returns: Normalised sensor reading as float, or -999.0f on error
+*   Returns: Normalised sensor reading as float, or SENSOR_ERROR (-999.0f) on error
 * 
 *   Reads from the ADC and uses the sensor map to convert this to a real value.
 *   Includes plausibility check based on sensor map limits for SCS compliance.
@@ -128,30 +130,174 @@ float read_sensor(stADCHandles_t *stADCHandle, stSensorMap_t *stSensorMap)
 *=========================================================================== 
 *   Revision History:
 *   16/11/25 CP Initial Version
+*   18/10/26 CP Lookup moved to sensor_map_lookup
 *
 *===========================================================================
 */
 {
-    uint8_t NCounter;
-    float fVSensor = adc_read_voltage(stADCHandle);
-    /* If outside plauseable range throw error (SCS Requirement) */
-    if (fVSensor < stSensorMap->fLowerLimit || fVSensor > stSensorMap->fUpperLimit)
+    return sensor_map_lookup(stSensorMap, adc_read_voltage(stADCHandle));
+}
+
+esp_err_t adc_read_millivolts(stADCHandles_t *stADCHandle, word *pwVoltagemV)
+/*
+*===========================================================================
+*   adc_read_millivolts
+*   Takes:  stADCHandle: Pointer to ADC handle structure, contains unit and calibration handles
+*           pwVoltagemV: Set to the calibrated voltage in mV
+* 
+*   Returns: ESP_OK, or the error from the read or calibration, pwVoltagemV
+*            is left alone on error
+* 
+*   adc_read_voltage without the float, the calibration already works in mV.
+*=========================================================================== 
+*   Revision History:
+*   18/10/26 CP Initial Version
+*   18/10/26 CP Returns the error instead of 0 mV
+*
+*===========================================================================
+*/
+{
+    int NRaw = 0;
+    int NVoltagemV = 0;
+    esp_err_t NStatus = adc_oneshot_read(stADCHandle->stADCUnit, stADCHandle->eNChannel, &NRaw);
+    if (NStatus != ESP_OK)
     {
-        return -999.0f;
+        return NStatus;
     }
+    NStatus = adc_cali_raw_to_voltage(stADCHandle->stCalibration, NRaw, &NVoltagemV);
+    if (NStatus != ESP_OK)
+    {
+        return NStatus;
+    }
+    *pwVoltagemV = (NVoltagemV < 0) ? 0 : (NVoltagemV > UINT16_MAX) ? UINT16_MAX : (word)NVoltagemV;
+    return ESP_OK;
+}
 
-    /* Lookup Sensor Value */
-    for (NCounter = 0; NCounter < sizeof(stSensorMap->afLookupTable[0])/sizeof(stSensorMap->afLookupTable[0][0]) - 1; NCounter++)
+sdword read_sensor_q(stADCHandles_t *stADCHandle, const stSensorMapQ_t *stSensorMapQ)
+/*
+*===========================================================================
+*   read_sensor_q
+*   Takes:  stADCHandle: Pointer to ADC handle structure, contains unit and calibration handles
+*           stSensorMapQ: Pointer to fixed point sensor map from sensor_map_q_init
+* 
+*   Returns: Sensor reading in Q16.16, or SENSOR_Q_ERROR on error or a
+*            failed read
+* 
+*   read_sensor with no float anywhere, the same plausibility check. For
+*   the fast paths (APPS at 1 kHz) where the soft float calls add up.
+*=========================================================================== 
+*   Revision History:
+*   18/10/26 CP Initial Version
+*   18/10/26 CP A failed read is an error, not 0 mV
+*
+*===========================================================================
+*/
+{
+    word wVoltagemV;
+    if (adc_read_millivolts(stADCHandle, &wVoltagemV) != ESP_OK)
     {
-        if (fVSensor >= stSensorMap->afLookupTable[0][NCounter] && fVSensor < stSensorMap->afLookupTable[0][NCounter + 1])
-        { 
-            float fSlope = (stSensorMap->afLookupTable[1][NCounter + 1] - stSensorMap->afLookupTable[1][NCounter]) /
-                           (stSensorMap->afLookupTable[0][NCounter + 1] - stSensorMap->afLookupTable[0][NCounter]);
-            float fOutput = stSensorMap->afLookupTable[1][NCounter] +
-                            fSlope * (fVSensor - stSensorMap->afLookupTable[0][NCounter]);
-            return fOutput;
-        }
+        return SENSOR_Q_ERROR;
     }
-    
-    return -999.0f;
-}
\ No newline at end of file
+    return sensor_map_q_lookup(stSensorMapQ, wVoltagemV);
+}
+
+float read_sensor_compiled(stADCHandles_t *stADCHandle, const stSensorMapCompiled_t *stCompiled)
+/*
+*===========================================================================
+*   read_sensor_compiled
+*   Takes:  stADCHandle: Pointer to ADC handle structure, contains unit and calibration handles
+*           stCompiled: Pointer to sensor map from sensor_map_compile
+* 
+*   Returns: Normalised sensor reading as float, or SENSOR_ERROR (-999.0f) on error
+* 
+*   read_sensor without the search through the table, the same result.
+*=========================================================================== 
+*   Revision History:
+*   18/10/26 CP Initial Version
+*
+*===========================================================================
+*/
+{
+    return sensor_map_compiled_lookup(stCompiled, adc_read_voltage(stADCHandle));
+}
+
+void adc_benchmark(stADCHandles_t *stADCHandle, const stSensorMap_t *stSensorMap)
+/*
+*===========================================================================
+*   adc_benchmark
+*   Takes:  stADCHandle: Pointer to a registered ADC handle
+*           stSensorMap: Pointer to the sensor map to time
+* 
+*   Returns: Nothing.
+* 
+*   Logs CPU cycles per conversion for the float, compiled and fixed point
+*   paths, the lookup alone over a sweep of the map's voltages and a whole
+*   read with the ADC. Call from main_init on a bench, it takes a few ms.
+*=========================================================================== 
+*   Revision History:
+*   18/10/26 CP Initial Version
+*   18/10/26 CP Times the compiled map
+*
+*===========================================================================
+*/
+{
+    static stSensorMapQ_t stSensorMapQ;
+    static stSensorMapCompiled_t stCompiled;
+    volatile float fSink = 0.0f;
+    volatile sdword sdwSink = 0;
+    if (sensor_map_q_init(stSensorMap, &stSensorMapQ) != ESP_OK || sensor_map_compile(stSensorMap, &stCompiled) != ESP_OK)
+    {
+        ESP_LOGE(ADC_TAG, "Sensor map does not convert to fixed point or compile");
+        return;
+    }
+
+    /* Lookup only, the same voltages both ways */
+    word wFirstmV = (word)(stSensorMapQ.adwVoltageuV[0] / 1000);
+    word wSpanmV = (word)(stSensorMapQ.adwVoltageuV[SENSOR_MAP_POINTS - 1] / 1000) - wFirstmV;
+    dword dwStartCycles = esp_cpu_get_cycle_count();
+    for (word i = 0; i < ADC_BENCH_CONVERSIONS; i++)
+    {
+        fSink = sensor_map_lookup(stSensorMap, (float)(wFirstmV + (dword)wSpanmV * i / ADC_BENCH_CONVERSIONS) / 1000.0f);
+    }
+    dword dwFloatCycles = esp_cpu_get_cycle_count() - dwStartCycles;
+    dwStartCycles = esp_cpu_get_cycle_count();
+    for (word i = 0; i < ADC_BENCH_CONVERSIONS; i++)
+    {
+        fSink = sensor_map_compiled_lookup(&stCompiled, (float)(wFirstmV + (dword)wSpanmV * i / ADC_BENCH_CONVERSIONS) / 1000.0f);
+    }
+    dword dwCompiledCycles = esp_cpu_get_cycle_count() - dwStartCycles;
+    dwStartCycles = esp_cpu_get_cycle_count();
+    for (word i = 0; i < ADC_BENCH_CONVERSIONS; i++)
+    {
+        sdwSink = sensor_map_q_lookup(&stSensorMapQ, (word)(wFirstmV + (dword)wSpanmV * i / ADC_BENCH_CONVERSIONS));
+    }
+    dword dwFixedCycles = esp_cpu_get_cycle_count() - dwStartCycles;
+    ESP_LOGI(ADC_TAG, "Lookup: float %lu cycles, compiled %lu cycles (%s), fixed %lu cycles per conversion",
+             (unsigned long)(dwFloatCycles / ADC_BENCH_CONVERSIONS), (unsigned long)(dwCompiledCycles / ADC_BENCH_CONVERSIONS),
+             stCompiled.bUniform ? "indexed" : "searched", (unsigned long)(dwFixedCycles / ADC_BENCH_CONVERSIONS));
+
+    /* Whole reads, the ADC conversion is the same for both */
+    dwStartCycles = esp_cpu_get_cycle_count();
+    for (word i = 0; i < ADC_BENCH_CONVERSIONS; i++)
+    {
+        fSink = read_sensor(stADCHandle, (stSensorMap_t *)stSensorMap);
+    }
+    dwFloatCycles = esp_cpu_get_cycle_count() - dwStartCycles;
+    dwStartCycles = esp_cpu_get_cycle_count();
+    for (word i = 0; i < ADC_BENCH_CONVERSIONS; i++)
+    {
+        fSink = read_sensor_compiled(stADCHandle, &stCompiled);
+    }
+    dwCompiledCycles = esp_cpu_get_cycle_count() - dwStartCycles;
+    dwStartCycles = esp_cpu_get_cycle_count();
+    for (word i = 0; i < ADC_BENCH_CONVERSIONS; i++)
+    {
+        sdwSink = read_sensor_q(stADCHandle, &stSensorMapQ);
+    }
+    dwFixedCycles = esp_cpu_get_cycle_count() - dwStartCycles;
+    ESP_LOGI(ADC_TAG, "read_sensor: float %lu cycles, compiled %lu cycles, fixed %lu cycles per conversion",
+             (unsigned long)(dwFloatCycles / ADC_BENCH_CONVERSIONS), (unsigned long)(dwCompiledCycles / ADC_BENCH_CONVERSIONS),
+             (unsigned long)(dwFixedCycles / ADC_BENCH_CONVERSIONS));
+    (void)fSink;
+    (void)sdwSink;
+}
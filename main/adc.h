@@ -6,13 +6,19 @@
 #include "esp_adc/adc_cali_scheme.h"
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_cpu.h"
 
 #include "pin.h"
 #include "sfrtypes.h"
+#include "sensormap.h"
 
 /* --------------------------- Function prototypes --------------------- */
 esp_err_t adc_register(adc_atten_t eNAtten, adc_unit_t eNUnit, stADCHandles_t *stADCHandle);
 float adc_read_voltage(stADCHandles_t *stADCHandle);
 float read_sensor(stADCHandles_t *stADCHandle, stSensorMap_t *stSensorMap);
+esp_err_t adc_read_millivolts(stADCHandles_t *stADCHandle, word *pwVoltagemV);
+sdword read_sensor_q(stADCHandles_t *stADCHandle, const stSensorMapQ_t *stSensorMapQ);
+float read_sensor_compiled(stADCHandles_t *stADCHandle, const stSensorMapCompiled_t *stCompiled);
+void adc_benchmark(stADCHandles_t *stADCHandle, const stSensorMap_t *stSensorMap);
 
 #endif // ADC_H
\ No newline at end of file
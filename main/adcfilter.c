@@ -0,0 +1,217 @@
+/*
+adcfilter.c
+File contains the per-channel filter run on the ADC scan's samples before
+a value is published. Three stages, each optional, all integer:
+
+  median of N   each raw sample is replaced by the median of it and the
+                N - 1 before it, a single sample spike never gets through
+  oversample    M of those are averaged into one output, the noise falls by
+                root M and the output gains fraction bits
+  IIR           first order low pass on the averages, y += (x - y) / 2^k,
+                8 fraction bits of mV in the state so small steps still move it
+
+Group delay, in samples of the channel at low frequency, adds up as
+(N - 1) / 2 for the median, (M - 1) / 2 for the average and (2^k - 1) * M
+for the low pass. adcfilter_group_delay_us works it out for a config and
+adcscan logs it per channel at start up, so trading latency for noise is a
+matter of changing the config and reading the log. With APPS at 10 kHz a
+channel, median of 3, a block of 10 averaged and k = 1 is 15.5 samples,
+1.55 ms.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include "adcfilter.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define ADCFILTER_STATE_SHIFT 8         // fraction bits of the average and the low pass
+#define ADCFILTER_STATE_HALF (1 << (ADCFILTER_STATE_SHIFT - 1))
+#define ADCFILTER_MAX_SUMMED 0xFFFF     // keeps the sum inside 32 bits, closed early if an average runs this long
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t adcfilter_init(stADCFilter_t *stFilter, const stADCFilterConfig_t *stConfig);
+boolean adcfilter_run(stADCFilter_t *stFilter, const word *awSamplesmV, word wNSamples, word *pwOutputmV);
+dword adcfilter_group_delay_us(const stADCFilterConfig_t *stConfig, dword dwtSampleus, word wNBlockSamples);
+static word adcfilter_median(stADCFilter_t *stFilter, word wSamplemV);
+static void adcfilter_output(stADCFilter_t *stFilter, word *pwOutputmV);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t adcfilter_init(stADCFilter_t *stFilter, const stADCFilterConfig_t *stConfig)
+{
+    /*
+    *===========================================================================
+    *   adcfilter_init
+    *   Takes:   stFilter - filter to set up
+    *            stConfig - its stages
+    *
+    *   Returns: ESP_OK or ESP_ERR_INVALID_ARG for an even or too long
+    *            median or too large a shift.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (stConfig->byMedian > ADCFILTER_MAX_MEDIAN || (stConfig->byMedian > 1 && (stConfig->byMedian & 1) == 0) ||
+        stConfig->byIIRShift > ADCFILTER_MAX_IIR_SHIFT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(stFilter, 0, sizeof(*stFilter));
+    stFilter->stConfig = *stConfig;
+    return ESP_OK;
+}
+
+boolean adcfilter_run(stADCFilter_t *stFilter, const word *awSamplesmV, word wNSamples, word *pwOutputmV)
+{
+    /*
+    *===========================================================================
+    *   adcfilter_run
+    *   Takes:   stFilter - the channel's filter
+    *            awSamplesmV - the channel's samples from one block, oldest first
+    *            wNSamples - how many
+    *            pwOutputmV - where the newest output goes
+    *
+    *   Returns: TRUE if the block finished at least one average, FALSE if
+    *            it is still being filled and pwOutputmV is untouched.
+    *
+    *   Averages run on across blocks unless byOversample is
+    *   ADCFILTER_AVERAGE_BLOCK, so an M that does not divide the block
+    *   gives some blocks two outputs and some none.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    boolean bOutput = FALSE;
+    byte byOversample = stFilter->stConfig.byOversample;
+
+    for (word i = 0; i < wNSamples; i++)
+    {
+        stFilter->dwSummV += adcfilter_median(stFilter, awSamplesmV[i]);
+        stFilter->wNSummed++;
+        if ((byOversample != ADCFILTER_AVERAGE_BLOCK && stFilter->wNSummed >= byOversample) ||
+            stFilter->wNSummed == ADCFILTER_MAX_SUMMED)
+        {
+            adcfilter_output(stFilter, pwOutputmV);
+            bOutput = TRUE;
+        }
+    }
+    if (byOversample == ADCFILTER_AVERAGE_BLOCK && stFilter->wNSummed > 0)
+    {
+        adcfilter_output(stFilter, pwOutputmV);
+        bOutput = TRUE;
+    }
+    return bOutput;
+}
+
+dword adcfilter_group_delay_us(const stADCFilterConfig_t *stConfig, dword dwtSampleus, word wNBlockSamples)
+{
+    /*
+    *===========================================================================
+    *   adcfilter_group_delay_us
+    *   Takes:   stConfig - the stages
+    *            dwtSampleus - time between one channel's samples
+    *            wNBlockSamples - the channel's samples per block, for
+    *                             ADCFILTER_AVERAGE_BLOCK
+    *
+    *   Returns: Low frequency group delay from sample to output in us.
+    *
+    *   Worked in half samples so the odd median and average halves are
+    *   exact. The block wait before the average is published is not in
+    *   here, it is the scan's latency.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    dword dwMedian = (stConfig->byMedian > 1) ? stConfig->byMedian : 1;
+    dword dwOversample = (stConfig->byOversample == ADCFILTER_AVERAGE_BLOCK) ? wNBlockSamples : stConfig->byOversample;
+    dwOversample = (dwOversample > 0) ? dwOversample : 1;
+    qword qwHalfSamples = (dwMedian - 1) + (dwOversample - 1) +
+                          2 * (((qword)1 << stConfig->byIIRShift) - 1) * dwOversample;
+    return (dword)((qwHalfSamples * dwtSampleus + 1) / 2);
+}
+
+static word adcfilter_median(stADCFilter_t *stFilter, word wSamplemV)
+{
+    /*
+    *===========================================================================
+    *   adcfilter_median
+    *   Takes:   stFilter - the channel's filter
+    *            wSamplemV - newest raw sample
+    *
+    *   Returns: Median of the window with it in, the sample itself until
+    *            the window is full or with no median stage.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    byte byMedian = stFilter->stConfig.byMedian;
+    if (byMedian <= 1)
+    {
+        return wSamplemV;
+    }
+    stFilter->awWindowmV[stFilter->byWindowHead] = wSamplemV;
+    stFilter->byWindowHead = (stFilter->byWindowHead + 1 == byMedian) ? 0 : stFilter->byWindowHead + 1;
+    if (stFilter->byNWindow < byMedian)
+    {
+        stFilter->byNWindow++;
+        return wSamplemV;
+    }
+
+    /* Insertion sort of at most 5, cheaper than anything cleverer at this size */
+    word awSortedmV[ADCFILTER_MAX_MEDIAN];
+    for (byte i = 0; i < byMedian; i++)
+    {
+        word wValuemV = stFilter->awWindowmV[i];
+        byte j = i;
+        while (j > 0 && awSortedmV[j - 1] > wValuemV)
+        {
+            awSortedmV[j] = awSortedmV[j - 1];
+            j--;
+        }
+        awSortedmV[j] = wValuemV;
+    }
+    return awSortedmV[byMedian / 2];
+}
+
+static void adcfilter_output(stADCFilter_t *stFilter, word *pwOutputmV)
+{
+    /*
+    *===========================================================================
+    *   adcfilter_output
+    *   Takes:   stFilter - the channel's filter, with a sum to average
+    *            pwOutputmV - where the output goes
+    *
+    *   Returns: Nothing.
+    *
+    *   Closes the average and steps the low pass with it. The low pass
+    *   starts at the first average rather than climbing from 0.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    sdword sdwAverageQ = (sdword)((((qword)stFilter->dwSummV << ADCFILTER_STATE_SHIFT) + stFilter->wNSummed / 2) /
+                                  stFilter->wNSummed);
+    stFilter->dwSummV = 0;
+    stFilter->wNSummed = 0;
+
+    if (!stFilter->bPrimed)
+    {
+        stFilter->sdwStateQ = sdwAverageQ;
+        stFilter->bPrimed = TRUE;
+    }
+    else
+    {
+        stFilter->sdwStateQ += (sdwAverageQ - stFilter->sdwStateQ) >> stFilter->stConfig.byIIRShift;
+    }
+    *pwOutputmV = (word)((stFilter->sdwStateQ + ADCFILTER_STATE_HALF) >> ADCFILTER_STATE_SHIFT);
+}
@@ -0,0 +1,37 @@
+#ifndef SFR_ADCFILTER
+#define SFR_ADCFILTER
+
+#include <string.h>
+#include "esp_err.h"
+
+#include "sfrtypes.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define ADCFILTER_MAX_MEDIAN 5          // spike window, odd
+#define ADCFILTER_MAX_IIR_SHIFT 8       // alpha down to 1/256
+#define ADCFILTER_AVERAGE_BLOCK 0       // byOversample, average whatever one scan block holds
+
+/* --------------------------- Types ---------------------------------------- */
+typedef struct {
+    byte byMedian;                  // median of this many raw samples, 0 or 1 for none, else 3 or 5
+    byte byOversample;              // median outputs averaged per output, 1 for none, ADCFILTER_AVERAGE_BLOCK for one per block
+    byte byIIRShift;                // low pass y += (x - y) / 2^shift on the averages, 0 for none
+} stADCFilterConfig_t;
+
+typedef struct {
+    stADCFilterConfig_t stConfig;
+    word awWindowmV[ADCFILTER_MAX_MEDIAN];
+    byte byWindowHead;
+    byte byNWindow;
+    dword dwSummV;
+    word wNSummed;
+    sdword sdwStateQ;               // low pass, mV with 8 fraction bits
+    boolean bPrimed;
+} stADCFilter_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t adcfilter_init(stADCFilter_t *stFilter, const stADCFilterConfig_t *stConfig);
+boolean adcfilter_run(stADCFilter_t *stFilter, const word *awSamplesmV, word wNSamples, word *pwOutputmV);
+dword adcfilter_group_delay_us(const stADCFilterConfig_t *stConfig, dword dwtSampleus, word wNBlockSamples);
+
+#endif // SFR_ADCFILTER
@@ -0,0 +1,510 @@
+/*
+adcscan.c
+File contains the continuous ADC acquisition. The ADC's pattern table
+scans the configured channels round and round at the sample rate and DMA
+fills one frame per block with the results. The frame done interrupt wakes
+the adc_scan task, which calibrates every result through a table built at
+start up (one index per sample rather than a curve fit), hands the block to
+the consumer if there is one, runs each channel's samples through its filter
+(adcfilter.c) and publishes the filter's newest output.
+
+Publishing is the decimation: with APPS at 20 kHz over two channels and a
+1 ms block each channel's value is made from 10 samples, new every 1 ms.
+The filter's group delay for each channel is logged at start up.
+Readers get the latest value and its age from adcscan_get without waiting,
+under a sequence counter like the signal store's, so task_1ms never blocks
+on the ADC. adc_scan sits above task_1ms so a block is published as soon as
+it lands.
+
+The unit cannot run oneshot reads as well, so the channels scanned here are
+not for adc_register.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "esp_attr.h"
+#include "adcscan.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    _Atomic dword dwSequence;       // odd while being written, 0 until the first block
+    word wVoltagemV;
+    qword qwtUpdatedus;
+} stADCScanValue_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define ADCSCAN_TAG "ADCSCAN"
+#define ADCSCAN_POOL_FRAMES 4           // frames the driver holds before it drops
+#define ADCSCAN_MAX_FRAME_BYTES (ADCSCAN_MAX_CHANNELS * ADCSCAN_MAX_BLOCK * SOC_ADC_DIGI_RESULT_BYTES)
+#define ADCSCAN_CHANNEL_SLOTS 8         // channel field of a result is 3 bits
+#define ADCSCAN_NO_CHANNEL 0xFF
+#define ADCSCAN_STACK_BYTES 3072
+#define ADCSCAN_PRIORITY 21             // above task_1ms, below esp_timer
+#define ADCSCAN_CORE 0
+#define ADCSCAN_TIMEOUT_MS 10           // wake to drain even if a notification is missed
+#define ADCSCAN_MAX_RETRIES 8
+#define US_PER_S 1000000
+
+/* --------------------------- Global Variables ----------------------------- */
+/* APPS node, both pedal sensors at 10 kHz each, a value every 1 ms */
+const stADCScanConfig_t stADCScanAPPS =
+{
+    .eUnit = ADC_UNIT_1,
+    .eAtten = ADC_ATTEN_DB_12,
+    .byNChannels = 2,
+    .aeChannels = { APPS1_IN, APPS2_IN },
+    .dwSampleRateHz = 20000,
+    .wtBlockus = 1000,
+    .pfConsumer = NULL,
+    .astFilters = {
+        { .byMedian = 3, .byOversample = ADCFILTER_AVERAGE_BLOCK, .byIIRShift = 1 },
+        { .byMedian = 3, .byOversample = ADCFILTER_AVERAGE_BLOCK, .byIIRShift = 1 },
+    },
+};
+/* IMD node, the IMD's PWM output through its RC filter, a value every 10 ms */
+const stADCScanConfig_t stADCScanIMD =
+{
+    .eUnit = ADC_UNIT_1,
+    .eAtten = ADC_ATTEN_DB_12,
+    .byNChannels = 1,
+    .aeChannels = { IMD_PWM_IN },
+    .dwSampleRateHz = 5000,
+    .wtBlockus = 10000,
+    .pfConsumer = NULL,
+    .astFilters = {
+        { .byMedian = 5, .byOversample = ADCFILTER_AVERAGE_BLOCK, .byIIRShift = 3 },
+    },
+};
+
+/* --------------------------- Local Variables ------------------------------ */
+static adc_continuous_handle_t stADCScanHandle = NULL;
+static stADCScanConfig_t stADCScanConfig;
+static TaskHandle_t stADCScanTask = NULL;
+static word *awADCScanCalibrationmV = NULL;    // ADCSCAN_RAW_CODES per channel
+static byte abyADCScanIndex[ADCSCAN_CHANNEL_SLOTS];
+static dword dwADCScanFrameBytes = 0;
+static dword dwtADCScanBlockus = 0;             // actual, from the whole conversions in a frame
+static byte abyADCScanFrame[ADCSCAN_MAX_FRAME_BYTES];
+static stADCScanBlock_t stADCScanBlock;
+static stADCFilter_t astADCScanFilters[ADCSCAN_MAX_CHANNELS];
+static stADCScanValue_t astADCScanValues[ADCSCAN_MAX_CHANNELS];
+static stADCScanStats_t stADCScanStats;
+static _Atomic dword dwNADCScanFramesDone = 0;
+static _Atomic dword dwtADCScanFrameDoneus = 0;
+static dword dwNADCScanFramesRead = 0;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t adcscan_init(const stADCScanConfig_t *stConfig);
+esp_err_t adcscan_get(byte byChannel, word *pwVoltagemV, qword *pqwtAgeus);
+void adcscan_get_stats(stADCScanStats_t *stStats);
+static esp_err_t adcscan_calibrate(void);
+static void adcscan_task(void *pvArg);
+static void adcscan_process(const byte *abyFrame, dword dwLength);
+static bool adcscan_frame_done(adc_continuous_handle_t stHandle, const adc_continuous_evt_data_t *stData, void *pvArg);
+static bool adcscan_pool_overflow(adc_continuous_handle_t stHandle, const adc_continuous_evt_data_t *stData, void *pvArg);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t adcscan_init(const stADCScanConfig_t *stConfig)
+{
+    /*
+    *===========================================================================
+    *   adcscan_init
+    *   Takes:   stConfig - channels, rate and block length, stADCScanAPPS or
+    *                       stADCScanIMD for the nodes that have them
+    *
+    *   Returns: ESP_OK, ESP_ERR_INVALID_ARG for a rate the ADC cannot do or
+    *            a block that does not fit, ESP_ERR_INVALID_STATE if already
+    *            running, or the driver's error.
+    *
+    *   Builds the calibration tables, sets up the scan and starts it.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (stADCScanHandle != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (stConfig == NULL || stConfig->byNChannels == 0 || stConfig->byNChannels > ADCSCAN_MAX_CHANNELS ||
+        stConfig->dwSampleRateHz < SOC_ADC_SAMPLE_FREQ_THRES_LOW || stConfig->dwSampleRateHz > SOC_ADC_SAMPLE_FREQ_THRES_HIGH)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Whole scans of the pattern in a frame, at least one */
+    dword dwNConversions = (dword)((qword)stConfig->dwSampleRateHz * stConfig->wtBlockus / US_PER_S);
+    dwNConversions -= dwNConversions % stConfig->byNChannels;
+    if (dwNConversions == 0 || dwNConversions / stConfig->byNChannels > ADCSCAN_MAX_BLOCK)
+    {
+        ESP_LOGE(ADCSCAN_TAG, "%lu Hz over %lu us does not fit a block", (unsigned long)stConfig->dwSampleRateHz,
+                 (unsigned long)stConfig->wtBlockus);
+        return ESP_ERR_INVALID_ARG;
+    }
+    stADCScanConfig = *stConfig;
+    dwADCScanFrameBytes = dwNConversions * SOC_ADC_DIGI_RESULT_BYTES;
+    dwtADCScanBlockus = (dword)((qword)dwNConversions * US_PER_S / stConfig->dwSampleRateHz);
+    memset(abyADCScanIndex, ADCSCAN_NO_CHANNEL, sizeof(abyADCScanIndex));
+    for (byte i = 0; i < stConfig->byNChannels; i++)
+    {
+        if (stConfig->aeChannels[i] >= ADCSCAN_CHANNEL_SLOTS)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        abyADCScanIndex[stConfig->aeChannels[i]] = i;
+        if (adcfilter_init(&astADCScanFilters[i], &stConfig->astFilters[i]) != ESP_OK)
+        {
+            ESP_LOGE(ADCSCAN_TAG, "Channel %u filter not valid", (unsigned)i);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    esp_err_t NStatus = adcscan_calibrate();
+    if (NStatus != ESP_OK)
+    {
+        return NStatus;
+    }
+
+    /* The driver and the scan pattern */
+    adc_continuous_handle_cfg_t stHandleConfig = {
+        .max_store_buf_size = ADCSCAN_POOL_FRAMES * dwADCScanFrameBytes,
+        .conv_frame_size = dwADCScanFrameBytes,
+    };
+    NStatus = adc_continuous_new_handle(&stHandleConfig, &stADCScanHandle);
+    if (NStatus != ESP_OK)
+    {
+        ESP_LOGE(ADCSCAN_TAG, "Failed to create the continuous ADC: %s", esp_err_to_name(NStatus));
+        return NStatus;
+    }
+    adc_digi_pattern_config_t astPattern[ADCSCAN_MAX_CHANNELS] = { 0 };
+    for (byte i = 0; i < stConfig->byNChannels; i++)
+    {
+        astPattern[i].atten = stConfig->eAtten;
+        astPattern[i].channel = stConfig->aeChannels[i];
+        astPattern[i].unit = stConfig->eUnit;
+        astPattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    }
+    adc_continuous_config_t stScanConfig = {
+        .pattern_num = stConfig->byNChannels,
+        .adc_pattern = astPattern,
+        .sample_freq_hz = stConfig->dwSampleRateHz,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+    };
+    NStatus = adc_continuous_config(stADCScanHandle, &stScanConfig);
+    if (NStatus != ESP_OK)
+    {
+        ESP_LOGE(ADCSCAN_TAG, "Failed to configure the scan: %s", esp_err_to_name(NStatus));
+        return NStatus;
+    }
+
+    /* The task first so the first frame has someone to wake */
+    if (xTaskCreatePinnedToCore(adcscan_task, "adc_scan", ADCSCAN_STACK_BYTES, NULL, ADCSCAN_PRIORITY,
+                                &stADCScanTask, ADCSCAN_CORE) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    adc_continuous_evt_cbs_t stCallbacks = {
+        .on_conv_done = adcscan_frame_done,
+        .on_pool_ovf = adcscan_pool_overflow,
+    };
+    NStatus = adc_continuous_register_event_callbacks(stADCScanHandle, &stCallbacks, NULL);
+    if (NStatus == ESP_OK)
+    {
+        NStatus = adc_continuous_start(stADCScanHandle);
+    }
+    if (NStatus == ESP_OK)
+    {
+        ESP_LOGI(ADCSCAN_TAG, "%u channels at %lu Hz, %lu samples each every %lu us", (unsigned)stConfig->byNChannels,
+                 (unsigned long)stConfig->dwSampleRateHz, (unsigned long)(dwNConversions / stConfig->byNChannels),
+                 (unsigned long)dwtADCScanBlockus);
+        dword dwtSampleus = (dword)((qword)stConfig->byNChannels * US_PER_S / stConfig->dwSampleRateHz);
+        for (byte i = 0; i < stConfig->byNChannels; i++)
+        {
+            ESP_LOGI(ADCSCAN_TAG, "Channel %u filter group delay %lu us", (unsigned)i,
+                     (unsigned long)adcfilter_group_delay_us(&stConfig->astFilters[i], dwtSampleus,
+                                                             (word)(dwNConversions / stConfig->byNChannels)));
+        }
+    }
+    return NStatus;
+}
+
+esp_err_t adcscan_get(byte byChannel, word *pwVoltagemV, qword *pqwtAgeus)
+{
+    /*
+    *===========================================================================
+    *   adcscan_get
+    *   Takes:   byChannel - index in the config's channel list
+    *            pwVoltagemV - where the decimated voltage goes
+    *            pqwtAgeus - where its age goes, NULL if not wanted
+    *
+    *   Returns: ESP_OK, ESP_ERR_INVALID_ARG for a channel not scanned,
+    *            ESP_ERR_NOT_FOUND before the first block or ESP_ERR_TIMEOUT
+    *            if it kept changing under the read.
+    *
+    *   Never waits, safe from any task.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (byChannel >= stADCScanConfig.byNChannels || pwVoltagemV == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stADCScanValue_t *stValue = &astADCScanValues[byChannel];
+
+    for (byte i = 0; i < ADCSCAN_MAX_RETRIES; i++)
+    {
+        dword dwSequence = __atomic_load_n(&stValue->dwSequence, __ATOMIC_ACQUIRE);
+        if (dwSequence & 1)
+        {
+            continue;
+        }
+        if (dwSequence == 0)
+        {
+            return ESP_ERR_NOT_FOUND;
+        }
+        word wVoltagemV = stValue->wVoltagemV;
+        qword qwtUpdatedus = stValue->qwtUpdatedus;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&stValue->dwSequence, __ATOMIC_RELAXED) == dwSequence)
+        {
+            *pwVoltagemV = wVoltagemV;
+            if (pqwtAgeus != NULL)
+            {
+                *pqwtAgeus = (qword)esp_timer_get_time() - qwtUpdatedus;
+            }
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+void adcscan_get_stats(stADCScanStats_t *stStats)
+{
+    /*
+    *===========================================================================
+    *   adcscan_get_stats
+    *   Takes:   stStats - where the counters go
+    *
+    *   Returns: Nothing.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    *stStats = stADCScanStats;
+    stStats->dwNOverflows = __atomic_load_n(&stADCScanStats.dwNOverflows, __ATOMIC_RELAXED);
+}
+
+static esp_err_t adcscan_calibrate(void)
+{
+    /*
+    *===========================================================================
+    *   adcscan_calibrate
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK, ESP_ERR_NO_MEM or the calibration's error.
+    *
+    *   Runs every raw code of every channel through its curve fit once,
+    *   8 KB a channel, so a sample costs an index instead of a fit.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    awADCScanCalibrationmV = malloc((size_t)stADCScanConfig.byNChannels * ADCSCAN_RAW_CODES * sizeof(word));
+    if (awADCScanCalibrationmV == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    for (byte i = 0; i < stADCScanConfig.byNChannels; i++)
+    {
+        adc_cali_handle_t stCalibration;
+        adc_cali_curve_fitting_config_t stCalibrationConfig = {
+            .unit_id = stADCScanConfig.eUnit,
+            .chan = stADCScanConfig.aeChannels[i],
+            .atten = stADCScanConfig.eAtten,
+            .bitwidth = SOC_ADC_DIGI_MAX_BITWIDTH,
+        };
+        esp_err_t NStatus = adc_cali_create_scheme_curve_fitting(&stCalibrationConfig, &stCalibration);
+        if (NStatus != ESP_OK)
+        {
+            ESP_LOGE(ADCSCAN_TAG, "Failed to create calibration handle: %s", esp_err_to_name(NStatus));
+            return NStatus;
+        }
+        word *awCalibrationmV = &awADCScanCalibrationmV[i * ADCSCAN_RAW_CODES];
+        for (word wRaw = 0; wRaw < ADCSCAN_RAW_CODES; wRaw++)
+        {
+            int NVoltagemV = 0;
+            (void)adc_cali_raw_to_voltage(stCalibration, wRaw, &NVoltagemV);
+            awCalibrationmV[wRaw] = (word)((NVoltagemV < 0) ? 0 : (NVoltagemV > UINT16_MAX) ? UINT16_MAX : NVoltagemV);
+        }
+        (void)adc_cali_delete_scheme_curve_fitting(stCalibration);
+    }
+    return ESP_OK;
+}
+
+static void adcscan_task(void *pvArg)
+{
+    /*
+    *===========================================================================
+    *   adcscan_task
+    *   Takes:   pvArg - unused
+    *
+    *   Returns: Never.
+    *
+    *   Woken by each finished frame, takes every frame the driver holds.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    for (;;)
+    {
+        (void)ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ADCSCAN_TIMEOUT_MS));
+        uint32_t dwLength = 0;
+        while (adc_continuous_read(stADCScanHandle, abyADCScanFrame, dwADCScanFrameBytes, &dwLength, 0) == ESP_OK)
+        {
+            adcscan_process(abyADCScanFrame, dwLength);
+        }
+    }
+}
+
+static void adcscan_process(const byte *abyFrame, dword dwLength)
+{
+    /*
+    *===========================================================================
+    *   adcscan_process
+    *   Takes:   abyFrame - DMA frame of TYPE2 results
+    *            dwLength - bytes in it
+    *
+    *   Returns: Nothing.
+    *
+    *   Sorts the frame into channels in mV, gives the block to the consumer
+    *   and publishes each channel's filtered value.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Publishes the filter output rather than the block mean
+    *
+    *===========================================================================
+    */
+    dword adwNSamples[ADCSCAN_MAX_CHANNELS] = { 0 };
+    stADCScanBlock_t *stBlock = &stADCScanBlock;
+    stBlock->byNChannels = stADCScanConfig.byNChannels;
+
+    for (dword i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= dwLength; i += SOC_ADC_DIGI_RESULT_BYTES)
+    {
+        const adc_digi_output_data_t *stResult = (const adc_digi_output_data_t *)&abyFrame[i];
+        byte byChannel = abyADCScanIndex[stResult->type2.channel];
+        if (byChannel == ADCSCAN_NO_CHANNEL || stResult->type2.unit != stADCScanConfig.eUnit)
+        {
+            stADCScanStats.dwNBadSamples++;
+            continue;
+        }
+        word wVoltagemV = awADCScanCalibrationmV[byChannel * ADCSCAN_RAW_CODES + stResult->type2.data];
+        if (adwNSamples[byChannel] < ADCSCAN_MAX_BLOCK)
+        {
+            stBlock->awSamplesmV[byChannel][adwNSamples[byChannel]] = wVoltagemV;
+        }
+        adwNSamples[byChannel]++;
+        stADCScanStats.dwNSamples++;
+    }
+
+    /* When the frame finished, earlier by a block for each frame still behind it */
+    qword qwtNowus = (qword)esp_timer_get_time();
+    dword dwNDone = __atomic_load_n(&dwNADCScanFramesDone, __ATOMIC_ACQUIRE);
+    dword dwtDoneus = __atomic_load_n(&dwtADCScanFrameDoneus, __ATOMIC_RELAXED);
+    dwNADCScanFramesRead++;
+    sdword sdwNBehind = (sdword)(dwNDone - dwNADCScanFramesRead);
+    dword dwtSinceDoneus = (dword)qwtNowus - dwtDoneus;
+    stBlock->qwtEndus = qwtNowus - dwtSinceDoneus - ((sdwNBehind > 0) ? (qword)sdwNBehind * dwtADCScanBlockus : 0);
+
+    for (byte i = 0; i < stBlock->byNChannels; i++)
+    {
+        stBlock->abyNSamples[i] = (byte)((adwNSamples[i] > ADCSCAN_MAX_BLOCK) ? ADCSCAN_MAX_BLOCK : adwNSamples[i]);
+    }
+    if (stADCScanConfig.pfConsumer != NULL)
+    {
+        stADCScanConfig.pfConsumer(stBlock);
+    }
+
+    /* Only this task writes, the sequence is for the readers */
+    for (byte i = 0; i < stBlock->byNChannels; i++)
+    {
+        word wVoltagemV;
+        if (!adcfilter_run(&astADCScanFilters[i], stBlock->awSamplesmV[i], stBlock->abyNSamples[i], &wVoltagemV))
+        {
+            continue;
+        }
+        stADCScanValue_t *stValue = &astADCScanValues[i];
+        dword dwSequence = __atomic_load_n(&stValue->dwSequence, __ATOMIC_RELAXED);
+        __atomic_store_n(&stValue->dwSequence, dwSequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        stValue->wVoltagemV = wVoltagemV;
+        stValue->qwtUpdatedus = stBlock->qwtEndus;
+        __atomic_store_n(&stValue->dwSequence, dwSequence + 2, __ATOMIC_RELEASE);
+    }
+
+    dword dwtLatencyus = (dword)((qword)esp_timer_get_time() - stBlock->qwtEndus);
+    stADCScanStats.dwNBlocks++;
+    stADCScanStats.dwtLastLatencyus = dwtLatencyus;
+    stADCScanStats.dwtMaxLatencyus = (dwtLatencyus > stADCScanStats.dwtMaxLatencyus) ? dwtLatencyus : stADCScanStats.dwtMaxLatencyus;
+}
+
+static bool IRAM_ATTR adcscan_frame_done(adc_continuous_handle_t stHandle, const adc_continuous_evt_data_t *stData, void *pvArg)
+{
+    /*
+    *===========================================================================
+    *   adcscan_frame_done
+    *   Takes:   stHandle, stData, pvArg - from the driver, unused
+    *
+    *   Returns: TRUE if adc_scan should run now.
+    *
+    *   ISR. Stamps the frame and wakes adc_scan.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    BaseType_t bWoken = pdFALSE;
+    __atomic_store_n(&dwtADCScanFrameDoneus, (dword)esp_timer_get_time(), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dwNADCScanFramesDone, 1, __ATOMIC_RELEASE);
+    vTaskNotifyGiveFromISR(stADCScanTask, &bWoken);
+    return bWoken == pdTRUE;
+}
+
+static bool IRAM_ATTR adcscan_pool_overflow(adc_continuous_handle_t stHandle, const adc_continuous_evt_data_t *stData, void *pvArg)
+{
+    /*
+    *===========================================================================
+    *   adcscan_pool_overflow
+    *   Takes:   stHandle, stData, pvArg - from the driver, unused
+    *
+    *   Returns: FALSE, nothing to wake.
+    *
+    *   ISR. adc_scan fell a whole pool behind and frames were dropped.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    __atomic_fetch_add(&stADCScanStats.dwNOverflows, 1, __ATOMIC_RELAXED);
+    return false;
+}
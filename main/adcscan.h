@@ -0,0 +1,56 @@
+#ifndef SFR_ADCSCAN
+#define SFR_ADCSCAN
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sfrtypes.h"
+#include "pin.h"
+#include "adcfilter.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define ADCSCAN_MAX_CHANNELS 3          // APPS1, APPS2 and one more (IMD on its own node)
+#define ADCSCAN_MAX_BLOCK 64            // samples per channel in one block
+#define ADCSCAN_RAW_CODES 4096          // 12 bit results
+
+/* --------------------------- Types ---------------------------------------- */
+typedef struct {
+    byte byNChannels;
+    word awSamplesmV[ADCSCAN_MAX_CHANNELS][ADCSCAN_MAX_BLOCK];  // calibrated, oldest first
+    byte abyNSamples[ADCSCAN_MAX_CHANNELS];
+    qword qwtEndus;                 // DMA frame completed
+} stADCScanBlock_t;
+
+typedef void (*pfADCScanConsumer_t)(const stADCScanBlock_t *stBlock);
+
+typedef struct {
+    adc_unit_t eUnit;
+    adc_atten_t eAtten;
+    byte byNChannels;
+    adc_channel_t aeChannels[ADCSCAN_MAX_CHANNELS];
+    dword dwSampleRateHz;           // conversions per second over all channels
+    word wtBlockus;                 // one DMA frame, and one decimated value per channel, per block
+    pfADCScanConsumer_t pfConsumer; // also given every block, NULL for none
+    stADCFilterConfig_t astFilters[ADCSCAN_MAX_CHANNELS];   // zeroed is the plain block mean
+} stADCScanConfig_t;
+
+typedef struct {
+    dword dwNBlocks;
+    dword dwNSamples;
+    dword dwNBadSamples;            // results for a channel not in the scan
+    dword dwNOverflows;             // DMA pool full, frames lost
+    dword dwtLastLatencyus;         // frame done to its value published
+    dword dwtMaxLatencyus;
+} stADCScanStats_t;
+
+/* --------------------------- Global Variables ----------------------------- */
+extern const stADCScanConfig_t stADCScanAPPS;
+extern const stADCScanConfig_t stADCScanIMD;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t adcscan_init(const stADCScanConfig_t *stConfig);
+esp_err_t adcscan_get(byte byChannel, word *pwVoltagemV, qword *pqwtAgeus);
+void adcscan_get_stats(stADCScanStats_t *stStats);
+
+#endif // SFR_ADCSCAN
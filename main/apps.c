@@ -0,0 +1,416 @@
+/*
+apps.c
+File contains the accelerator pedal plausibility engine for the APPS node.
+Every 1 ms it takes both pedal sensors' filtered voltages from the ADC scan
+(adcscan.c), turns them into pedal travel through fixed point maps and
+checks them against each other (T.4.2):
+
+    either sensor outside its map's limits, open or shorted
+    either value missing or older than APPS_MAX_AGE_US
+    the two more than 10 % of pedal travel apart
+
+Any of these lasting 100 ms latches a fault and the pedal is sent as 0
+until both sensors agree again with the pedal released. Before then the
+lower of the usable positions is sent, so a sensor reading high cannot
+raise the torque request while the fault times out.
+
+The result goes out as APPSStatus (dbc/sfr.dbc) on CAN0 in the same run, a
+low ID so it wins arbitration over the diagnostics. Latency is measured
+from the end of the older sensor's scan block to the frame leaving the
+bus, through the CAN TX done hook. It is bounded by one scan block (1 ms),
+the runnable's phase against the scan (up to 1 ms) and the frame on the
+bus; the filter's group delay, logged by adcscan at start up, comes before
+the block end and is not in it.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include "apps.h"
+#include "scheduler.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    word wRestmV;                   // pedal released
+    word wFullmV;                   // pedal at full travel, either side of wRestmV
+    word wLowerLimitmV;             // below this the sensor is open or shorted
+    word wUpperLimitmV;
+} stAPPSCalibration_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define APPS_TAG "APPS"
+#define APPS_N_SENSORS 2
+#define APPS_DEVIATION_Q (10 * SENSOR_Q_ONE)    // 10 % of pedal travel, T.4.2.4
+#define APPS_FAULT_TIME_US 100000               // implausible this long latches, T.4.2.5
+#define APPS_RELEASED_Q (5 * SENSOR_Q_ONE)      // both under this to clear the latch
+#define APPS_MAX_AGE_US 2500                    // two scan blocks and a half
+#define APPS_LATENCY_SLOTS 8                    // frames in flight the latency can follow
+#define APPS_COUNTER_MASK 0x07
+#define APPS_MAX_SAMPLE_AGE_US 2550             // APPSStatus.SampleAge saturates
+#define APPS_BUDGET_US 100
+#define APPS_MV_PER_V 1000.0f
+
+/* --------------------------- Local Variables ------------------------------ */
+#ifdef GPIO_CAN0_TX
+extern twai_node_handle_t stCANBus0;
+#endif
+
+/*
+* Pedal travel in sensor mV, measured on the car, UPDATE THESE. Index is the
+* channel's place in stADCScanAPPS. APPS2 runs the other way so the two
+* shorted together read as a deviation.
+*/
+static const stAPPSCalibration_t astAPPSCalibration[APPS_N_SENSORS] =
+{
+    { .wRestmV = 400, .wFullmV = 2900, .wLowerLimitmV = 250, .wUpperLimitmV = 3050 },
+    { .wRestmV = 2900, .wFullmV = 400, .wLowerLimitmV = 250, .wUpperLimitmV = 3050 },
+};
+
+static stSensorMapQ_t astAPPSMaps[APPS_N_SENSORS];
+static stAPPSStatus_t stAPPSStatus;
+static boolean bAPPSPending = FALSE;            // implausible, not yet for long enough to latch
+static qword qwtAPPSPendingSinceus = 0;
+static byte byAPPSCounter = 0;
+static qword aqwtAPPSSampleus[APPS_LATENCY_SLOTS];
+static _Atomic dword dwNAPPSQueued = 0;
+static _Atomic dword dwNAPPSDone = 0;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t apps_init(void);
+void apps_get_status(stAPPSStatus_t *stStatus);
+static esp_err_t apps_build_map(const stAPPSCalibration_t *stCalibration, stSensorMapQ_t *stMapQ);
+static void apps_runnable(void);
+static void apps_send(const stDBCAPPSStatus_t *stMessage, qword qwtSampleus);
+static void apps_tx_done(byte byBus, dword dwID, boolean bSent);
+static word apps_q_to_hundredths(sdword sdwPositionQ);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t apps_init(void)
+{
+    /*
+    *===========================================================================
+    *   apps_init
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK, ESP_ERR_INVALID_ARG for a calibration that does not
+    *            fit inside its limits, or the scan's, CAN's or scheduler's
+    *            error.
+    *
+    *   Starts the ADC scan with stADCScanAPPS, builds the pedal maps and
+    *   registers the 1 ms runnable. Needs CAN.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    static const stSchedRunnable_t astAPPSRunnables[] =
+    {
+        { "apps", apps_runnable, 1, SCHED_OFFSET_AUTO, APPS_BUDGET_US },
+    };
+
+    for (byte i = 0; i < APPS_N_SENSORS; i++)
+    {
+        esp_err_t NStatus = apps_build_map(&astAPPSCalibration[i], &astAPPSMaps[i]);
+        if (NStatus != ESP_OK)
+        {
+            ESP_LOGE(APPS_TAG, "APPS%u calibration not valid", (unsigned)(i + 1));
+            return NStatus;
+        }
+    }
+    esp_err_t NStatus = adcscan_init(&stADCScanAPPS);
+    if (NStatus != ESP_OK)
+    {
+        ESP_LOGE(APPS_TAG, "Failed to start ADC scan: %s", esp_err_to_name(NStatus));
+        return NStatus;
+    }
+    NStatus = CAN_set_tx_done_hook(apps_tx_done);
+    if (NStatus != ESP_OK)
+    {
+        return NStatus;
+    }
+    return scheduler_register(astAPPSRunnables, sizeof(astAPPSRunnables) / sizeof(astAPPSRunnables[0]));
+}
+
+void apps_get_status(stAPPSStatus_t *stStatus)
+{
+    /*
+    *===========================================================================
+    *   apps_get_status
+    *   Takes:   stStatus - where the last run and the counters go
+    *
+    *   Returns: Nothing.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    *stStatus = stAPPSStatus;
+}
+
+static esp_err_t apps_build_map(const stAPPSCalibration_t *stCalibration, stSensorMapQ_t *stMapQ)
+{
+    /*
+    *===========================================================================
+    *   apps_build_map
+    *   Takes:   stCalibration - the sensor's travel and limits
+    *            stMapQ - fixed point map to fill
+    *
+    *   Returns: ESP_OK or ESP_ERR_INVALID_ARG.
+    *
+    *   Breakpoints on the two ends of travel with the rest spread evenly
+    *   between, so travel maps exactly linear and the ends sit flat at 0 %
+    *   and 100 % out to the limits. The last breakpoint is 1 mV over the
+    *   upper limit as the map's last breakpoint is off the table.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stSensorMap_t stMap;
+    float fRest = (float)stCalibration->wRestmV / APPS_MV_PER_V;
+    float fFull = (float)stCalibration->wFullmV / APPS_MV_PER_V;
+    float fTravelLow = (fRest < fFull) ? fRest : fFull;
+    float fTravelHigh = (fRest < fFull) ? fFull : fRest;
+
+    stMap.fLowerLimit = (float)stCalibration->wLowerLimitmV / APPS_MV_PER_V;
+    stMap.fUpperLimit = (float)stCalibration->wUpperLimitmV / APPS_MV_PER_V;
+    if (stCalibration->wRestmV == stCalibration->wFullmV || stMap.fLowerLimit >= fTravelLow || fTravelHigh >= stMap.fUpperLimit)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stMap.afLookupTable[0][0] = stMap.fLowerLimit;
+    for (int i = 1; i < SENSOR_MAP_POINTS - 1; i++)
+    {
+        stMap.afLookupTable[0][i] = fTravelLow + (fTravelHigh - fTravelLow) * (float)(i - 1) / (float)(SENSOR_MAP_POINTS - 3);
+    }
+    stMap.afLookupTable[0][SENSOR_MAP_POINTS - 1] = stMap.fUpperLimit + 1.0f / APPS_MV_PER_V;
+    for (int i = 0; i < SENSOR_MAP_POINTS; i++)
+    {
+        float fPosition = 100.0f * (stMap.afLookupTable[0][i] - fRest) / (fFull - fRest);
+        stMap.afLookupTable[1][i] = (fPosition < 0.0f) ? 0.0f : (fPosition > 100.0f) ? 100.0f : fPosition;
+    }
+    return sensor_map_q_init(&stMap, stMapQ);
+}
+
+static void apps_runnable(void)
+{
+    /*
+    *===========================================================================
+    *   apps_runnable
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Every 1 ms in task_1ms. Checks the sensors, times and latches the
+    *   fault and sends APPSStatus.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    qword qwtNowus = (qword)esp_timer_get_time();
+    qword qwtSampleus = qwtNowus;
+    sdword asdwPositionQ[APPS_N_SENSORS];
+    byte byFaults = 0;
+    boolean bSampled = FALSE;
+
+    /* Both positions, with the older sample's time for the latency */
+    for (byte i = 0; i < APPS_N_SENSORS; i++)
+    {
+        word wVoltagemV;
+        qword qwtAgeus;
+        if (adcscan_get(i, &wVoltagemV, &qwtAgeus) != ESP_OK || qwtAgeus > APPS_MAX_AGE_US)
+        {
+            asdwPositionQ[i] = SENSOR_Q_ERROR;
+            byFaults |= APPS_FAULT_STALE;
+            continue;
+        }
+        qwtSampleus = (qwtNowus - qwtAgeus < qwtSampleus) ? qwtNowus - qwtAgeus : qwtSampleus;
+        bSampled = TRUE;
+        asdwPositionQ[i] = sensor_map_q_lookup(&astAPPSMaps[i], wVoltagemV);
+        if (asdwPositionQ[i] == SENSOR_Q_ERROR)
+        {
+            byFaults |= (i == 0) ? APPS_FAULT_APPS1_RANGE : APPS_FAULT_APPS2_RANGE;
+        }
+    }
+    boolean bValid1 = (asdwPositionQ[0] != SENSOR_Q_ERROR);
+    boolean bValid2 = (asdwPositionQ[1] != SENSOR_Q_ERROR);
+    if (bValid1 && bValid2)
+    {
+        sdword sdwDeviationQ = asdwPositionQ[0] - asdwPositionQ[1];
+        if (sdwDeviationQ > APPS_DEVIATION_Q || sdwDeviationQ < -APPS_DEVIATION_Q)
+        {
+            byFaults |= APPS_FAULT_DEVIATION;
+        }
+    }
+
+    /* Timed latch, cleared only by agreeing sensors with the pedal released */
+    if (byFaults != 0)
+    {
+        if (!bAPPSPending)
+        {
+            bAPPSPending = TRUE;
+            qwtAPPSPendingSinceus = qwtNowus;
+        }
+        if (!stAPPSStatus.bLatched && qwtNowus - qwtAPPSPendingSinceus >= APPS_FAULT_TIME_US)
+        {
+            stAPPSStatus.bLatched = TRUE;
+            stAPPSStatus.dwNLatches++;
+            ESP_LOGW(APPS_TAG, "Implausible for %u ms, faults 0x%02X", (unsigned)(APPS_FAULT_TIME_US / 1000), (unsigned)byFaults);
+        }
+    }
+    else
+    {
+        bAPPSPending = FALSE;
+        if (stAPPSStatus.bLatched && asdwPositionQ[0] < APPS_RELEASED_Q && asdwPositionQ[1] < APPS_RELEASED_Q)
+        {
+            stAPPSStatus.bLatched = FALSE;
+        }
+    }
+
+    /* Mean when plausible, otherwise the lower usable one, 0 once latched */
+    sdword sdwPedalQ = 0;
+    if (stAPPSStatus.bLatched)
+    {
+        sdwPedalQ = 0;
+    }
+    else if (byFaults == 0)
+    {
+        sdwPedalQ = asdwPositionQ[0] / 2 + asdwPositionQ[1] / 2;
+    }
+    else if (bValid1 && bValid2)
+    {
+        sdwPedalQ = (asdwPositionQ[0] < asdwPositionQ[1]) ? asdwPositionQ[0] : asdwPositionQ[1];
+    }
+    else if (bValid1 || bValid2)
+    {
+        sdwPedalQ = bValid1 ? asdwPositionQ[0] : asdwPositionQ[1];
+    }
+
+    stAPPSStatus.wPedal = apps_q_to_hundredths(sdwPedalQ);
+    stAPPSStatus.wAPPS1 = bValid1 ? apps_q_to_hundredths(asdwPositionQ[0]) : 0;
+    stAPPSStatus.wAPPS2 = bValid2 ? apps_q_to_hundredths(asdwPositionQ[1]) : 0;
+    stAPPSStatus.byFaults = byFaults;
+
+    dword dwtAgeus = (dword)(qwtNowus - qwtSampleus);
+    stAPPSStatus.dwtMaxAgeus = (dwtAgeus > stAPPSStatus.dwtMaxAgeus) ? dwtAgeus : stAPPSStatus.dwtMaxAgeus;
+    stDBCAPPSStatus_t stMessage =
+    {
+        .dwPedalPosition = stAPPSStatus.wPedal,
+        .dwAPPS1Position = stAPPSStatus.wAPPS1,
+        .dwAPPS2Position = stAPPSStatus.wAPPS2,
+        .dwDeviation = (byFaults & APPS_FAULT_DEVIATION) ? 1 : 0,
+        .dwAPPS1Range = (byFaults & APPS_FAULT_APPS1_RANGE) ? 1 : 0,
+        .dwAPPS2Range = (byFaults & APPS_FAULT_APPS2_RANGE) ? 1 : 0,
+        .dwStale = (byFaults & APPS_FAULT_STALE) ? 1 : 0,
+        .dwFaultLatched = stAPPSStatus.bLatched ? 1 : 0,
+        .dwCounter = byAPPSCounter,
+        .dwSampleAge = (dwtAgeus > APPS_MAX_SAMPLE_AGE_US) ? APPS_MAX_SAMPLE_AGE_US : dwtAgeus,
+    };
+    byAPPSCounter = (byAPPSCounter + 1) & APPS_COUNTER_MASK;
+    apps_send(&stMessage, bSampled ? qwtSampleus : 0);
+}
+
+static void apps_send(const stDBCAPPSStatus_t *stMessage, qword qwtSampleus)
+{
+    /*
+    *===========================================================================
+    *   apps_send
+    *   Takes:   stMessage - APPSStatus to send
+    *            qwtSampleus - when the older sample it carries was taken, 0
+    *                          if it carries none and has no latency
+    *
+    *   Returns: Nothing.
+    *
+    *   Queues the frame on CAN0 and leaves its sample time for apps_tx_done.
+    *   The count goes up before the driver has the frame so a done
+    *   interrupt straight after always finds its slot.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    #ifdef GPIO_CAN0_TX
+    CAN_frame_t stFrame = { .dwID = DBC_APPS_STATUS_ID, .byDLC = DBC_APPS_STATUS_DLC, .byBus = CAN_BUS_NONE };
+    dbc_apps_status_encode(stMessage, stFrame.abData);
+
+    /* Frames lost in bus off never report done, start following again from here */
+    dword dwNQueued = __atomic_load_n(&dwNAPPSQueued, __ATOMIC_RELAXED);
+    if (dwNQueued - __atomic_load_n(&dwNAPPSDone, __ATOMIC_ACQUIRE) >= APPS_LATENCY_SLOTS)
+    {
+        __atomic_store_n(&dwNAPPSDone, dwNQueued, __ATOMIC_RELAXED);
+    }
+    aqwtAPPSSampleus[dwNQueued % APPS_LATENCY_SLOTS] = qwtSampleus;
+    __atomic_store_n(&dwNAPPSQueued, dwNQueued + 1, __ATOMIC_RELEASE);
+
+    word wNSent = 0;
+    (void)CAN_transmit_batch(stCANBus0, &stFrame, 1, &wNSent);
+    if (wNSent == 1)
+    {
+        stAPPSStatus.dwNFrames++;
+    }
+    else
+    {
+        __atomic_store_n(&dwNAPPSQueued, dwNQueued, __ATOMIC_RELEASE);
+        stAPPSStatus.dwNQueueFull++;
+    }
+    #else
+    (void)stMessage;
+    (void)qwtSampleus;
+    #endif
+}
+
+static void IRAM_ATTR apps_tx_done(byte byBus, dword dwID, boolean bSent)
+{
+    /*
+    *===========================================================================
+    *   apps_tx_done
+    *   Takes:   byBus, dwID - the frame that finished
+    *            bSent - FALSE if the controller gave up on it
+    *
+    *   Returns: Nothing.
+    *
+    *   ISR, from CAN_set_tx_done_hook. Frames finish in the order queued,
+    *   so the oldest open slot is this frame's.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (byBus != 0 || dwID != DBC_APPS_STATUS_ID)
+    {
+        return;
+    }
+    dword dwNDone = __atomic_load_n(&dwNAPPSDone, __ATOMIC_RELAXED);
+    if (dwNDone == __atomic_load_n(&dwNAPPSQueued, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    qword qwtSampleus = aqwtAPPSSampleus[dwNDone % APPS_LATENCY_SLOTS];
+    __atomic_store_n(&dwNAPPSDone, dwNDone + 1, __ATOMIC_RELEASE);
+    if (!bSent)
+    {
+        stAPPSStatus.dwNNotSent++;
+        return;
+    }
+    if (qwtSampleus == 0)
+    {
+        return;
+    }
+    dword dwtLatencyus = (dword)((qword)esp_timer_get_time() - qwtSampleus);
+    stAPPSStatus.dwtLastLatencyus = dwtLatencyus;
+    stAPPSStatus.dwtMaxLatencyus = (dwtLatencyus > stAPPSStatus.dwtMaxLatencyus) ? dwtLatencyus : stAPPSStatus.dwtMaxLatencyus;
+}
+
+static word apps_q_to_hundredths(sdword sdwPositionQ)
+{
+    /* Q16.16 % to 0.01 %, the map keeps it within 0 to 100 % */
+    return (word)(((sqword)sdwPositionQ * 100 + (SENSOR_Q_ONE / 2)) >> SENSOR_Q_SHIFT);
+}
@@ -0,0 +1,42 @@
+#ifndef SFR_APPS
+#define SFR_APPS
+
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sfrtypes.h"
+#include "pin.h"
+#include "can.h"
+#include "adcscan.h"
+#include "sensormap.h"
+#include "sfr_dbc.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define APPS_FAULT_DEVIATION 0x01       // sensors more than APPS_DEVIATION apart
+#define APPS_FAULT_APPS1_RANGE 0x02     // outside its map's limits, open or shorted
+#define APPS_FAULT_APPS2_RANGE 0x04
+#define APPS_FAULT_STALE 0x08           // no scan value, or older than APPS_MAX_AGE_US
+
+/* --------------------------- Types ---------------------------------------- */
+typedef struct {
+    word wPedal;                    // 0.01 %, as sent, 0 while latched
+    word wAPPS1;                    // 0.01 %, 0 when out of range or stale
+    word wAPPS2;
+    byte byFaults;                  // APPS_FAULT_ bits of the last run
+    boolean bLatched;
+    dword dwNFrames;                // queued to CAN0
+    dword dwNQueueFull;             // driver refused the frame
+    dword dwNNotSent;               // queued but given up on by the controller
+    dword dwNLatches;
+    dword dwtMaxAgeus;              // older sample to frame queued
+    dword dwtLastLatencyus;         // older sample to the frame off the bus
+    dword dwtMaxLatencyus;
+} stAPPSStatus_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t apps_init(void);
+void apps_get_status(stAPPSStatus_t *stStatus);
+
+#endif // SFR_APPS
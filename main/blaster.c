@@ -0,0 +1,363 @@
+/*
+blaster.c
+File contains the CAN Blaster traffic generator. Frames are sent from a
+profile table, each entry with its own ID, DLC, period, jitter, payload
+pattern and burst length. The table periods only set the mix, every period is
+scaled together so the generated traffic holds a target bus load. The load is
+measured with the exact bit count of every frame sent, stuff bits included,
+and the scale is corrected once a second so payload dependent stuffing and
+refused frames do not pull the load off target.
+
+The target is the load this node adds, traffic from other nodes is on top.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <string.h>
+#include "blaster.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    qword qwtNextDueus;
+    dword dwNFrames;
+    word wRampValue;
+} stBlasterState_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define BLASTER_TICK 250                // generator period (us)
+#define BLASTER_BATCH_MAX 16            // frames queued per tick at most
+#define BLASTER_MAX_LAG 10000           // an entry further behind than this skips ahead (us)
+#define BLASTER_REPORT_PERIOD 1000000   // rate, load and error report (us)
+#define BLASTER_SCALE_ONE 65536         // rate scale of 1.0, Q16
+#define BLASTER_SCALE_MIN (BLASTER_SCALE_ONE / 64)
+#define BLASTER_SCALE_MAX (BLASTER_SCALE_ONE * 64)
+#define BLASTER_MAX_LOAD_PERCENT 100
+#define US_PER_S 1000000ULL
+#define PERMILLE 1000
+
+/* --------------------------- Local Variables ------------------------------ */
+#ifdef GPIO_CAN0_TX
+extern twai_node_handle_t stCANBus0;
+#endif
+
+/*
+* Traffic mix. Periods are relative, UPDATE THESE to resemble the bus under
+* test. The IDs must not be used by anything else on the bus.
+*/
+static const stBlasterProfile_t astBlasterProfile[] =
+{
+    { .dwID = 0x100,      .byDLC = 8, .dwtPeriodus = 1000,  .dwtJitterus = 0,   .ePattern = eBLASTER_COUNTER, .wStep = 0,   .byBurst = 1 },
+    { .dwID = 0x200,      .byDLC = 8, .dwtPeriodus = 2000,  .dwtJitterus = 200, .ePattern = eBLASTER_RANDOM,  .wStep = 0,   .byBurst = 1 },
+    { .dwID = 0x300,      .byDLC = 4, .dwtPeriodus = 10000, .dwtJitterus = 0,   .ePattern = eBLASTER_RAMP,    .wStep = 100, .byBurst = 4 },
+    { .dwID = 0x18FF0001, .byDLC = 8, .dwtPeriodus = 5000,  .dwtJitterus = 500, .ePattern = eBLASTER_RANDOM,  .wStep = 0,   .byBurst = 1 },
+};
+#define BLASTER_N_PROFILES (sizeof(astBlasterProfile) / sizeof(astBlasterProfile[0]))
+
+static stBlasterState_t astBlasterState[BLASTER_N_PROFILES];
+static esp_timer_handle_t stBlasterTimer = NULL;
+static qword qwTargetBitsPerSecond = 0;
+static dword dwRateScaleQ16 = BLASTER_SCALE_ONE;    // rate multiplier on the table, Q16
+static byte byBlasterTargetPercent = 0;
+
+/* Counters for the current report period */
+static qword qwtReportStartus = 0;
+static qword qwNBitsSent = 0;
+static dword dwNFramesSent = 0;
+static dword dwNTxErrors = 0;
+static stBlasterStats_t stBlasterStats;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t blaster_init(byte byTargetLoadPercent);
+void blaster_stop(void);
+void blaster_get_stats(stBlasterStats_t *stStats);
+static void blaster_timer_callback(void *pvArg);
+static void blaster_build_frame(word wNProfile, CAN_frame_t *stFrame);
+static void blaster_report(qword qwtNowus);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t blaster_init(byte byTargetLoadPercent)
+{
+    /*
+    *===========================================================================
+    *   blaster_init
+    *   Takes:   byTargetLoadPercent - bus load to generate, 1 to 100
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Works out the starting rate scale from the table and one sample frame
+    *   per entry, then starts the generator timer. Needs CAN initialised.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    #ifndef GPIO_CAN0_TX
+    return ESP_ERR_NOT_SUPPORTED;
+    #else
+    if (byTargetLoadPercent == 0 || byTargetLoadPercent > BLASTER_MAX_LOAD_PERCENT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    byBlasterTargetPercent = byTargetLoadPercent;
+    qwTargetBitsPerSecond = (qword)CAN0_BITRATE * byTargetLoadPercent / 100;
+
+    /* Load of the table as written */
+    qword qwNominalBitsPerSecond = 0;
+    for (word i = 0; i < BLASTER_N_PROFILES; i++)
+    {
+        CAN_frame_t stSample;
+        astBlasterState[i] = (stBlasterState_t){ 0 };
+        blaster_build_frame(i, &stSample);
+        astBlasterState[i].dwNFrames = 0;
+        astBlasterState[i].wRampValue = 0;
+        qwNominalBitsPerSecond += (qword)CAN_frame_bits(&stSample) * astBlasterProfile[i].byBurst
+                                * US_PER_S / astBlasterProfile[i].dwtPeriodus;
+    }
+    qword qwScale = qwTargetBitsPerSecond * BLASTER_SCALE_ONE / qwNominalBitsPerSecond;
+    dwRateScaleQ16 = (dword)((qwScale < BLASTER_SCALE_MIN) ? BLASTER_SCALE_MIN
+                           : (qwScale > BLASTER_SCALE_MAX) ? BLASTER_SCALE_MAX : qwScale);
+
+    qword qwtNowus = (qword)esp_timer_get_time();
+    for (word i = 0; i < BLASTER_N_PROFILES; i++)
+    {
+        astBlasterState[i].qwtNextDueus = qwtNowus;
+    }
+    qwtReportStartus = qwtNowus;
+    qwNBitsSent = 0;
+    dwNFramesSent = 0;
+    dwNTxErrors = 0;
+
+    if (stBlasterTimer == NULL)
+    {
+        const esp_timer_create_args_t stTimerArgs =
+        {
+            .callback = &blaster_timer_callback,
+            .arg = NULL,
+            .name = "blaster"
+        };
+        esp_err_t NStatus = esp_timer_create(&stTimerArgs, &stBlasterTimer);
+        if (NStatus != ESP_OK)
+        {
+            return NStatus;
+        }
+    }
+    ESP_LOGI("BLASTER", "Target %d%% load, %lu profiles, table is %lu.%03lu x target",
+             (int)byTargetLoadPercent, (unsigned long)BLASTER_N_PROFILES,
+             (unsigned long)(qwNominalBitsPerSecond / qwTargetBitsPerSecond),
+             (unsigned long)(qwNominalBitsPerSecond * 1000 / qwTargetBitsPerSecond % 1000));
+    return esp_timer_start_periodic(stBlasterTimer, BLASTER_TICK);
+    #endif
+}
+
+void blaster_stop(void)
+{
+    if (stBlasterTimer != NULL)
+    {
+        (void)esp_timer_stop(stBlasterTimer);
+    }
+}
+
+void blaster_get_stats(stBlasterStats_t *stStats)
+{
+    /* Updated once a second by the timer, a torn read only upsets one report */
+    *stStats = stBlasterStats;
+}
+
+static void blaster_timer_callback(void *pvArg)
+{
+    /*
+    *===========================================================================
+    *   blaster_timer_callback
+    *   Takes:   pvArg - unused
+    *
+    *   Returns: Nothing.
+    *
+    *   Queues every frame that has come due since the last tick. Each entry's
+    *   next time moves on by its scaled period plus random jitter, an entry
+    *   that falls far behind (bus saturated) skips ahead rather than bursting
+    *   to catch up. Refused frames are counted as TX errors and dropped.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    #ifdef GPIO_CAN0_TX
+    CAN_frame_t astBatch[BLASTER_BATCH_MAX];
+    word awBits[BLASTER_BATCH_MAX];
+    word wNBatch = 0;
+    qword qwtNowus = (qword)esp_timer_get_time();
+
+    for (word i = 0; i < BLASTER_N_PROFILES; i++)
+    {
+        const stBlasterProfile_t *stProfile = &astBlasterProfile[i];
+        stBlasterState_t *stState = &astBlasterState[i];
+
+        if (qwtNowus > stState->qwtNextDueus && qwtNowus - stState->qwtNextDueus > BLASTER_MAX_LAG)
+        {
+            stState->qwtNextDueus = qwtNowus;
+        }
+        while (stState->qwtNextDueus <= qwtNowus && wNBatch + stProfile->byBurst <= BLASTER_BATCH_MAX)
+        {
+            for (byte j = 0; j < stProfile->byBurst; j++)
+            {
+                blaster_build_frame(i, &astBatch[wNBatch]);
+                awBits[wNBatch] = CAN_frame_bits(&astBatch[wNBatch]);
+                wNBatch++;
+            }
+
+            qword qwtPeriodus = (qword)stProfile->dwtPeriodus * BLASTER_SCALE_ONE / dwRateScaleQ16;
+            if (stProfile->dwtJitterus > 0)
+            {
+                sqword sqwJitterus = (sqword)(esp_random() % (2 * stProfile->dwtJitterus + 1)) - (sqword)stProfile->dwtJitterus;
+                qwtPeriodus = ((sqword)qwtPeriodus + sqwJitterus > 0) ? (qword)((sqword)qwtPeriodus + sqwJitterus) : 1;
+            }
+            stState->qwtNextDueus += (qwtPeriodus > 0) ? qwtPeriodus : 1;
+        }
+    }
+
+    if (wNBatch > 0)
+    {
+        word wNSent = 0;
+        (void)CAN_transmit_batch(stCANBus0, astBatch, wNBatch, &wNSent);
+        for (word i = 0; i < wNSent; i++)
+        {
+            qwNBitsSent += awBits[i];
+        }
+        dwNFramesSent += wNSent;
+        dwNTxErrors += wNBatch - wNSent;
+    }
+
+    if (qwtNowus - qwtReportStartus >= BLASTER_REPORT_PERIOD)
+    {
+        blaster_report(qwtNowus);
+    }
+    #endif
+}
+
+static void blaster_build_frame(word wNProfile, CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   blaster_build_frame
+    *   Takes:   wNProfile - table entry
+    *            stFrame - filled with the entry's next frame
+    *
+    *   Returns: Nothing.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    const stBlasterProfile_t *stProfile = &astBlasterProfile[wNProfile];
+    stBlasterState_t *stState = &astBlasterState[wNProfile];
+    byte byLength = (stProfile->byDLC > 8) ? 8 : stProfile->byDLC;
+
+    memset(stFrame, 0, sizeof(*stFrame));
+    stFrame->dwID = stProfile->dwID;
+    stFrame->byDLC = stProfile->byDLC;
+    switch (stProfile->ePattern)
+    {
+        case eBLASTER_COUNTER:
+            for (byte i = 0; i < byLength && i < sizeof(stState->dwNFrames); i++)
+            {
+                stFrame->abData[i] = (byte)(stState->dwNFrames >> (8 * i));
+            }
+            break;
+        case eBLASTER_RANDOM:
+            for (byte i = 0; i < byLength; i += 4)
+            {
+                dword dwRandom = esp_random();
+                for (byte j = 0; j < 4 && i + j < byLength; j++)
+                {
+                    stFrame->abData[i + j] = (byte)(dwRandom >> (8 * j));
+                }
+            }
+            break;
+        case eBLASTER_RAMP:
+            stState->wRampValue += stProfile->wStep;
+            for (byte i = 0; i < byLength; i++)
+            {
+                stFrame->abData[i] = (byte)(stState->wRampValue >> (8 * (i & 1)));
+            }
+            break;
+        default:
+            break;
+    }
+    stState->dwNFrames++;
+}
+
+static void blaster_report(qword qwtNowus)
+{
+    /*
+    *===========================================================================
+    *   blaster_report
+    *   Takes:   qwtNowus - current time
+    *
+    *   Returns: Nothing.
+    *
+    *   Publishes the last period's rate, load and errors, sends them as a
+    *   CAN_ID_BLASTER_REPORT frame and corrects the rate scale towards the
+    *   target, at most halving or doubling it each period.
+    *
+    *   Report frame: bytes 0-1 frames/s, 2-3 load in 0.1 %, 4-5 TX errors,
+    *   6 target %, 7 rate scale in 1/16 steps (saturates), little endian.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    #ifdef GPIO_CAN0_TX
+    qword qwtElapsedus = qwtNowus - qwtReportStartus;
+
+    stBlasterStats.dwFramesPerSecond = (dword)((qword)dwNFramesSent * US_PER_S / qwtElapsedus);
+    stBlasterStats.wLoadPermille = (word)(qwNBitsSent * PERMILLE * US_PER_S / (qwtElapsedus * CAN0_BITRATE));
+    stBlasterStats.dwNTxErrors = dwNTxErrors;
+
+    /* Closed loop on the measured load */
+    qword qwBitsPerSecond = qwNBitsSent * US_PER_S / qwtElapsedus;
+    if (qwBitsPerSecond > 0)
+    {
+        qword qwScale = (qword)dwRateScaleQ16 * qwTargetBitsPerSecond / qwBitsPerSecond;
+        qwScale = (qwScale > (qword)dwRateScaleQ16 * 2) ? (qword)dwRateScaleQ16 * 2
+                : (qwScale < dwRateScaleQ16 / 2) ? dwRateScaleQ16 / 2 : qwScale;
+        dwRateScaleQ16 = (dword)((qwScale < BLASTER_SCALE_MIN) ? BLASTER_SCALE_MIN
+                               : (qwScale > BLASTER_SCALE_MAX) ? BLASTER_SCALE_MAX : qwScale);
+    }
+
+    word wScaleSixteenths = (word)(dwRateScaleQ16 / (BLASTER_SCALE_ONE / 16));
+    CAN_frame_t stReport =
+    {
+        .dwID = CAN_ID_BLASTER_REPORT,
+        .byDLC = 8,
+        .abData = {
+            (byte)(stBlasterStats.dwFramesPerSecond & 0xFF),
+            (byte)(stBlasterStats.dwFramesPerSecond >> 8 & 0xFF),
+            (byte)(stBlasterStats.wLoadPermille & 0xFF),
+            (byte)(stBlasterStats.wLoadPermille >> 8 & 0xFF),
+            (byte)((dwNTxErrors > 0xFFFF ? 0xFFFF : dwNTxErrors) & 0xFF),
+            (byte)((dwNTxErrors > 0xFFFF ? 0xFFFF : dwNTxErrors) >> 8 & 0xFF),
+            byBlasterTargetPercent,
+            (byte)((wScaleSixteenths > 0xFF) ? 0xFF : wScaleSixteenths),
+        }
+    };
+    word wNSent = 0;
+    (void)CAN_transmit_batch(stCANBus0, &stReport, 1, &wNSent);
+
+    #ifdef DEBUG
+    ESP_LOGI("BLASTER", "%lu frames/s, load %u.%u%%, %lu TX errors",
+             (unsigned long)stBlasterStats.dwFramesPerSecond,
+             (unsigned)(stBlasterStats.wLoadPermille / 10), (unsigned)(stBlasterStats.wLoadPermille % 10),
+             (unsigned long)dwNTxErrors);
+    #endif
+
+    qwtReportStartus = qwtNowus;
+    qwNBitsSent = (wNSent > 0) ? CAN_frame_bits(&stReport) : 0;
+    dwNFramesSent = 0;
+    dwNTxErrors = 0;
+    #endif
+}
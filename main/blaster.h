@@ -0,0 +1,40 @@
+#ifndef SFR_BLASTER
+#define SFR_BLASTER
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+
+#include "sfrtypes.h"
+#include "can.h"
+
+/* --------------------------- Types ---------------------------------------- */
+typedef enum {
+    eBLASTER_COUNTER = 0,   // frame count, little endian from byte 0
+    eBLASTER_RANDOM,        // new random bytes every frame
+    eBLASTER_RAMP,          // 16 bit sawtooth in every byte pair, rising wStep per frame
+} eBlasterPattern_t;
+
+typedef struct {
+    dword dwID;             // above 0x7FF is sent extended
+    byte byDLC;
+    dword dwtPeriodus;      // nominal period, scaled to hit the target load
+    dword dwtJitterus;      // each period is moved by up to +/- this much
+    eBlasterPattern_t ePattern;
+    word wStep;             // ramp step per frame
+    byte byBurst;           // frames sent back to back each period, 1 for none
+} stBlasterProfile_t;
+
+typedef struct {
+    dword dwFramesPerSecond;
+    word wLoadPermille;     // bus load in 0.1 %
+    dword dwNTxErrors;      // frames the driver refused in the last second
+} stBlasterStats_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t blaster_init(byte byTargetLoadPercent);
+void blaster_stop(void);
+void blaster_get_stats(stBlasterStats_t *stStats);
+
+#endif // SFR_BLASTER
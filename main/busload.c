@@ -0,0 +1,371 @@
+/*
+busload.c
+File contains the CAN bus load estimator. Every frame received or sent is
+counted at its worst case length on the wire: arbitration, control, data, CRC,
+the most stuff bits that frame could need, ACK, EOF and interframe space. The
+count is an upper bound, a bus that reads under 100 % here has room left.
+
+Loads are worked out every 100 ms and reported once a second per bus:
+    CAN_ID_BUSLOAD_REPORT  [0] bus, [1-2] last 100 ms, [3-4] last 1 s,
+                           [5-6] peak 100 ms, all in 0.1 %, [7] frames / 100
+    CAN_ID_BUSLOAD_TOP_IDS one frame per busiest ID over the last second,
+                           [0] bus << 4 | rank, [1-4] ID, [5-6] load in 0.1 %,
+                           [7] share of the bus traffic in %
+All little endian.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <string.h>
+#include "busload.h"
+#include "can.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define BUSLOAD_N_WINDOWS 10        // 100 ms windows in the 1 s load
+#define BUSLOAD_ID_BITS 7
+#define BUSLOAD_N_IDS (1 << BUSLOAD_ID_BITS)    // IDs tracked per bus each second, later IDs are counted as untracked
+#define BUSLOAD_MAX_PROBES 8        // slots an ID tries from the RX ISR before it is untracked
+#define BUSLOAD_N_TOP_IDS 5         // busiest IDs reported each second
+#define BUSLOAD_HASH 2654435761UL   // Fibonacci hashing multiplier
+#define US_PER_S 1000000ULL
+#define PERMILLE 1000
+#define PERCENT 100
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    _Atomic dword dwKey;            // ID + 1, 0 while the slot is free
+    _Atomic dword dwNBits;          // since the last report
+    dword dwKeyLast;                // the slot's ID over the last report period
+    dword dwNBitsLast;
+} stBusLoadID_t;
+
+typedef struct {
+    _Atomic dword dwNBits;          // since the last 100 ms sample
+    _Atomic dword dwNFrames;
+    _Atomic dword dwNUntrackedBits; // IDs that found the table full
+    _Atomic boolean bResetPeak;     // set by busload_reset_peak, taken by the next sample
+    dword adwWindowBits[BUSLOAD_N_WINDOWS];
+    dword adwWindowus[BUSLOAD_N_WINDOWS];
+    dword dwNSecondFrames;
+    byte byWindow;
+    qword qwtLastSampleus;
+    stBusLoadStats_t stStats;
+    stBusLoadID_t astIDs[BUSLOAD_N_IDS];
+} stBusLoad_t;
+
+/* --------------------------- Local Variables ------------------------------ */
+#ifdef GPIO_CAN0_TX
+extern twai_node_handle_t stCANBus0;
+#endif
+
+static const dword adwBitrate[CAN_N_BUSES] = { CAN0_BITRATE, CAN1_BITRATE };
+static const boolean abBusEnabled[CAN_N_BUSES] =
+{
+    #ifdef GPIO_CAN0_TX
+    TRUE,
+    #else
+    FALSE,
+    #endif
+    #ifdef GPIO_CAN1_TX
+    TRUE,
+    #else
+    FALSE,
+    #endif
+};
+static stBusLoad_t astBusLoad[CAN_N_BUSES];
+
+/* --------------------------- Function prototypes -------------------------- */
+void busload_count(byte byBus, dword dwID, byte byDLC, boolean bExtended);
+void busload_service(void);
+esp_err_t busload_get_stats(byte byBus, stBusLoadStats_t *stStats);
+esp_err_t busload_reset_peak(byte byBus);
+static word busload_permille(qword qwNBits, qword qwtElapsedus, dword dwBitrate);
+static void busload_report(byte byBus, qword qwtSecondus);
+
+/* --------------------------- Functions ------------------------------------ */
+
+void busload_count(byte byBus, dword dwID, byte byDLC, boolean bExtended)
+{
+    /*
+    *===========================================================================
+    *   busload_count
+    *   Takes:   byBus - bus the frame was seen on
+    *            dwID, byDLC, bExtended - the frame
+    *
+    *   Returns: Nothing.
+    *
+    *   Adds a frame to the bus and per ID totals. Safe from the RX ISR and
+    *   tasks at once, the ID table is claimed with compare and swap. An ID
+    *   tries at most BUSLOAD_MAX_PROBES slots.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Probes capped
+    *
+    *===========================================================================
+    */
+    if (byBus >= CAN_N_BUSES)
+    {
+        return;
+    }
+    stBusLoad_t *stBus = &astBusLoad[byBus];
+    dword dwNBits = CAN_frame_bits_worst_case(byDLC, bExtended);
+    dword dwKey = dwID + 1;
+
+    __atomic_fetch_add(&stBus->dwNBits, dwNBits, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stBus->dwNFrames, 1, __ATOMIC_RELAXED);
+
+    /* Find or claim the ID's slot */
+    word wSlot = (word)((dword)(dwID * BUSLOAD_HASH) >> (32 - BUSLOAD_ID_BITS));
+    for (word i = 0; i < BUSLOAD_MAX_PROBES; i++)
+    {
+        stBusLoadID_t *stID = &stBus->astIDs[wSlot];
+        dword dwSlotKey = __atomic_load_n(&stID->dwKey, __ATOMIC_ACQUIRE);
+        if (dwSlotKey == 0)
+        {
+            dword dwExpected = 0;
+            if (__atomic_compare_exchange_n(&stID->dwKey, &dwExpected, dwKey, FALSE,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                dwSlotKey = dwKey;
+            }
+            else
+            {
+                dwSlotKey = dwExpected;
+            }
+        }
+        if (dwSlotKey == dwKey)
+        {
+            __atomic_fetch_add(&stID->dwNBits, dwNBits, __ATOMIC_RELAXED);
+            return;
+        }
+        wSlot = (wSlot + 1) & (BUSLOAD_N_IDS - 1);
+    }
+    __atomic_fetch_add(&stBus->dwNUntrackedBits, dwNBits, __ATOMIC_RELAXED);
+}
+
+void busload_service(void)
+{
+    /*
+    *===========================================================================
+    *   busload_service
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Call every 100 ms. Closes the current window on every bus, updates the
+    *   100 ms, 1 s and peak loads and sends the reports once a second.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP First call drops the counts from before it, peak reset
+    *
+    *===========================================================================
+    */
+    qword qwtNowus = (qword)esp_timer_get_time();
+
+    for (byte byBus = 0; byBus < CAN_N_BUSES; byBus++)
+    {
+        stBusLoad_t *stBus = &astBusLoad[byBus];
+        if (!abBusEnabled[byBus])
+        {
+            continue;
+        }
+        if (stBus->qwtLastSampleus == 0)
+        {
+            /* First call, only start the window. Frames counted since CAN_init
+            *  have no window of their own and would inflate the first one */
+            stBus->qwtLastSampleus = qwtNowus;
+            __atomic_store_n(&stBus->dwNBits, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&stBus->dwNFrames, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        dword dwNBits = __atomic_exchange_n(&stBus->dwNBits, 0, __ATOMIC_RELAXED);
+        stBus->dwNSecondFrames += __atomic_exchange_n(&stBus->dwNFrames, 0, __ATOMIC_RELAXED);
+        qword qwtElapsedus = qwtNowus - stBus->qwtLastSampleus;
+        stBus->qwtLastSampleus = qwtNowus;
+
+        stBus->adwWindowBits[stBus->byWindow] = dwNBits;
+        stBus->adwWindowus[stBus->byWindow] = (dword)qwtElapsedus;
+        stBus->stStats.wInstantPermille = busload_permille(dwNBits, qwtElapsedus, adwBitrate[byBus]);
+        if (__atomic_exchange_n(&stBus->bResetPeak, FALSE, __ATOMIC_RELAXED) ||
+            stBus->stStats.wInstantPermille > stBus->stStats.wPeakPermille)
+        {
+            stBus->stStats.wPeakPermille = stBus->stStats.wInstantPermille;
+        }
+
+        stBus->byWindow++;
+        if (stBus->byWindow >= BUSLOAD_N_WINDOWS)
+        {
+            qword qwNSecondBits = 0;
+            qword qwtSecondus = 0;
+            for (byte i = 0; i < BUSLOAD_N_WINDOWS; i++)
+            {
+                qwNSecondBits += stBus->adwWindowBits[i];
+                qwtSecondus += stBus->adwWindowus[i];
+            }
+            stBus->stStats.wSecondPermille = busload_permille(qwNSecondBits, qwtSecondus, adwBitrate[byBus]);
+            stBus->stStats.dwFramesPerSecond = (dword)(stBus->dwNSecondFrames * US_PER_S / qwtSecondus);
+            stBus->dwNSecondFrames = 0;
+            stBus->byWindow = 0;
+            busload_report(byBus, qwtSecondus);
+        }
+    }
+}
+
+esp_err_t busload_get_stats(byte byBus, stBusLoadStats_t *stStats)
+{
+    if (byBus >= CAN_N_BUSES || !abBusEnabled[byBus])
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stStats = astBusLoad[byBus].stStats;
+    return ESP_OK;
+}
+
+esp_err_t busload_reset_peak(byte byBus)
+{
+    /*
+    *===========================================================================
+    *   busload_reset_peak
+    *   Takes:   byBus - bus to reset
+    *
+    *   Returns: ESP_OK, or ESP_ERR_INVALID_ARG for a bus that is not fitted.
+    *
+    *   Starts the peak again from the next 100 ms sample, for example at
+    *   the start of a run. Safe from any task.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (byBus >= CAN_N_BUSES || !abBusEnabled[byBus])
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    __atomic_store_n(&astBusLoad[byBus].bResetPeak, TRUE, __ATOMIC_RELAXED);
+    return ESP_OK;
+}
+
+static word busload_permille(qword qwNBits, qword qwtElapsedus, dword dwBitrate)
+{
+    /* Bits seen as a share of the bits the bus could carry, in 0.1 % */
+    if (qwtElapsedus == 0)
+    {
+        return 0;
+    }
+    qword qwPermille = qwNBits * PERMILLE * US_PER_S / (qwtElapsedus * dwBitrate);
+    return (word)((qwPermille > 0xFFFF) ? 0xFFFF : qwPermille);
+}
+
+static void busload_report(byte byBus, qword qwtSecondus)
+{
+    /*
+    *===========================================================================
+    *   busload_report
+    *   Takes:   byBus - bus to report
+    *            qwtSecondus - length of the second just closed
+    *
+    *   Returns: Nothing.
+    *
+    *   Takes the per ID totals for the second and frees every slot, so IDs
+    *   that have gone quiet make room for new ones, then sends the bus load
+    *   frame and one frame for each of the busiest IDs. Reports go out on
+    *   CAN0.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP ID slots freed each second
+    *
+    *===========================================================================
+    */
+    stBusLoad_t *stBus = &astBusLoad[byBus];
+    stBusLoadStats_t *stStats = &stBus->stStats;
+    word awTop[BUSLOAD_N_TOP_IDS];
+    byte byNTop = 0;
+    qword qwNTotalBits = __atomic_exchange_n(&stBus->dwNUntrackedBits, 0, __ATOMIC_RELAXED);
+
+    /* Close the second for every ID and keep the busiest, highest first. The
+    *  key is freed before the bits are taken, a frame that claims the slot
+    *  in between is counted against the old ID rather than left behind */
+    for (word i = 0; i < BUSLOAD_N_IDS; i++)
+    {
+        stBusLoadID_t *stID = &stBus->astIDs[i];
+        stID->dwKeyLast = __atomic_exchange_n(&stID->dwKey, 0, __ATOMIC_ACQ_REL);
+        stID->dwNBitsLast = __atomic_exchange_n(&stID->dwNBits, 0, __ATOMIC_RELAXED);
+        qwNTotalBits += stID->dwNBitsLast;
+        if (stID->dwNBitsLast == 0 || stID->dwKeyLast == 0)
+        {
+            continue;
+        }
+
+        byte byRank = byNTop;
+        while (byRank > 0 && stBus->astIDs[awTop[byRank - 1]].dwNBitsLast < stID->dwNBitsLast)
+        {
+            byRank--;
+        }
+        if (byRank < BUSLOAD_N_TOP_IDS)
+        {
+            byte byLast = (byNTop < BUSLOAD_N_TOP_IDS) ? byNTop : BUSLOAD_N_TOP_IDS - 1;
+            memmove(&awTop[byRank + 1], &awTop[byRank], (byLast - byRank) * sizeof(awTop[0]));
+            awTop[byRank] = i;
+            if (byNTop < BUSLOAD_N_TOP_IDS)
+            {
+                byNTop++;
+            }
+        }
+    }
+
+    #ifdef DEBUG
+    ESP_LOGI("BUSLOAD", "CAN%d load %u.%u%% (1 s %u.%u%%, peak %u.%u%%), %lu frames/s",
+             (int)byBus,
+             (unsigned)(stStats->wInstantPermille / 10), (unsigned)(stStats->wInstantPermille % 10),
+             (unsigned)(stStats->wSecondPermille / 10), (unsigned)(stStats->wSecondPermille % 10),
+             (unsigned)(stStats->wPeakPermille / 10), (unsigned)(stStats->wPeakPermille % 10),
+             (unsigned long)stStats->dwFramesPerSecond);
+    #endif
+
+    #ifdef GPIO_CAN0_TX
+    CAN_frame_t astReport[1 + BUSLOAD_N_TOP_IDS];
+    dword dwFramesPer100 = stStats->dwFramesPerSecond / 100;
+    astReport[0] = (CAN_frame_t)
+    {
+        .dwID = CAN_ID_BUSLOAD_REPORT,
+        .byDLC = 8,
+        .abData = {
+            byBus,
+            (byte)(stStats->wInstantPermille & 0xFF),
+            (byte)(stStats->wInstantPermille >> 8 & 0xFF),
+            (byte)(stStats->wSecondPermille & 0xFF),
+            (byte)(stStats->wSecondPermille >> 8 & 0xFF),
+            (byte)(stStats->wPeakPermille & 0xFF),
+            (byte)(stStats->wPeakPermille >> 8 & 0xFF),
+            (byte)((dwFramesPer100 > 0xFF) ? 0xFF : dwFramesPer100),
+        }
+    };
+    for (byte i = 0; i < byNTop; i++)
+    {
+        stBusLoadID_t *stID = &stBus->astIDs[awTop[i]];
+        dword dwID = stID->dwKeyLast - 1;
+        word wPermille = busload_permille(stID->dwNBitsLast, qwtSecondus, adwBitrate[byBus]);
+        astReport[1 + i] = (CAN_frame_t)
+        {
+            .dwID = CAN_ID_BUSLOAD_TOP_IDS,
+            .byDLC = 8,
+            .abData = {
+                (byte)(byBus << 4 | i),
+                (byte)(dwID & 0xFF),
+                (byte)(dwID >> 8 & 0xFF),
+                (byte)(dwID >> 16 & 0xFF),
+                (byte)(dwID >> 24 & 0xFF),
+                (byte)(wPermille & 0xFF),
+                (byte)(wPermille >> 8 & 0xFF),
+                (byte)(stID->dwNBitsLast * PERCENT / qwNTotalBits),
+            }
+        };
+    }
+    (void)CAN_transmit_batch(stCANBus0, astReport, 1 + byNTop, NULL);
+    #endif
+}
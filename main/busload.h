@@ -0,0 +1,25 @@
+#ifndef SFR_BUSLOAD
+#define SFR_BUSLOAD
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sfrtypes.h"
+#include "pin.h"
+
+/* --------------------------- Types ---------------------------------------- */
+typedef struct {
+    word wInstantPermille;  // last 100 ms, in 0.1 % of the bit rate
+    word wSecondPermille;   // last 1 s
+    word wPeakPermille;     // highest 100 ms since power up or busload_reset_peak
+    dword dwFramesPerSecond;
+} stBusLoadStats_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+void busload_count(byte byBus, dword dwID, byte byDLC, boolean bExtended);
+void busload_service(void);
+esp_err_t busload_get_stats(byte byBus, stBusLoadStats_t *stStats);
+esp_err_t busload_reset_peak(byte byBus);
+
+#endif // SFR_BUSLOAD
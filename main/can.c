@@ -7,7 +7,14 @@ Written by Cole Perera for Sheffield Formula Racing 2025
 
 #include <stdio.h>
 #include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "can.h"
+#include "busload.h"
+#include "signals.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "gateway.h"
 
 /* --------------------------- Global Variables ----------------------------- */
 #ifdef GPIO_CAN0_TX
@@ -21,26 +28,72 @@ _Atomic word wRingBufHead = 0; // next write index
 _Atomic word wRingBufTail = 0; // next read index
 
 /* --------------------------- Local Variables ------------------------------ */
-
+/*
+* Frames handed to the driver by CAN_transmit_batch. The driver keeps a pointer
+* to the frame until it is sent, so they cannot live on the stack. A set bit
+* in dwTxPoolFree is a free slot. A slot is claimed with a CAS before it is
+* filled, given back if the driver refuses the frame, and freed by the TX done
+* ISR once the frame has left or been given up on. A full queue then costs no
+* slots and a held frame is never overwritten.
+*/
+#if CAN_TX_POOL_LENGTH > 32
+#error "CAN_TX_POOL_LENGTH must fit the free slot mask"
+#endif
+#define CAN_TX_POOL_ALL ((dword)(((qword)1 << CAN_TX_POOL_LENGTH) - 1))
+static twai_frame_t astTxPool[CAN_TX_POOL_LENGTH];
+static byte abyTxPoolData[CAN_TX_POOL_LENGTH][8];
+static _Atomic dword dwTxPoolFree = CAN_TX_POOL_ALL;
+
+/* Error counters per bus. The ISR counts into astCANTelemetry, the 100 ms
+* sample copies it to astCANTelemetryLast for the deltas and readers */
+static stCANTelemetry_t astCANTelemetry[CAN_N_BUSES];
+static stCANTelemetry_t astCANTelemetryLast[CAN_N_BUSES];
+static portMUX_TYPE stRingBufLock = portMUX_INITIALIZER_UNLOCKED; // RX ISR and CAN_ring_push both write the ring
+static pfCANTxDone_t pfCANTxDoneHook = NULL;    // told of every frame that leaves, from the ISR
+
+typedef struct {
+    word wCRC;          // CRC-15 so far
+    byte byLastBit;
+    byte byRunLength;   // identical bits in a row, stuff bits included
+    word wNBits;        // bits on the wire so far, stuff bits included
+} stCANBitStream_t;
 
 /* --------------------------- Function prototypes -------------------------- */
 esp_err_t CAN_init(boolean bEnableRx);
 esp_err_t CAN_transmit(twai_node_handle_t stCANBus, CAN_frame_t stFrame);
+esp_err_t CAN_transmit_batch(twai_node_handle_t stCANBus, const CAN_frame_t *astFrames, word wNFrames, word *pwNSent);
+word CAN_frame_bits(const CAN_frame_t *stFrame);
+word CAN_frame_bits_worst_case(byte byDLC, boolean bExtended);
+static void CAN_bits_push(stCANBitStream_t *stStream, dword dwValue, byte byNBits, boolean bCRC);
 bool CAN_receive_callback(twai_node_handle_t stCANBus, const twai_rx_done_event_data_t *edata, void *stRxCallback);
 esp_err_t CAN_receive_debug();
 void CAN_bus_diagnosics();
 const char* CAN_error_state_to_string(twai_error_state_t stState);
 esp_err_t CAN_empty_buffer(twai_node_handle_t stCANBus);
+esp_err_t CAN_get_telemetry(byte byBus, stCANTelemetry_t *stTelemetry);
+esp_err_t CAN_ring_push(const CAN_frame_t *stFrame);
+static bool CAN_error_callback(twai_node_handle_t stCANBus, const twai_error_event_data_t *edata, void *pvArg);
+static bool CAN_state_callback(twai_node_handle_t stCANBus, const twai_state_change_event_data_t *edata, void *pvArg);
+static bool CAN_tx_done_callback(twai_node_handle_t stCANBus, const twai_tx_done_event_data_t *edata, void *pvArg);
+esp_err_t CAN_set_tx_done_hook(pfCANTxDone_t pfHook);
+twai_node_handle_t CAN_bus_handle(byte byBus);
+static byte CAN_bus_index(twai_node_handle_t stCANBus);
 
 /* --------------------------- Definitions ---------------------------------- */
-#define CAN0_BITRATE 1000000  // 1000kbps
 #define CAN0_TX_QUEUE_LENGTH 10
 
-#define CAN1_BITRATE 1000000  // 1 Mbps
 #define CAN1_TX_QUEUE_LENGTH 10
 
 #define MAX_CAN_TXS_PER_CALL 1
 
+#define CAN_CRC15_POLYNOMIAL 0x4599
+#define CAN_STUFF_RUN 5             // a stuff bit follows this many identical bits
+#define CAN_FRAME_TAIL_BITS 13      // CRC delimiter, ACK slot and delimiter, EOF and interframe space, never stuffed
+#define CAN_STUFFED_BITS_STANDARD 34 // SOF to CRC less the data field, standard ID
+#define CAN_STUFFED_BITS_EXTENDED 54 // SOF to CRC less the data field, extended ID
+
+#define CAN_SATURATE(value, max) (byte)(((value) > (max)) ? (max) : (value))
+
 /* --------------------------- Functions ------------------------------------ */
 
 esp_err_t CAN_init(boolean bEnableRx)
@@ -53,16 +106,31 @@ esp_err_t CAN_init(boolean bEnableRx)
     *   Returns: ESP_OK if successful, error code if not.
     * 
     *   Creates and starts all defined CAN busses that have pins specifed in
-    *   pin.h.
+    *   pin.h, and registers the bus diagnostics and load estimator.
     *=========================================================================== 
     *   Revision History:
     *   20/04/25 CP Initial Version
     *   29/10/25 CP Updated to use onchip driver, old driver depriecated
+    *   18/10/26 CP Error and state callbacks for the telemetry on every bus
+    *   18/10/26 CP Registers its 100 ms runnables with the scheduler
+    *   18/10/26 CP TX done callback for CAN_set_tx_done_hook
     *
     *===========================================================================
     */
+    static const stSchedRunnable_t astCANRunnables[] =
+    {
+        { "CAN_diag", CAN_bus_diagnosics, 100, SCHED_OFFSET_AUTO, 1000 },
+        { "busload", busload_service, 100, SCHED_OFFSET_AUTO, 1000 },
+    };
 
     esp_err_t stState = ESP_OK;
+    twai_event_callbacks_t stCallbacks =
+    {
+        .on_rx_done = bEnableRx ? CAN_receive_callback : NULL,
+        .on_tx_done = CAN_tx_done_callback,
+        .on_error = CAN_error_callback,
+        .on_state_change = CAN_state_callback,
+    };
 
     /* Bus 0 */
     #ifdef GPIO_CAN0_TX
@@ -79,17 +147,10 @@ esp_err_t CAN_init(boolean bEnableRx)
     {
         ESP_LOGE("CAN", "CAN0 twai_new_node_onchip failed: %s", esp_err_to_name(stState));  
     }
-    if (bEnableRx) 
+    stState = twai_node_register_event_callbacks(stCANBus0, &stCallbacks, NULL);
+    if ( stState != ESP_OK )
     {
-        twai_event_callbacks_t stRxCallback =
-        {
-            .on_rx_done = CAN_receive_callback,
-        };
-        stState = twai_node_register_event_callbacks(stCANBus0, &stRxCallback, NULL);
-        if ( stState != ESP_OK )
-        {
-            ESP_LOGE("CAN", "CAN0 failed to register callback: %s", esp_err_to_name(stState));  
-        }
+        ESP_LOGE("CAN", "CAN0 failed to register callback: %s", esp_err_to_name(stState));  
     }
     stState = twai_node_enable(stCANBus0); 
     if ( stState != ESP_OK )
@@ -113,7 +174,7 @@ esp_err_t CAN_init(boolean bEnableRx)
     {
         ESP_LOGE("CAN", "CAN1 twai_new_node_onchip failed: %s", esp_err_to_name(stState));  
     }
-    stState = twai_node_register_event_callbacks(stCANBus1, &stRxCallback, NULL);
+    stState = twai_node_register_event_callbacks(stCANBus1, &stCallbacks, NULL);
     if ( stState != ESP_OK )
     {
         ESP_LOGE("CAN", "CAN1 failed to register callback: %s", esp_err_to_name(stState));  
@@ -137,7 +198,8 @@ esp_err_t CAN_init(boolean bEnableRx)
     __atomic_store_n(&wRingBufHead, 0, __ATOMIC_RELAXED);
     __atomic_store_n(&wRingBufTail, 0, __ATOMIC_RELAXED);  
 
-    return stState;
+    esp_err_t NStatus = scheduler_register(astCANRunnables, sizeof(astCANRunnables) / sizeof(astCANRunnables[0]));
+    return (stState != ESP_OK) ? stState : NStatus;
 }
 
 esp_err_t CAN_transmit(twai_node_handle_t stCANBus, CAN_frame_t stFrame)
@@ -150,34 +212,195 @@ esp_err_t CAN_transmit(twai_node_handle_t stCANBus, CAN_frame_t stFrame)
     * 
     *   Returns: ESP_OK if successful, error code if not.
     * 
-    *   Transmits a CAN message on the given CAN bus. in debug mode it prints the
-    *   status of the bus for every call.
+    *   Transmits a CAN message on the given CAN bus. The driver keeps a
+    *   pointer to the frame until it is sent, so it goes through the
+    *   CAN_transmit_batch pool rather than the stack.
     *=========================================================================== 
     *   Revision History:
     *   20/04/25 CP Initial Version
     *   29/10/25 CP Updated to use onchip driver, old driver depriecated
     *   02/11/25 CP Makes transmit work with messages < 8 bytes
+    *   18/10/26 CP Counts the frame towards the bus load
+    *   18/10/26 CP Sent from the TX pool, counted there
     *
     *===========================================================================
     */
-    esp_err_t stState;
+    return CAN_transmit_batch(stCANBus, &stFrame, 1, NULL);
+}
 
-    /* Construct message */
-    uint8_t abyData[(int)stFrame.byDLC];
-    memcpy(abyData, stFrame.abData, stFrame.byDLC);
-    twai_frame_t stMessage = 
+esp_err_t CAN_transmit_batch(twai_node_handle_t stCANBus, const CAN_frame_t *astFrames, word wNFrames, word *pwNSent)
+{
+    /*
+    *===========================================================================
+    *   CAN_transmit_batch
+    *   Takes:   stCANBus: CAN bus handle
+    *            astFrames: frames to transmit, in order
+    *            wNFrames: number of frames
+    *            pwNSent: returns how many were queued
+    *
+    *   Returns: ESP_OK if every frame was queued, the driver error for the
+    *            first frame that was not otherwise (usually the TX queue is
+    *            full, the caller retries the rest later), ESP_ERR_NO_MEM if
+    *            every pool slot is still held by the driver.
+    *
+    *   Queues several frames with one call and no copies onto the stack.
+    *   IDs above 11 bits are sent as extended frames. Safe from any task.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Pool slots claimed atomically, APPS sends from task_1ms
+    *   18/10/26 CP Slots freed on TX done, and given back when refused
+    *   18/10/26 CP Bus load counted on TX done, once the frame is sent
+    *
+    *===========================================================================
+    */
+    esp_err_t NStatus = ESP_OK;
+    word wNSent = 0;
+
+    while (wNSent < wNFrames)
     {
-        .header.id  = (uint32_t)stFrame.dwID,
-        .header.dlc = (uint16_t)stFrame.byDLC,
-        .header.ide = 0,
-        .buffer     = abyData,
-        .buffer_len = sizeof(abyData)
-    };
-    
-    /* Transmit message */
-    stState = twai_node_transmit(stCANBus, &stMessage, FALSE);
-    
-    return stState;
+        const CAN_frame_t *stFrame = &astFrames[wNSent];
+        byte byLength = (stFrame->byDLC > 8) ? 8 : stFrame->byDLC;
+        dword dwFree = __atomic_load_n(&dwTxPoolFree, __ATOMIC_ACQUIRE);
+        word wSlot;
+        do
+        {
+            if (dwFree == 0)
+            {
+                NStatus = ESP_ERR_NO_MEM;
+                break;
+            }
+            wSlot = (word)__builtin_ctz(dwFree);
+        } while (!__atomic_compare_exchange_n(&dwTxPoolFree, &dwFree, dwFree & ~((dword)1 << wSlot),
+                                              FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+        if (NStatus != ESP_OK)
+        {
+            break;
+        }
+        twai_frame_t *stMessage = &astTxPool[wSlot];
+
+        memcpy(abyTxPoolData[wSlot], stFrame->abData, byLength);
+        *stMessage = (twai_frame_t)
+        {
+            .header.id  = (uint32_t)stFrame->dwID,
+            .header.dlc = (uint16_t)stFrame->byDLC,
+            .header.ide = (stFrame->dwID > CAN_STANDARD_ID_MAX) ? 1 : 0,
+            .buffer     = abyTxPoolData[wSlot],
+            .buffer_len = byLength,
+        };
+        NStatus = twai_node_transmit(stCANBus, stMessage, 0);
+        if (NStatus != ESP_OK)
+        {
+            __atomic_fetch_or(&dwTxPoolFree, (dword)1 << wSlot, __ATOMIC_RELEASE);
+            break;
+        }
+        wNSent++;
+    }
+
+    if (pwNSent != NULL)
+    {
+        *pwNSent = wNSent;
+    }
+    return NStatus;
+}
+
+word CAN_frame_bits(const CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   CAN_frame_bits
+    *   Takes:   stFrame: frame to measure
+    *
+    *   Returns: Bits the frame takes on the wire, from SOF to the end of the
+    *            interframe space.
+    *
+    *   Builds the frame bit by bit to find the real number of stuff bits,
+    *   which depends on the ID, data and CRC. Data frames only, IDs above 11
+    *   bits are counted as extended.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stCANBitStream_t stStream = { .wCRC = 0, .byLastBit = 0xFF, .byRunLength = 0, .wNBits = 0 };
+    byte byLength = (stFrame->byDLC > 8) ? 8 : stFrame->byDLC;
+
+    CAN_bits_push(&stStream, 0, 1, TRUE);                                   // SOF
+    if (stFrame->dwID > CAN_STANDARD_ID_MAX)
+    {
+        CAN_bits_push(&stStream, (stFrame->dwID >> 18) & 0x7FF, 11, TRUE);  // base ID
+        CAN_bits_push(&stStream, 0x3, 2, TRUE);                             // SRR, IDE
+        CAN_bits_push(&stStream, stFrame->dwID & 0x3FFFF, 18, TRUE);        // ID extension
+        CAN_bits_push(&stStream, 0, 3, TRUE);                               // RTR, r1, r0
+    }
+    else
+    {
+        CAN_bits_push(&stStream, stFrame->dwID, 11, TRUE);
+        CAN_bits_push(&stStream, 0, 3, TRUE);                               // RTR, IDE, r0
+    }
+    CAN_bits_push(&stStream, stFrame->byDLC & 0x0F, 4, TRUE);
+    for (byte i = 0; i < byLength; i++)
+    {
+        CAN_bits_push(&stStream, stFrame->abData[i], 8, TRUE);
+    }
+    CAN_bits_push(&stStream, stStream.wCRC, 15, FALSE);
+
+    return stStream.wNBits + CAN_FRAME_TAIL_BITS;
+}
+
+word CAN_frame_bits_worst_case(byte byDLC, boolean bExtended)
+{
+    /*
+    *===========================================================================
+    *   CAN_frame_bits_worst_case
+    *   Takes:   byDLC: data length code
+    *            bExtended: TRUE for a 29 bit ID
+    *
+    *   Returns: Most bits a data frame of this length can take on the wire,
+    *            from SOF to the end of the interframe space.
+    *
+    *   Stuffing covers SOF to the end of the CRC, at worst one stuff bit for
+    *   every 4 bits after the first 5. Cheap enough to use from an ISR, where
+    *   CAN_frame_bits is not.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    word wNStuffed = (bExtended ? CAN_STUFFED_BITS_EXTENDED : CAN_STUFFED_BITS_STANDARD)
+                   + 8 * ((byDLC > 8) ? 8 : byDLC);
+
+    return wNStuffed + (wNStuffed - 1) / (CAN_STUFF_RUN - 1) + CAN_FRAME_TAIL_BITS;
+}
+
+static void CAN_bits_push(stCANBitStream_t *stStream, dword dwValue, byte byNBits, boolean bCRC)
+{
+    /* Adds bits MSB first, updating the CRC and inserting stuff bits */
+    for (sbyte i = (sbyte)byNBits - 1; i >= 0; i--)
+    {
+        byte byBit = (byte)((dwValue >> i) & 1);
+        if (bCRC)
+        {
+            word wFeedback = (word)(byBit ^ ((stStream->wCRC >> 14) & 1));
+            stStream->wCRC = (word)((stStream->wCRC << 1) & 0x7FFF);
+            if (wFeedback)
+            {
+                stStream->wCRC ^= CAN_CRC15_POLYNOMIAL;
+            }
+        }
+        stStream->byRunLength = (byBit == stStream->byLastBit) ? stStream->byRunLength + 1 : 1;
+        stStream->byLastBit = byBit;
+        stStream->wNBits++;
+        if (stStream->byRunLength == CAN_STUFF_RUN)
+        {
+            /* Stuff bit is the opposite level and starts the next run */
+            stStream->byLastBit = (byte)!byBit;
+            stStream->byRunLength = 1;
+            stStream->wNBits++;
+        }
+    }
 }
 
 esp_err_t CAN_receive_debug()
@@ -195,11 +418,13 @@ esp_err_t CAN_receive_debug()
     *   Revision History:
     *   29/10/25 CP Initial Version
     *   02/11/25 CP Improved terminal readability
+    *   18/10/26 CP Refuses while the gateway runs
     *
     *===========================================================================
     */
 
-    if (!stCANRingBuffer) 
+    /* The gateway owns the ring while it runs, a second reader would steal its frames */
+    if (!stCANRingBuffer || gateway_running()) 
     {
         return ESP_ERR_INVALID_STATE;
     }
@@ -246,56 +471,249 @@ void CAN_bus_diagnosics()
     /*
     *===========================================================================
     *   CAN_bus_diagnosics
-    *   Takes:   stCANBus: Pointer to the CAN bus handle
+    *   Takes:   None
     * 
     *   Returns: Nothing.
     * 
-    *   Checks the status of the CAN bus and attempts to recover if there is an
-    *   error.
+    *   Checks the status of every CAN bus and attempts to recover if there is
+    *   an error. Call every 100 ms, each call samples the error counters and
+    *   sends one CAN_ID_CAN_TELEMETRY frame per bus, also put in the ring
+    *   buffer so the SD log keeps the time series:
+    *       [0] bus << 4 | error state
+    *       [1] TEC, [2] REC, both saturate at 255
+    *       [3] bit errors << 4 | form errors, since the last frame, sat. 15
+    *       [4] stuff errors << 4 | ACK errors, since the last frame, sat. 15
+    *       [5] arbitration lost, [6] RX overruns, since the last frame
+    *       [7] bus off recoveries since power up, wraps
     *=========================================================================== 
     *   Revision History:
     *   20/04/25 CP Initial Version
+    *   18/10/26 CP Error state kept per bus, error counter telemetry
     *
     *===========================================================================
     */
 
     twai_node_status_t stBusStatus;
     twai_node_record_t stBusStatistics;
-    static twai_error_state_t stLastErrorState = TWAI_ERROR_ACTIVE;
+    CAN_frame_t astTelemetry[CAN_N_BUSES];
+    word wNTelemetry = 0;
+
+    for (byte byBus = 0; byBus < CAN_N_BUSES; byBus++)
+    {
+        twai_node_handle_t stCANBus = CAN_bus_handle(byBus);
+        stCANTelemetry_t *stTelemetry = &astCANTelemetry[byBus];
+        stCANTelemetry_t *stLast = &astCANTelemetryLast[byBus];
+        if (stCANBus == NULL)
+        {
+            continue;
+        }
+
+        /* Check if the CAN bus is in error state and recover */
+        if (twai_node_get_info(stCANBus, &stBusStatus, &stBusStatistics) != ESP_OK)
+        {
+            continue;
+        }
+        /* Detect state change */
+        if (stBusStatus.state != stTelemetry->eState) {
+            ESP_LOGW("CAN", "CAN%d bus error state changed from %s to %s", (int)byBus,
+                CAN_error_state_to_string(stTelemetry->eState),
+                CAN_error_state_to_string(stBusStatus.state));
+            stTelemetry->eState = stBusStatus.state;
+        }
+        stTelemetry->wTEC = stBusStatus.tx_error_count;
+        stTelemetry->wREC = stBusStatus.rx_error_count;
+        stTelemetry->dwNBusErrors = stBusStatistics.bus_err_num;
+        /* If bad error then restart bus */
+        if (stBusStatus.state == TWAI_ERROR_BUS_OFF) 
+        {
+            ESP_LOGW("CAN", "Recovering bus %d : %s", (int)byBus, esp_err_to_name(twai_node_recover(stCANBus))); 
+        }
+
+        /* Counters from the ISR, read once so the frame and the copy agree */
+        stCANTelemetry_t stNow = *stTelemetry;
+        stNow.dwNBitErrors = __atomic_load_n(&stTelemetry->dwNBitErrors, __ATOMIC_RELAXED);
+        stNow.dwNFormErrors = __atomic_load_n(&stTelemetry->dwNFormErrors, __ATOMIC_RELAXED);
+        stNow.dwNStuffErrors = __atomic_load_n(&stTelemetry->dwNStuffErrors, __ATOMIC_RELAXED);
+        stNow.dwNAckErrors = __atomic_load_n(&stTelemetry->dwNAckErrors, __ATOMIC_RELAXED);
+        stNow.dwNArbitrationLost = __atomic_load_n(&stTelemetry->dwNArbitrationLost, __ATOMIC_RELAXED);
+        stNow.dwNRxOverruns = __atomic_load_n(&stTelemetry->dwNRxOverruns, __ATOMIC_RELAXED);
+        stNow.dwNBusOffRecoveries = __atomic_load_n(&stTelemetry->dwNBusOffRecoveries, __ATOMIC_RELAXED);
+
+        astTelemetry[wNTelemetry++] = (CAN_frame_t)
+        {
+            .dwID = CAN_ID_CAN_TELEMETRY,
+            .byDLC = 8,
+            .abData = {
+                (byte)(byBus << 4 | (stNow.eState & 0x0F)),
+                CAN_SATURATE(stNow.wTEC, 0xFF),
+                CAN_SATURATE(stNow.wREC, 0xFF),
+                (byte)(CAN_SATURATE(stNow.dwNBitErrors - stLast->dwNBitErrors, 0x0F) << 4
+                     | CAN_SATURATE(stNow.dwNFormErrors - stLast->dwNFormErrors, 0x0F)),
+                (byte)(CAN_SATURATE(stNow.dwNStuffErrors - stLast->dwNStuffErrors, 0x0F) << 4
+                     | CAN_SATURATE(stNow.dwNAckErrors - stLast->dwNAckErrors, 0x0F)),
+                CAN_SATURATE(stNow.dwNArbitrationLost - stLast->dwNArbitrationLost, 0xFF),
+                CAN_SATURATE(stNow.dwNRxOverruns - stLast->dwNRxOverruns, 0xFF),
+                (byte)(stNow.dwNBusOffRecoveries & 0xFF),
+            },
+            .qwtTimestampus = (qword)esp_timer_get_time(),
+            .byBus = CAN_BUS_NONE,
+        };
+        *stLast = stNow;
+    }
 
     #ifdef GPIO_CAN0_TX
-    /* Check if the CAN bus is in error state and recover */
-    twai_node_get_info(stCANBus0, &stBusStatus, &stBusStatistics);
-    /* Detect state change */
-    if (stBusStatus.state != stLastErrorState) {
-        ESP_LOGW("CAN", "CAN0 bus error state changed from %s to %s",
-            CAN_error_state_to_string(stLastErrorState),
-            CAN_error_state_to_string(stBusStatus.state));
-        stLastErrorState = stBusStatus.state;
+    (void)CAN_transmit_batch(stCANBus0, astTelemetry, wNTelemetry, NULL);
+    #endif
+    for (word i = 0; i < wNTelemetry; i++)
+    {
+        (void)CAN_ring_push(&astTelemetry[i]);
     }
-    /* If bad error then restart bus */
-    if (stBusStatus.state == TWAI_ERROR_BUS_OFF) 
+}
+
+esp_err_t CAN_get_telemetry(byte byBus, stCANTelemetry_t *stTelemetry)
+{
+    /* Copy of the latest sample, counters keep counting between samples */
+    if (byBus >= CAN_N_BUSES || CAN_bus_handle(byBus) == NULL)
     {
-        ESP_LOGW("CAN", "Recovering bus 0 : %s", esp_err_to_name(twai_node_recover(stCANBus0))); 
+        return ESP_ERR_INVALID_ARG;
     }
-    #endif
+    *stTelemetry = astCANTelemetryLast[byBus];
+    return ESP_OK;
+}
 
-    #ifdef GPIO_CAN1_TX
-    /* Check if the CAN bus is in error state and recover */
-    twai_node_get_info(stCANBus1, &stBusStatus, &stBusStatistics);
-    /* Detect state change */
-    if (stBusStatus.state != stLastErrorState) {
-        ESP_LOGW("CAN", "CAN1 bus error state changed from %s to %s",
-            CAN_error_state_to_string(stLastErrorState),
-            CAN_error_state_to_string(stBusStatus.state));
-        stLastErrorState = stBusStatus.state;
+esp_err_t CAN_ring_push(const CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   CAN_ring_push
+    *   Takes:   stFrame: frame to add
+    *
+    *   Returns: ESP_OK if added, ESP_ERR_NO_MEM if the ring buffer is full.
+    *
+    *   Adds a frame made on this device to the ring buffer, so it is logged
+    *   like a received one. Holds the ring lock against the RX ISR.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    esp_err_t NStatus = ESP_OK;
+    if (!stCANRingBuffer) 
+    {
+        return ESP_ERR_INVALID_STATE;
     }
-    /* If bad error then restart bus */
-    if (stBusStatus.state == TWAI_ERROR_BUS_OFF) 
+
+    taskENTER_CRITICAL(&stRingBufLock);
+    word wLocalHead = __atomic_load_n(&wRingBufHead, __ATOMIC_RELAXED);
+    word wNext = (wLocalHead + 1 >= CAN_QUEUE_LENGTH) ? 0 : wLocalHead + 1;
+    if (wNext == __atomic_load_n(&wRingBufTail, __ATOMIC_ACQUIRE))
     {
-        ESP_LOGW("CAN", "Recovering bus 1: %s", esp_err_to_name(twai_node_recover(stCANBus1))); 
+        NStatus = ESP_ERR_NO_MEM;
     }
-    #endif
+    else
+    {
+        stCANRingBuffer[wLocalHead] = *stFrame;
+        __atomic_store_n(&wRingBufHead, wNext, __ATOMIC_RELEASE);
+    }
+    taskEXIT_CRITICAL(&stRingBufLock);
+    return NStatus;
+}
+
+static bool CAN_error_callback(twai_node_handle_t stCANBus, const twai_error_event_data_t *edata, void *pvArg)
+{
+    /* ISR, counts each error flag the controller raised */
+    stCANTelemetry_t *stTelemetry = &astCANTelemetry[CAN_bus_index(stCANBus)];
+
+    if (edata->err_flags.bit_err)
+    {
+        __atomic_fetch_add(&stTelemetry->dwNBitErrors, 1, __ATOMIC_RELAXED);
+    }
+    if (edata->err_flags.form_err)
+    {
+        __atomic_fetch_add(&stTelemetry->dwNFormErrors, 1, __ATOMIC_RELAXED);
+    }
+    if (edata->err_flags.stuff_err)
+    {
+        __atomic_fetch_add(&stTelemetry->dwNStuffErrors, 1, __ATOMIC_RELAXED);
+    }
+    if (edata->err_flags.ack_err)
+    {
+        __atomic_fetch_add(&stTelemetry->dwNAckErrors, 1, __ATOMIC_RELAXED);
+    }
+    if (edata->err_flags.arb_lost)
+    {
+        __atomic_fetch_add(&stTelemetry->dwNArbitrationLost, 1, __ATOMIC_RELAXED);
+    }
+    return FALSE;
+}
+
+static bool CAN_state_callback(twai_node_handle_t stCANBus, const twai_state_change_event_data_t *edata, void *pvArg)
+{
+    /* ISR, a bus off recovery ends with the node leaving bus off */
+    if (edata->old_sta == TWAI_ERROR_BUS_OFF && edata->new_sta != TWAI_ERROR_BUS_OFF)
+    {
+        __atomic_fetch_add(&astCANTelemetry[CAN_bus_index(stCANBus)].dwNBusOffRecoveries, 1, __ATOMIC_RELAXED);
+    }
+    return FALSE;
+}
+
+static bool CAN_tx_done_callback(twai_node_handle_t stCANBus, const twai_tx_done_event_data_t *edata, void *pvArg)
+{
+    /* ISR, counts a sent frame towards the bus load, frees its pool slot and
+    *  passes it to the hook. The frame is read before the slot is freed, a
+    *  task may refill it straight away */
+    const twai_frame_t *stFrame = edata->done_tx_frame;
+    if (stFrame == NULL)
+    {
+        return FALSE;
+    }
+    dword dwID = stFrame->header.id;
+    if (edata->is_tx_success)
+    {
+        busload_count(CAN_bus_index(stCANBus), dwID, (byte)stFrame->header.dlc, stFrame->header.ide);
+    }
+    if (stFrame >= &astTxPool[0] && stFrame < &astTxPool[CAN_TX_POOL_LENGTH])
+    {
+        __atomic_fetch_or(&dwTxPoolFree, (dword)1 << (stFrame - astTxPool), __ATOMIC_RELEASE);
+    }
+    pfCANTxDone_t pfHook = __atomic_load_n(&pfCANTxDoneHook, __ATOMIC_ACQUIRE);
+    if (pfHook != NULL)
+    {
+        pfHook(CAN_bus_index(stCANBus), dwID, edata->is_tx_success);
+    }
+    return FALSE;
+}
+
+esp_err_t CAN_set_tx_done_hook(pfCANTxDone_t pfHook)
+{
+    /*
+    *===========================================================================
+    *   CAN_set_tx_done_hook
+    *   Takes:   pfHook - called from the TX done ISR with the bus, ID and
+    *                     whether it was sent, must be in IRAM. NULL to remove
+    *
+    *   Returns: ESP_OK, or ESP_ERR_INVALID_STATE if another hook is set.
+    *
+    *   One hook for the node, it filters by ID itself.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    pfCANTxDone_t pfExpected = NULL;
+    if (pfHook == NULL)
+    {
+        __atomic_store_n(&pfCANTxDoneHook, NULL, __ATOMIC_RELEASE);
+        return ESP_OK;
+    }
+    if (!__atomic_compare_exchange_n(&pfCANTxDoneHook, &pfExpected, pfHook, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) &&
+        pfExpected != pfHook)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
 }
 
 bool CAN_receive_callback(twai_node_handle_t stCANBus, const twai_rx_done_event_data_t *edata, void *stRxCallback)
@@ -317,12 +735,20 @@ bool CAN_receive_callback(twai_node_handle_t stCANBus, const twai_rx_done_event_
     *   20/04/25 CP Initial Version
     *   08/10/25 CP Updated to implement ring buffer
     *   30/10/25 CP Updated to use onchip driver, old driver depriecated
+    *   18/10/26 CP Timestamp frames on reception
+    *   18/10/26 CP Counts the frame towards the bus load
+    *   18/10/26 CP Counts RX overruns, ring lock shared with CAN_ring_push
+    *   18/10/26 CP Tags frames with the bus they came from
+    *   18/10/26 CP Updates the signal store
+    *   18/10/26 CP Trace events, the end carries the ring depth
     *
     *===========================================================================
     */
 
     esp_err_t stState;
     CAN_frame_t stRxedFrame;
+    byte byTraceISR = eTRACE_ISR_CAN0_RX + CAN_bus_index(stCANBus);
+    trace_event(eTRACE_ISR_BEGIN, byTraceISR, 0);
     /* Initialise Rx Buffer */
     uint8_t abyRxBuffer[8];
     twai_frame_t stRxFrame = {
@@ -333,13 +759,27 @@ bool CAN_receive_callback(twai_node_handle_t stCANBus, const twai_rx_done_event_
     stState = twai_node_receive_from_isr(stCANBus, &stRxFrame);
     if ( stState == ESP_OK )
     {
+        /* Copy frame, unused bytes zeroed for the decoders */
+        stRxedFrame.dwID = (dword)stRxFrame.header.id;
+        stRxedFrame.byDLC = (byte)stRxFrame.header.dlc;
+        stRxedFrame.qwtTimestampus = (qword)esp_timer_get_time();
+        stRxedFrame.byBus = CAN_bus_index(stCANBus);
+        memset(stRxedFrame.abData, 0, sizeof(stRxedFrame.abData));
+        memcpy(stRxedFrame.abData, stRxFrame.buffer, stRxFrame.header.dlc);
+
+        /* Counted before the ring buffer so dropped frames still count */
+        busload_count(stRxedFrame.byBus, stRxedFrame.dwID, stRxedFrame.byDLC, stRxFrame.header.ide);
+        signals_update(&stRxedFrame);
+
         /* Put CAN Frame into Ring Buffer */
         if (!stCANRingBuffer) 
         {
+            trace_event(eTRACE_ISR_END, byTraceISR, 0);
             return ESP_ERR_INVALID_STATE;
         }
 
         /* Get local copy of queue head and tail */
+        taskENTER_CRITICAL_ISR(&stRingBufLock);
         word wLocalHead = __atomic_load_n(&wRingBufHead, __ATOMIC_RELAXED);
         word wNext = wLocalHead + 1;
         if (wNext >= CAN_QUEUE_LENGTH) 
@@ -350,20 +790,23 @@ bool CAN_receive_callback(twai_node_handle_t stCANBus, const twai_rx_done_event_
 
         if (wNext == wLocalTail) {
             /* Buffer full, drop frame */
+            taskEXIT_CRITICAL_ISR(&stRingBufLock);
+            __atomic_fetch_add(&astCANTelemetry[CAN_bus_index(stCANBus)].dwNRxOverruns, 1, __ATOMIC_RELAXED);
+            trace_event(eTRACE_ISR_END, byTraceISR, CAN_QUEUE_LENGTH - 1);
             return ESP_ERR_NO_MEM;
         }
 
         /* Copy frame into buffer */
-        stRxedFrame.dwID = (dword)stRxFrame.header.id;
-        stRxedFrame.byDLC = (byte)stRxFrame.header.dlc;
-        memcpy(stRxedFrame.abData, stRxFrame.buffer, stRxFrame.header.dlc);
         stCANRingBuffer[wLocalHead] = stRxedFrame;
 
         /* Publish new head */
         __atomic_store_n(&wRingBufHead, wNext, __ATOMIC_RELEASE);
+        taskEXIT_CRITICAL_ISR(&stRingBufLock);
+        trace_event(eTRACE_ISR_END, byTraceISR, (wNext >= wLocalTail) ? (wNext - wLocalTail) : (wNext + CAN_QUEUE_LENGTH - wLocalTail));
         return TRUE;
     }
 
+    trace_event(eTRACE_ISR_END, byTraceISR, 0);
     return FALSE;
 }
 
@@ -378,14 +821,17 @@ esp_err_t CAN_empty_buffer(twai_node_handle_t stCANBus)
     * 
     *   Empties the CAN ring buffer by transmitting messages until the buffer is
     *   empty or the max number of messages per call is reached.
+    *   ESP_ERR_INVALID_STATE while the gateway runs.
     *=========================================================================== 
     *   Revision History:
     *   15/10/25 CP Initial Version
+    *   18/10/26 CP Refuses while the gateway runs
     *
     *===========================================================================
     */
     esp_err_t NStatus = ESP_OK;
-    if (!stCANRingBuffer) 
+    /* The gateway owns the ring while it runs, a second reader would steal its frames */
+    if (!stCANRingBuffer || gateway_running()) 
     {
         return ESP_ERR_INVALID_STATE;
     }
@@ -419,4 +865,35 @@ esp_err_t CAN_empty_buffer(twai_node_handle_t stCANBus)
     /* Publish new tail */
     __atomic_store_n(&wRingBufTail, dwLocalTail, __ATOMIC_RELEASE);
     return NStatus;
-}
\ No newline at end of file
+}
+
+twai_node_handle_t CAN_bus_handle(byte byBus)
+{
+    /* Handle of a bus number, NULL if the bus is not fitted */
+    #ifdef GPIO_CAN0_TX
+    if (byBus == 0)
+    {
+        return stCANBus0;
+    }
+    #endif
+    #ifdef GPIO_CAN1_TX
+    if (byBus == 1)
+    {
+        return stCANBus1;
+    }
+    #endif
+    return NULL;
+}
+
+static byte CAN_bus_index(twai_node_handle_t stCANBus)
+{
+    /* Bus number of a handle, 0 for CAN0 */
+    #ifdef GPIO_CAN1_TX
+    if (stCANBus == stCANBus1)
+    {
+        return 1;
+    }
+    #endif
+    (void)stCANBus;
+    return 0;
+}
@@ -5,18 +5,56 @@
 #include "esp_twai_onchip.h"
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_timer.h"
 
 #include "pin.h"
 #include "string.h"
 #include "espnow.h"
 
+typedef struct {
+    twai_error_state_t eState;
+    word wTEC;
+    word wREC;
+    dword dwNBusErrors;         // driver total
+    dword dwNBitErrors;
+    dword dwNFormErrors;
+    dword dwNStuffErrors;
+    dword dwNAckErrors;
+    dword dwNArbitrationLost;
+    dword dwNRxOverruns;        // frames dropped with the ring buffer full
+    dword dwNBusOffRecoveries;
+} stCANTelemetry_t;
+
+typedef void (*pfCANTxDone_t)(byte byBus, dword dwID, boolean bSent);
+
 esp_err_t CAN_init(boolean bEnableRx);
 esp_err_t CAN_transmit(twai_node_handle_t stCANBus, CAN_frame_t stFrame);
+esp_err_t CAN_transmit_batch(twai_node_handle_t stCANBus, const CAN_frame_t *astFrames, word wNFrames, word *pwNSent);
+word CAN_frame_bits(const CAN_frame_t *stFrame);
+word CAN_frame_bits_worst_case(byte byDLC, boolean bExtended);
 bool CAN_receive_callback(twai_node_handle_t stCANBus, const twai_rx_done_event_data_t *edata, void *stRxCallback);
 esp_err_t CAN_receive_debug();
 void CAN_bus_diagnosics();
 const char* CAN_error_state_to_string(twai_error_state_t stState);
 esp_err_t CAN_empty_buffer(twai_node_handle_t stCANBus);
+esp_err_t CAN_get_telemetry(byte byBus, stCANTelemetry_t *stTelemetry);
+esp_err_t CAN_ring_push(const CAN_frame_t *stFrame);
+twai_node_handle_t CAN_bus_handle(byte byBus);
+esp_err_t CAN_set_tx_done_hook(pfCANTxDone_t pfHook);
+
+#define CAN0_BITRATE 1000000  // 1000kbps
+#define CAN1_BITRATE 1000000  // 1 Mbps
+#define CAN_N_BUSES 2
+
+#define CAN_STANDARD_ID_MAX 0x7FF
+#define CAN_TX_POOL_LENGTH 32 // frames CAN_transmit_batch keeps for the driver, more than the TX queues hold
+
+/* Diagnostic frames, UPDATE THESE if they clash with the car */
+#define CAN_ID_BLASTER_REPORT 0x7F0
+#define CAN_ID_BUSLOAD_REPORT 0x7F1
+#define CAN_ID_BUSLOAD_TOP_IDS 0x7F2
+#define CAN_ID_CAN_TELEMETRY 0x7F3
+#define CAN_ID_GATEWAY_REPORT 0x7F4
 
 #define LOG_CAN_FRAME(frame) do { \
     char _buf[128]; \
@@ -7,6 +7,9 @@ Written by Cole Perera for Sheffield Formula Racing 2025
 
 #include "espnow.h"
 #include "sfrtypes.h"
+#include "trace.h"
+#include "scheduler.h"
+#include "gateway.h"
 
 /* --------------------------- Local Types ----------------------------- */
 typedef enum {
@@ -61,6 +64,9 @@ esp_err_t ESPNOW_fill_buffer(const byte *abyData, byte byNDataLength);
 esp_err_t ESPNOW_empty_buffer(void);
 static void ESPNOW_tx_callback(const wifi_tx_info_t *tx_info, esp_now_send_status_t NStatus);
 static void ESPNOW_rx_callback(const esp_now_recv_info_t *recv_info, const uint8_t *byData, int byNLength);
+#ifdef TX_SIDE
+static void ESPNOW_runnable(void);
+#endif
 
 
 /* --------------------------- Functions ----------------------------- */
@@ -73,10 +79,12 @@ esp_err_t ESPNOW_init(void)
     * 
     *   Returns: ESP_OK if successful, error code if not.
     * 
-    *   Installs the wifi driver and starts the esp now service.
+    *   Installs the wifi driver and starts the esp now service. The TX side
+    *   registers ESPNOW_empty_buffer with the scheduler.
     *=========================================================================== 
     *   Revision History:
     *   04/05/25 CP Initial Version
+    *   18/10/26 CP TX side registers its sender with the scheduler
     *
     *===========================================================================
     */
@@ -128,6 +136,16 @@ esp_err_t ESPNOW_init(void)
         ESP_LOGE("ESP-NOW", "Failed to add peer: %s", esp_err_to_name(NStatus));
         return NStatus;
     }
+
+    /* One packet a call, 22 frames every 10 ms keeps up with a busy bus */
+    static const stSchedRunnable_t astESPNOWRunnables[] =
+    {
+        { "espnow", ESPNOW_runnable, 10, SCHED_OFFSET_AUTO, 1000 },
+    };
+    NStatus = scheduler_register(astESPNOWRunnables, sizeof(astESPNOWRunnables) / sizeof(astESPNOWRunnables[0]));
+    if (NStatus != ESP_OK) {
+        return NStatus;
+    }
     #endif
 
     /* Register Callbacks */
@@ -184,10 +202,12 @@ static void ESPNOW_tx_callback(const wifi_tx_info_t *tx_info, esp_now_send_statu
     *=========================================================================== 
     *   Revision History:
     *   06/10/25 CP Initial Version
+    *   18/10/26 CP Trace events
     *
     *===========================================================================
     */
 
+    trace_event(eTRACE_ISR_BEGIN, eTRACE_ISR_ESPNOW_TX, 0);
     byte abyMACAddress[6];
     memcpy(abyMACAddress, tx_info->des_addr, sizeof(abyMACAddress));
     
@@ -196,6 +216,7 @@ static void ESPNOW_tx_callback(const wifi_tx_info_t *tx_info, esp_now_send_statu
         abyMACAddress[0], abyMACAddress[1], abyMACAddress[2],
         abyMACAddress[3], abyMACAddress[4], abyMACAddress[5], NStatus);
     #endif
+    trace_event(eTRACE_ISR_END, eTRACE_ISR_ESPNOW_TX, (word)NStatus);
 }
 
 static void ESPNOW_rx_callback(const esp_now_recv_info_t *recv_info, const uint8_t *byData, int byNLength)
@@ -216,14 +237,17 @@ static void ESPNOW_rx_callback(const esp_now_recv_info_t *recv_info, const uint8
     *=========================================================================== 
     *   Revision History:
     *   06/10/25 CP Initial Version
+    *   18/10/26 CP Trace events
     *
     *===========================================================================
     */
 
+    trace_event(eTRACE_ISR_BEGIN, eTRACE_ISR_ESPNOW_RX, 0);
     ESPNOW_fill_buffer(byData, byNLength);
     #ifdef DEBUG
     ESP_LOGI("ESP-NOW", "%d Bytes Recieved.", byNLength); 
     #endif
+    trace_event(eTRACE_ISR_END, eTRACE_ISR_ESPNOW_RX, (word)byNLength);
 
 }
 
@@ -242,17 +266,21 @@ esp_err_t ESPNOW_empty_buffer(void)
     *   ESP-NOW packet (2 bytes ID, 1 byte DLC, 8 bytes data). The ring buffer is
     *   115 frames in total so it can take up to 3 ESP-NOW packets to empty
     *   the buffer if it is full. This function only sends one ESP-NOW packet per
-    *   call, it is intended to be run once per 100ms or so.
+    *   call, ESPNOW_init registers it to run every 10 ms. Returns
+    *   ESP_ERR_INVALID_STATE while the gateway runs.
     * 
     *=========================================================================== 
     *   Revision History:
     *   08/10/25 CP Initial Version
+    *   18/10/26 CP Run by the scheduler
+    *   18/10/26 CP Refuses while the gateway runs
     *
     *===========================================================================
     */
 
     byte byBytesToSend[MAX_ESPNOW_PAYLOAD];
-    if (!stCANRingBuffer) 
+    /* The gateway owns the ring while it runs, a second reader would steal its frames */
+    if (!stCANRingBuffer || gateway_running()) 
     {
         return ESP_ERR_INVALID_STATE;
     }
@@ -310,6 +338,8 @@ esp_err_t ESPNOW_fill_buffer(const byte *abyData, byte byNDataLength)
     *   Revision History:
     *   15/10/25 CP Initial Version
     *   03/11/25 CP Fixed the way this was writing to the ring buffer, god what a nightmare
+    *   18/10/26 CP Timestamp frames on reception
+    *   18/10/26 CP Frames are tagged as not from a local bus
     *
     *===========================================================================
     */
@@ -334,6 +364,8 @@ esp_err_t ESPNOW_fill_buffer(const byte *abyData, byte byNDataLength)
         stFrame.dwID = dwID;
         stFrame.byDLC = abyData[offset + 2];
         memcpy(stFrame.abData, &abyData[offset + 3], 8);
+        stFrame.qwtTimestampus = (qword)esp_timer_get_time();
+        stFrame.byBus = CAN_BUS_NONE;
 
         /* Check if buffer is full */
         if ((wLocalHead + 1) % CAN_QUEUE_LENGTH == wLocalTail) 
@@ -358,3 +390,24 @@ esp_err_t ESPNOW_fill_buffer(const byte *abyData, byte byNDataLength)
     __atomic_store_n(&wRingBufHead, wLocalHead, __ATOMIC_RELEASE);
     return ESP_OK;
 }
+
+#ifdef TX_SIDE
+static void ESPNOW_runnable(void)
+{
+    /*
+    *===========================================================================
+    *   ESPNOW_runnable
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   ESPNOW_empty_buffer for the scheduler.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    (void)ESPNOW_empty_buffer();
+}
+#endif
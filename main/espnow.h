@@ -11,6 +11,7 @@
 #include "esp_mac.h"
 #include "esp_now.h"
 #include "esp_crc.h"
+#include "esp_timer.h"
 #include "esp_err.h"
 #include "string.h"
 #include "sfrtypes.h"
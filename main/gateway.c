@@ -0,0 +1,389 @@
+/*
+gateway.c
+File contains the CAN gateway between CAN0 and CAN1. Frames received on
+either bus are taken from the ring buffer and looked up in a route table by
+source bus and ID, one array index per frame. A route forwards the frame to
+the other bus, forwards it under a new ID, or drops it, optionally with a
+minimum time between frames per ID. IDs no route covers are dropped, so the
+buses stay isolated apart from what is listed.
+
+The gateway empties the ring buffer, so a gateway node does not also log to
+the SD card or send over ESP-NOW, those readers of the ring refuse to run
+while gateway_running(). Frames made on this device are not routed.
+
+Once a second each route that saw traffic is reported as a
+CAN_ID_GATEWAY_REPORT frame on CAN0:
+    [0] route, 0 for IDs no route covers
+    [1-2] frames forwarded, [3] frames dropped or rate limited,
+    [4] frames the destination refused, all since the last report
+    [5-6] mean latency (us), [7] max latency (10 us), RX to queued
+All little endian, counts saturate.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <string.h>
+#include "gateway.h"
+#include "scheduler.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define GATEWAY_N_IDS 2048                  // all 11 bit IDs, looked up directly
+#define GATEWAY_FRAMES_PER_CALL 32          // frames routed per gateway_pump call
+#define GATEWAY_REPORT_PERIOD 1000000       // route report (us)
+#define GATEWAY_MAX_ROUTES 254              // route numbers fit a byte, 0 is the default
+#define GATEWAY_LATENCY_REPORT_UNIT 10      // us per bit of the max latency byte
+
+/* --------------------------- Local Variables ------------------------------ */
+extern CAN_frame_t *stCANRingBuffer;
+extern _Atomic word wRingBufHead;
+extern _Atomic word wRingBufTail;
+#ifdef GPIO_CAN0_TX
+extern twai_node_handle_t stCANBus0;
+#endif
+
+/*
+* Routes, bus 0 is the chassis bus and bus 1 the inverter bus. IDs are
+* placeholders, UPDATE THESE to match the car. Later routes win where ranges
+* overlap.
+*/
+static const stGatewayRoute_t astGatewayRoutes[] =
+{
+    /* Inverter temperatures to the chassis bus at 10 Hz */
+    { .bySourceBus = 1, .dwFirstID = 0x0A0, .dwLastID = 0x0AF, .eAction = eGATEWAY_FORWARD,
+      .byDestBus = 0, .dwNewID = 0, .wtMinIntervalms = 100 },
+    /* Inverter faults, every frame */
+    { .bySourceBus = 1, .dwFirstID = 0x181, .dwLastID = 0x181, .eAction = eGATEWAY_FORWARD,
+      .byDestBus = 0, .dwNewID = 0, .wtMinIntervalms = 0 },
+    /* Motor speed, moved clear of a chassis bus ID */
+    { .bySourceBus = 1, .dwFirstID = 0x0A5, .dwLastID = 0x0A5, .eAction = eGATEWAY_REMAP,
+      .byDestBus = 0, .dwNewID = 0x6A5, .wtMinIntervalms = 10 },
+    /* Torque request from the VCU to the inverters */
+    { .bySourceBus = 0, .dwFirstID = 0x0C0, .dwLastID = 0x0C1, .eAction = eGATEWAY_FORWARD,
+      .byDestBus = 1, .dwNewID = 0, .wtMinIntervalms = 0 },
+};
+#define GATEWAY_N_ROUTES (sizeof(astGatewayRoutes) / sizeof(astGatewayRoutes[0]))
+
+static boolean bGatewayRunning = FALSE;
+static byte *abyRouteIndex = NULL;          // route number for every bus and 11 bit ID, 0 for none
+static dword *adwtLastForwardedms = NULL;   // per bus and ID, for the rate limit
+static stGatewayRouteStats_t astRouteStats[GATEWAY_N_ROUTES + 1];
+static stGatewayRouteStats_t astRouteStatsReported[GATEWAY_N_ROUTES + 1];
+static dword adwtPeriodMaxLatencyus[GATEWAY_N_ROUTES + 1];
+static qword qwtLastReportus = 0;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t gateway_init(void);
+esp_err_t gateway_pump(void);
+boolean gateway_running(void);
+esp_err_t gateway_get_stats(byte byRoute, stGatewayRouteStats_t *stStats);
+static void gateway_route_frame(const CAN_frame_t *stFrame);
+static void gateway_report(void);
+static void gateway_runnable(void);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t gateway_init(void)
+{
+    /*
+    *===========================================================================
+    *   gateway_init
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Checks the route table and builds the lookup from it, then registers
+    *   the pump with the scheduler. Call after CAN_init with RX enabled.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Registers gateway_pump as a background runnable
+    *
+    *===========================================================================
+    */
+    if (GATEWAY_N_ROUTES > GATEWAY_MAX_ROUTES)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (abyRouteIndex == NULL)
+    {
+        abyRouteIndex = calloc(CAN_N_BUSES * GATEWAY_N_IDS, sizeof(byte));
+        adwtLastForwardedms = calloc(CAN_N_BUSES * GATEWAY_N_IDS, sizeof(dword));
+        if (abyRouteIndex == NULL || adwtLastForwardedms == NULL)
+        {
+            ESP_LOGE("GATEWAY", "Failed to allocate route tables");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    memset(abyRouteIndex, 0, CAN_N_BUSES * GATEWAY_N_IDS * sizeof(byte));
+    memset(adwtLastForwardedms, 0, CAN_N_BUSES * GATEWAY_N_IDS * sizeof(dword));
+
+    for (word i = 0; i < GATEWAY_N_ROUTES; i++)
+    {
+        const stGatewayRoute_t *stRoute = &astGatewayRoutes[i];
+        dword dwNIDs = stRoute->dwLastID - stRoute->dwFirstID + 1;
+        if (stRoute->bySourceBus >= CAN_N_BUSES || stRoute->dwLastID < stRoute->dwFirstID
+            || stRoute->dwLastID >= GATEWAY_N_IDS)
+        {
+            ESP_LOGE("GATEWAY", "Route %d has a bad bus or ID range", (int)(i + 1));
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (stRoute->eAction != eGATEWAY_DROP
+            && (stRoute->byDestBus >= CAN_N_BUSES || stRoute->byDestBus == stRoute->bySourceBus
+                || CAN_bus_handle(stRoute->byDestBus) == NULL))
+        {
+            ESP_LOGE("GATEWAY", "Route %d goes to CAN%d, which is not fitted", (int)(i + 1), (int)stRoute->byDestBus);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (stRoute->eAction == eGATEWAY_REMAP && stRoute->dwNewID + dwNIDs - 1 > CAN_STANDARD_ID_MAX)
+        {
+            ESP_LOGE("GATEWAY", "Route %d remaps past the 11 bit IDs", (int)(i + 1));
+            return ESP_ERR_INVALID_ARG;
+        }
+        memset(&abyRouteIndex[stRoute->bySourceBus * GATEWAY_N_IDS + stRoute->dwFirstID], i + 1, dwNIDs);
+    }
+
+    memset(astRouteStats, 0, sizeof(astRouteStats));
+    memset(astRouteStatsReported, 0, sizeof(astRouteStatsReported));
+    memset(adwtPeriodMaxLatencyus, 0, sizeof(adwtPeriodMaxLatencyus));
+    qwtLastReportus = (qword)esp_timer_get_time();
+    bGatewayRunning = TRUE;
+    ESP_LOGI("GATEWAY", "Routing with %d routes", (int)GATEWAY_N_ROUTES);
+
+    static const stSchedRunnable_t astGatewayRunnables[] =
+    {
+        { "gateway", gateway_runnable, 0, 0, 1000 },
+    };
+    static boolean bRegistered = FALSE;
+    if (!bRegistered)
+    {
+        bRegistered = TRUE;
+        return scheduler_register(astGatewayRunnables, sizeof(astGatewayRunnables) / sizeof(astGatewayRunnables[0]));
+    }
+    return ESP_OK;
+}
+
+esp_err_t gateway_pump(void)
+{
+    /*
+    *===========================================================================
+    *   gateway_pump
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK if successful, ESP_ERR_INVALID_STATE if the gateway
+    *            is not running.
+    *
+    *   The gateway's TX pump, call from the background task. Routes up to
+    *   GATEWAY_FRAMES_PER_CALL frames from the ring buffer and sends the
+    *   route report when it is due.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (!bGatewayRunning || !stCANRingBuffer)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /* Load ring buffer head and tail */
+    word wLocalHead = __atomic_load_n(&wRingBufHead, __ATOMIC_ACQUIRE);
+    word wLocalTail = __atomic_load_n(&wRingBufTail, __ATOMIC_RELAXED);
+    word wCounter = 0;
+
+    while (wCounter < GATEWAY_FRAMES_PER_CALL && wLocalTail != wLocalHead)
+    {
+        gateway_route_frame(&stCANRingBuffer[wLocalTail]);
+
+        /* Advance tail */
+        wLocalTail++;
+        wCounter++;
+        if (wLocalTail >= CAN_QUEUE_LENGTH)
+        {
+            wLocalTail = 0;
+        }
+    }
+    /* Publish new tail */
+    __atomic_store_n(&wRingBufTail, wLocalTail, __ATOMIC_RELEASE);
+
+    if ((qword)esp_timer_get_time() - qwtLastReportus >= GATEWAY_REPORT_PERIOD)
+    {
+        gateway_report();
+    }
+    return ESP_OK;
+}
+
+boolean gateway_running(void)
+{
+    return bGatewayRunning;
+}
+
+esp_err_t gateway_get_stats(byte byRoute, stGatewayRouteStats_t *stStats)
+{
+    /* Totals since gateway_init, route 0 is IDs no route covers */
+    if (byRoute > GATEWAY_N_ROUTES)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stStats = astRouteStats[byRoute];
+    return ESP_OK;
+}
+
+static void gateway_route_frame(const CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   gateway_route_frame
+    *   Takes:   stFrame - frame from the ring buffer
+    *
+    *   Returns: Nothing.
+    *
+    *   One table lookup finds the route. Extended IDs are never routed. A
+    *   frame the destination will not take is dropped and counted, waiting
+    *   for it would hold up the other direction.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (stFrame->byBus >= CAN_N_BUSES)
+    {
+        return;
+    }
+
+    dword dwSlot = stFrame->byBus * GATEWAY_N_IDS + stFrame->dwID;
+    byte byRoute = (stFrame->dwID < GATEWAY_N_IDS) ? abyRouteIndex[dwSlot] : 0;
+    stGatewayRouteStats_t *stStats = &astRouteStats[byRoute];
+    if (byRoute == 0)
+    {
+        stStats->dwNDropped++;
+        return;
+    }
+    const stGatewayRoute_t *stRoute = &astGatewayRoutes[byRoute - 1];
+    if (stRoute->eAction == eGATEWAY_DROP)
+    {
+        stStats->dwNDropped++;
+        return;
+    }
+
+    if (stRoute->wtMinIntervalms > 0)
+    {
+        dword dwtNowms = (dword)(stFrame->qwtTimestampus / 1000);
+        if (dwtNowms - adwtLastForwardedms[dwSlot] < stRoute->wtMinIntervalms)
+        {
+            stStats->dwNRateLimited++;
+            return;
+        }
+        adwtLastForwardedms[dwSlot] = dwtNowms;
+    }
+
+    CAN_frame_t stOut = *stFrame;
+    if (stRoute->eAction == eGATEWAY_REMAP)
+    {
+        stOut.dwID = stRoute->dwNewID + (stFrame->dwID - stRoute->dwFirstID);
+    }
+    word wNSent = 0;
+    (void)CAN_transmit_batch(CAN_bus_handle(stRoute->byDestBus), &stOut, 1, &wNSent);
+    if (wNSent == 0)
+    {
+        stStats->dwNTxFailed++;
+        return;
+    }
+
+    dword dwtLatencyus = (dword)((qword)esp_timer_get_time() - stFrame->qwtTimestampus);
+    stStats->dwNForwarded++;
+    stStats->qwtTotalLatencyus += dwtLatencyus;
+    if (dwtLatencyus > stStats->dwtMaxLatencyus)
+    {
+        stStats->dwtMaxLatencyus = dwtLatencyus;
+    }
+    if (dwtLatencyus > adwtPeriodMaxLatencyus[byRoute])
+    {
+        adwtPeriodMaxLatencyus[byRoute] = dwtLatencyus;
+    }
+}
+
+static void gateway_report(void)
+{
+    /*
+    *===========================================================================
+    *   gateway_report
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Sends a report frame for each route that saw traffic since the last
+    *   one. Reports the TX queue will not take are skipped, the totals carry
+    *   on in gateway_get_stats.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    qwtLastReportus = (qword)esp_timer_get_time();
+
+    for (word i = 0; i <= GATEWAY_N_ROUTES; i++)
+    {
+        stGatewayRouteStats_t *stNow = &astRouteStats[i];
+        stGatewayRouteStats_t *stLast = &astRouteStatsReported[i];
+        dword dwNForwarded = stNow->dwNForwarded - stLast->dwNForwarded;
+        dword dwNDropped = (stNow->dwNDropped - stLast->dwNDropped) + (stNow->dwNRateLimited - stLast->dwNRateLimited);
+        dword dwNTxFailed = stNow->dwNTxFailed - stLast->dwNTxFailed;
+        if (dwNForwarded == 0 && dwNDropped == 0 && dwNTxFailed == 0)
+        {
+            continue;
+        }
+        dword dwtMeanLatencyus = (dwNForwarded > 0)
+                               ? (dword)((stNow->qwtTotalLatencyus - stLast->qwtTotalLatencyus) / dwNForwarded) : 0;
+        dword dwtMaxLatency = adwtPeriodMaxLatencyus[i] / GATEWAY_LATENCY_REPORT_UNIT;
+
+        #ifdef DEBUG
+        ESP_LOGI("GATEWAY", "Route %d: %lu forwarded, %lu dropped, %lu refused, latency %lu us mean %lu us max",
+                 (int)i, (unsigned long)dwNForwarded, (unsigned long)dwNDropped, (unsigned long)dwNTxFailed,
+                 (unsigned long)dwtMeanLatencyus, (unsigned long)adwtPeriodMaxLatencyus[i]);
+        #endif
+
+        #ifdef GPIO_CAN0_TX
+        CAN_frame_t stReport =
+        {
+            .dwID = CAN_ID_GATEWAY_REPORT,
+            .byDLC = 8,
+            .abData = {
+                (byte)i,
+                (byte)((dwNForwarded > 0xFFFF ? 0xFFFF : dwNForwarded) & 0xFF),
+                (byte)((dwNForwarded > 0xFFFF ? 0xFFFF : dwNForwarded) >> 8 & 0xFF),
+                (byte)(dwNDropped > 0xFF ? 0xFF : dwNDropped),
+                (byte)(dwNTxFailed > 0xFF ? 0xFF : dwNTxFailed),
+                (byte)((dwtMeanLatencyus > 0xFFFF ? 0xFFFF : dwtMeanLatencyus) & 0xFF),
+                (byte)((dwtMeanLatencyus > 0xFFFF ? 0xFFFF : dwtMeanLatencyus) >> 8 & 0xFF),
+                (byte)(dwtMaxLatency > 0xFF ? 0xFF : dwtMaxLatency),
+            }
+        };
+        (void)CAN_transmit_batch(stCANBus0, &stReport, 1, NULL);
+        #endif
+
+        *stLast = *stNow;
+        adwtPeriodMaxLatencyus[i] = 0;
+    }
+}
+
+static void gateway_runnable(void)
+{
+    /*
+    *===========================================================================
+    *   gateway_runnable
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   gateway_pump for the scheduler, every time the background task wakes.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    (void)gateway_pump();
+}
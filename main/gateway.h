@@ -0,0 +1,44 @@
+#ifndef SFR_GATEWAY
+#define SFR_GATEWAY
+
+#include <stdlib.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sfrtypes.h"
+#include "can.h"
+
+/* --------------------------- Types ---------------------------------------- */
+typedef enum {
+    eGATEWAY_DROP = 0,
+    eGATEWAY_FORWARD,       // same ID on the destination bus
+    eGATEWAY_REMAP,         // ID moved to dwNewID + (ID - dwFirstID)
+} eGatewayAction_t;
+
+typedef struct {
+    byte bySourceBus;
+    dword dwFirstID;        // 11 bit IDs only
+    dword dwLastID;
+    eGatewayAction_t eAction;
+    byte byDestBus;
+    dword dwNewID;          // first ID of the range after a remap
+    word wtMinIntervalms;   // rate limit per ID, 0 for none
+} stGatewayRoute_t;
+
+typedef struct {
+    dword dwNForwarded;
+    dword dwNDropped;       // by the route
+    dword dwNRateLimited;
+    dword dwNTxFailed;      // destination TX queue full or bus off
+    qword qwtTotalLatencyus; // RX to queued on the destination, for the mean
+    dword dwtMaxLatencyus;
+} stGatewayRouteStats_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t gateway_init(void);
+esp_err_t gateway_pump(void);
+boolean gateway_running(void);
+esp_err_t gateway_get_stats(byte byRoute, stGatewayRouteStats_t *stStats);
+
+#endif // SFR_GATEWAY
@@ -0,0 +1,404 @@
+/*
+logfilter.c
+File contains the per ID filtering and decimation for the SD card logger.
+Profiles are read from a config file on the card at boot, eg:
+
+    # logcfg.txt
+    select endurance
+
+    profile endurance
+    default every 10
+    0x0A0-0x0AF interval 100    # inverter temperatures, 10 Hz is plenty
+    0x181 include               # inverter faults, every frame
+    0x7E0-0x7EF exclude         # diagnostics
+
+    profile testing
+    default include
+
+Each rule line is an ID or ID range followed by any of include, exclude,
+every <N> (keep one frame in N) and interval <ms> (minimum time between kept
+frames). Later lines win where ranges overlap. "default" sets the rule for
+IDs no line covers and for extended IDs. Without a config file every frame is
+logged.
+
+The decision and the counters are separate: logfilter_keep only looks, and
+logfilter_commit moves the counters on once the frame has been written or
+dropped. A frame whose write failed is kept again when it is retried.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "logfilter.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    boolean bInclude;
+    word wNEvery;           // keep one frame in this many, 1 keeps all
+    word wtIntervalms;      // minimum time between kept frames, 0 for none
+} stLogFilterRule_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define LOGFILTER_N_IDS 2048        // all 11 bit IDs, looked up directly
+#define LOGFILTER_EXTENDED_BITS 6   // log2 of the extended IDs with their own counters
+#define LOGFILTER_N_EXTENDED (1 << LOGFILTER_EXTENDED_BITS)
+#define LOGFILTER_EXTENDED_SHARED (LOGFILTER_N_IDS + LOGFILTER_N_EXTENDED) // counters for extended IDs past those
+#define LOGFILTER_N_SLOTS (LOGFILTER_EXTENDED_SHARED + 1)
+#define LOGFILTER_HASH_MULTIPLIER 2654435761u // Knuth multiplicative hash
+#define LOGFILTER_MAX_RULES 32      // rule 0 is the default
+#define LOGFILTER_LINE_LENGTH 128
+#define LOGFILTER_NAME_LENGTH 32
+#define LOGFILTER_DELIMITERS " \t\r\n"
+
+/* --------------------------- Local Variables ------------------------------ */
+static boolean bLogFilterActive = FALSE;
+static stLogFilterRule_t astLogFilterRules[LOGFILTER_MAX_RULES];
+static byte byNLogFilterRules = 0;
+static byte *abyIDRule = NULL;          // rule index for every 11 bit ID
+static word *awNIDSeen = NULL;          // frames seen per counter slot, for every N
+static dword *adwtIDLastLoggedms = NULL; // time of the last kept frame per slot, for interval
+static dword adwExtendedIDs[LOGFILTER_N_EXTENDED]; // extended ID of each slot after the 11 bit ones, 0 = free
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t logfilter_load(const char *abyPath);
+boolean logfilter_keep(const CAN_frame_t *stFrame);
+void logfilter_commit(const CAN_frame_t *stFrame, boolean bKept);
+static boolean logfilter_parse_rule(char *abyRuleText, stLogFilterRule_t *stRule);
+static dword logfilter_slot(dword dwID, boolean bClaim);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t logfilter_load(const char *abyPath)
+{
+    /*
+    *===========================================================================
+    *   logfilter_load
+    *   Takes:   abyPath - config file on the SD card
+    *
+    *   Returns: ESP_OK if a profile was loaded, ESP_ERR_NOT_FOUND if there is
+    *            no config or no profile selected (everything is logged),
+    *            error code otherwise.
+    *
+    *   Reads the profile named by the "select" line into the lookup tables.
+    *   The file is read twice, once for the select line and once for the
+    *   profile, so select can be anywhere in the file.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Counter slots for extended IDs
+    *
+    *===========================================================================
+    */
+    char abyLine[LOGFILTER_LINE_LENGTH];
+    char abySelected[LOGFILTER_NAME_LENGTH] = "";
+    boolean bInProfile = FALSE;
+    dword dwNLine = 0;
+
+    bLogFilterActive = FALSE;
+    FILE *stFile = fopen(abyPath, "r");
+    if (stFile == NULL)
+    {
+        ESP_LOGI("LOGFILTER", "No %s, logging every frame", abyPath);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /* Pass 1: which profile */
+    while (fgets(abyLine, sizeof(abyLine), stFile) != NULL)
+    {
+        char *pbyComment = strchr(abyLine, '#');
+        if (pbyComment != NULL)
+        {
+            *pbyComment = '\0';
+        }
+        char *pbyKeyword = strtok(abyLine, LOGFILTER_DELIMITERS);
+        char *pbyName = strtok(NULL, LOGFILTER_DELIMITERS);
+        if (pbyKeyword != NULL && pbyName != NULL && strcmp(pbyKeyword, "select") == 0)
+        {
+            strncpy(abySelected, pbyName, sizeof(abySelected) - 1);
+        }
+    }
+    if (abySelected[0] == '\0')
+    {
+        fclose(stFile);
+        ESP_LOGW("LOGFILTER", "%s selects no profile, logging every frame", abyPath);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (abyIDRule == NULL)
+    {
+        abyIDRule = calloc(LOGFILTER_N_IDS, sizeof(byte));
+        awNIDSeen = calloc(LOGFILTER_N_SLOTS, sizeof(word));
+        adwtIDLastLoggedms = calloc(LOGFILTER_N_SLOTS, sizeof(dword));
+        if (abyIDRule == NULL || awNIDSeen == NULL || adwtIDLastLoggedms == NULL)
+        {
+            fclose(stFile);
+            ESP_LOGE("LOGFILTER", "Failed to allocate ID tables");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    memset(abyIDRule, 0, LOGFILTER_N_IDS * sizeof(byte));
+    astLogFilterRules[0] = (stLogFilterRule_t){ .bInclude = TRUE, .wNEvery = 1, .wtIntervalms = 0 };
+    byNLogFilterRules = 1;
+
+    /* Pass 2: load the selected profile */
+    rewind(stFile);
+    while (fgets(abyLine, sizeof(abyLine), stFile) != NULL)
+    {
+        dwNLine++;
+        char *pbyComment = strchr(abyLine, '#');
+        if (pbyComment != NULL)
+        {
+            *pbyComment = '\0';
+        }
+        char *pbyKeyword = strtok(abyLine, LOGFILTER_DELIMITERS);
+        if (pbyKeyword == NULL || strcmp(pbyKeyword, "select") == 0)
+        {
+            continue;
+        }
+        if (strcmp(pbyKeyword, "profile") == 0)
+        {
+            char *pbyName = strtok(NULL, LOGFILTER_DELIMITERS);
+            bInProfile = (pbyName != NULL && strcmp(pbyName, abySelected) == 0);
+            continue;
+        }
+        if (!bInProfile)
+        {
+            continue;
+        }
+
+        stLogFilterRule_t stRule;
+        if (!logfilter_parse_rule(strtok(NULL, ""), &stRule))
+        {
+            ESP_LOGW("LOGFILTER", "%s line %lu not understood, ignored", abyPath, (unsigned long)dwNLine);
+            continue;
+        }
+        if (strcmp(pbyKeyword, "default") == 0)
+        {
+            astLogFilterRules[0] = stRule;
+            continue;
+        }
+
+        /* ID or ID range */
+        char *pbyEnd;
+        dword dwFirstID = strtoul(pbyKeyword, &pbyEnd, 0);
+        dword dwLastID = (*pbyEnd == '-') ? strtoul(pbyEnd + 1, &pbyEnd, 0) : dwFirstID;
+        if (*pbyEnd != '\0' || dwLastID < dwFirstID || dwLastID >= LOGFILTER_N_IDS)
+        {
+            ESP_LOGW("LOGFILTER", "%s line %lu has a bad ID, ignored", abyPath, (unsigned long)dwNLine);
+            continue;
+        }
+        if (byNLogFilterRules >= LOGFILTER_MAX_RULES)
+        {
+            ESP_LOGW("LOGFILTER", "More than %d rules, line %lu ignored", LOGFILTER_MAX_RULES, (unsigned long)dwNLine);
+            continue;
+        }
+        astLogFilterRules[byNLogFilterRules] = stRule;
+        memset(&abyIDRule[dwFirstID], byNLogFilterRules, dwLastID - dwFirstID + 1);
+        byNLogFilterRules++;
+    }
+    fclose(stFile);
+
+    memset(awNIDSeen, 0, LOGFILTER_N_SLOTS * sizeof(word));
+    memset(adwtIDLastLoggedms, 0, LOGFILTER_N_SLOTS * sizeof(dword));
+    memset(adwExtendedIDs, 0, sizeof(adwExtendedIDs));
+    bLogFilterActive = TRUE;
+    ESP_LOGI("LOGFILTER", "Profile %s loaded, %d rules", abySelected, (int)byNLogFilterRules);
+    return ESP_OK;
+}
+
+static boolean logfilter_parse_rule(char *abyRuleText, stLogFilterRule_t *stRule)
+{
+    /*
+    *===========================================================================
+    *   logfilter_parse_rule
+    *   Takes:   abyRuleText - rest of the line after the ID
+    *            stRule - rule to fill in
+    *
+    *   Returns: TRUE if the text was understood.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    *stRule = (stLogFilterRule_t){ .bInclude = TRUE, .wNEvery = 1, .wtIntervalms = 0 };
+    if (abyRuleText == NULL)
+    {
+        return FALSE;
+    }
+
+    boolean bAnyAction = FALSE;
+    char *pbyToken = strtok(abyRuleText, LOGFILTER_DELIMITERS);
+    while (pbyToken != NULL)
+    {
+        if (strcmp(pbyToken, "include") == 0)
+        {
+            stRule->bInclude = TRUE;
+        }
+        else if (strcmp(pbyToken, "exclude") == 0)
+        {
+            stRule->bInclude = FALSE;
+        }
+        else if (strcmp(pbyToken, "every") == 0 || strcmp(pbyToken, "interval") == 0)
+        {
+            char *pbyValue = strtok(NULL, LOGFILTER_DELIMITERS);
+            if (pbyValue == NULL)
+            {
+                return FALSE;
+            }
+            dword dwValue = strtoul(pbyValue, NULL, 0);
+            if (dwValue > 0xFFFF)
+            {
+                return FALSE;
+            }
+            if (pbyToken[0] == 'e')
+            {
+                stRule->wNEvery = (dwValue > 0) ? (word)dwValue : 1;
+            }
+            else
+            {
+                stRule->wtIntervalms = (word)dwValue;
+            }
+        }
+        else
+        {
+            return FALSE;
+        }
+        bAnyAction = TRUE;
+        pbyToken = strtok(NULL, LOGFILTER_DELIMITERS);
+    }
+    return bAnyAction;
+}
+
+boolean logfilter_keep(const CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   logfilter_keep
+    *   Takes:   stFrame - frame about to be logged
+    *
+    *   Returns: TRUE if the frame should be written.
+    *
+    *   One table lookup per frame, extended IDs use the default rule. Changes
+    *   nothing, call logfilter_commit once the frame is dealt with.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Decision only, counters moved to logfilter_commit
+    *
+    *===========================================================================
+    */
+    if (!bLogFilterActive)
+    {
+        return TRUE;
+    }
+
+    const stLogFilterRule_t *stRule = &astLogFilterRules[(stFrame->dwID < LOGFILTER_N_IDS) ? abyIDRule[stFrame->dwID] : 0];
+    if (!stRule->bInclude)
+    {
+        return FALSE;
+    }
+
+    /* Keep the first of every N, an extended ID not seen yet is at its first */
+    dword dwSlot = logfilter_slot(stFrame->dwID, FALSE);
+    if (dwSlot != LOGFILTER_N_SLOTS && awNIDSeen[dwSlot] != 0)
+    {
+        return FALSE;
+    }
+
+    if (stRule->wtIntervalms > 0 && dwSlot != LOGFILTER_N_SLOTS)
+    {
+        dword dwtNowms = (dword)(stFrame->qwtTimestampus / 1000);
+        if (dwtNowms - adwtIDLastLoggedms[dwSlot] < stRule->wtIntervalms)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void logfilter_commit(const CAN_frame_t *stFrame, boolean bKept)
+{
+    /*
+    *===========================================================================
+    *   logfilter_commit
+    *   Takes:   stFrame - frame logfilter_keep was asked about
+    *            bKept - TRUE if it was written, FALSE if it was dropped
+    *
+    *   Returns: Nothing.
+    *
+    *   Counts the frame towards its every N and, if it was written, starts
+    *   its interval. Not called for a frame whose write failed, so the retry
+    *   gets the same answer.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (!bLogFilterActive)
+    {
+        return;
+    }
+
+    const stLogFilterRule_t *stRule = &astLogFilterRules[(stFrame->dwID < LOGFILTER_N_IDS) ? abyIDRule[stFrame->dwID] : 0];
+    if (!stRule->bInclude)
+    {
+        return;
+    }
+    dword dwSlot = logfilter_slot(stFrame->dwID, TRUE);
+    word wNSeen = awNIDSeen[dwSlot];
+    awNIDSeen[dwSlot] = (wNSeen + 1 >= stRule->wNEvery) ? 0 : wNSeen + 1;
+    if (bKept)
+    {
+        adwtIDLastLoggedms[dwSlot] = (dword)(stFrame->qwtTimestampus / 1000);
+    }
+}
+
+static dword logfilter_slot(dword dwID, boolean bClaim)
+{
+    /*
+    *===========================================================================
+    *   logfilter_slot
+    *   Takes:   dwID - frame ID
+    *            bClaim - TRUE to give a new extended ID a slot
+    *
+    *   Returns: Counter slot of the ID. LOGFILTER_N_SLOTS for an extended ID
+    *            without one when bClaim is FALSE.
+    *
+    *   11 bit IDs are their own slot. Extended IDs are hashed into
+    *   LOGFILTER_N_EXTENDED slots, once those are taken the rest share
+    *   LOGFILTER_EXTENDED_SHARED.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Slot from the top bits of the hash
+    *
+    *===========================================================================
+    */
+    if (dwID < LOGFILTER_N_IDS)
+    {
+        return dwID;
+    }
+    /* The top bits of a multiplicative hash are the well mixed ones */
+    dword dwHash = (dword)(dwID * LOGFILTER_HASH_MULTIPLIER) >> (32 - LOGFILTER_EXTENDED_BITS);
+    for (dword i = 0; i < LOGFILTER_N_EXTENDED; i++)
+    {
+        dword dwEntry = (dwHash + i) & (LOGFILTER_N_EXTENDED - 1);
+        if (adwExtendedIDs[dwEntry] == dwID)
+        {
+            return LOGFILTER_N_IDS + dwEntry;
+        }
+        if (adwExtendedIDs[dwEntry] == 0)
+        {
+            if (!bClaim)
+            {
+                return LOGFILTER_N_SLOTS;
+            }
+            adwExtendedIDs[dwEntry] = dwID;
+            return LOGFILTER_N_IDS + dwEntry;
+        }
+    }
+    return LOGFILTER_EXTENDED_SHARED;
+}
@@ -0,0 +1,15 @@
+#ifndef SFR_LOGFILTER
+#define SFR_LOGFILTER
+
+#include <stdio.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "sfrtypes.h"
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t logfilter_load(const char *abyPath);
+boolean logfilter_keep(const CAN_frame_t *stFrame);
+void logfilter_commit(const CAN_frame_t *stFrame, boolean bKept);
+
+#endif // SFR_LOGFILTER
@@ -22,28 +22,27 @@ Written by Cole Perera for Sheffield Formula Racing 2025
 #include "pin.h"
 #include "espnow.h"
 #include "sdcard.h"
+#include "trigger.h"
+#include "replay.h"
+#include "blaster.h"
+#include "gateway.h"
+#include "scheduler.h"
+#include "signals.h"
+#include "trace.h"
+#include "supervisor.h"
 #include "adc.h"
+#include "adcscan.h"
+#include "apps.h"
 #include "I2C.h"
 
 /* --------------------------- Definitions ----------------------------- */
-#define TIMER_INTERVAL_WD       100     // in microseconds
-#define TIMER_INTERVAL_GP       100
-#define INTERRUPT_INTERVAL_1MS   1000    // in microseconds
-#define INTERRUPT_INTERVAL_100MS 100000 
-#define TIMER_INTERVAL_1MS      pdMS_TO_TICKS(1)       // in milliseconds
-#define TIMER_INTERVAL_100MS    pdMS_TO_TICKS(100)
 
 /* --------------------------- Global Variables ----------------------------- */
-esp_timer_handle_t stTaskInterrupt1ms;
-esp_timer_handle_t stTaskInterrupt100ms;
 esp_reset_reason_t eResetReason;
 
 /* --------------------------- Function prototypes ----------------------------- */
-static void timers_init(void);
 static void main_init(void);
 static void GPIO_init(void);
-void IRAM_ATTR call_back_1ms(void *arg);
-void IRAM_ATTR call_back_100ms(void *arg);
 
 /* --------------------------- Functions ----------------------------- */
 
@@ -52,7 +51,7 @@ void app_main(void)
     /* Get last reset reason */
     eResetReason = esp_reset_reason();
     
-    /* Register app_main task with the WDT */ 
+    /* Set up the WDT, task_BG registers itself with it and the supervisor feeds it */ 
     (void)esp_task_wdt_deinit(); 
     esp_task_wdt_config_t stWDTConfig = {
         .timeout_ms = 2000, 
@@ -60,27 +59,9 @@ void app_main(void)
         .trigger_panic = true,
     };
     esp_task_wdt_init(&stWDTConfig);
-    ESP_ERROR_CHECK(esp_task_wdt_add(NULL)); 
 
-    /* Initialise device */
+    /* Initialise device, the scheduler's tasks run everything from here */
     main_init();
-
-    /* Run background task all other tasks are called by interrupts */
-    while(1)
-    {
-        task_BG();
-    }
-
-}
-
-void IRAM_ATTR call_back_1ms(void *arg)
-{
-    task_1ms();
-}
-
-void IRAM_ATTR call_back_100ms(void *arg)
-{
-    task_100ms();
 }
 
 static void main_init(void)
@@ -93,6 +74,12 @@ static void main_init(void)
     // {
     //     ESP_LOGE(SFR_TAG, "Failed to initialise ESP-NOW: %s", esp_err_to_name(NStatus));
     // }
+    /* Signal store, before CAN so the RX ISR finds it ready */
+    NStatus = signals_init();
+    if (NStatus != ESP_OK)
+    {
+        ESP_LOGE(SFR_TAG, "Failed to initialise signal store: %s", esp_err_to_name(NStatus));
+    }
     /* CAN BUS */
     NStatus = CAN_init(TRUE);
     if (NStatus != ESP_OK)
@@ -105,6 +92,37 @@ static void main_init(void)
     // {
     //     ESP_LOGE(SFR_TAG, "Failed to initialise SD Card: %s", esp_err_to_name(NStatus));
     // }
+    /* SD Card event trigger, needs the SD card */
+    // NStatus = trigger_init();
+    // if (NStatus != ESP_OK)
+    // {
+    //     ESP_LOGE(SFR_TAG, "Failed to initialise event trigger: %s", esp_err_to_name(NStatus));
+    // }
+    /* Replay a log onto CAN0, needs CAN, the SD card and an MDF4 log (CONFIG_SFR_LOG_FORMAT_MDF4) */
+    // NStatus = replay_start("/sdcard/log000.mf4", eREPLAY_REAL_TIME, 100);
+    // if (NStatus != ESP_OK)
+    // {
+    //     ESP_LOGE(SFR_TAG, "Failed to start replay: %s", esp_err_to_name(NStatus));
+    // }
+    /* CAN0 <-> CAN1 gateway, needs CAN with RX. Takes the ring buffer, no SD logging or ESP-NOW */
+    // NStatus = gateway_init();
+    // if (NStatus != ESP_OK)
+    // {
+    //     ESP_LOGE(SFR_TAG, "Failed to start gateway: %s", esp_err_to_name(NStatus));
+    // }
+    /* CAN Blaster load generator on CAN0, needs CAN. Test benches only */
+    // NStatus = blaster_init(50);
+    // if (NStatus != ESP_OK)
+    // {
+    //     ESP_LOGE(SFR_TAG, "Failed to start CAN Blaster: %s", esp_err_to_name(NStatus));
+    // }
+
+    /* Execution trace, dumped to the SD card or serial at the first deadline miss */
+    // NStatus = trace_start(TRUE);
+    // if (NStatus != ESP_OK)
+    // {
+    //     ESP_LOGE(SFR_TAG, "Failed to start trace: %s", esp_err_to_name(NStatus));
+    // }
 
     /* External Clock */
     // NStatus = I2C_init();
@@ -113,33 +131,26 @@ static void main_init(void)
     //     ESP_LOGE(SFR_TAG, "Failed to initialise I2C: %s", esp_err_to_name(NStatus));
     // }
 
-    /* ADC */
-    
-    /* Timers and GPIO cause a hard fault on fail so no error warning */
+    /* ADC, IMD node only, the APPS node's scan is started by apps_init */
+    // NStatus = adcscan_init(&stADCScanIMD);
+    // if (NStatus != ESP_OK)
+    // {
+    //     ESP_LOGE(SFR_TAG, "Failed to start ADC scan: %s", esp_err_to_name(NStatus));
+    // }
+    /* APPS plausibility and pedal frame every 1 ms, APPS node only, needs CAN */
+    // NStatus = apps_init();
+    // if (NStatus != ESP_OK)
+    // {
+    //     ESP_LOGE(SFR_TAG, "Failed to start APPS: %s", esp_err_to_name(NStatus));
+    // }
+
+    /* GPIO, the supervisor and the scheduler cause a hard fault on fail so no error warning */
     GPIO_init();
-    timers_init();  
+    ESP_ERROR_CHECK(supervisor_init());
+    ESP_ERROR_CHECK(scheduler_init());
     
 }
 
-static void timers_init(void)
-{
-    const esp_timer_create_args_t stTaskInterrupt1msArgs = {
-        .callback = &call_back_1ms,
-        .arg = NULL,
-        .name = "1ms"
-    };
-    const esp_timer_create_args_t stTaskInterrupt100msArgs = {
-        .callback = &call_back_100ms,
-        .arg = NULL,
-        .name = "100ms"
-    };
-
-    ESP_ERROR_CHECK(esp_timer_create(&stTaskInterrupt1msArgs, &stTaskInterrupt1ms));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(stTaskInterrupt1ms, INTERRUPT_INTERVAL_1MS)); // 1ms
-    ESP_ERROR_CHECK(esp_timer_create(&stTaskInterrupt100msArgs, &stTaskInterrupt100ms));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(stTaskInterrupt100ms, INTERRUPT_INTERVAL_100MS)); // 100ms
-}
-
 static void GPIO_init(void)
 {
     gpio_config_t onboardLEDConfig = {
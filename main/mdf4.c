@@ -0,0 +1,466 @@
+/*
+mdf4.c
+File contains the ASAM MDF 4.1 layout for the SD card logger. The log is
+written as one data group holding a CAN_DataFrame channel group laid out as
+in the ASAM MDF bus logging standard, so analysis tools show it as a CAN
+trace and can decode it against a DBC without any conversion.
+
+The file is a finalized MDF4 file from the moment it is created. Records are
+streamed into the one DT block, which is preallocated on the card, and the
+DT length and record count are rewritten once the records are synced, so a
+file cut off by a power loss still opens, ending at the last update.
+mdf4_recover trims the unused preallocated tail at the next boot.
+
+All values in MDF4 are little endian, as is the ESP32, so fields are copied
+straight in.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "mdf4.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    byte *abyBuffer;
+    dword dwLength;         // bytes of abyBuffer used, next block goes here
+} stMDF4Builder_t;
+
+typedef struct {
+    const char *abyName;
+    byte byDataType;
+    word wByteOffset;       // from the start of the record
+    byte byBitOffset;
+    byte byBitCount;
+} stMDF4Member_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define MDF4_ID_SIZE 64             // identification block at the start of the file
+#define MDF4_BLOCK_HEADER_SIZE 24   // id, reserved, length, link count
+#define MDF4_DT_OFFSET (MDF4_HEADER_SIZE - MDF4_BLOCK_HEADER_SIZE)
+#define MDF4_VERSION 410
+
+#define MDF4_CN_LINKS 8
+#define MDF4_CN_DATA_SIZE 72
+#define MDF4_CN_TYPE_FIXED 0
+#define MDF4_CN_TYPE_MASTER 2
+#define MDF4_CN_SYNC_NONE 0
+#define MDF4_CN_SYNC_TIME 1
+#define MDF4_CN_FLAG_BUS_EVENT 0x0400
+#define MDF4_DATA_UINT_LE 0
+#define MDF4_DATA_BYTE_ARRAY 10
+
+#define MDF4_CG_LINKS 6
+#define MDF4_CG_FLAG_BUS_EVENT 0x0002
+#define MDF4_CG_FLAG_PLAIN_BUS_EVENT 0x0004
+#define MDF4_PATH_SEPARATOR '.'
+
+#define MDF4_SI_TYPE_BUS 2
+#define MDF4_SI_BUS_CAN 2
+#define MDF4_CC_TYPE_LINEAR 1
+
+/* Record layout, MDF4_RECORD_SIZE bytes */
+#define MDF4_REC_TIMESTAMP 0        // us since boot, 8 bytes
+#define MDF4_REC_FRAME 8            // start of the CAN_DataFrame structure
+#define MDF4_REC_BUS 8              // bus channel, 1 based
+#define MDF4_REC_ID 9               // 29 bit ID, bit 31 is IDE
+#define MDF4_REC_DLC 13
+#define MDF4_REC_DATA_LENGTH 14
+#define MDF4_REC_DATA 15            // 8 bytes, 1 byte pad after
+#define MDF4_REC_IDE_FLAG 0x80000000
+#define MDF4_STANDARD_ID_MAX 0x7FF
+
+static const char MDF4_FH_COMMENT[] =
+    "<FHcomment xmlns='http://www.asam.net/mdf/v4'><TX>Logged on the car</TX>"
+    "<tool_id>SFR logger</tool_id><tool_vendor>Sheffield Formula Racing</tool_vendor>"
+    "<tool_version>1.0</tool_version></FHcomment>";
+
+/* Members of the CAN_DataFrame structure, names as the bus logging standard */
+static const stMDF4Member_t astMDF4FrameMembers[] =
+{
+    { "CAN_DataFrame.BusChannel", MDF4_DATA_UINT_LE,    MDF4_REC_BUS,         0, 8 },
+    { "CAN_DataFrame.ID",         MDF4_DATA_UINT_LE,    MDF4_REC_ID,          0, 29 },
+    { "CAN_DataFrame.IDE",        MDF4_DATA_UINT_LE,    MDF4_REC_ID + 3,      7, 1 },
+    { "CAN_DataFrame.DLC",        MDF4_DATA_UINT_LE,    MDF4_REC_DLC,         0, 4 },
+    { "CAN_DataFrame.DataLength", MDF4_DATA_UINT_LE,    MDF4_REC_DATA_LENGTH, 0, 8 },
+    { "CAN_DataFrame.DataBytes",  MDF4_DATA_BYTE_ARRAY, MDF4_REC_DATA,        0, 64 },
+};
+#define MDF4_N_FRAME_MEMBERS (sizeof(astMDF4FrameMembers) / sizeof(astMDF4FrameMembers[0]))
+
+/* --------------------------- Function prototypes -------------------------- */
+void mdf4_build_header(byte *abyHeader, stMDF4Layout_t *stLayout);
+void mdf4_pack_record(byte *abyRecord, const CAN_frame_t *stFrame, byte byBusChannel);
+boolean mdf4_unpack_record(const byte *abyRecord, CAN_frame_t *stFrame, byte *pbyBusChannel);
+esp_err_t mdf4_update_length(FILE *stFile, const stMDF4Layout_t *stLayout, qword qwNRecords);
+esp_err_t mdf4_recover(const char *abyPath);
+static dword mdf4_add_block(stMDF4Builder_t *stBuilder, const char *abyID, word wNLinks, dword dwDataSize);
+static dword mdf4_add_text(stMDF4Builder_t *stBuilder, const char *abyID, const char *abyText);
+static dword mdf4_add_channel(stMDF4Builder_t *stBuilder, const char *abyName, byte byType, byte bySyncType,
+                              byte byDataType, word wByteOffset, byte byBitOffset, dword dwBitCount);
+static void mdf4_set_link(stMDF4Builder_t *stBuilder, dword dwBlock, word wNLink, dword dwTarget);
+static byte *mdf4_block_data(stMDF4Builder_t *stBuilder, dword dwBlock, word wNLinks);
+static void mdf4_put(byte *abyField, qword qwValue, byte byNBytes);
+
+/* --------------------------- Functions ------------------------------------ */
+
+void mdf4_build_header(byte *abyHeader, stMDF4Layout_t *stLayout)
+{
+    /*
+    *===========================================================================
+    *   mdf4_build_header
+    *   Takes:   abyHeader - MDF4_HEADER_SIZE byte buffer for the start of the file
+    *            stLayout - filled with the offsets mdf4_update_length writes
+    *
+    *   Returns: Nothing.
+    *
+    *   Builds every block the log needs ahead of the records: ID, HD, FH with
+    *   its MD comment, one DG holding one CG of CAN_DataFrame records, the SI
+    *   naming the bus, a time master channel in us with a linear conversion to
+    *   seconds, the CAN_DataFrame structure and its members. The DT block
+    *   header goes last so the records start on a sector boundary.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stMDF4Builder_t stBuilder = { .abyBuffer = abyHeader, .dwLength = MDF4_ID_SIZE };
+    memset(abyHeader, 0, MDF4_HEADER_SIZE);
+
+    /* ID block */
+    memcpy(&abyHeader[0], "MDF     ", 8);
+    memcpy(&abyHeader[8], "4.10    ", 8);
+    memcpy(&abyHeader[16], "SFR     ", 8);
+    mdf4_put(&abyHeader[28], MDF4_VERSION, 2);
+
+    /* HD: no real time clock, start time is left at 0 and timestamps are since boot */
+    dword dwHD = mdf4_add_block(&stBuilder, "##HD", 6, 32);
+    dword dwFH = mdf4_add_block(&stBuilder, "##FH", 2, 16);
+    mdf4_set_link(&stBuilder, dwHD, 1, dwFH);
+    mdf4_set_link(&stBuilder, dwFH, 1, mdf4_add_text(&stBuilder, "##MD", MDF4_FH_COMMENT));
+
+    /* DG and CG */
+    dword dwDG = mdf4_add_block(&stBuilder, "##DG", 4, 8);
+    mdf4_set_link(&stBuilder, dwHD, 0, dwDG);
+    dword dwCG = mdf4_add_block(&stBuilder, "##CG", MDF4_CG_LINKS, 32);
+    mdf4_set_link(&stBuilder, dwDG, 1, dwCG);
+    mdf4_set_link(&stBuilder, dwDG, 2, MDF4_DT_OFFSET);
+    mdf4_set_link(&stBuilder, dwCG, 2, mdf4_add_text(&stBuilder, "##TX", "CAN"));
+    byte *abyCGData = mdf4_block_data(&stBuilder, dwCG, MDF4_CG_LINKS);
+    mdf4_put(&abyCGData[16], MDF4_CG_FLAG_BUS_EVENT | MDF4_CG_FLAG_PLAIN_BUS_EVENT, 2);
+    mdf4_put(&abyCGData[18], MDF4_PATH_SEPARATOR, 2);
+    mdf4_put(&abyCGData[24], MDF4_RECORD_SIZE, 4);
+    stLayout->dwCycleCountOffset = dwCG + MDF4_BLOCK_HEADER_SIZE + MDF4_CG_LINKS * 8 + 8;
+
+    dword dwSI = mdf4_add_block(&stBuilder, "##SI", 3, 8);
+    mdf4_set_link(&stBuilder, dwCG, 3, dwSI);
+    mdf4_set_link(&stBuilder, dwSI, 0, mdf4_add_text(&stBuilder, "##TX", "CAN"));
+    byte *abySIData = mdf4_block_data(&stBuilder, dwSI, 3);
+    abySIData[0] = MDF4_SI_TYPE_BUS;
+    abySIData[1] = MDF4_SI_BUS_CAN;
+
+    /* Time master, raw us scaled to s */
+    dword dwTime = mdf4_add_channel(&stBuilder, "Timestamp", MDF4_CN_TYPE_MASTER, MDF4_CN_SYNC_TIME,
+                                    MDF4_DATA_UINT_LE, MDF4_REC_TIMESTAMP, 0, 64);
+    mdf4_set_link(&stBuilder, dwCG, 1, dwTime);
+    dword dwCC = mdf4_add_block(&stBuilder, "##CC", 4, 40);
+    mdf4_set_link(&stBuilder, dwTime, 4, dwCC);
+    mdf4_set_link(&stBuilder, dwTime, 6, mdf4_add_text(&stBuilder, "##TX", "s"));
+    byte *abyCCData = mdf4_block_data(&stBuilder, dwCC, 4);
+    abyCCData[0] = MDF4_CC_TYPE_LINEAR;
+    mdf4_put(&abyCCData[6], 2, 2);     // two parameters, offset then factor
+    double fOffset = 0.0;
+    double fFactor = 1e-6;
+    memcpy(&abyCCData[24], &fOffset, sizeof(fOffset));
+    memcpy(&abyCCData[32], &fFactor, sizeof(fFactor));
+
+    /* CAN_DataFrame structure, members chained through their next links */
+    dword dwFrame = mdf4_add_channel(&stBuilder, "CAN_DataFrame", MDF4_CN_TYPE_FIXED, MDF4_CN_SYNC_NONE,
+                                     MDF4_DATA_BYTE_ARRAY, MDF4_REC_FRAME, 0, (MDF4_RECORD_SIZE - MDF4_REC_FRAME) * 8);
+    mdf4_set_link(&stBuilder, dwTime, 0, dwFrame);
+    dword dwPrevious = dwFrame;
+    for (word wNMember = 0; wNMember < MDF4_N_FRAME_MEMBERS; wNMember++)
+    {
+        const stMDF4Member_t *stMember = &astMDF4FrameMembers[wNMember];
+        dword dwMember = mdf4_add_channel(&stBuilder, stMember->abyName, MDF4_CN_TYPE_FIXED, MDF4_CN_SYNC_NONE,
+                                          stMember->byDataType, stMember->wByteOffset, stMember->byBitOffset,
+                                          stMember->byBitCount);
+        mdf4_set_link(&stBuilder, dwPrevious, (dwPrevious == dwFrame) ? 1 : 0, dwMember);
+        dwPrevious = dwMember;
+    }
+
+    /* DT header, the records follow it */
+    memcpy(&abyHeader[MDF4_DT_OFFSET], "##DT", 4);
+    mdf4_put(&abyHeader[MDF4_DT_OFFSET + 8], MDF4_BLOCK_HEADER_SIZE, 8);
+    stLayout->dwDataLengthOffset = MDF4_DT_OFFSET + 8;
+
+    #ifdef DEBUG
+    if (stBuilder.dwLength > MDF4_DT_OFFSET)
+    {
+        ESP_LOGE("MDF4", "Header blocks overrun the DT block (%lu bytes)", (unsigned long)stBuilder.dwLength);
+    }
+    #endif
+}
+
+static dword mdf4_add_block(stMDF4Builder_t *stBuilder, const char *abyID, word wNLinks, dword dwDataSize)
+{
+    /*
+    *===========================================================================
+    *   mdf4_add_block
+    *   Takes:   stBuilder - header being built
+    *            abyID - four character block id, eg "##CG"
+    *            wNLinks - number of links
+    *            dwDataSize - bytes of data after the links
+    *
+    *   Returns: File offset of the new block, its links and data are zero.
+    *
+    *   Blocks are padded to the 8 byte alignment MDF4 requires.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    dword dwBlock = stBuilder->dwLength;
+    dword dwBlockLength = (MDF4_BLOCK_HEADER_SIZE + wNLinks * 8 + dwDataSize + 7) & ~7UL;
+    if (dwBlock + dwBlockLength > MDF4_DT_OFFSET)
+    {
+        /* Never happens with the fixed layout, keeps a bad edit from writing past the buffer */
+        stBuilder->dwLength = dwBlock + dwBlockLength;
+        return 0;
+    }
+    memcpy(&stBuilder->abyBuffer[dwBlock], abyID, 4);
+    mdf4_put(&stBuilder->abyBuffer[dwBlock + 8], dwBlockLength, 8);
+    mdf4_put(&stBuilder->abyBuffer[dwBlock + 16], wNLinks, 8);
+    stBuilder->dwLength = dwBlock + dwBlockLength;
+    return dwBlock;
+}
+
+static dword mdf4_add_text(stMDF4Builder_t *stBuilder, const char *abyID, const char *abyText)
+{
+    /*
+    *===========================================================================
+    *   mdf4_add_text
+    *   Takes:   stBuilder - header being built
+    *            abyID - "##TX" for plain text, "##MD" for XML
+    *            abyText - null terminated UTF-8
+    *
+    *   Returns: File offset of the new block.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    dword dwTextSize = strlen(abyText) + 1;
+    dword dwBlock = mdf4_add_block(stBuilder, abyID, 0, dwTextSize);
+    if (dwBlock != 0)
+    {
+        memcpy(mdf4_block_data(stBuilder, dwBlock, 0), abyText, dwTextSize);
+    }
+    return dwBlock;
+}
+
+static dword mdf4_add_channel(stMDF4Builder_t *stBuilder, const char *abyName, byte byType, byte bySyncType,
+                              byte byDataType, word wByteOffset, byte byBitOffset, dword dwBitCount)
+{
+    /*
+    *===========================================================================
+    *   mdf4_add_channel
+    *   Takes:   stBuilder - header being built
+    *            abyName - channel name
+    *            byType, bySyncType, byDataType - cn_type, cn_sync_type, cn_data_type
+    *            wByteOffset, byBitOffset, dwBitCount - position in the record
+    *
+    *   Returns: File offset of the new CN block.
+    *
+    *   Every channel in the group is part of the bus event so all carry the
+    *   bus event flag.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    dword dwBlock = mdf4_add_block(stBuilder, "##CN", MDF4_CN_LINKS, MDF4_CN_DATA_SIZE);
+    if (dwBlock == 0)
+    {
+        return 0;
+    }
+    mdf4_set_link(stBuilder, dwBlock, 2, mdf4_add_text(stBuilder, "##TX", abyName));
+    byte *abyData = mdf4_block_data(stBuilder, dwBlock, MDF4_CN_LINKS);
+    abyData[0] = byType;
+    abyData[1] = bySyncType;
+    abyData[2] = byDataType;
+    abyData[3] = byBitOffset;
+    mdf4_put(&abyData[4], wByteOffset, 4);
+    mdf4_put(&abyData[8], dwBitCount, 4);
+    mdf4_put(&abyData[12], MDF4_CN_FLAG_BUS_EVENT, 4);
+    return dwBlock;
+}
+
+static void mdf4_set_link(stMDF4Builder_t *stBuilder, dword dwBlock, word wNLink, dword dwTarget)
+{
+    if (dwBlock != 0)
+    {
+        mdf4_put(&stBuilder->abyBuffer[dwBlock + MDF4_BLOCK_HEADER_SIZE + wNLink * 8], dwTarget, 8);
+    }
+}
+
+static byte *mdf4_block_data(stMDF4Builder_t *stBuilder, dword dwBlock, word wNLinks)
+{
+    return &stBuilder->abyBuffer[dwBlock + MDF4_BLOCK_HEADER_SIZE + wNLinks * 8];
+}
+
+static void mdf4_put(byte *abyField, qword qwValue, byte byNBytes)
+{
+    /* Little endian on both ends, copy the low bytes */
+    memcpy(abyField, &qwValue, byNBytes);
+}
+
+void mdf4_pack_record(byte *abyRecord, const CAN_frame_t *stFrame, byte byBusChannel)
+{
+    /*
+    *===========================================================================
+    *   mdf4_pack_record
+    *   Takes:   abyRecord - MDF4_RECORD_SIZE bytes for the record
+    *            stFrame - frame to log
+    *            byBusChannel - bus the frame was seen on, 1 based
+    *
+    *   Returns: Nothing.
+    *
+    *   Lays a frame out as one CAN_DataFrame record. IDs above 11 bits are
+    *   marked as extended.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    uint32_t dwRecordID = (uint32_t)stFrame->dwID;
+    byte byLength = (stFrame->byDLC > 8) ? 8 : stFrame->byDLC;
+
+    if (stFrame->dwID > MDF4_STANDARD_ID_MAX)
+    {
+        dwRecordID |= MDF4_REC_IDE_FLAG;
+    }
+    memcpy(&abyRecord[MDF4_REC_TIMESTAMP], &stFrame->qwtTimestampus, 8);
+    abyRecord[MDF4_REC_BUS] = byBusChannel;
+    memcpy(&abyRecord[MDF4_REC_ID], &dwRecordID, 4);
+    abyRecord[MDF4_REC_DLC] = stFrame->byDLC;
+    abyRecord[MDF4_REC_DATA_LENGTH] = byLength;
+    memset(&abyRecord[MDF4_REC_DATA], 0, MDF4_RECORD_SIZE - MDF4_REC_DATA);
+    memcpy(&abyRecord[MDF4_REC_DATA], stFrame->abData, byLength);
+}
+
+boolean mdf4_unpack_record(const byte *abyRecord, CAN_frame_t *stFrame, byte *pbyBusChannel)
+{
+    /*
+    *===========================================================================
+    *   mdf4_unpack_record
+    *   Takes:   abyRecord - one record from the DT block
+    *            stFrame - filled with the frame
+    *            pbyBusChannel - filled with the bus, may be NULL
+    *
+    *   Returns: TRUE if the record holds a sensible frame.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    uint32_t dwRecordID;
+
+    memcpy(&stFrame->qwtTimestampus, &abyRecord[MDF4_REC_TIMESTAMP], 8);
+    memcpy(&dwRecordID, &abyRecord[MDF4_REC_ID], 4);
+    stFrame->dwID = dwRecordID & ~MDF4_REC_IDE_FLAG;
+    stFrame->byDLC = abyRecord[MDF4_REC_DLC];
+    memcpy(stFrame->abData, &abyRecord[MDF4_REC_DATA], 8);
+    if (pbyBusChannel != NULL)
+    {
+        *pbyBusChannel = abyRecord[MDF4_REC_BUS];
+    }
+    return stFrame->byDLC <= 8 && abyRecord[MDF4_REC_DATA_LENGTH] <= 8;
+}
+
+esp_err_t mdf4_update_length(FILE *stFile, const stMDF4Layout_t *stLayout, qword qwNRecords)
+{
+    /*
+    *===========================================================================
+    *   mdf4_update_length
+    *   Takes:   stFile - open log, the records must already be on the card
+    *            stLayout - offsets from mdf4_build_header
+    *            qwNRecords - records in the DT block
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Writes the record count and DT length and syncs them. The counts only
+    *   ever cover records that were synced first, so after a power loss the
+    *   file is a complete log up to the last update.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    qword qwDataLength = MDF4_BLOCK_HEADER_SIZE + qwNRecords * MDF4_RECORD_SIZE;
+
+    if (fseek(stFile, (long)stLayout->dwCycleCountOffset, SEEK_SET) != 0 ||
+        fwrite(&qwNRecords, sizeof(qwNRecords), 1, stFile) != 1 ||
+        fseek(stFile, (long)stLayout->dwDataLengthOffset, SEEK_SET) != 0 ||
+        fwrite(&qwDataLength, sizeof(qwDataLength), 1, stFile) != 1 ||
+        fflush(stFile) != 0 || fsync(fileno(stFile)) != 0)
+    {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mdf4_recover(const char *abyPath)
+{
+    /*
+    *===========================================================================
+    *   mdf4_recover
+    *   Takes:   abyPath - log left by a previous session
+    *
+    *   Returns: ESP_OK if successful, ESP_ERR_NOT_FOUND if there is no such
+    *            file, error code otherwise.
+    *
+    *   Cuts the file back to the end of its DT block, dropping the unused
+    *   preallocated tail and anything written after the last length update.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    byte abyDTHeader[MDF4_BLOCK_HEADER_SIZE];
+    qword qwDataLength;
+
+    FILE *stFile = fopen(abyPath, "r+b");
+    if (stFile == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (fseek(stFile, MDF4_DT_OFFSET, SEEK_SET) != 0 ||
+        fread(abyDTHeader, 1, sizeof(abyDTHeader), stFile) != sizeof(abyDTHeader) ||
+        memcmp(abyDTHeader, "##DT", 4) != 0)
+    {
+        fclose(stFile);
+        ESP_LOGW("MDF4", "%s is not an SFR MDF4 log", abyPath);
+        return ESP_ERR_INVALID_STATE;
+    }
+    memcpy(&qwDataLength, &abyDTHeader[8], sizeof(qwDataLength));
+
+    esp_err_t NStatus = ESP_OK;
+    if (ftruncate(fileno(stFile), (off_t)(MDF4_DT_OFFSET + qwDataLength)) != 0)
+    {
+        NStatus = ESP_FAIL;
+    }
+    fclose(stFile);
+    ESP_LOGI("MDF4", "%s holds %llu frames", abyPath,
+             (unsigned long long)((qwDataLength - MDF4_BLOCK_HEADER_SIZE) / MDF4_RECORD_SIZE));
+    return NStatus;
+}
@@ -0,0 +1,34 @@
+#ifndef SFR_MDF4
+#define SFR_MDF4
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#include "sfrtypes.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+/*
+* Log layout: all metadata blocks fit in the first MDF4_HEADER_SIZE bytes and
+* the single DT block starts so its records begin at MDF4_HEADER_SIZE. Records
+* are then a plain stream of MDF4_RECORD_SIZE byte CAN_DataFrame records (ASAM
+* MDF bus logging), sector aligned and appended as they arrive.
+* See mdf4.c for how the file stays readable through a power loss.
+*/
+#define MDF4_HEADER_SIZE 4096 // bytes before the first record
+#define MDF4_RECORD_SIZE 24   // bytes per CAN frame record
+
+/* --------------------------- Types ---------------------------------------- */
+typedef struct {
+    dword dwCycleCountOffset;   // cg_cycle_count of the CAN_DataFrame group
+    dword dwDataLengthOffset;   // block length of the DT block
+} stMDF4Layout_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+void mdf4_build_header(byte *abyHeader, stMDF4Layout_t *stLayout);
+void mdf4_pack_record(byte *abyRecord, const CAN_frame_t *stFrame, byte byBusChannel);
+boolean mdf4_unpack_record(const byte *abyRecord, CAN_frame_t *stFrame, byte *pbyBusChannel);
+esp_err_t mdf4_update_length(FILE *stFile, const stMDF4Layout_t *stLayout, qword qwNRecords);
+esp_err_t mdf4_recover(const char *abyPath);
+
+#endif // SFR_MDF4
@@ -0,0 +1,513 @@
+/*
+replay.c
+File contains the replay engine, it plays an MDF4 log from the SD card back
+onto CAN0 with the original timing, scaled, or as fast as the bus takes it.
+The block journal (.sfr) is not replayed, its CAN lines only carry whole
+seconds, build with CONFIG_SFR_LOG_FORMAT_MDF4 to log for replay.
+
+The log is read ahead in large blocks by replay_service from the background
+task, the frames are sent from an esp_timer one shot that is re-armed for the
+next frame's time. The timer is woken a little early and spins to the exact
+microsecond, frames due within REPLAY_BATCH_WINDOW of each other go to the
+driver in one batch.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <string.h>
+#include "replay.h"
+#include "scheduler.h"
+#include "sdlog.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    byte *abyRecords;
+    word wNRecords;
+    _Atomic boolean bFull;          // set by replay_service, cleared by the timer once sent
+} stReplayBuffer_t;
+
+typedef enum {
+    eREPLAY_FETCH_OK = 0,
+    eREPLAY_FETCH_UNDERRUN,         // the read ahead is behind, try again shortly
+    eREPLAY_FETCH_END,              // every frame in the log has been fetched
+} eReplayFetch_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define REPLAY_N_BUFFERS 4
+#define REPLAY_BUFFER_RECORDS 512       // 12 KB reads, a whole number of sectors
+#define REPLAY_BATCH_MAX 8              // frames per call to CAN_transmit_batch
+#define REPLAY_BATCH_WINDOW 50          // frames due this close together are sent together (us)
+#define REPLAY_WAKE_EARLY 30            // timer is armed this far ahead of the frame (us)
+#define REPLAY_RETRY_PERIOD 100         // wait when the TX queue is full or the read ahead is behind (us)
+#define REPLAY_MIN_DELAY 10             // shortest one shot (us)
+#define REPLAY_START_DELAY 10000        // first frame goes out this long after replay_start (us)
+#define REPLAY_LATE_LIMIT 100           // a frame sent later than this counts as late (us)
+#define REPLAY_REAL_TIME_PERCENT 100
+
+/* --------------------------- Local Variables ------------------------------ */
+#ifdef GPIO_CAN0_TX
+extern twai_node_handle_t stCANBus0;
+#endif
+
+static FILE *stReplayFile = NULL;
+static esp_timer_handle_t stReplayTimer = NULL;
+static stReplayBuffer_t astReplayBuffers[REPLAY_N_BUFFERS];
+static qword qwNRecordsToRead = 0;      // records in the log not yet read into a buffer
+static word wFillBuffer = 0;            // next buffer replay_service fills
+static _Atomic boolean bReadEnded = FALSE;
+
+/* Timer side */
+static word wPlayBuffer = 0;
+static word wPlayRecord = 0;
+static CAN_frame_t astPending[REPLAY_BATCH_MAX];
+static qword aqwtPendingDueus[REPLAY_BATCH_MAX];
+static word wNPending = 0;
+static CAN_frame_t stLookahead;         // next frame, not yet due
+static qword qwtLookaheadDueus = 0;
+static boolean bLookaheadValid = FALSE;
+static _Atomic boolean bReplayFinished = FALSE;
+
+static eReplayMode_t eReplayMode = eREPLAY_REAL_TIME;
+static word wReplaySpeedPercent = REPLAY_REAL_TIME_PERCENT;
+static qword qwtReplayStartus = 0;      // when the first frame is due
+static qword qwtFirstFrameus = 0;       // log timestamp of the first frame
+static boolean bFirstFrame = TRUE;
+static stReplayStats_t stReplayStats;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t replay_start(const char *abyPath, eReplayMode_t eMode, word wSpeedPercent);
+void replay_stop(void);
+esp_err_t replay_service(void);
+boolean replay_running(void);
+void replay_get_stats(stReplayStats_t *stStats);
+static void replay_timer_callback(void *pvArg);
+static eReplayFetch_t replay_fetch(CAN_frame_t *stFrame);
+static qword replay_due_time(qword qwtFrameus);
+static void replay_runnable(void);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t replay_start(const char *abyPath, eReplayMode_t eMode, word wSpeedPercent)
+{
+    /*
+    *===========================================================================
+    *   replay_start
+    *   Takes:   abyPath - MDF4 log written by the SD card logger, built with
+    *                      CONFIG_SFR_LOG_FORMAT_MDF4
+    *            eMode - real time, accelerated or as fast as possible
+    *            wSpeedPercent - for eREPLAY_ACCELERATED, 200 plays at twice
+    *                            real time
+    *
+    *   Returns: ESP_OK if successful, ESP_ERR_NOT_SUPPORTED for a block
+    *            journal log, error code if not.
+    *
+    *   Opens the log, fills the read ahead and starts the timer. Needs CAN
+    *   and the SD card initialised. The first call registers replay_service
+    *   with the scheduler's background task.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Registers replay_service as a background runnable
+    *   18/10/26 CP Journal logs rejected by name
+    *
+    *===========================================================================
+    */
+    #ifndef GPIO_CAN0_TX
+    return ESP_ERR_NOT_SUPPORTED;
+    #else
+    byte abyDTHeader[24];
+    qword qwDataLength;
+    dword dwMagic;
+
+    if (stReplayFile != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (eMode == eREPLAY_ACCELERATED && wSpeedPercent == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stReplayFile = fopen(abyPath, "rb");
+    if (stReplayFile == NULL)
+    {
+        ESP_LOGE("REPLAY", "Failed to open %s", abyPath);
+        return ESP_ERR_NOT_FOUND;
+    }
+    /* Reads are whole buffers, stdio buffering only adds a copy */
+    setvbuf(stReplayFile, NULL, _IONBF, 0);
+    if (fread(&dwMagic, sizeof(dwMagic), 1, stReplayFile) == 1 && dwMagic == SDLOG_BLOCK_MAGIC)
+    {
+        ESP_LOGE("REPLAY", "%s is a block journal log, replay needs an MDF4 log (CONFIG_SFR_LOG_FORMAT_MDF4)", abyPath);
+        replay_stop();
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (fseek(stReplayFile, MDF4_HEADER_SIZE - sizeof(abyDTHeader), SEEK_SET) != 0 ||
+        fread(abyDTHeader, 1, sizeof(abyDTHeader), stReplayFile) != sizeof(abyDTHeader) ||
+        memcmp(abyDTHeader, "##DT", 4) != 0)
+    {
+        ESP_LOGE("REPLAY", "%s is not an MDF4 log from the logger", abyPath);
+        replay_stop();
+        return ESP_ERR_INVALID_STATE;
+    }
+    memcpy(&qwDataLength, &abyDTHeader[8], sizeof(qwDataLength));
+    qwNRecordsToRead = (qwDataLength - sizeof(abyDTHeader)) / MDF4_RECORD_SIZE;
+
+    for (word i = 0; i < REPLAY_N_BUFFERS; i++)
+    {
+        if (astReplayBuffers[i].abyRecords == NULL)
+        {
+            size_t NSize = REPLAY_BUFFER_RECORDS * MDF4_RECORD_SIZE;
+            astReplayBuffers[i].abyRecords = heap_caps_malloc(NSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (astReplayBuffers[i].abyRecords == NULL)
+            {
+                astReplayBuffers[i].abyRecords = heap_caps_malloc(NSize, MALLOC_CAP_8BIT);
+            }
+            if (astReplayBuffers[i].abyRecords == NULL)
+            {
+                ESP_LOGE("REPLAY", "Failed to allocate read ahead");
+                replay_stop();
+                return ESP_ERR_NO_MEM;
+            }
+        }
+        __atomic_store_n(&astReplayBuffers[i].bFull, FALSE, __ATOMIC_RELAXED);
+    }
+    if (stReplayTimer == NULL)
+    {
+        const esp_timer_create_args_t stTimerArgs =
+        {
+            .callback = &replay_timer_callback,
+            .arg = NULL,
+            .name = "replay"
+        };
+        esp_err_t NStatus = esp_timer_create(&stTimerArgs, &stReplayTimer);
+        if (NStatus != ESP_OK)
+        {
+            replay_stop();
+            return NStatus;
+        }
+    }
+
+    memset(&stReplayStats, 0, sizeof(stReplayStats));
+    eReplayMode = eMode;
+    wReplaySpeedPercent = (eMode == eREPLAY_ACCELERATED) ? wSpeedPercent : REPLAY_REAL_TIME_PERCENT;
+    wFillBuffer = 0;
+    wPlayBuffer = 0;
+    wPlayRecord = 0;
+    wNPending = 0;
+    bLookaheadValid = FALSE;
+    bFirstFrame = TRUE;
+    __atomic_store_n(&bReadEnded, FALSE, __ATOMIC_RELAXED);
+    __atomic_store_n(&bReplayFinished, FALSE, __ATOMIC_RELAXED);
+
+    static const stSchedRunnable_t astReplayRunnables[] =
+    {
+        { "replay", replay_runnable, 0, 0, 5000 },
+    };
+    static boolean bRegistered = FALSE;
+    if (!bRegistered)
+    {
+        esp_err_t NStatus = scheduler_register(astReplayRunnables, sizeof(astReplayRunnables) / sizeof(astReplayRunnables[0]));
+        if (NStatus != ESP_OK)
+        {
+            replay_stop();
+            return NStatus;
+        }
+        bRegistered = TRUE;
+    }
+
+    /* Fill the read ahead before the clock starts */
+    (void)replay_service();
+    qwtReplayStartus = (qword)esp_timer_get_time() + REPLAY_START_DELAY;
+    ESP_LOGI("REPLAY", "Replaying %llu frames from %s", (unsigned long long)qwNRecordsToRead, abyPath);
+    return esp_timer_start_once(stReplayTimer, REPLAY_START_DELAY - REPLAY_WAKE_EARLY);
+    #endif
+}
+
+void replay_stop(void)
+{
+    /*
+    *===========================================================================
+    *   replay_stop
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Stops the timer, closes the log and prints the timing counters. The
+    *   read ahead buffers are kept for the next replay.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (stReplayTimer != NULL)
+    {
+        (void)esp_timer_stop(stReplayTimer);
+    }
+    if (stReplayFile == NULL)
+    {
+        return;
+    }
+    fclose(stReplayFile);
+    stReplayFile = NULL;
+
+    sdword sdwMeanErrorus = (stReplayStats.qwNFramesSent > 0)
+                          ? (sdword)(stReplayStats.sqwTotalErrorus / (sqword)stReplayStats.qwNFramesSent) : 0;
+    ESP_LOGI("REPLAY", "Sent %llu frames, %lu late, error mean %ld min %ld max %ld us, %lu TX queue full, %lu underruns",
+             (unsigned long long)stReplayStats.qwNFramesSent, (unsigned long)stReplayStats.dwNLateFrames,
+             (long)sdwMeanErrorus, (long)stReplayStats.sdwMinErrorus, (long)stReplayStats.sdwMaxErrorus,
+             (unsigned long)stReplayStats.dwNTxQueueFull, (unsigned long)stReplayStats.dwNUnderruns);
+}
+
+esp_err_t replay_service(void)
+{
+    /*
+    *===========================================================================
+    *   replay_service
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Refills any read ahead buffer the timer has finished with, one large
+    *   read each, and stops the replay once the last frame has gone. Call
+    *   from the background task.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (stReplayFile == NULL)
+    {
+        return ESP_OK;
+    }
+    if (__atomic_load_n(&bReplayFinished, __ATOMIC_ACQUIRE))
+    {
+        replay_stop();
+        return ESP_OK;
+    }
+
+    while (!__atomic_load_n(&bReadEnded, __ATOMIC_RELAXED) &&
+           !__atomic_load_n(&astReplayBuffers[wFillBuffer].bFull, __ATOMIC_ACQUIRE))
+    {
+        stReplayBuffer_t *stBuffer = &astReplayBuffers[wFillBuffer];
+        size_t NRecords = REPLAY_BUFFER_RECORDS;
+        if (NRecords > qwNRecordsToRead)
+        {
+            NRecords = (size_t)qwNRecordsToRead;
+        }
+        NRecords = (NRecords > 0) ? fread(stBuffer->abyRecords, MDF4_RECORD_SIZE, NRecords, stReplayFile) : 0;
+        if (NRecords == 0)
+        {
+            /* Every filled buffer is published before the end is */
+            __atomic_store_n(&bReadEnded, TRUE, __ATOMIC_RELEASE);
+            break;
+        }
+        qwNRecordsToRead -= NRecords;
+        stBuffer->wNRecords = (word)NRecords;
+        __atomic_store_n(&stBuffer->bFull, TRUE, __ATOMIC_RELEASE);
+        wFillBuffer = (wFillBuffer + 1 >= REPLAY_N_BUFFERS) ? 0 : wFillBuffer + 1;
+    }
+    return ESP_OK;
+}
+
+boolean replay_running(void)
+{
+    return stReplayFile != NULL;
+}
+
+void replay_get_stats(stReplayStats_t *stStats)
+{
+    /* Written by the timer task, a torn read only upsets one report */
+    *stStats = stReplayStats;
+}
+
+static eReplayFetch_t replay_fetch(CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   replay_fetch
+    *   Takes:   stFrame - filled with the next frame of the log
+    *
+    *   Returns: eREPLAY_FETCH_OK, eREPLAY_FETCH_UNDERRUN if the read ahead
+    *            has not caught up, eREPLAY_FETCH_END after the last frame.
+    *
+    *   The end flag is read before the buffer flag, replay_service sets it
+    *   after publishing its last buffer so an empty buffer seen after the end
+    *   flag really is the end.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stReplayBuffer_t *stBuffer = &astReplayBuffers[wPlayBuffer];
+    boolean bEnded = __atomic_load_n(&bReadEnded, __ATOMIC_ACQUIRE);
+
+    if (!__atomic_load_n(&stBuffer->bFull, __ATOMIC_ACQUIRE))
+    {
+        return bEnded ? eREPLAY_FETCH_END : eREPLAY_FETCH_UNDERRUN;
+    }
+    (void)mdf4_unpack_record(&stBuffer->abyRecords[wPlayRecord * MDF4_RECORD_SIZE], stFrame, NULL);
+    wPlayRecord++;
+    if (wPlayRecord >= stBuffer->wNRecords)
+    {
+        wPlayRecord = 0;
+        __atomic_store_n(&stBuffer->bFull, FALSE, __ATOMIC_RELEASE);
+        wPlayBuffer = (wPlayBuffer + 1 >= REPLAY_N_BUFFERS) ? 0 : wPlayBuffer + 1;
+    }
+    return eREPLAY_FETCH_OK;
+}
+
+static qword replay_due_time(qword qwtFrameus)
+{
+    if (eReplayMode == eREPLAY_AS_FAST_AS_POSSIBLE)
+    {
+        return 0;
+    }
+    if (bFirstFrame)
+    {
+        qwtFirstFrameus = qwtFrameus;
+        bFirstFrame = FALSE;
+    }
+    qword qwtOffsetus = (qwtFrameus > qwtFirstFrameus) ? qwtFrameus - qwtFirstFrameus : 0;
+    return qwtReplayStartus + qwtOffsetus * REPLAY_REAL_TIME_PERCENT / wReplaySpeedPercent;
+}
+
+static void replay_timer_callback(void *pvArg)
+{
+    /*
+    *===========================================================================
+    *   replay_timer_callback
+    *   Takes:   pvArg - unused
+    *
+    *   Returns: Nothing.
+    *
+    *   Collects the frames due by the end of the batch window, waits for the
+    *   first one's exact time, sends them and re-arms for the next frame.
+    *   Frames the TX queue would not take are kept and retried. Timing error
+    *   is the time the frame was queued minus its due time.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    #ifdef GPIO_CAN0_TX
+    qword qwtNowus = (qword)esp_timer_get_time();
+    eReplayFetch_t eFetch = eREPLAY_FETCH_OK;
+
+    /* Gather the frames that are due */
+    while (wNPending < REPLAY_BATCH_MAX)
+    {
+        if (!bLookaheadValid)
+        {
+            eFetch = replay_fetch(&stLookahead);
+            if (eFetch != eREPLAY_FETCH_OK)
+            {
+                break;
+            }
+            qwtLookaheadDueus = replay_due_time(stLookahead.qwtTimestampus);
+            bLookaheadValid = TRUE;
+        }
+        if (qwtLookaheadDueus > qwtNowus + REPLAY_BATCH_WINDOW)
+        {
+            break;
+        }
+        astPending[wNPending] = stLookahead;
+        aqwtPendingDueus[wNPending] = qwtLookaheadDueus;
+        wNPending++;
+        bLookaheadValid = FALSE;
+    }
+    if (eFetch == eREPLAY_FETCH_UNDERRUN)
+    {
+        stReplayStats.dwNUnderruns++;
+    }
+
+    if (wNPending > 0)
+    {
+        /* Woken REPLAY_WAKE_EARLY ahead, spin out the rest */
+        while ((qword)esp_timer_get_time() < aqwtPendingDueus[0])
+        {
+        }
+        qword qwtSendus = (qword)esp_timer_get_time();
+        word wNSent = 0;
+        (void)CAN_transmit_batch(stCANBus0, astPending, wNPending, &wNSent);
+
+        if (eReplayMode != eREPLAY_AS_FAST_AS_POSSIBLE)
+        {
+            for (word i = 0; i < wNSent; i++)
+            {
+                sdword sdwErrorus = (sdword)((sqword)qwtSendus - (sqword)aqwtPendingDueus[i]);
+                if (stReplayStats.qwNFramesSent + i == 0 || sdwErrorus > stReplayStats.sdwMaxErrorus)
+                {
+                    stReplayStats.sdwMaxErrorus = sdwErrorus;
+                }
+                if (stReplayStats.qwNFramesSent + i == 0 || sdwErrorus < stReplayStats.sdwMinErrorus)
+                {
+                    stReplayStats.sdwMinErrorus = sdwErrorus;
+                }
+                if (sdwErrorus > REPLAY_LATE_LIMIT)
+                {
+                    stReplayStats.dwNLateFrames++;
+                }
+                stReplayStats.sqwTotalErrorus += sdwErrorus;
+            }
+        }
+        stReplayStats.qwNFramesSent += wNSent;
+
+        if (wNSent < wNPending)
+        {
+            stReplayStats.dwNTxQueueFull++;
+            memmove(&astPending[0], &astPending[wNSent], (wNPending - wNSent) * sizeof(astPending[0]));
+            memmove(&aqwtPendingDueus[0], &aqwtPendingDueus[wNSent], (wNPending - wNSent) * sizeof(aqwtPendingDueus[0]));
+        }
+        wNPending -= wNSent;
+    }
+
+    /* Next wake up */
+    qword qwtNextus;
+    if (wNPending > 0 || eFetch == eREPLAY_FETCH_UNDERRUN)
+    {
+        qwtNextus = qwtNowus + REPLAY_RETRY_PERIOD;
+    }
+    else if (bLookaheadValid)
+    {
+        qwtNextus = qwtLookaheadDueus - REPLAY_WAKE_EARLY;
+    }
+    else if (eFetch == eREPLAY_FETCH_END)
+    {
+        __atomic_store_n(&bReplayFinished, TRUE, __ATOMIC_RELEASE);
+        return;
+    }
+    else
+    {
+        /* Batch was full, carry straight on */
+        qwtNextus = qwtNowus;
+    }
+    qword qwtAfterus = (qword)esp_timer_get_time();
+    qword qwDelayus = (qwtNextus > qwtAfterus + REPLAY_MIN_DELAY) ? qwtNextus - qwtAfterus : REPLAY_MIN_DELAY;
+    (void)esp_timer_start_once(stReplayTimer, qwDelayus);
+    #endif
+}
+
+static void replay_runnable(void)
+{
+    /*
+    *===========================================================================
+    *   replay_runnable
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   replay_service for the scheduler, keeps the read ahead full. Does
+    *   nothing when no replay is running.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    (void)replay_service();
+}
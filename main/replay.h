@@ -0,0 +1,38 @@
+#ifndef SFR_REPLAY
+#define SFR_REPLAY
+
+#include <stdio.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#include "sfrtypes.h"
+#include "can.h"
+#include "mdf4.h"
+
+/* --------------------------- Types ---------------------------------------- */
+typedef enum {
+    eREPLAY_REAL_TIME = 0,          // original timing
+    eREPLAY_ACCELERATED,            // original timing scaled by wSpeedPercent
+    eREPLAY_AS_FAST_AS_POSSIBLE,    // as fast as the TX queue takes them
+} eReplayMode_t;
+
+typedef struct {
+    qword qwNFramesSent;
+    dword dwNLateFrames;            // sent more than REPLAY_LATE_LIMIT after their time
+    sqword sqwTotalErrorus;         // sum of send time - due time, for the mean
+    sdword sdwMaxErrorus;           // latest frame
+    sdword sdwMinErrorus;           // earliest frame
+    dword dwNTxQueueFull;           // times the TX queue was full and the batch was retried
+    dword dwNUnderruns;             // times the read ahead had not caught up
+} stReplayStats_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t replay_start(const char *abyPath, eReplayMode_t eMode, word wSpeedPercent);
+void replay_stop(void);
+esp_err_t replay_service(void);
+boolean replay_running(void);
+void replay_get_stats(stReplayStats_t *stStats);
+
+#endif // SFR_REPLAY
@@ -0,0 +1,896 @@
+/*
+scheduler.c
+File contains the task scheduler. Each rate in tasks.c runs in its own
+FreeRTOS task, paced with xTaskDelayUntil so releases do not drift, and
+prioritised rate monotonically: the shorter the period the higher the
+priority, so the 1 ms work always preempts the 100 ms work.
+
+task_BG has the lowest priority above idle and sleeps on a task
+notification. The 1 ms task wakes it at the end of each run, so background
+work follows the periodic work once a millisecond and the idle task gets
+whatever is left, rather than being starved by a busy loop.
+
+Each task measures its run time, start jitter against its period, overruns
+(released late), deadline misses (finished after its next release) and its
+share of the CPU over the last second. The headroom is what the four leave for
+idle. Run times exclude the time higher priority scheduler tasks took out of
+the run, so they are each task's own cost. Time taken by ISRs and other
+FreeRTOS tasks still counts against the task they interrupted. All four run
+on one core so that sum holds.
+
+Run times and jitter go into log scale histograms, four buckets per power of
+two, so percentiles are within 25 % from 1 us to a second:
+    bucket 0-3      0-3 us exactly
+    bucket 4n+m     (4 + m) << (n - 1) us up to the next bucket, n >= 1
+Once a second every task sends DBC TaskTiming (0x7F5) and TaskHealth (0x7F6),
+with the task number as the multiplexer, see dbc/sfr.dbc. scheduler_dump
+prints the lot with the histograms on the serial port.
+
+Modules add their work as runnables with scheduler_register: a static table
+of name, period, offset and budget. Each runnable runs in the slowest task
+whose period divides its own, on the cycles that match its offset, after the
+task's own body in tasks.c. SCHED_OFFSET_AUTO picks the phase that collides
+with the smallest budget already registered in that task, which spreads the
+slow work over the fast cycles instead of stacking it on cycle 0. A runnable
+that goes over its budget is counted and gives up its next release, so one
+slow module cannot keep eating the rest of its task's time. Only modules that
+are initialised register, so a device only runs the work of its role.
+
+Needs CONFIG_FREERTOS_HZ=1000, see sdkconfig.defaults.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include "scheduler.h"
+#include "tasks.h"
+#include "can.h"
+#include "sfr_dbc.h"
+#include "trace.h"
+
+#if configTICK_RATE_HZ < 1000
+#error "The scheduler needs a 1 kHz FreeRTOS tick, set CONFIG_FREERTOS_HZ=1000"
+#endif
+
+/* --------------------------- Local Types ----------------------------- */
+#define SCHED_HIST_OCTAVES 20       // up to ~1 s
+#define SCHED_HIST_BUCKETS (4 * (SCHED_HIST_OCTAVES + 1))
+
+typedef struct {
+    const char *abyName;
+    void (*pfTask)(void);
+    word wtPeriodms;            // 0 for the background task
+    UBaseType_t NPriority;
+    dword dwStackBytes;
+} stSchedTask_t;
+
+typedef struct {
+    dword adwBuckets[SCHED_HIST_BUCKETS];
+    dword dwNSamples;
+} stSchedHistogram_t;
+
+typedef struct {
+    const stSchedRunnable_t *stRunnable;    // the module's table entry
+    eSchedTask_t eTask;
+    word wDivider;              // runnable period in task cycles
+    word wPhase;                // task cycle it runs on, modulo wDivider
+    boolean bSkipNext;
+    stRunnableStats_t stStats;
+} stSchedRunnableSlot_t;
+
+typedef struct {
+    TaskHandle_t stHandle;
+    stSchedStats_t stStats;
+    dword dwNCycles;
+    stSchedHistogram_t stRunHistogram;
+    stSchedHistogram_t stJitterHistogram;
+    dword dwNOverrunsReported;
+    dword dwNDeadlineMissesReported;
+    qword qwtLastStartus;
+    qword qwtWindowStartus;
+    qword qwtWindowBusyus;
+} stSchedState_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SCHED_TAG "SCHED"
+#define SCHED_STACK_BYTES 4096
+#define SCHED_BG_TIMEOUT_MS 10      // BG still runs if the 1 ms task stops
+#define SCHED_LOAD_WINDOW_US 1000000
+#define SCHED_CORE 0
+#define US_PER_MS 1000
+#define PERMILLE 1000
+#define SCHED_SATURATE(value, max) (((value) > (max)) ? (max) : (value))
+/* TaskTiming and TaskHealth are multiplexed on Task, each task has its own signals */
+#define SCHED_REPORT_TASK(Name, stTiming, stHealth, stStats, stState)                                                   \
+    do                                                                                                                  \
+    {                                                                                                                   \
+        (stTiming).dwTask##Name##Load = (stStats).wLoadPermille;                                                        \
+        (stTiming).dwTask##Name##RunP50 = SCHED_SATURATE((stStats).dwtP50us, 0xFFFF);                                   \
+        (stTiming).dwTask##Name##RunP99 = SCHED_SATURATE((stStats).dwtP99us, 0xFFFF);                                   \
+        (stTiming).dwTask##Name##RunP999 = SCHED_SATURATE((stStats).dwtP999us, 0xFFFF);                                 \
+        (stHealth).dwTask##Name##RunMax = SCHED_SATURATE((stStats).dwtMaxus, 0xFFFF);                                   \
+        (stHealth).dwTask##Name##JitterP99 = SCHED_SATURATE((stStats).dwtJitterP99us, 2550);                            \
+        (stHealth).dwTask##Name##JitterMax = SCHED_SATURATE((stStats).dwtMaxJitterus, 2550);                            \
+        (stHealth).dwTask##Name##Overruns =                                                                             \
+            SCHED_SATURATE((stStats).dwNOverruns - (stState)->dwNOverrunsReported, 0xFF);                               \
+        (stHealth).dwTask##Name##DeadlineMisses =                                                                       \
+            SCHED_SATURATE((stStats).dwNDeadlineMisses - (stState)->dwNDeadlineMissesReported, 0xFF);                   \
+    } while (0)
+
+/* --------------------------- Local Variables ------------------------------ */
+#ifdef GPIO_CAN0_TX
+extern twai_node_handle_t stCANBus0;
+#endif
+
+/* Rate monotonic, below esp_timer (22) and the WiFi task (23) */
+static const stSchedTask_t astSchedTasks[eSCHED_TOTAL] =
+{
+    [eSCHED_1MS]   = { "task_1ms",   task_1ms,   1,   20, SCHED_STACK_BYTES },
+    [eSCHED_10MS]  = { "task_10ms",  task_10ms,  10,  19, SCHED_STACK_BYTES },
+    [eSCHED_100MS] = { "task_100ms", task_100ms, 100, 18, SCHED_STACK_BYTES },
+    [eSCHED_BG]    = { "task_BG",    task_BG,    0,   tskIDLE_PRIORITY + 1, SCHED_STACK_BYTES },
+};
+static stSchedState_t astSchedState[eSCHED_TOTAL];
+static _Atomic dword dwtSchedBusyus;   // own run time of every scheduler task, wraps
+static stSchedRunnableSlot_t astRunnableSlots[SCHED_MAX_RUNNABLES];
+static _Atomic byte byNRunnableSlots;
+static const stSchedRunnable_t astSchedRunnables[] =
+{
+    { "sched_report", scheduler_report, 1000, SCHED_OFFSET_AUTO, 500 },
+};
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t scheduler_init(void);
+esp_err_t scheduler_get_stats(eSchedTask_t eTask, stSchedStats_t *stStats);
+word scheduler_headroom_permille(void);
+const char *scheduler_task_name(eSchedTask_t eTask);
+word scheduler_task_period_ms(eSchedTask_t eTask);
+esp_err_t scheduler_register(const stSchedRunnable_t *astRunnables, byte byNRunnables);
+esp_err_t scheduler_get_runnable_stats(byte byRunnable, stRunnableStats_t *stStats);
+void scheduler_report(void);
+void scheduler_dump(void);
+static void scheduler_task(void *pvTask);
+static void scheduler_run_runnables(eSchedTask_t eTask);
+static word scheduler_pick_phase(eSchedTask_t eTask, word wDivider);
+static word scheduler_gcd(word wA, word wB);
+static void scheduler_account(eSchedTask_t eTask, qword qwtStartus, dword dwtRunus, qword qwtEndus);
+static void scheduler_histogram_add(stSchedHistogram_t *stHistogram, dword dwValue);
+static dword scheduler_histogram_percentile(const stSchedHistogram_t *stHistogram, word wPermille);
+static dword scheduler_bucket_upper(byte byBucket);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t scheduler_init(void)
+{
+    /*
+    *===========================================================================
+    *   scheduler_init
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK or ESP_ERR_NO_MEM if a task could not be created.
+    *
+    *   Creates the task for each rate. BG is created first so the 1 ms task
+    *   always has it to notify.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Tasks pinned to one core for the run time accounting
+    *   18/10/26 CP Registers the scheduler's own report
+    *   18/10/26 CP Task index passed through uintptr_t, builds on the host
+    *
+    *===========================================================================
+    */
+    esp_err_t NStatus = scheduler_register(astSchedRunnables, sizeof(astSchedRunnables) / sizeof(astSchedRunnables[0]));
+    if (NStatus != ESP_OK)
+    {
+        return NStatus;
+    }
+    for (sdword i = eSCHED_TOTAL - 1; i >= 0; i--)
+    {
+        const stSchedTask_t *stTask = &astSchedTasks[i];
+        if (xTaskCreatePinnedToCore(scheduler_task, stTask->abyName, stTask->dwStackBytes, (void *)(uintptr_t)i,
+                                    stTask->NPriority, &astSchedState[i].stHandle, SCHED_CORE) != pdPASS)
+        {
+            ESP_LOGE(SCHED_TAG, "Failed to create %s", stTask->abyName);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t scheduler_get_stats(eSchedTask_t eTask, stSchedStats_t *stStats)
+{
+    /*
+    *===========================================================================
+    *   scheduler_get_stats
+    *   Takes:   eTask - task to read
+    *            stStats - filled with its timing
+    *
+    *   Returns: ESP_OK or ESP_ERR_INVALID_ARG.
+    *
+    *   Only the task itself writes its fields, each one is read whole but
+    *   they may come from neighbouring runs.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Adds the percentiles
+    *
+    *===========================================================================
+    */
+    if (eTask >= eSCHED_TOTAL || stStats == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stSchedState_t *stState = &astSchedState[eTask];
+    *stStats = stState->stStats;
+    stStats->dwtP50us = scheduler_histogram_percentile(&stState->stRunHistogram, 500);
+    stStats->dwtP99us = scheduler_histogram_percentile(&stState->stRunHistogram, 990);
+    stStats->dwtP999us = scheduler_histogram_percentile(&stState->stRunHistogram, 999);
+    stStats->dwtJitterP99us = scheduler_histogram_percentile(&stState->stJitterHistogram, 990);
+    return ESP_OK;
+}
+
+word scheduler_headroom_permille(void)
+{
+    /*
+    *===========================================================================
+    *   scheduler_headroom_permille
+    *   Takes:   None
+    *
+    *   Returns: CPU left for idle over the last second, in 0.1 %.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    dword dwLoadPermille = 0;
+    for (byte i = 0; i < eSCHED_TOTAL; i++)
+    {
+        dwLoadPermille += astSchedState[i].stStats.wLoadPermille;
+    }
+    return (dwLoadPermille >= PERMILLE) ? 0 : (word)(PERMILLE - dwLoadPermille);
+}
+
+const char *scheduler_task_name(eSchedTask_t eTask)
+{
+    /*
+    *===========================================================================
+    *   scheduler_task_name
+    *   Takes:   eTask - task
+    *
+    *   Returns: Its FreeRTOS task name, "" for an unknown task.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    return (eTask < eSCHED_TOTAL) ? astSchedTasks[eTask].abyName : "";
+}
+
+word scheduler_task_period_ms(eSchedTask_t eTask)
+{
+    /*
+    *===========================================================================
+    *   scheduler_task_period_ms
+    *   Takes:   eTask - task
+    *
+    *   Returns: Its release period, 0 for the background task or an unknown
+    *            task.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    return (eTask < eSCHED_TOTAL) ? astSchedTasks[eTask].wtPeriodms : 0;
+}
+
+esp_err_t scheduler_register(const stSchedRunnable_t *astRunnables, byte byNRunnables)
+{
+    /*
+    *===========================================================================
+    *   scheduler_register
+    *   Takes:   astRunnables - the module's runnables, must stay valid, a
+    *                           static const table
+    *            byNRunnables - how many
+    *
+    *   Returns: ESP_OK, ESP_ERR_INVALID_ARG for a bad period or offset or
+    *            ESP_ERR_NO_MEM past SCHED_MAX_RUNNABLES.
+    *
+    *   Call from init code, one caller at a time. Runnables are published
+    *   one by one and start with their next matching task cycle, so this is
+    *   also safe once the scheduler is running. There is no unregister,
+    *   a module that stops leaves its runnable returning straight away.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (astRunnables == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (byte i = 0; i < byNRunnables; i++)
+    {
+        const stSchedRunnable_t *stRunnable = &astRunnables[i];
+        byte byNSlots = __atomic_load_n(&byNRunnableSlots, __ATOMIC_RELAXED);
+        if (byNSlots >= SCHED_MAX_RUNNABLES)
+        {
+            ESP_LOGE(SCHED_TAG, "No room for %s, raise SCHED_MAX_RUNNABLES", stRunnable->abyName);
+            return ESP_ERR_NO_MEM;
+        }
+        if (stRunnable->pfRunnable == NULL)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        /* Slowest task whose period divides the runnable's */
+        eSchedTask_t eTask = eSCHED_BG;
+        if (stRunnable->wtPeriodms != 0)
+        {
+            eTask = eSCHED_1MS;
+            for (byte j = eSCHED_10MS; j <= eSCHED_100MS; j++)
+            {
+                if (stRunnable->wtPeriodms % astSchedTasks[j].wtPeriodms == 0)
+                {
+                    eTask = j;
+                }
+            }
+        }
+        word wtTaskPeriodms = (eTask == eSCHED_BG) ? 1 : astSchedTasks[eTask].wtPeriodms;
+        word wDivider = (eTask == eSCHED_BG) ? 1 : stRunnable->wtPeriodms / wtTaskPeriodms;
+        word wPhase;
+        if (stRunnable->wtOffsetms == SCHED_OFFSET_AUTO)
+        {
+            wPhase = scheduler_pick_phase(eTask, wDivider);
+        }
+        else if (stRunnable->wtOffsetms % wtTaskPeriodms == 0 && stRunnable->wtOffsetms / wtTaskPeriodms < wDivider)
+        {
+            wPhase = stRunnable->wtOffsetms / wtTaskPeriodms;
+        }
+        else
+        {
+            ESP_LOGE(SCHED_TAG, "%s offset %u ms does not fit its %u ms period", stRunnable->abyName,
+                     (unsigned)stRunnable->wtOffsetms, (unsigned)stRunnable->wtPeriodms);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        stSchedRunnableSlot_t *stSlot = &astRunnableSlots[byNSlots];
+        *stSlot = (stSchedRunnableSlot_t)
+        {
+            .stRunnable = stRunnable,
+            .eTask = eTask,
+            .wDivider = wDivider,
+            .wPhase = wPhase,
+            .bSkipNext = FALSE,
+            .stStats = { .abyName = stRunnable->abyName, .eTask = eTask, .wtPeriodms = stRunnable->wtPeriodms,
+                         .wtOffsetms = wPhase * wtTaskPeriodms },
+        };
+        __atomic_store_n(&byNRunnableSlots, byNSlots + 1, __ATOMIC_RELEASE);
+        #ifdef DEBUG
+        ESP_LOGI(SCHED_TAG, "%s every %u ms at +%u ms in %s", stRunnable->abyName, (unsigned)stRunnable->wtPeriodms,
+                 (unsigned)(wPhase * wtTaskPeriodms), astSchedTasks[eTask].abyName);
+        #endif
+    }
+    return ESP_OK;
+}
+
+esp_err_t scheduler_get_runnable_stats(byte byRunnable, stRunnableStats_t *stStats)
+{
+    /*
+    *===========================================================================
+    *   scheduler_get_runnable_stats
+    *   Takes:   byRunnable - index in order of registration
+    *            stStats - filled with its timing
+    *
+    *   Returns: ESP_OK, ESP_ERR_NOT_FOUND past the last runnable or
+    *            ESP_ERR_INVALID_ARG.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (stStats == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (byRunnable >= __atomic_load_n(&byNRunnableSlots, __ATOMIC_ACQUIRE))
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *stStats = astRunnableSlots[byRunnable].stStats;
+    return ESP_OK;
+}
+
+static void scheduler_task(void *pvTask)
+{
+    /*
+    *===========================================================================
+    *   scheduler_task
+    *   Takes:   pvTask - eSchedTask_t of the task to run
+    *
+    *   Returns: Never.
+    *
+    *   Body of every scheduler task. Periodic tasks wait for their next
+    *   release, BG waits for the 1 ms task's notification. BG also owns the
+    *   task watchdog, it only gets fed once every task has run.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Own run time and deadline misses
+    *   18/10/26 CP Runs the registered runnables after the task body
+    *   18/10/26 CP Trace events
+    *   18/10/26 CP Task index passed through uintptr_t
+    *
+    *===========================================================================
+    */
+    eSchedTask_t eTask = (eSchedTask_t)(uintptr_t)pvTask;
+    const stSchedTask_t *stTask = &astSchedTasks[eTask];
+    TickType_t stLastWake = xTaskGetTickCount();
+
+    if (eTask == eSCHED_BG)
+    {
+        ESP_ERROR_CHECK(esp_task_wdt_add(NULL));
+    }
+
+    while (1)
+    {
+        boolean bOnTime = TRUE;
+        if (stTask->wtPeriodms == 0)
+        {
+            (void)ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SCHED_BG_TIMEOUT_MS));
+        }
+        else
+        {
+            bOnTime = (xTaskDelayUntil(&stLastWake, pdMS_TO_TICKS(stTask->wtPeriodms)) == pdTRUE);
+        }
+
+        qword qwtStartus = (qword)esp_timer_get_time();
+        dword dwtBusyStartus = __atomic_load_n(&dwtSchedBusyus, __ATOMIC_RELAXED);
+        trace_event(eTRACE_TASK_BEGIN, eTask, 0);
+        stTask->pfTask();
+        scheduler_run_runnables(eTask);
+        trace_event(eTRACE_TASK_END, eTask, 0);
+        qword qwtEndus = (qword)esp_timer_get_time();
+
+        /* Take out what higher priority tasks ran in the meantime, then add ours */
+        dword dwtPreemptedus = (dword)(__atomic_load_n(&dwtSchedBusyus, __ATOMIC_RELAXED) - dwtBusyStartus);
+        dword dwtRunus = (dword)(qwtEndus - qwtStartus);
+        dwtRunus = (dwtPreemptedus < dwtRunus) ? dwtRunus - dwtPreemptedus : 0;
+        __atomic_fetch_add(&dwtSchedBusyus, dwtRunus, __ATOMIC_RELAXED);
+
+        if (!bOnTime)
+        {
+            /* Released late, the last run or a higher priority task took the period */
+            astSchedState[eTask].stStats.dwNOverruns++;
+        }
+        if (stTask->wtPeriodms != 0 && xTaskGetTickCount() - stLastWake >= pdMS_TO_TICKS(stTask->wtPeriodms))
+        {
+            /* Still running at the next release */
+            astSchedState[eTask].stStats.dwNDeadlineMisses++;
+            trace_stall(eTask);
+        }
+        scheduler_account(eTask, qwtStartus, dwtRunus, qwtEndus);
+
+        if (eTask == eSCHED_1MS)
+        {
+            (void)xTaskNotifyGive(astSchedState[eSCHED_BG].stHandle);
+        }
+    }
+}
+
+static void scheduler_run_runnables(eSchedTask_t eTask)
+{
+    /*
+    *===========================================================================
+    *   scheduler_run_runnables
+    *   Takes:   eTask - task running them
+    *
+    *   Returns: Nothing.
+    *
+    *   Runs the task's runnables due this cycle in order of registration and
+    *   holds each to its budget.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Trace events
+    *
+    *===========================================================================
+    */
+    stSchedState_t *stState = &astSchedState[eTask];
+    byte byNSlots = __atomic_load_n(&byNRunnableSlots, __ATOMIC_ACQUIRE);
+
+    for (byte i = 0; i < byNSlots; i++)
+    {
+        stSchedRunnableSlot_t *stSlot = &astRunnableSlots[i];
+        if (stSlot->eTask != eTask || stState->dwNCycles % stSlot->wDivider != stSlot->wPhase)
+        {
+            continue;
+        }
+        if (stSlot->bSkipNext)
+        {
+            stSlot->bSkipNext = FALSE;
+            stSlot->stStats.dwNSkipped++;
+            continue;
+        }
+
+        qword qwtStartus = (qword)esp_timer_get_time();
+        dword dwtBusyStartus = __atomic_load_n(&dwtSchedBusyus, __ATOMIC_RELAXED);
+        trace_event(eTRACE_RUNNABLE_BEGIN, i, 0);
+        stSlot->stRunnable->pfRunnable();
+        trace_event(eTRACE_RUNNABLE_END, i, 0);
+        dword dwtPreemptedus = (dword)(__atomic_load_n(&dwtSchedBusyus, __ATOMIC_RELAXED) - dwtBusyStartus);
+        dword dwtRunus = (dword)((qword)esp_timer_get_time() - qwtStartus);
+        dwtRunus = (dwtPreemptedus < dwtRunus) ? dwtRunus - dwtPreemptedus : 0;
+
+        stRunnableStats_t *stStats = &stSlot->stStats;
+        stStats->dwNRuns++;
+        stStats->dwtLastus = dwtRunus;
+        if (dwtRunus > stStats->dwtMaxus)
+        {
+            stStats->dwtMaxus = dwtRunus;
+        }
+        if (stSlot->stRunnable->dwtBudgetus != 0 && dwtRunus > stSlot->stRunnable->dwtBudgetus)
+        {
+            /* Over budget, give the time back by missing the next release */
+            stStats->dwNBudgetOverruns++;
+            stSlot->bSkipNext = TRUE;
+            if (stStats->dwNBudgetOverruns == 1)
+            {
+                ESP_LOGW(SCHED_TAG, "%s took %lu us, budget %lu us", stSlot->stRunnable->abyName,
+                         (unsigned long)dwtRunus, (unsigned long)stSlot->stRunnable->dwtBudgetus);
+            }
+        }
+    }
+    stState->dwNCycles++;
+}
+
+static word scheduler_pick_phase(eSchedTask_t eTask, word wDivider)
+{
+    /*
+    *===========================================================================
+    *   scheduler_pick_phase
+    *   Takes:   eTask - task the runnable will run in
+    *            wDivider - its period in task cycles
+    *
+    *   Returns: Phase with the least budget already due on the same cycles.
+    *
+    *   Two runnables with periods a and b cycles and phases p and q meet on
+    *   some cycle when p and q are equal modulo gcd(a, b). Runnables with no
+    *   budget count as 1 us so they still spread out.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    byte byNSlots = __atomic_load_n(&byNRunnableSlots, __ATOMIC_ACQUIRE);
+    qword qwtBestus = ~0ULL;
+    word wBestPhase = 0;
+
+    for (word wPhase = 0; wPhase < wDivider; wPhase++)
+    {
+        qword qwtCollidingus = 0;
+        for (byte i = 0; i < byNSlots; i++)
+        {
+            const stSchedRunnableSlot_t *stSlot = &astRunnableSlots[i];
+            if (stSlot->eTask != eTask)
+            {
+                continue;
+            }
+            word wGCD = scheduler_gcd(wDivider, stSlot->wDivider);
+            if (wPhase % wGCD == stSlot->wPhase % wGCD)
+            {
+                qwtCollidingus += (stSlot->stRunnable->dwtBudgetus != 0) ? stSlot->stRunnable->dwtBudgetus : 1;
+            }
+        }
+        if (qwtCollidingus < qwtBestus)
+        {
+            qwtBestus = qwtCollidingus;
+            wBestPhase = wPhase;
+        }
+    }
+    return wBestPhase;
+}
+
+static word scheduler_gcd(word wA, word wB)
+{
+    /*
+    *===========================================================================
+    *   scheduler_gcd
+    *   Takes:   wA, wB - two periods
+    *
+    *   Returns: Their greatest common divisor.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    while (wB != 0)
+    {
+        word wRemainder = wA % wB;
+        wA = wB;
+        wB = wRemainder;
+    }
+    return wA;
+}
+
+static void scheduler_account(eSchedTask_t eTask, qword qwtStartus, dword dwtRunus, qword qwtEndus)
+{
+    /*
+    *===========================================================================
+    *   scheduler_account
+    *   Takes:   eTask - task that just ran
+    *            qwtStartus, qwtEndus - when it ran
+    *            dwtRunus - its own run time
+    *
+    *   Returns: Nothing.
+    *
+    *   Run time, jitter as the start to start error against the period, and
+    *   the CPU share over each SCHED_LOAD_WINDOW_US.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Run time and jitter histograms
+    *
+    *===========================================================================
+    */
+    stSchedState_t *stState = &astSchedState[eTask];
+    stSchedStats_t *stStats = &stState->stStats;
+    word wtPeriodms = astSchedTasks[eTask].wtPeriodms;
+
+    stStats->dwNRuns++;
+    stStats->dwtLastus = dwtRunus;
+    if (dwtRunus > stStats->dwtMaxus)
+    {
+        stStats->dwtMaxus = dwtRunus;
+    }
+    scheduler_histogram_add(&stState->stRunHistogram, dwtRunus);
+
+    if (wtPeriodms != 0 && stState->qwtLastStartus != 0)
+    {
+        sqword sqwtErrorus = (sqword)(qwtStartus - stState->qwtLastStartus) - (sqword)wtPeriodms * US_PER_MS;
+        dword dwtJitterus = (dword)((sqwtErrorus < 0) ? -sqwtErrorus : sqwtErrorus);
+        if (dwtJitterus > stStats->dwtMaxJitterus)
+        {
+            stStats->dwtMaxJitterus = dwtJitterus;
+        }
+        scheduler_histogram_add(&stState->stJitterHistogram, dwtJitterus);
+    }
+    stState->qwtLastStartus = qwtStartus;
+
+    stState->qwtWindowBusyus += dwtRunus;
+    if (stState->qwtWindowStartus == 0)
+    {
+        stState->qwtWindowStartus = qwtStartus;
+    }
+    else if (qwtEndus - stState->qwtWindowStartus >= SCHED_LOAD_WINDOW_US)
+    {
+        stStats->wLoadPermille = (word)(stState->qwtWindowBusyus * PERMILLE / (qwtEndus - stState->qwtWindowStartus));
+        stState->qwtWindowBusyus = 0;
+        stState->qwtWindowStartus = qwtEndus;
+    }
+}
+
+void scheduler_report(void)
+{
+    /*
+    *===========================================================================
+    *   scheduler_report
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Call once a second. Sends TaskTiming and TaskHealth for every task on
+    *   CAN0, multiplexed on the task number. Overruns and deadline misses are
+    *   the counts since the last call.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Per task signals for the multiplexed TaskTiming and TaskHealth
+    *
+    *===========================================================================
+    */
+    #ifdef GPIO_CAN0_TX
+    CAN_frame_t astReport[2 * eSCHED_TOTAL];
+    word wHeadroomPermille = scheduler_headroom_permille();
+
+    for (byte i = 0; i < eSCHED_TOTAL; i++)
+    {
+        stSchedState_t *stState = &astSchedState[i];
+        stSchedStats_t stStats;
+        (void)scheduler_get_stats(i, &stStats);
+
+        stDBCTaskTiming_t stTiming = { .dwTask = i };
+        stDBCTaskHealth_t stHealth = { .dwTask = i, .dwHeadroom = wHeadroomPermille };
+        switch (i)
+        {
+            case eSCHED_1MS:
+                SCHED_REPORT_TASK(1ms, stTiming, stHealth, stStats, stState);
+                break;
+            case eSCHED_10MS:
+                SCHED_REPORT_TASK(10ms, stTiming, stHealth, stStats, stState);
+                break;
+            case eSCHED_100MS:
+                SCHED_REPORT_TASK(100ms, stTiming, stHealth, stStats, stState);
+                break;
+            default:
+                SCHED_REPORT_TASK(BG, stTiming, stHealth, stStats, stState);
+                break;
+        }
+        stState->dwNOverrunsReported = stStats.dwNOverruns;
+        stState->dwNDeadlineMissesReported = stStats.dwNDeadlineMisses;
+
+        astReport[2 * i] = (CAN_frame_t){ .dwID = DBC_TASK_TIMING_ID, .byDLC = DBC_TASK_TIMING_DLC, .byBus = CAN_BUS_NONE };
+        dbc_task_timing_encode(&stTiming, astReport[2 * i].abData);
+        astReport[2 * i + 1] = (CAN_frame_t){ .dwID = DBC_TASK_HEALTH_ID, .byDLC = DBC_TASK_HEALTH_DLC, .byBus = CAN_BUS_NONE };
+        dbc_task_health_encode(&stHealth, astReport[2 * i + 1].abData);
+    }
+    (void)CAN_transmit_batch(stCANBus0, astReport, 2 * eSCHED_TOTAL, NULL);
+    #endif
+}
+
+void scheduler_dump(void)
+{
+    /*
+    *===========================================================================
+    *   scheduler_dump
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Prints every task's timing and the non empty histogram buckets, as
+    *   upper edge in us: count, then every runnable.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Prints the runnables
+    *
+    *===========================================================================
+    */
+    ESP_LOGI(SCHED_TAG, "CPU headroom %u.%u %%", (unsigned)(scheduler_headroom_permille() / 10),
+             (unsigned)(scheduler_headroom_permille() % 10));
+    for (byte i = 0; i < eSCHED_TOTAL; i++)
+    {
+        stSchedState_t *stState = &astSchedState[i];
+        stSchedStats_t stStats;
+        (void)scheduler_get_stats(i, &stStats);
+
+        ESP_LOGI(SCHED_TAG, "%-10s load %u.%u %% runs %lu run p50 %lu p99 %lu p99.9 %lu max %lu us",
+                 astSchedTasks[i].abyName,
+                 (unsigned)(stStats.wLoadPermille / 10), (unsigned)(stStats.wLoadPermille % 10),
+                 (unsigned long)stStats.dwNRuns, (unsigned long)stStats.dwtP50us, (unsigned long)stStats.dwtP99us,
+                 (unsigned long)stStats.dwtP999us, (unsigned long)stStats.dwtMaxus);
+        ESP_LOGI(SCHED_TAG, "%-10s jitter p99 %lu max %lu us, %lu overruns, %lu deadline misses",
+                 astSchedTasks[i].abyName,
+                 (unsigned long)stStats.dwtJitterP99us, (unsigned long)stStats.dwtMaxJitterus,
+                 (unsigned long)stStats.dwNOverruns, (unsigned long)stStats.dwNDeadlineMisses);
+
+        const stSchedHistogram_t *astHistograms[2] = { &stState->stRunHistogram, &stState->stJitterHistogram };
+        const char *aabyNames[2] = { "run", "jitter" };
+        for (byte j = 0; j < 2; j++)
+        {
+            char abyLine[160];
+            int NLength = snprintf(abyLine, sizeof(abyLine), "%-10s %-6s", astSchedTasks[i].abyName, aabyNames[j]);
+            for (byte k = 0; k < SCHED_HIST_BUCKETS && NLength < (int)sizeof(abyLine); k++)
+            {
+                dword dwCount = astHistograms[j]->adwBuckets[k];
+                if (dwCount == 0)
+                {
+                    continue;
+                }
+                NLength += snprintf(&abyLine[NLength], sizeof(abyLine) - NLength, " %lu:%lu",
+                                    (unsigned long)scheduler_bucket_upper(k), (unsigned long)dwCount);
+            }
+            if (astHistograms[j]->dwNSamples > 0)
+            {
+                ESP_LOGI(SCHED_TAG, "%s", abyLine);
+            }
+        }
+    }
+
+    stRunnableStats_t stRunnable;
+    for (byte i = 0; scheduler_get_runnable_stats(i, &stRunnable) == ESP_OK; i++)
+    {
+        ESP_LOGI(SCHED_TAG, "  %-14s %-10s +%u ms runs %lu last %lu max %lu us, %lu over budget, %lu skipped",
+                 stRunnable.abyName, astSchedTasks[stRunnable.eTask].abyName, (unsigned)stRunnable.wtOffsetms,
+                 (unsigned long)stRunnable.dwNRuns, (unsigned long)stRunnable.dwtLastus,
+                 (unsigned long)stRunnable.dwtMaxus, (unsigned long)stRunnable.dwNBudgetOverruns,
+                 (unsigned long)stRunnable.dwNSkipped);
+    }
+}
+
+static void scheduler_histogram_add(stSchedHistogram_t *stHistogram, dword dwValue)
+{
+    /*
+    *===========================================================================
+    *   scheduler_histogram_add
+    *   Takes:   stHistogram - histogram to add to
+    *            dwValue - sample, us
+    *
+    *   Returns: Nothing.
+    *
+    *   Bucket from the position of the top bit and the two bits under it,
+    *   samples past the last octave go in the last bucket.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    word wBucket;
+    if (dwValue < 4)
+    {
+        wBucket = (word)dwValue;
+    }
+    else
+    {
+        byte byTopBit = (byte)(31 - __builtin_clz((unsigned int)dwValue));
+        wBucket = (word)(4 * (byTopBit - 1) + ((dwValue >> (byTopBit - 2)) & 3));
+    }
+    if (wBucket >= SCHED_HIST_BUCKETS)
+    {
+        wBucket = SCHED_HIST_BUCKETS - 1;
+    }
+    stHistogram->adwBuckets[wBucket]++;
+    stHistogram->dwNSamples++;
+}
+
+static dword scheduler_histogram_percentile(const stSchedHistogram_t *stHistogram, word wPermille)
+{
+    /*
+    *===========================================================================
+    *   scheduler_histogram_percentile
+    *   Takes:   stHistogram - histogram to read
+    *            wPermille - percentile in 0.1 %, 999 for p99.9
+    *
+    *   Returns: Upper edge of the bucket holding the percentile, 0 if empty.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    qword qwTarget = ((qword)stHistogram->dwNSamples * wPermille + PERMILLE - 1) / PERMILLE;
+    qword qwNSeen = 0;
+    if (stHistogram->dwNSamples == 0)
+    {
+        return 0;
+    }
+    for (byte i = 0; i < SCHED_HIST_BUCKETS; i++)
+    {
+        qwNSeen += stHistogram->adwBuckets[i];
+        if (qwNSeen >= qwTarget)
+        {
+            return scheduler_bucket_upper(i);
+        }
+    }
+    return scheduler_bucket_upper(SCHED_HIST_BUCKETS - 1);
+}
+
+static dword scheduler_bucket_upper(byte byBucket)
+{
+    /*
+    *===========================================================================
+    *   scheduler_bucket_upper
+    *   Takes:   byBucket - histogram bucket
+    *
+    *   Returns: Largest value in us that lands in the bucket.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (byBucket < 4)
+    {
+        return byBucket;
+    }
+    byte byOctave = byBucket / 4;
+    dword dwStep = (dword)1 << (byOctave - 1);
+    return (dword)(4 + byBucket % 4) * dwStep + dwStep - 1;
+}
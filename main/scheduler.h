@@ -0,0 +1,72 @@
+#ifndef SFR_SCHEDULER
+#define SFR_SCHEDULER
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_task_wdt.h"
+
+#include "sfrtypes.h"
+#include "pin.h"
+
+/* --------------------------- Types ---------------------------------------- */
+typedef enum {
+    eSCHED_1MS = 0,
+    eSCHED_10MS,
+    eSCHED_100MS,
+    eSCHED_BG,
+    eSCHED_TOTAL,
+} eSchedTask_t;
+
+typedef struct {
+    dword dwNRuns;
+    dword dwtLastus;            // run time, less preemption by the other scheduler tasks
+    dword dwtMaxus;
+    dword dwtP50us;             // run time percentiles, upper edge of the histogram bucket
+    dword dwtP99us;
+    dword dwtP999us;
+    dword dwtJitterP99us;       // start to start error against the period
+    dword dwtMaxJitterus;
+    dword dwNOverruns;          // releases that started late
+    dword dwNDeadlineMisses;    // runs that finished after the next release
+    word wLoadPermille;         // share of the CPU over the last second
+} stSchedStats_t;
+
+typedef struct {
+    const char *abyName;
+    void (*pfRunnable)(void);
+    word wtPeriodms;            // 0 runs it every time the background task wakes
+    word wtOffsetms;            // phase within the period, SCHED_OFFSET_AUTO to stagger it
+    dword dwtBudgetus;          // own run time allowed each run, 0 for none
+} stSchedRunnable_t;
+
+typedef struct {
+    const char *abyName;
+    eSchedTask_t eTask;         // task it runs in
+    word wtPeriodms;            // as registered, 0 for the background task
+    word wtOffsetms;            // phase it was given
+    dword dwNRuns;
+    dword dwtLastus;
+    dword dwtMaxus;
+    dword dwNBudgetOverruns;
+    dword dwNSkipped;           // releases given up after an overrun
+} stRunnableStats_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SCHED_OFFSET_AUTO 0xFFFF
+#define SCHED_MAX_RUNNABLES 32
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t scheduler_init(void);
+esp_err_t scheduler_get_stats(eSchedTask_t eTask, stSchedStats_t *stStats);
+word scheduler_headroom_permille(void);
+const char *scheduler_task_name(eSchedTask_t eTask);
+word scheduler_task_period_ms(eSchedTask_t eTask);
+esp_err_t scheduler_register(const stSchedRunnable_t *astRunnables, byte byNRunnables);
+esp_err_t scheduler_get_runnable_stats(byte byRunnable, stRunnableStats_t *stStats);
+void scheduler_report(void);
+void scheduler_dump(void);
+
+#endif // SFR_SCHEDULER
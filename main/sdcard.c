@@ -6,10 +6,22 @@ Written by Cole Perera for Sheffield Formula Racing 2025
 */
 
 #include "sdcard.h"
+#include "trace.h"
+#include "scheduler.h"
+#include "gateway.h"
+
+/* Format chosen in menuconfig, see Kconfig.projbuild. The block journal (.sfr)
+* is the default, MDF4 (.mf4) holds CAN frames only */
+#ifdef CONFIG_SFR_LOG_FORMAT_MDF4
+#define LOG_FORMAT_MDF4
+#elif !defined(CONFIG_SFR_LOG_UNCOMPRESSED)
+#define LOG_COMPRESSION
+#endif
 
 /* --------------------------- Global Variables ----------------------------- */
 static const char *SD_MOUNT_POINT = "/sdcard";
-static char abyFilePath[64] = "/sdcard/log000.txt";
+static char abyFilePath[64] = "/sdcard/log000.mf4";
+static int NLogFile = 0;
 
 /* --------------------------- Local Variables ------------------------------ */
 extern dword dwTimeSincePowerUpms;
@@ -17,14 +29,63 @@ extern CAN_frame_t *stCANRingBuffer;
 extern _Atomic word wRingBufHead;
 extern _Atomic word wRingBufTail;
 
+static FILE *stLogFile = NULL;
+static byte abyLogBlock[SDLOG_BLOCK_SIZE];
+static word wLogBlockFill = 0;         // payload bytes used in abyLogBlock
+static dword dwLogBlockSequence = 0;   // index of the block being filled
+static dword dwLogPreallocatedBytes = 0;
+#ifndef LOG_FORMAT_MDF4
+static dword dwLogBlockStartms = 0;    // time the first record went into the block
+static dword dwLogSessionID = 0;
+static stSDLogIndexEntry_t astLogIndex[SDLOG_INDEX_ENTRIES];
+static word wLogNIndex = 0;
+static dword dwLogIndexPeriodms = 0;   // spacing of the entries, doubled each time the index is thinned
+static dword dwLogIndexBlocks = 0;
+#else
+static stMDF4Layout_t stLogMDF4Layout;
+static dword dwLogBytesSynced = 0;     // record bytes covered by the DT length on the card
+static dword dwLastSyncms = 0;         // time of the last DT length update
+#endif
+#ifdef LOG_COMPRESSION
+static stSDCompressor_t stLogCompressor;
+static boolean bLogBlockRaw = FALSE;   // block is stored as its records, not compressed
+static qword qwLogRawBytes = 0;        // record bytes committed
+static qword qwLogStoredBytes = 0;     // payload bytes committed, compressed or not
+static dword dwLogNRawBlocks = 0;      // blocks stored uncompressed
+static qword qwLogCompressCycles = 0;  // CPU cycles spent in the compressor
+#endif
+
 /* --------------------------- Function prototypes -------------------------- */
 esp_err_t SD_card_init(void);
+esp_err_t SD_card_flush(void);
+void SD_card_event_path(char *abyPath, size_t NPathSize, word wNEvent);
+static esp_err_t SD_card_open_log(void);
+static esp_err_t SD_card_append(const byte *abyData, word wLength);
+static esp_err_t SD_card_commit_block(void);
+static esp_err_t SD_card_preallocate(dword dwBytesNeeded);
+#ifndef LOG_FORMAT_MDF4
+static void SD_card_index_block(void);
+static esp_err_t SD_card_write_index(void);
+static int SD_card_format_CAN(char *abyLine, size_t NLineSize, CAN_frame_t stCANFrame);
+#endif
+static esp_err_t SD_card_log_frame(const CAN_frame_t *stFrame);
+static void SD_card_runnable(void);
+#ifdef LOG_FORMAT_MDF4
+static esp_err_t SD_card_sync_records(void);
+#endif
 
 /* --------------------------- Definitions ---------------------------------- */
 #define MAX_FILES 5
 #define ALLOCATION_UNIT_SIZE 16 * 1024
 #define SDMMC_FREQ 10000 // 10 kHz
 #define MAX_TRANSFER_SIZE 4000 // max transfer size of one spi operation (bytes)
+#define LOG_PREALLOCATE_SIZE (1024 * 1024) // file is grown in steps of this size (bytes)
+#define LOG_COMMIT_PERIOD 1000 // max time a part filled block is held in RAM (ms)
+#define LOG_LINE_LENGTH 64 // longest formatted CAN frame line (bytes)
+#define LOG_STATS_PERIOD 256 // blocks between compression reports
+#define LOG_INDEX_PERIOD 1000 // time between index entries to start with (ms)
+#define LOG_INDEX_BLOCKS 64 // blocks between index entries to start with
+#define LOG_CONFIG_FILE "logcfg.txt" // logging profiles, see logfilter.c
 
 /* --------------------------- Functions ------------------------------------ */
 
@@ -37,13 +98,19 @@ esp_err_t SD_card_init(void)
     * 
     *   Returns: ESP_OK if successful, error code if not.
     * 
-    *   Initializes the SD card interface.
+    *   Initializes the SD card interface, opens the next log and registers
+    *   the logger with the scheduler.
     *===========================================================================
     *   Revision History:
     *   20/10/25 CP Initial Version
+    *   18/10/26 CP Registers sdcard_empty_buffer with the scheduler
     *
     *===========================================================================
     */
+    static const stSchedRunnable_t astSDRunnables[] =
+    {
+        { "sdcard", SD_card_runnable, 0, 0, 0 },
+    };
     esp_err_t NStatus = ESP_OK;
     esp_vfs_fat_sdmmc_mount_config_t stSDMountConfig = 
     {
@@ -98,7 +165,12 @@ esp_err_t SD_card_init(void)
     ESP_LOGI("SDCARD", "Mounted successfully.");
     /* Print Card Details */
     sdmmc_card_print_info(stdout, stSDCard);
-    /* Query card to update file abyFilePath */
+    /* Logging profile, without one every frame is logged */
+    char abyConfigPath[64];
+    snprintf(abyConfigPath, sizeof(abyConfigPath), "%s/%s", SD_MOUNT_POINT, LOG_CONFIG_FILE);
+    (void)logfilter_load(abyConfigPath);
+
+    /* Find the newest log on the card, the new log takes the next number */
     DIR *stDirectory;
     stDirectory = opendir(SD_MOUNT_POINT);
     if (stDirectory == NULL)
@@ -108,44 +180,665 @@ esp_err_t SD_card_init(void)
     }
     struct dirent *stDirInfo;
     stDirInfo = readdir(stDirectory);
-    word wNLastFile = 0;
+    int NLastFile = -1;
     while (stDirInfo != NULL)
     {
-        wNLastFile++;
+        int NFile;
+        if (strncasecmp(stDirInfo->d_name, "log", 3) == 0 && sscanf(stDirInfo->d_name + 3, "%3d", &NFile) == 1
+            && NFile > NLastFile)
+        {
+            NLastFile = NFile;
+        }
         stDirInfo = readdir(stDirectory);
     }
     closedir(stDirectory);
-    snprintf(abyFilePath, sizeof(abyFilePath), "%s/log%03d.txt", SD_MOUNT_POINT, (int)wNLastFile);
 
-   return NStatus;
+    /* Trim the previous log back to its last committed data, it may have been cut off by a power loss */
+    if (NLastFile >= 0)
+    {
+        snprintf(abyFilePath, sizeof(abyFilePath), "%s/log%03d.sfr", SD_MOUNT_POINT, NLastFile);
+        (void)sdlog_recover(abyFilePath, NULL);
+        snprintf(abyFilePath, sizeof(abyFilePath), "%s/log%03d.mf4", SD_MOUNT_POINT, NLastFile);
+        (void)mdf4_recover(abyFilePath);
+    }
+    NLogFile = NLastFile + 1;
+    #ifdef LOG_FORMAT_MDF4
+    snprintf(abyFilePath, sizeof(abyFilePath), "%s/log%03d.mf4", SD_MOUNT_POINT, NLogFile);
+    #else
+    snprintf(abyFilePath, sizeof(abyFilePath), "%s/log%03d.sfr", SD_MOUNT_POINT, NLogFile);
+    #endif
+
+    NStatus = SD_card_open_log();
+    if (NStatus != ESP_OK)
+    {
+        ESP_LOGE("SDCARD", "Failed to open %s: %s", abyFilePath, esp_err_to_name(NStatus));
+        return NStatus;
+    }
+
+    /* Block writes wait on the card, so background task only and no budget */
+    return scheduler_register(astSDRunnables, sizeof(astSDRunnables) / sizeof(astSDRunnables[0]));
+}
+
+static esp_err_t SD_card_open_log(void)
+{
+    /*
+    *===========================================================================
+    *   SD_card_open_log
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Opens a new log file at abyFilePath and preallocates the first chunk of
+    *   it. The file is kept open for the whole session, opening and closing the
+    *   file for every write is slow and leaves the FAT entry stale after a power
+    *   loss. With LOG_FORMAT_MDF4 the MDF4 header is written first and a
+    *   reader seeks by bisecting the fixed records, the journal starts a new
+    *   time index.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP MDF4 header
+    *   18/10/26 CP Time index trailer
+    *
+    *===========================================================================
+    */
+    stLogFile = fopen(abyFilePath, "w+b");
+    if (stLogFile == NULL)
+    {
+        return ESP_FAIL;
+    }
+    /* Blocks are written whole so stdio buffering only adds a copy */
+    setvbuf(stLogFile, NULL, _IONBF, 0);
+
+    dwLogBlockSequence = 0;
+    wLogBlockFill = 0;
+    dwLogPreallocatedBytes = 0;
+
+    #ifdef LOG_FORMAT_MDF4
+    dwLogBytesSynced = 0;
+    dwLastSyncms = dwTimeSincePowerUpms;
+    ESP_LOGI("SDCARD", "Logging to %s", abyFilePath);
+    mdf4_build_header(abyLogBlock, &stLogMDF4Layout);
+    esp_err_t NStatus = SD_card_preallocate(MDF4_HEADER_SIZE + SDLOG_BLOCK_SIZE);
+    if (NStatus != ESP_OK)
+    {
+        return NStatus;
+    }
+    if (fseek(stLogFile, 0, SEEK_SET) != 0 ||
+        fwrite(abyLogBlock, 1, MDF4_HEADER_SIZE, stLogFile) != MDF4_HEADER_SIZE ||
+        fsync(fileno(stLogFile)) != 0)
+    {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+    #else
+    dwLogSessionID = esp_random();
+    wLogNIndex = 0;
+    dwLogIndexPeriodms = LOG_INDEX_PERIOD;
+    dwLogIndexBlocks = LOG_INDEX_BLOCKS;
+    #ifdef LOG_COMPRESSION
+    sdcompress_reset(&stLogCompressor, &abyLogBlock[sizeof(stSDLogBlockHeader_t)], SDLOG_PAYLOAD_SIZE);
+    #endif
+    ESP_LOGI("SDCARD", "Logging to %s, session %08lX", abyFilePath, (unsigned long)dwLogSessionID);
+
+    return SD_card_preallocate(SDLOG_BLOCK_SIZE);
+    #endif
+}
+
+static esp_err_t SD_card_preallocate(dword dwBytesNeeded)
+{
+    /*
+    *===========================================================================
+    *   SD_card_preallocate
+    *   Takes:   dwBytesNeeded - file length the next write needs
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Grows the log file in LOG_PREALLOCATE_SIZE steps and syncs it so the
+    *   cluster chain and file length are on the card before any data is
+    *   written into them. Normal block writes then land inside the file and
+    *   never touch the FAT, recovery trims the unused tail at the next boot.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    static const byte byZero = 0;
+
+    if (dwBytesNeeded <= dwLogPreallocatedBytes)
+    {
+        return ESP_OK;
+    }
+    dword dwNewLength = dwLogPreallocatedBytes + LOG_PREALLOCATE_SIZE;
+    if (fseek(stLogFile, (long)dwNewLength - 1, SEEK_SET) != 0 || fwrite(&byZero, 1, 1, stLogFile) != 1)
+    {
+        return ESP_FAIL;
+    }
+    if (fsync(fileno(stLogFile)) != 0)
+    {
+        return ESP_FAIL;
+    }
+    dwLogPreallocatedBytes = dwNewLength;
+    return ESP_OK;
+}
+
+static esp_err_t SD_card_commit_block(void)
+{
+    /*
+    *===========================================================================
+    *   SD_card_commit_block
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Seals the block being filled and writes it to its slot in the file. On
+    *   a failed write the block is kept so the next commit retries it. The
+    *   journal writes its time index after the block when the next slot is
+    *   an index slot.
+    *
+    *   With LOG_FORMAT_MDF4 the block is a sector aligned slice of the record
+    *   stream after the header. A part filled block is written as far as it
+    *   goes and kept, it is written again over the same slot once it is full.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP MDF4 record blocks
+    *   18/10/26 CP Trace events around the write
+    *   18/10/26 CP Blocks that do not compress are stored raw
+    *   18/10/26 CP Time index entry and trailer block
+    *
+    *===========================================================================
+    */
+    if (stLogFile == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (wLogBlockFill == 0)
+    {
+        return ESP_OK;
+    }
+
+    #ifdef LOG_FORMAT_MDF4
+    dword dwOffset = MDF4_HEADER_SIZE + dwLogBlockSequence * SDLOG_BLOCK_SIZE;
+    esp_err_t NStatus = SD_card_preallocate(dwOffset + SDLOG_BLOCK_SIZE);
+    if (NStatus != ESP_OK)
+    {
+        return NStatus;
+    }
+    trace_event(eTRACE_SD_WRITE_BEGIN, 0, wLogBlockFill);
+    boolean bFailed = fseek(stLogFile, (long)dwOffset, SEEK_SET) != 0 ||
+                      fwrite(abyLogBlock, 1, wLogBlockFill, stLogFile) != wLogBlockFill;
+    trace_event(eTRACE_SD_WRITE_END, 0, wLogBlockFill);
+    if (bFailed)
+    {
+        return ESP_FAIL;
+    }
+    if (wLogBlockFill == SDLOG_BLOCK_SIZE)
+    {
+        dwLogBlockSequence++;
+        wLogBlockFill = 0;
+    }
+    return ESP_OK;
+    #else
+    dword dwOffset = dwLogBlockSequence * SDLOG_BLOCK_SIZE;
+    esp_err_t NStatus = SD_card_preallocate(dwOffset + SDLOG_BLOCK_SIZE);
+    if (NStatus != ESP_OK)
+    {
+        return NStatus;
+    }
+
+    word wFlags = 0;
+    #ifdef LOG_COMPRESSION
+    /* A block the compressor did not shrink is stored as its records. It stays
+    *  raw if the write fails, the next append commits it before compressing */
+    if (!bLogBlockRaw && stLogCompressor.wOutputLength >= stLogCompressor.wRawLength)
+    {
+        memcpy(&abyLogBlock[sizeof(stSDLogBlockHeader_t)], stLogCompressor.abyRaw, stLogCompressor.wRawLength);
+        wLogBlockFill = stLogCompressor.wRawLength;
+        bLogBlockRaw = TRUE;
+    }
+    if (!bLogBlockRaw)
+    {
+        wFlags |= SDLOG_FLAG_COMPRESSED;
+    }
+    #endif
+    sdlog_seal_block(abyLogBlock, dwLogSessionID, dwLogBlockSequence, dwLogBlockStartms, wLogBlockFill, wFlags);
+    trace_event(eTRACE_SD_WRITE_BEGIN, 0, SDLOG_BLOCK_SIZE);
+    boolean bFailed = fseek(stLogFile, (long)dwOffset, SEEK_SET) != 0 ||
+                      fwrite(abyLogBlock, 1, SDLOG_BLOCK_SIZE, stLogFile) != SDLOG_BLOCK_SIZE;
+    trace_event(eTRACE_SD_WRITE_END, 0, SDLOG_BLOCK_SIZE);
+    if (bFailed)
+    {
+        return ESP_FAIL;
+    }
+
+    SD_card_index_block();
+    dwLogBlockSequence++;
+
+    #ifdef LOG_COMPRESSION
+    qwLogRawBytes += bLogBlockRaw ? wLogBlockFill : stLogCompressor.wRawLength;
+    qwLogStoredBytes += wLogBlockFill;
+    dwLogNRawBlocks += bLogBlockRaw ? 1 : 0;
+    bLogBlockRaw = FALSE;
+    sdcompress_reset(&stLogCompressor, &abyLogBlock[sizeof(stSDLogBlockHeader_t)], SDLOG_PAYLOAD_SIZE);
+    #endif
+    wLogBlockFill = 0;
+
+    /* The block buffer is empty now, the index is built in it */
+    if (dwLogBlockSequence % SDLOG_INDEX_INTERVAL == SDLOG_INDEX_INTERVAL - 1 && SD_card_write_index() != ESP_OK)
+    {
+        ESP_LOGW("SDCARD", "Failed to write the time index at block %lu", (unsigned long)dwLogBlockSequence);
+    }
+
+    #ifdef LOG_COMPRESSION
+    if (dwLogBlockSequence % LOG_STATS_PERIOD == 0)
+    {
+        ESP_LOGI("SDCARD", "Compression ratio %lu.%02lu, %lu cycles/byte, %lu of %lu blocks raw",
+            (unsigned long)(qwLogRawBytes / qwLogStoredBytes),
+            (unsigned long)((qwLogRawBytes * 100 / qwLogStoredBytes) % 100),
+            (unsigned long)(qwLogCompressCycles / qwLogRawBytes),
+            (unsigned long)dwLogNRawBlocks, (unsigned long)dwLogBlockSequence);
+    }
+    #endif
+    return ESP_OK;
+    #endif
+}
+
+#ifndef LOG_FORMAT_MDF4
+static void SD_card_index_block(void)
+{
+    /*
+    *===========================================================================
+    *   SD_card_index_block
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Called as each block is committed. Adds the block to the time index
+    *   when dwLogIndexPeriodms or dwLogIndexBlocks has passed since the last
+    *   entry. A full index drops every other entry and doubles both, so it
+    *   always fits one block and covers the whole log at any length.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (wLogNIndex > 0 &&
+        dwLogBlockStartms - astLogIndex[wLogNIndex - 1].dwTimestampms < dwLogIndexPeriodms &&
+        dwLogBlockSequence - astLogIndex[wLogNIndex - 1].dwBlock < dwLogIndexBlocks)
+    {
+        return;
+    }
+    if (wLogNIndex == SDLOG_INDEX_ENTRIES)
+    {
+        for (word i = 0; i < SDLOG_INDEX_ENTRIES / 2; i++)
+        {
+            astLogIndex[i] = astLogIndex[i * 2];
+        }
+        wLogNIndex = SDLOG_INDEX_ENTRIES / 2;
+        dwLogIndexPeriodms *= 2;
+        dwLogIndexBlocks *= 2;
+    }
+    astLogIndex[wLogNIndex].dwTimestampms = (uint32_t)dwLogBlockStartms;
+    astLogIndex[wLogNIndex].dwBlock = (uint32_t)dwLogBlockSequence;
+    wLogNIndex++;
+}
+
+static esp_err_t SD_card_write_index(void)
+{
+    /*
+    *===========================================================================
+    *   SD_card_write_index
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Writes the time index as the block at dwLogBlockSequence, flagged
+    *   SDLOG_FLAG_INDEX. It carries the time of the block before it so the
+    *   header times stay in order. Call with the block buffer empty. If the
+    *   write fails the slot goes to the next data block and readers use the
+    *   index block before it.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    dword dwOffset = dwLogBlockSequence * SDLOG_BLOCK_SIZE;
+    word wLength = wLogNIndex * sizeof(astLogIndex[0]);
+    esp_err_t NStatus = SD_card_preallocate(dwOffset + SDLOG_BLOCK_SIZE);
+    if (NStatus != ESP_OK)
+    {
+        return NStatus;
+    }
+
+    memcpy(&abyLogBlock[sizeof(stSDLogBlockHeader_t)], astLogIndex, wLength);
+    sdlog_seal_block(abyLogBlock, dwLogSessionID, dwLogBlockSequence, dwLogBlockStartms, wLength, SDLOG_FLAG_INDEX);
+    trace_event(eTRACE_SD_WRITE_BEGIN, 0, SDLOG_BLOCK_SIZE);
+    boolean bFailed = fseek(stLogFile, (long)dwOffset, SEEK_SET) != 0 ||
+                      fwrite(abyLogBlock, 1, SDLOG_BLOCK_SIZE, stLogFile) != SDLOG_BLOCK_SIZE;
+    trace_event(eTRACE_SD_WRITE_END, 0, SDLOG_BLOCK_SIZE);
+    if (bFailed)
+    {
+        return ESP_FAIL;
+    }
+    dwLogBlockSequence++;
+    return ESP_OK;
+}
+#endif
+
+static esp_err_t SD_card_append(const byte *abyData, word wLength)
+{
+    /*
+    *===========================================================================
+    *   SD_card_append
+    *   Takes:   abyData - bytes to log
+    *            wLength - number of bytes, at most SDLOG_PAYLOAD_SIZE
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Adds a record to the block being filled, committing the block first if
+    *   the record does not fit. Records never straddle two blocks so every
+    *   block can be read on its own. With LOG_COMPRESSION the record is
+    *   compressed into the block as it is added. A record too long to ever
+    *   pass the compressor's fit check is stored raw in a block of its own.
+    *   An MDF4 log only holds CAN frames so text is refused.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Compress records into the block
+    *   18/10/26 CP Refuse text in an MDF4 log
+    *   18/10/26 CP Oversize records in a raw block
+    *
+    *===========================================================================
+    */
+    esp_err_t NStatus = ESP_OK;
+
+    #ifdef LOG_FORMAT_MDF4
+    (void)abyData;
+    (void)wLength;
+    NStatus = ESP_ERR_NOT_SUPPORTED;
+    #else
+    if (wLength > SDLOG_PAYLOAD_SIZE)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    #ifdef LOG_COMPRESSION
+    /* A raw block holds its one record, whatever follows starts a new block */
+    if (bLogBlockRaw)
+    {
+        NStatus = SD_card_commit_block();
+        if (NStatus != ESP_OK)
+        {
+            return NStatus;
+        }
+    }
+    if (SDCOMPRESS_WORST_CASE(wLength) > SDLOG_PAYLOAD_SIZE)
+    {
+        NStatus = SD_card_commit_block();
+        if (NStatus != ESP_OK)
+        {
+            return NStatus;
+        }
+        memcpy(&abyLogBlock[sizeof(stSDLogBlockHeader_t)], abyData, wLength);
+        wLogBlockFill = wLength;
+        dwLogBlockStartms = dwTimeSincePowerUpms;
+        bLogBlockRaw = TRUE;
+        return ESP_OK;
+    }
+    dword dwStartCycles = esp_cpu_get_cycle_count();
+    NStatus = sdcompress_append(&stLogCompressor, abyData, wLength);
+    if (NStatus == ESP_ERR_NO_MEM)
+    {
+        NStatus = SD_card_commit_block();
+        if (NStatus != ESP_OK)
+        {
+            return NStatus;
+        }
+        NStatus = sdcompress_append(&stLogCompressor, abyData, wLength);
+    }
+    qwLogCompressCycles += (dword)(esp_cpu_get_cycle_count() - dwStartCycles);
+    if (NStatus != ESP_OK)
+    {
+        return NStatus;
+    }
+    if (wLogBlockFill == 0)
+    {
+        dwLogBlockStartms = dwTimeSincePowerUpms;
+    }
+    wLogBlockFill = stLogCompressor.wOutputLength;
+    #else
+    if (wLogBlockFill + wLength > SDLOG_PAYLOAD_SIZE)
+    {
+        NStatus = SD_card_commit_block();
+        if (NStatus != ESP_OK)
+        {
+            return NStatus;
+        }
+    }
+    if (wLogBlockFill == 0)
+    {
+        dwLogBlockStartms = dwTimeSincePowerUpms;
+    }
+    memcpy(&abyLogBlock[sizeof(stSDLogBlockHeader_t) + wLogBlockFill], abyData, wLength);
+    wLogBlockFill += wLength;
+    #endif
+    #endif
+    return NStatus;
+}
+
+#ifdef LOG_FORMAT_MDF4
+static esp_err_t SD_card_sync_records(void)
+{
+    /*
+    *===========================================================================
+    *   SD_card_sync_records
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Writes the records held in RAM, syncs them, then moves the DT length
+    *   and record count on the card up to cover them. The length is never
+    *   ahead of data that is safely written.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    dword dwBytesLogged = dwLogBlockSequence * SDLOG_BLOCK_SIZE + wLogBlockFill;
+
+    dwLastSyncms = dwTimeSincePowerUpms;
+    if (dwBytesLogged == dwLogBytesSynced)
+    {
+        return ESP_OK;
+    }
+    esp_err_t NStatus = SD_card_commit_block();
+    if (NStatus != ESP_OK)
+    {
+        return NStatus;
+    }
+    if (fsync(fileno(stLogFile)) != 0)
+    {
+        return ESP_FAIL;
+    }
+    NStatus = mdf4_update_length(stLogFile, &stLogMDF4Layout, dwBytesLogged / MDF4_RECORD_SIZE);
+    if (NStatus == ESP_OK)
+    {
+        dwLogBytesSynced = dwBytesLogged;
+    }
+    return NStatus;
+}
+#endif
+
+static esp_err_t SD_card_log_frame(const CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   SD_card_log_frame
+    *   Takes:   stFrame - frame to log
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Adds a frame to the log in the format chosen at build time. MDF4
+    *   records run straight on from one block into the next, the record
+    *   stream is contiguous in the file.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Logs the bus each frame came from
+    *
+    *===========================================================================
+    */
+    #ifdef LOG_FORMAT_MDF4
+    byte abyRecord[MDF4_RECORD_SIZE];
+    /* MDF4 bus channels count from 1, 0 marks frames that were not on a bus here */
+    mdf4_pack_record(abyRecord, stFrame, (stFrame->byBus == CAN_BUS_NONE) ? 0 : stFrame->byBus + 1);
+
+    word wFirstPart = SDLOG_BLOCK_SIZE - wLogBlockFill;
+    if (wFirstPart > MDF4_RECORD_SIZE)
+    {
+        wFirstPart = MDF4_RECORD_SIZE;
+    }
+    memcpy(&abyLogBlock[wLogBlockFill], abyRecord, wFirstPart);
+    wLogBlockFill += wFirstPart;
+    if (wLogBlockFill == SDLOG_BLOCK_SIZE)
+    {
+        esp_err_t NStatus = SD_card_commit_block();
+        if (NStatus != ESP_OK)
+        {
+            /* The ring keeps the frame for a retry, drop the part copied */
+            wLogBlockFill -= wFirstPart;
+            return NStatus;
+        }
+    }
+    memcpy(&abyLogBlock[wLogBlockFill], &abyRecord[wFirstPart], MDF4_RECORD_SIZE - wFirstPart);
+    wLogBlockFill += MDF4_RECORD_SIZE - wFirstPart;
+    return ESP_OK;
+    #else
+    char abyLine[LOG_LINE_LENGTH];
+    int NLength = SD_card_format_CAN(abyLine, sizeof(abyLine), *stFrame);
+    return SD_card_append((const byte *)abyLine, (word)NLength);
+    #endif
+}
+
+esp_err_t SD_card_flush(void)
+{
+    /*
+    *===========================================================================
+    *   SD_card_flush
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Commits the part filled block and syncs the log. Call before a planned
+    *   power down, otherwise blocks are committed when full or once they have
+    *   been open for LOG_COMMIT_PERIOD.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP MDF4 length update
+    *
+    *===========================================================================
+    */
+    #ifdef LOG_FORMAT_MDF4
+    if (stLogFile == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return SD_card_sync_records();
+    #else
+    esp_err_t NStatus = SD_card_commit_block();
+    if (NStatus == ESP_OK && stLogFile != NULL && fsync(fileno(stLogFile)) != 0)
+    {
+        NStatus = ESP_FAIL;
+    }
+    return NStatus;
+    #endif
 }
 
+void SD_card_event_path(char *abyPath, size_t NPathSize, word wNEvent)
+{
+    /*
+    *===========================================================================
+    *   SD_card_event_path
+    *   Takes:   abyPath - buffer for the path
+    *            NPathSize - size of abyPath
+    *            wNEvent - event number within this session
+    *
+    *   Returns: Nothing.
+    *
+    *   Builds the path of an event file belonging to the current log, eg
+    *   l003e01.txt is the second event of log003. Fits 8.3 names.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    snprintf(abyPath, NPathSize, "%s/l%03de%02d.txt", SD_MOUNT_POINT, NLogFile, (int)(wNEvent % 100));
+}
+
+#ifndef LOG_FORMAT_MDF4
+static int SD_card_format_CAN(char *abyLine, size_t NLineSize, CAN_frame_t stCANFrame)
+{
+    /*
+    *===========================================================================
+    *   SD_card_format_CAN
+    *   Takes:   abyLine - buffer for the text line
+    *            NLineSize - size of abyLine
+    *            stCANFrame - CAN frame to format
+    *
+    *   Returns: Length of the line in bytes.
+    *
+    *   Formats a CAN frame as one line of the text log.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version, pulled out of sdcard_empty_buffer
+    *
+    *===========================================================================
+    */
+    int NOffset = snprintf(abyLine, NLineSize, "%d: %d %X ", (int)dwTimeSincePowerUpms/1000,
+                           (int)stCANFrame.dwID, (int)stCANFrame.byDLC);
+    for (byte i = 0; i < stCANFrame.byDLC && i < 8; i++)
+    {
+        NOffset += snprintf(abyLine + NOffset, NLineSize - NOffset, " %02X", (int)stCANFrame.abData[i]);
+    }
+    NOffset += snprintf(abyLine + NOffset, NLineSize - NOffset, "\n");
+    return NOffset;
+}
+#endif
+
 esp_err_t SD_card_write(byte *abyData)
 {
     /*
     *===========================================================================
     *   SD_card_write
-    *   Takes:   abyPath - abyFilePath to file to write to
-    *            abyData - data to write
+    *   Takes:   abyData - null terminated text to write
     * 
     *   Returns: ESP_OK if successful, error code if not.
     * 
-    *   Writes data to a file on the SD card.
+    *   Writes a line of text to the log on the SD card.
     *===========================================================================
     *   Revision History:
     *   20/10/25 CP Initial Version
+    *   18/10/26 CP Write through the block journal
     *
     *===========================================================================
     */
 
-    FILE *stFile = fopen(abyFilePath, "a");
-    if (stFile == NULL)
+    size_t NLength = strlen((const char *)abyData);
+    if (NLength >= SDLOG_PAYLOAD_SIZE)
     {
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_SIZE;
     }
-    fprintf(stFile, "%s\n", abyData);
-    fclose(stFile);
-    return ESP_OK;
+    abyData[NLength] = '\n';
+    esp_err_t NStatus = SD_card_append(abyData, (word)(NLength + 1));
+    abyData[NLength] = '\0';
+    return NStatus;
 }
 
 esp_err_t SD_card_write_CAN(CAN_frame_t stCANFrame, dword dwTimestamp)
@@ -153,33 +846,22 @@ esp_err_t SD_card_write_CAN(CAN_frame_t stCANFrame, dword dwTimestamp)
     /*
     *===========================================================================
     *   SD_card_write_CAN
-    *   Takes:   abyPath - abyFilePath to file to write to
-    *            stCANFrame - pointer to CAN frame to write
+    *   Takes:   stCANFrame - CAN frame to write
     *            dwTimestamp - time since power on (seconds)
     * 
     *   Returns: ESP_OK if successful, error code if not.
     * 
-    *   Writes a CAN frame to a file on the SD card.
+    *   Writes a CAN frame to the log on the SD card.
     *===========================================================================
     *   Revision History:
     *   21/10/25 CP Initial Version
+    *   18/10/26 CP Write through the block journal
+    *   18/10/26 CP Write in the selected log format
     *
     *===========================================================================
     */
 
-    FILE *stFile = fopen(abyFilePath, "a");
-    if (stFile == NULL)
-    {
-        return ESP_FAIL;
-    }
-    fprintf(stFile, "%d: %d %X ", (int)dwTimeSincePowerUpms/1000, (int)stCANFrame.dwID, (int)stCANFrame.byDLC);
-    for (byte i = 0; i < stCANFrame.byDLC; i++)
-    {
-        fprintf(stFile, " %02X", (int)stCANFrame.abData[i]);
-    }
-    fprintf(stFile, "\n");
-    fclose(stFile);
-    return ESP_OK;
+    return SD_card_log_frame(&stCANFrame);
 };
 
 esp_err_t sdcard_empty_buffer(void)
@@ -193,43 +875,55 @@ esp_err_t sdcard_empty_buffer(void)
     * 
     *   Empties the CAN ring buffer dumping the contents into the sdcard. If there 
     *   is no data to append, it returns ESP_OK. The ring buffer is
-    *   115 frames in total.
+    *   115 frames in total. Frames go into the block journal, a block is
+    *   written when it is full or has been open for LOG_COMMIT_PERIOD. Every
+    *   frame is also passed to the event trigger, before the logging profile
+    *   decides whether it goes in the main log. An MDF4 log has its length
+    *   brought up to date every LOG_COMMIT_PERIOD instead. Returns
+    *   ESP_ERR_INVALID_STATE while the gateway runs.
     * 
     *=========================================================================== 
     *   Revision History:
     *   24/10/25 CP Initial Version
+    *   18/10/26 CP Write through the block journal, file stays open
+    *   18/10/26 CP Feed the event trigger
+    *   18/10/26 CP Apply the logging profile
+    *   18/10/26 CP MDF4 output
+    *   18/10/26 CP Profile counters only move once the frame is written
+    *   18/10/26 CP Refuses while the gateway runs
     *
     *===========================================================================
     */
 
-    /* Load ring buffer head and tail */
-    if (!stCANRingBuffer) 
+    esp_err_t NStatus = ESP_OK;
+
+    /* The gateway owns the ring while it runs, a second reader would steal its frames */
+    if (!stCANRingBuffer || stLogFile == NULL || gateway_running()) 
     {
         return ESP_ERR_INVALID_STATE;
     }
+
+    /* Load ring buffer head and tail */
     dword dwLocalHead = __atomic_load_n(&wRingBufHead, __ATOMIC_ACQUIRE);
     dword dwLocalTail = __atomic_load_n(&wRingBufTail, __ATOMIC_RELAXED);
 
-    /* Load file */
-    FILE *stFile = fopen(abyFilePath, "a");
-    if (stFile == NULL)
-    {
-        return ESP_FAIL;
-    }
-
-    /* Until the ring buffer is empty, write lines to file */ 
+    /* Until the ring buffer is empty, write lines to the block */ 
     while (dwLocalTail != dwLocalHead) 
     {
-        #ifdef DEBUG
-        ESP_LOGI("SDCARD", "Writing CAN Frame to SD Card");
-        #endif
         CAN_frame_t stCANFrame = stCANRingBuffer[dwLocalTail];
-        fprintf(stFile, "%d: %d %X ", (int)dwTimeSincePowerUpms/1000, (int)stCANFrame.dwID, (int)stCANFrame.byDLC);
-        for (byte i = 0; i < stCANFrame.byDLC; i++)
+        boolean bKeep = logfilter_keep(&stCANFrame);
+        if (bKeep)
         {
-            fprintf(stFile, " %02X", (int)stCANFrame.abData[i]);
+            NStatus = SD_card_log_frame(&stCANFrame);
+            if (NStatus != ESP_OK)
+            {
+                /* Leave the frame in the ring, it is retried on the next call */
+                break;
+            }
         }
-        fprintf(stFile, "\n");
+        logfilter_commit(&stCANFrame, bKeep);
+        /* The trigger history is always full rate */
+        trigger_process_frame(&stCANFrame);
 
         /* Advance tail */ 
         dwLocalTail++;
@@ -240,7 +934,42 @@ esp_err_t sdcard_empty_buffer(void)
     }
     /* Publish new tail */
     __atomic_store_n(&wRingBufTail, dwLocalTail, __ATOMIC_RELEASE);
-    fclose(stFile);
+
+    /* Write the next part of an event if one is in progress */
+    (void)trigger_service();
+
+    /* Do not hold a quiet block in RAM for too long */
+    #ifdef LOG_FORMAT_MDF4
+    if (NStatus == ESP_OK && dwTimeSincePowerUpms - dwLastSyncms >= LOG_COMMIT_PERIOD)
+    {
+        NStatus = SD_card_sync_records();
+    }
+    #else
+    if (NStatus == ESP_OK && wLogBlockFill > 0 && dwTimeSincePowerUpms - dwLogBlockStartms >= LOG_COMMIT_PERIOD)
+    {
+        NStatus = SD_card_commit_block();
+    }
+    #endif
     
-    return ESP_OK;
-}
\ No newline at end of file
+    return NStatus;
+}
+
+static void SD_card_runnable(void)
+{
+    /*
+    *===========================================================================
+    *   SD_card_runnable
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   sdcard_empty_buffer for the scheduler, every time the background task
+    *   wakes.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    (void)sdcard_empty_buffer();
+}
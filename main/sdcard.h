@@ -10,11 +10,25 @@
 #include "espnow.h"
 #include "sfrtypes.h"
 #include "dirent.h"
+#include "esp_random.h"
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "esp_cpu.h"
+
+#include "sdlog.h"
+#include "sdcompress.h"
+#include "mdf4.h"
+#include "trigger.h"
+#include "logfilter.h"
 
 esp_err_t SD_card_init(void);
 esp_err_t sdcard_empty_buffer(void);
 esp_err_t SD_card_write(byte *abyData);
 esp_err_t SD_card_write_CAN(CAN_frame_t stCANFrame, dword dwTimestamp);
+esp_err_t SD_card_flush(void);
+void SD_card_event_path(char *abyPath, size_t NPathSize, word wNEvent);
 
 #define SDCARD
 #endif
\ No newline at end of file
@@ -0,0 +1,265 @@
+/*
+sdcompress.c
+File contains the log block compressor used by the SD card logger. It is a
+small LZ77 in the style of LZ4, integer only and with a fixed RAM footprint.
+
+Compressed stream is a list of sequences:
+    token       high nibble literal count, low nibble match length - 4
+                a nibble of 15 means more length bytes follow (255 = keep adding)
+    [length]    extra literal count bytes
+    literals
+    offset      2 bytes little endian, distance back to the match, 0 = no match
+    [length]    extra match length bytes
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <string.h>
+#include "sdcompress.h"
+
+/* --------------------------- Function prototypes -------------------------- */
+void sdcompress_reset(stSDCompressor_t *stCompressor, byte *abyOutput, word wOutputSize);
+esp_err_t sdcompress_append(stSDCompressor_t *stCompressor, const byte *abyData, word wLength);
+int sdcompress_decompress(const byte *abyInput, word wInputLength, byte *abyOutput, word wOutputSize);
+static void sdcompress_emit(stSDCompressor_t *stCompressor, const byte *abyLiterals, word wNLiterals,
+                            word wOffset, word wMatchLength);
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SDCOMPRESS_NIBBLE_MAX 15
+#define SDCOMPRESS_LENGTH_BYTE_MAX 255
+#define SDCOMPRESS_HASH_MULTIPLIER 2654435761u // Knuth multiplicative hash
+
+/* --------------------------- Functions ------------------------------------ */
+
+void sdcompress_reset(stSDCompressor_t *stCompressor, byte *abyOutput, word wOutputSize)
+{
+    /*
+    *===========================================================================
+    *   sdcompress_reset
+    *   Takes:   stCompressor - compressor state
+    *            abyOutput - where the compressed block is built
+    *            wOutputSize - size of abyOutput
+    *
+    *   Returns: Nothing.
+    *
+    *   Starts a new block, nothing from the previous block is referenced.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stCompressor->abyOutput = abyOutput;
+    stCompressor->wOutputSize = wOutputSize;
+    stCompressor->wOutputLength = 0;
+    stCompressor->wRawLength = 0;
+    memset(stCompressor->awHashTable, 0, sizeof(stCompressor->awHashTable));
+}
+
+esp_err_t sdcompress_append(stSDCompressor_t *stCompressor, const byte *abyData, word wLength)
+{
+    /*
+    *===========================================================================
+    *   sdcompress_append
+    *   Takes:   stCompressor - compressor state
+    *            abyData - record to add
+    *            wLength - length of the record
+    *
+    *   Returns: ESP_OK if added, ESP_ERR_NO_MEM if the block is full.
+    *
+    *   Compresses a record onto the end of the block. The record is only
+    *   accepted if it is guaranteed to fit so a record is never split between
+    *   blocks. Greedy matching with a single hash probe per position, cheap
+    *   enough to run in the logging path.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (stCompressor->wRawLength + wLength > SDCOMPRESS_RAW_SIZE ||
+        stCompressor->wOutputLength + SDCOMPRESS_WORST_CASE(wLength) > stCompressor->wOutputSize)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    byte *abyRaw = stCompressor->abyRaw;
+    word wStart = stCompressor->wRawLength;
+    word wEnd = wStart + wLength;
+    word wPosition = wStart;
+    word wLiteralStart = wStart;
+    memcpy(&abyRaw[wStart], abyData, wLength);
+    stCompressor->wRawLength = wEnd;
+
+    while (wPosition + SDCOMPRESS_MIN_MATCH <= wEnd)
+    {
+        uint32_t dwSequence;
+        memcpy(&dwSequence, &abyRaw[wPosition], sizeof(dwSequence));
+        uint32_t dwHash = (uint32_t)(dwSequence * SDCOMPRESS_HASH_MULTIPLIER) >> (32 - SDCOMPRESS_HASH_BITS);
+        word wCandidate = stCompressor->awHashTable[dwHash];
+        stCompressor->awHashTable[dwHash] = wPosition + 1;
+
+        if (wCandidate != 0 && memcmp(&abyRaw[wCandidate - 1], &abyRaw[wPosition], SDCOMPRESS_MIN_MATCH) == 0)
+        {
+            wCandidate--;
+            word wMatchLength = SDCOMPRESS_MIN_MATCH;
+            while (wPosition + wMatchLength < wEnd && abyRaw[wCandidate + wMatchLength] == abyRaw[wPosition + wMatchLength])
+            {
+                wMatchLength++;
+            }
+            sdcompress_emit(stCompressor, &abyRaw[wLiteralStart], wPosition - wLiteralStart,
+                            wPosition - wCandidate, wMatchLength);
+            wPosition += wMatchLength;
+            wLiteralStart = wPosition;
+        }
+        else
+        {
+            wPosition++;
+        }
+    }
+    if (wLiteralStart < wEnd)
+    {
+        sdcompress_emit(stCompressor, &abyRaw[wLiteralStart], wEnd - wLiteralStart, 0, 0);
+    }
+    return ESP_OK;
+}
+
+static void sdcompress_emit(stSDCompressor_t *stCompressor, const byte *abyLiterals, word wNLiterals,
+                            word wOffset, word wMatchLength)
+{
+    /*
+    *===========================================================================
+    *   sdcompress_emit
+    *   Takes:   stCompressor - compressor state
+    *            abyLiterals - bytes to copy as is
+    *            wNLiterals - number of literals
+    *            wOffset - distance back to the match, 0 for no match
+    *            wMatchLength - length of the match, 0 for no match
+    *
+    *   Returns: Nothing.
+    *
+    *   Writes one sequence to the output, the caller has checked it fits.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    byte *pbyOut = &stCompressor->abyOutput[stCompressor->wOutputLength];
+    word wMatchCode = (wMatchLength > 0) ? wMatchLength - SDCOMPRESS_MIN_MATCH : 0;
+    word wRemaining;
+
+    *pbyOut++ = (byte)(((wNLiterals < SDCOMPRESS_NIBBLE_MAX ? wNLiterals : SDCOMPRESS_NIBBLE_MAX) << 4) |
+                       (wMatchCode < SDCOMPRESS_NIBBLE_MAX ? wMatchCode : SDCOMPRESS_NIBBLE_MAX));
+    if (wNLiterals >= SDCOMPRESS_NIBBLE_MAX)
+    {
+        for (wRemaining = wNLiterals - SDCOMPRESS_NIBBLE_MAX; wRemaining >= SDCOMPRESS_LENGTH_BYTE_MAX;
+             wRemaining -= SDCOMPRESS_LENGTH_BYTE_MAX)
+        {
+            *pbyOut++ = SDCOMPRESS_LENGTH_BYTE_MAX;
+        }
+        *pbyOut++ = (byte)wRemaining;
+    }
+    memcpy(pbyOut, abyLiterals, wNLiterals);
+    pbyOut += wNLiterals;
+    *pbyOut++ = (byte)(wOffset & 0xFF);
+    *pbyOut++ = (byte)(wOffset >> 8);
+    if (wMatchLength > 0 && wMatchCode >= SDCOMPRESS_NIBBLE_MAX)
+    {
+        for (wRemaining = wMatchCode - SDCOMPRESS_NIBBLE_MAX; wRemaining >= SDCOMPRESS_LENGTH_BYTE_MAX;
+             wRemaining -= SDCOMPRESS_LENGTH_BYTE_MAX)
+        {
+            *pbyOut++ = SDCOMPRESS_LENGTH_BYTE_MAX;
+        }
+        *pbyOut++ = (byte)wRemaining;
+    }
+    stCompressor->wOutputLength = (word)(pbyOut - stCompressor->abyOutput);
+}
+
+int sdcompress_decompress(const byte *abyInput, word wInputLength, byte *abyOutput, word wOutputSize)
+{
+    /*
+    *===========================================================================
+    *   sdcompress_decompress
+    *   Takes:   abyInput - compressed block payload
+    *            wInputLength - length of the payload
+    *            abyOutput - buffer for the decompressed records
+    *            wOutputSize - size of abyOutput, SDCOMPRESS_RAW_SIZE is always enough
+    *
+    *   Returns: Number of bytes decompressed, -1 if the payload is corrupt.
+    *
+    *   Every access is bounds checked, a damaged block fails cleanly.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    dword dwIn = 0;
+    dword dwOut = 0;
+    dword dwLength;
+    byte byExtra;
+
+    while (dwIn < wInputLength)
+    {
+        byte byToken = abyInput[dwIn++];
+
+        /* Literals */
+        dwLength = byToken >> 4;
+        if (dwLength == SDCOMPRESS_NIBBLE_MAX)
+        {
+            do
+            {
+                if (dwIn >= wInputLength)
+                {
+                    return -1;
+                }
+                byExtra = abyInput[dwIn++];
+                dwLength += byExtra;
+            } while (byExtra == SDCOMPRESS_LENGTH_BYTE_MAX);
+        }
+        if (dwIn + dwLength > wInputLength || dwOut + dwLength > wOutputSize)
+        {
+            return -1;
+        }
+        memcpy(&abyOutput[dwOut], &abyInput[dwIn], dwLength);
+        dwIn += dwLength;
+        dwOut += dwLength;
+
+        /* Match */
+        if (dwIn + 2 > wInputLength)
+        {
+            return -1;
+        }
+        dword dwOffset = (dword)abyInput[dwIn] | ((dword)abyInput[dwIn + 1] << 8);
+        dwIn += 2;
+        if (dwOffset == 0)
+        {
+            continue;
+        }
+        dwLength = (byToken & SDCOMPRESS_NIBBLE_MAX) + SDCOMPRESS_MIN_MATCH;
+        if ((byToken & SDCOMPRESS_NIBBLE_MAX) == SDCOMPRESS_NIBBLE_MAX)
+        {
+            do
+            {
+                if (dwIn >= wInputLength)
+                {
+                    return -1;
+                }
+                byExtra = abyInput[dwIn++];
+                dwLength += byExtra;
+            } while (byExtra == SDCOMPRESS_LENGTH_BYTE_MAX);
+        }
+        if (dwOffset > dwOut || dwOut + dwLength > wOutputSize)
+        {
+            return -1;
+        }
+        /* Byte by byte, a match may overlap the bytes it is producing */
+        for (dword i = 0; i < dwLength; i++)
+        {
+            abyOutput[dwOut + i] = abyOutput[dwOut - dwOffset + i];
+        }
+        dwOut += dwLength;
+    }
+    return (int)dwOut;
+}
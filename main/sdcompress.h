@@ -0,0 +1,36 @@
+#ifndef SFR_SDCOMPRESS
+#define SFR_SDCOMPRESS
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sfrtypes.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SDCOMPRESS_RAW_SIZE 16384 // max uncompressed bytes per block (bytes)
+#define SDCOMPRESS_HASH_BITS 11
+#define SDCOMPRESS_HASH_SIZE (1 << SDCOMPRESS_HASH_BITS)
+#define SDCOMPRESS_MIN_MATCH 4
+/* Largest output a record of n bytes can produce, used to check it fits before compressing */
+#define SDCOMPRESS_WORST_CASE(n) ((n) + (n) / 8 + 8)
+
+/* --------------------------- Types ---------------------------------------- */
+/*
+* Streaming LZ77 compressor, one instance per log block. Records are added one
+* at a time and matched against everything already in the block, the block is
+* the whole window so every block decompresses on its own.
+*/
+typedef struct {
+    byte *abyOutput;
+    word wOutputSize;
+    word wOutputLength;
+    word wRawLength;
+    byte abyRaw[SDCOMPRESS_RAW_SIZE];
+    word awHashTable[SDCOMPRESS_HASH_SIZE]; // position + 1 of the last 4 byte sequence with this hash, 0 = empty
+} stSDCompressor_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+void sdcompress_reset(stSDCompressor_t *stCompressor, byte *abyOutput, word wOutputSize);
+esp_err_t sdcompress_append(stSDCompressor_t *stCompressor, const byte *abyData, word wLength);
+int sdcompress_decompress(const byte *abyInput, word wInputLength, byte *abyOutput, word wOutputSize);
+
+#endif // SFR_SDCOMPRESS
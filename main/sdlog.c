@@ -0,0 +1,229 @@
+/*
+sdlog.c
+File contains the block format used by the SD card logger. Blocks are sealed
+with a sequence number and a CRC protected commit marker so a log cut short by
+a power loss can be trimmed back to the last complete block at boot.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include "esp_crc.h"
+#include "esp_log.h"
+#include "sdlog.h"
+
+/* --------------------------- Function prototypes -------------------------- */
+dword sdlog_crc32(dword dwCRC, const byte *abyData, dword dwLength);
+void sdlog_seal_block(byte *abyBlock, dword dwSessionID, dword dwSequence, dword dwTimestampms,
+                      word wPayloadLength, word wFlags);
+boolean sdlog_block_valid(const byte *abyBlock, dword dwSessionID, dword dwSequence);
+esp_err_t sdlog_recover(const char *abyPath, dword *pdwNBlocks);
+static boolean sdlog_read_block(FILE *stFile, dword dwNBlock, byte *abyBlock);
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SDLOG_COMMIT_OFFSET (SDLOG_BLOCK_SIZE - sizeof(stSDLogCommit_t))
+
+/* --------------------------- Local Variables ------------------------------ */
+static byte abyRecoveryBlock[SDLOG_BLOCK_SIZE];
+
+/* --------------------------- Functions ------------------------------------ */
+
+dword sdlog_crc32(dword dwCRC, const byte *abyData, dword dwLength)
+{
+    /*
+    *===========================================================================
+    *   sdlog_crc32
+    *   Takes:   dwCRC - running CRC, 0 to start
+    *            abyData - data to add to the CRC
+    *            dwLength - number of bytes
+    *
+    *   Returns: Updated CRC32 (IEEE 802.3, same as zlib).
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    return (dword)esp_crc32_le((uint32_t)dwCRC, abyData, (uint32_t)dwLength);
+}
+
+void sdlog_seal_block(byte *abyBlock, dword dwSessionID, dword dwSequence, dword dwTimestampms,
+                      word wPayloadLength, word wFlags)
+{
+    /*
+    *===========================================================================
+    *   sdlog_seal_block
+    *   Takes:   abyBlock - SDLOG_BLOCK_SIZE buffer, payload already in place
+    *            dwSessionID - ID of the log file the block belongs to
+    *            dwSequence - index of the block in the file
+    *            dwTimestampms - time of the first record in the block
+    *            wPayloadLength - bytes of payload used
+    *            wFlags - block flags
+    *
+    *   Returns: Nothing.
+    *
+    *   Fills in the block header and the commit marker. Unused payload is
+    *   zeroed so the block on the card does not carry stale data.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stSDLogBlockHeader_t stHeader =
+    {
+        .dwMagic = SDLOG_BLOCK_MAGIC,
+        .dwSessionID = (uint32_t)dwSessionID,
+        .dwSequence = (uint32_t)dwSequence,
+        .dwTimestampms = (uint32_t)dwTimestampms,
+        .wPayloadLength = (uint16_t)wPayloadLength,
+        .wFlags = (uint16_t)wFlags,
+    };
+    memcpy(abyBlock, &stHeader, sizeof(stHeader));
+    memset(abyBlock + sizeof(stHeader) + wPayloadLength, 0, SDLOG_PAYLOAD_SIZE - wPayloadLength);
+
+    stSDLogCommit_t stCommit =
+    {
+        .dwMagic = SDLOG_COMMIT_MAGIC,
+        .dwSequence = (uint32_t)dwSequence,
+        .dwCRC = (uint32_t)sdlog_crc32(0, abyBlock, sizeof(stHeader) + wPayloadLength),
+    };
+    memcpy(abyBlock + SDLOG_COMMIT_OFFSET, &stCommit, sizeof(stCommit));
+}
+
+boolean sdlog_block_valid(const byte *abyBlock, dword dwSessionID, dword dwSequence)
+{
+    /*
+    *===========================================================================
+    *   sdlog_block_valid
+    *   Takes:   abyBlock - SDLOG_BLOCK_SIZE buffer read from the card
+    *            dwSessionID - expected session
+    *            dwSequence - expected block index
+    *
+    *   Returns: TRUE if the block is complete and belongs to this file.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stSDLogBlockHeader_t stHeader;
+    stSDLogCommit_t stCommit;
+    memcpy(&stHeader, abyBlock, sizeof(stHeader));
+    memcpy(&stCommit, abyBlock + SDLOG_COMMIT_OFFSET, sizeof(stCommit));
+
+    if (stHeader.dwMagic != SDLOG_BLOCK_MAGIC || stCommit.dwMagic != SDLOG_COMMIT_MAGIC ||
+        stHeader.dwSessionID != dwSessionID || stHeader.dwSequence != dwSequence ||
+        stCommit.dwSequence != dwSequence || stHeader.wPayloadLength > SDLOG_PAYLOAD_SIZE)
+    {
+        return FALSE;
+    }
+    return sdlog_crc32(0, abyBlock, sizeof(stHeader) + stHeader.wPayloadLength) == stCommit.dwCRC;
+}
+
+esp_err_t sdlog_recover(const char *abyPath, dword *pdwNBlocks)
+{
+    /*
+    *===========================================================================
+    *   sdlog_recover
+    *   Takes:   abyPath - log file to check
+    *            pdwNBlocks - returns the number of good blocks, may be NULL
+    *
+    *   Returns: ESP_OK if the file is consistent or was repaired, error code if not.
+    *
+    *   Finds the last committed block and truncates the file after it. The
+    *   logger preallocates space so the file length on the card is normally
+    *   past the real end of the data. Blocks are written in order so the good
+    *   blocks are always a prefix of the file, this lets the scan binary search
+    *   for the end in log2(blocks) reads rather than reading the whole file.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stSDLogBlockHeader_t stHeader;
+    dword dwNGoodBlocks = 0;
+
+    FILE *stFile = fopen(abyPath, "r+b");
+    if (stFile == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (fseek(stFile, 0, SEEK_END) != 0)
+    {
+        fclose(stFile);
+        return ESP_FAIL;
+    }
+    long sdwFileLength = ftell(stFile);
+    dword dwNBlocks = (sdwFileLength > 0) ? (dword)sdwFileLength / SDLOG_BLOCK_SIZE : 0;
+
+    /* The first block tells us which session the file belongs to */
+    if (dwNBlocks > 0 && sdlog_read_block(stFile, 0, abyRecoveryBlock))
+    {
+        memcpy(&stHeader, abyRecoveryBlock, sizeof(stHeader));
+        if (sdlog_block_valid(abyRecoveryBlock, stHeader.dwSessionID, 0))
+        {
+            /* Invariant: block dwLow is good, block dwHigh is not (or past the end) */
+            dword dwLow = 0;
+            dword dwHigh = dwNBlocks;
+            while (dwHigh - dwLow > 1)
+            {
+                dword dwMid = dwLow + (dwHigh - dwLow) / 2;
+                if (sdlog_read_block(stFile, dwMid, abyRecoveryBlock) &&
+                    sdlog_block_valid(abyRecoveryBlock, stHeader.dwSessionID, dwMid))
+                {
+                    dwLow = dwMid;
+                }
+                else
+                {
+                    dwHigh = dwMid;
+                }
+            }
+            dwNGoodBlocks = dwLow + 1;
+        }
+    }
+
+    esp_err_t NStatus = ESP_OK;
+    if ((long)(dwNGoodBlocks * SDLOG_BLOCK_SIZE) != sdwFileLength)
+    {
+        fflush(stFile);
+        if (ftruncate(fileno(stFile), (off_t)(dwNGoodBlocks * SDLOG_BLOCK_SIZE)) != 0)
+        {
+            NStatus = ESP_FAIL;
+        }
+        ESP_LOGW("SDCARD", "Recovered %s: %lu good blocks, trimmed %ld bytes", abyPath,
+            (unsigned long)dwNGoodBlocks, sdwFileLength - (long)(dwNGoodBlocks * SDLOG_BLOCK_SIZE));
+    }
+    fclose(stFile);
+
+    if (pdwNBlocks != NULL)
+    {
+        *pdwNBlocks = dwNGoodBlocks;
+    }
+    return NStatus;
+}
+
+static boolean sdlog_read_block(FILE *stFile, dword dwNBlock, byte *abyBlock)
+{
+    /*
+    *===========================================================================
+    *   sdlog_read_block
+    *   Takes:   stFile - open log file
+    *            dwNBlock - block index to read
+    *            abyBlock - SDLOG_BLOCK_SIZE buffer to read into
+    *
+    *   Returns: TRUE if a whole block was read.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (fseek(stFile, (long)(dwNBlock * SDLOG_BLOCK_SIZE), SEEK_SET) != 0)
+    {
+        return FALSE;
+    }
+    return fread(abyBlock, 1, SDLOG_BLOCK_SIZE, stFile) == SDLOG_BLOCK_SIZE;
+}
@@ -0,0 +1,67 @@
+#ifndef SFR_SDLOG
+#define SFR_SDLOG
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sfrtypes.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+/*
+* Log files are a sequence of fixed size blocks. Each block carries a header
+* and ends in a commit marker, the commit marker is the last thing written so a
+* block that was torn by a power cut fails its CRC. Fixed size blocks let the
+* recovery scan binary search for the last good block instead of reading the
+* whole file.
+*/
+#define SDLOG_BLOCK_SIZE 4096 // bytes, multiple of the 512 byte sector size
+#define SDLOG_BLOCK_MAGIC 0x4B4C4653 // "SFLK"
+#define SDLOG_COMMIT_MAGIC 0x544D4F43 // "COMT"
+
+/* Block flags */
+#define SDLOG_FLAG_COMPRESSED 0x0001 // payload is an sdcompress stream
+#define SDLOG_FLAG_INDEX 0x0002 // payload is the time index, no records
+
+/*
+* Sparse time index. The logger keeps one entry every so often mapping a time
+* to the block that holds it and writes the whole index so far as a block of
+* its own at every sequence n * SDLOG_INDEX_INTERVAL - 1. The last index block
+* is the log's trailer, a reader jumps to it from the file length and only
+* bisects the block headers between two entries. A log cut short by a power
+* loss still has one within SDLOG_INDEX_INTERVAL blocks of its end.
+*/
+#define SDLOG_INDEX_INTERVAL 256 // blocks, 1 MB
+
+/* --------------------------- Types ---------------------------------------- */
+/* On card layout, fixed width types so the layout does not depend on the target */
+typedef struct __attribute__((packed)) {
+    uint32_t dwMagic;
+    uint32_t dwSessionID;   // random per file, rejects stale blocks in preallocated space
+    uint32_t dwSequence;    // block index within the file
+    uint32_t dwTimestampms; // time since power up of the first record in the block
+    uint16_t wPayloadLength;
+    uint16_t wFlags;
+} stSDLogBlockHeader_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t dwMagic;
+    uint32_t dwSequence;
+    uint32_t dwCRC;         // CRC32 of header and payload
+} stSDLogCommit_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t dwTimestampms; // time of the first record in the block
+    uint32_t dwBlock;
+} stSDLogIndexEntry_t;
+
+#define SDLOG_PAYLOAD_SIZE (SDLOG_BLOCK_SIZE - sizeof(stSDLogBlockHeader_t) - sizeof(stSDLogCommit_t))
+#define SDLOG_INDEX_ENTRIES (SDLOG_PAYLOAD_SIZE / sizeof(stSDLogIndexEntry_t))
+
+/* --------------------------- Function prototypes -------------------------- */
+dword sdlog_crc32(dword dwCRC, const byte *abyData, dword dwLength);
+void sdlog_seal_block(byte *abyBlock, dword dwSessionID, dword dwSequence, dword dwTimestampms,
+                      word wPayloadLength, word wFlags);
+boolean sdlog_block_valid(const byte *abyBlock, dword dwSessionID, dword dwSequence);
+esp_err_t sdlog_recover(const char *abyPath, dword *pdwNBlocks);
+
+#endif // SFR_SDLOG
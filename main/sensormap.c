@@ -0,0 +1,301 @@
+/*
+sensormap.c
+File contains the sensor maps, the lookup tables turning a sensor voltage
+into a real value. read_sensor uses the float map as written in the
+stSensorMap_t. The C6 has no FPU so every float operation there is a soft
+float library call; the fixed point map is the same table built once into
+integer microvolts and Q16.16 values with the slope of every segment worked
+out ahead, so a lookup from the calibration's millivolts is a binary search,
+a subtract and a multiply.
+
+Breakpoints are kept in uV as rounding them to the mV of the input moves
+the narrow segments of a tight curve enough to show. A fixed point slope
+has SENSOR_SLOPE_SHIFT more fraction bits than a value, which keeps the
+interpolation within a Q16.16 LSB of exact across a whole segment. Steeper
+than 500 units per mV does not fit and the map is refused.
+
+The compiled map keeps the float arithmetic, and its results, but not the
+search: slopes are worked out ahead with sensor_map_lookup's own division,
+evenly spaced voltages are indexed directly and anything else gets a binary
+search with no branches in its loop. Either way the interpolation is the
+same float operations on the same values, so it matches bit for bit.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <math.h>
+#include "sensormap.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SENSORMAP_UV_PER_V 1000000.0
+#define SENSORMAP_UV_PER_MV 1000
+#define SENSORMAP_UNIFORM_TOLERANCE 0.25f   // of a step, breakpoints closer than this to even spacing index directly
+_Static_assert(sizeof(((stSensorMap_t *)0)->afLookupTable[0]) / sizeof(float) == SENSOR_MAP_POINTS,
+               "stSensorMap_t and SENSOR_MAP_POINTS disagree");
+
+/* --------------------------- Function prototypes -------------------------- */
+float sensor_map_lookup(const stSensorMap_t *stSensorMap, float fVSensor);
+esp_err_t sensor_map_q_init(const stSensorMap_t *stSensorMap, stSensorMapQ_t *stSensorMapQ);
+sdword sensor_map_q_lookup(const stSensorMapQ_t *stSensorMapQ, word wVSensormV);
+esp_err_t sensor_map_compile(const stSensorMap_t *stSensorMap, stSensorMapCompiled_t *stCompiled);
+float sensor_map_compiled_lookup(const stSensorMapCompiled_t *stCompiled, float fVSensor);
+
+/* --------------------------- Functions ------------------------------------ */
+
+float sensor_map_lookup(const stSensorMap_t *stSensorMap, float fVSensor)
+{
+    /*
+    *===========================================================================
+    *   sensor_map_lookup
+    *   Takes:   stSensorMap - limits and lookup table
+    *            fVSensor - sensor voltage (V)
+    *
+    *   Returns: Interpolated sensor value, or SENSOR_ERROR outside the limits
+    *            or the table.
+    *
+    *   Includes plausibility check based on sensor map limits for SCS compliance.
+    *===========================================================================
+    *   Revision History:
+    *   16/11/25 CP Initial Version, in read_sensor
+    *   18/10/26 CP Split out of read_sensor so the fixed point map can be checked against it
+    *
+    *===========================================================================
+    */
+    uint8_t NCounter;
+    /* If outside plauseable range throw error (SCS Requirement) */
+    if (fVSensor < stSensorMap->fLowerLimit || fVSensor > stSensorMap->fUpperLimit)
+    {
+        return SENSOR_ERROR;
+    }
+
+    /* Lookup Sensor Value */
+    for (NCounter = 0; NCounter < SENSOR_MAP_POINTS - 1; NCounter++)
+    {
+        if (fVSensor >= stSensorMap->afLookupTable[0][NCounter] && fVSensor < stSensorMap->afLookupTable[0][NCounter + 1])
+        {
+            float fSlope = (stSensorMap->afLookupTable[1][NCounter + 1] - stSensorMap->afLookupTable[1][NCounter]) /
+                           (stSensorMap->afLookupTable[0][NCounter + 1] - stSensorMap->afLookupTable[0][NCounter]);
+            float fOutput = stSensorMap->afLookupTable[1][NCounter] +
+                            fSlope * (fVSensor - stSensorMap->afLookupTable[0][NCounter]);
+            return fOutput;
+        }
+    }
+
+    return SENSOR_ERROR;
+}
+
+esp_err_t sensor_map_q_init(const stSensorMap_t *stSensorMap, stSensorMapQ_t *stSensorMapQ)
+{
+    /*
+    *===========================================================================
+    *   sensor_map_q_init
+    *   Takes:   stSensorMap - float map to convert
+    *            stSensorMapQ - fixed point map to build
+    *
+    *   Returns: ESP_OK, or ESP_ERR_INVALID_ARG if the voltages go backwards
+    *            or below 0 V, a value is past Q16.16 or a slope too steep.
+    *
+    *   The only place the fixed point path does float arithmetic, call it
+    *   once at start up.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (stSensorMap == NULL || stSensorMapQ == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (word i = 0; i < SENSOR_MAP_POINTS; i++)
+    {
+        double fVoltageuV = round((double)stSensorMap->afLookupTable[0][i] * SENSORMAP_UV_PER_V);
+        double fOutputQ = round((double)stSensorMap->afLookupTable[1][i] * SENSOR_Q_ONE);
+        if (fVoltageuV < 0.0 || fVoltageuV > (double)UINT16_MAX * SENSORMAP_UV_PER_MV || fOutputQ <= INT32_MIN ||
+            fOutputQ > INT32_MAX || (i > 0 && fVoltageuV < stSensorMapQ->adwVoltageuV[i - 1]))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        stSensorMapQ->adwVoltageuV[i] = (dword)fVoltageuV;
+        stSensorMapQ->asdwOutputQ[i] = (sdword)fOutputQ;
+    }
+
+    /* Slopes from the rounded points, so each segment ends where the next starts */
+    for (word i = 0; i < SENSOR_MAP_POINTS - 1; i++)
+    {
+        dword dwtWidthuV = stSensorMapQ->adwVoltageuV[i + 1] - stSensorMapQ->adwVoltageuV[i];
+        double fSlopeQ = 0.0;
+        if (dwtWidthuV != 0)
+        {
+            fSlopeQ = round((double)(stSensorMapQ->asdwOutputQ[i + 1] - (sqword)stSensorMapQ->asdwOutputQ[i]) *
+                            (1 << SENSOR_SLOPE_SHIFT) / dwtWidthuV);
+        }
+        if (fSlopeQ <= INT32_MIN || fSlopeQ > INT32_MAX)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        stSensorMapQ->asdwSlopeQ[i] = (sdword)fSlopeQ;
+    }
+
+    double fLowerLimituV = round((double)stSensorMap->fLowerLimit * SENSORMAP_UV_PER_V);
+    double fUpperLimituV = round((double)stSensorMap->fUpperLimit * SENSORMAP_UV_PER_V);
+    stSensorMapQ->dwLowerLimituV = (dword)fmax(0.0, fmin(fLowerLimituV, UINT32_MAX));
+    stSensorMapQ->dwUpperLimituV = (dword)fmax(0.0, fmin(fUpperLimituV, UINT32_MAX));
+    return ESP_OK;
+}
+
+sdword sensor_map_q_lookup(const stSensorMapQ_t *stSensorMapQ, word wVSensormV)
+{
+    /*
+    *===========================================================================
+    *   sensor_map_q_lookup
+    *   Takes:   stSensorMapQ - map from sensor_map_q_init
+    *            wVSensormV - sensor voltage (mV)
+    *
+    *   Returns: Interpolated sensor value in Q16.16, or SENSOR_Q_ERROR
+    *            outside the limits or the table.
+    *
+    *   sensor_map_lookup in integers, the same limits and the same segments:
+    *   the last breakpoint is off the table as it is there.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    const dword *adwVoltageuV = stSensorMapQ->adwVoltageuV;
+    dword dwVSensoruV = (dword)wVSensormV * SENSORMAP_UV_PER_MV;
+    if (dwVSensoruV < stSensorMapQ->dwLowerLimituV || dwVSensoruV > stSensorMapQ->dwUpperLimituV ||
+        dwVSensoruV < adwVoltageuV[0] || dwVSensoruV >= adwVoltageuV[SENSOR_MAP_POINTS - 1])
+    {
+        return SENSOR_Q_ERROR;
+    }
+
+    /* Segment with adwVoltageuV[byLow] <= dwVSensoruV < adwVoltageuV[byLow + 1] */
+    byte byLow = 0;
+    byte byHigh = SENSOR_MAP_POINTS - 1;
+    while (byHigh - byLow > 1)
+    {
+        byte byMid = (byte)((byLow + byHigh) / 2);
+        if (adwVoltageuV[byMid] <= dwVSensoruV)
+        {
+            byLow = byMid;
+        }
+        else
+        {
+            byHigh = byMid;
+        }
+    }
+
+    sqword sqwDeltaQ = (sqword)stSensorMapQ->asdwSlopeQ[byLow] * (dwVSensoruV - adwVoltageuV[byLow]);
+    return stSensorMapQ->asdwOutputQ[byLow] +
+           (sdword)((sqwDeltaQ + (1 << (SENSOR_SLOPE_SHIFT - 1))) >> SENSOR_SLOPE_SHIFT);
+}
+
+esp_err_t sensor_map_compile(const stSensorMap_t *stSensorMap, stSensorMapCompiled_t *stCompiled)
+{
+    /*
+    *===========================================================================
+    *   sensor_map_compile
+    *   Takes:   stSensorMap - float map to compile
+    *            stCompiled - compiled map to build
+    *
+    *   Returns: ESP_OK, or ESP_ERR_INVALID_ARG if the voltages go backwards
+    *            or are not numbers. Keep such a map on sensor_map_lookup.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (stSensorMap == NULL || stCompiled == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const float *afVoltage = stSensorMap->afLookupTable[0];
+    const float *afOutput = stSensorMap->afLookupTable[1];
+    for (word i = 0; i < SENSOR_MAP_POINTS; i++)
+    {
+        if (!(afVoltage[i] == afVoltage[i]) || (i > 0 && !(afVoltage[i] >= afVoltage[i - 1])))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        stCompiled->afVoltage[i] = afVoltage[i];
+        stCompiled->afOutput[i] = afOutput[i];
+    }
+
+    /* Segments a voltage can never fall in (zero width) keep whatever the division gives */
+    for (word i = 0; i < SENSOR_MAP_POINTS - 1; i++)
+    {
+        stCompiled->afSlope[i] = (afOutput[i + 1] - afOutput[i]) / (afVoltage[i + 1] - afVoltage[i]);
+    }
+    stCompiled->fLowerLimit = stSensorMap->fLowerLimit;
+    stCompiled->fUpperLimit = stSensorMap->fUpperLimit;
+
+    /* Evenly spaced if the guess from the first voltage and the step is never out by a segment */
+    float fStep = (afVoltage[SENSOR_MAP_POINTS - 1] - afVoltage[0]) / (SENSOR_MAP_POINTS - 1);
+    stCompiled->bUniform = (fStep > 0.0f);
+    for (word i = 0; i < SENSOR_MAP_POINTS && stCompiled->bUniform; i++)
+    {
+        float fError = afVoltage[i] - (afVoltage[0] + fStep * i);
+        stCompiled->bUniform = (fError <= fStep * SENSORMAP_UNIFORM_TOLERANCE && fError >= -fStep * SENSORMAP_UNIFORM_TOLERANCE);
+    }
+    stCompiled->fInverseStep = stCompiled->bUniform ? 1.0f / fStep : 0.0f;
+    return ESP_OK;
+}
+
+float sensor_map_compiled_lookup(const stSensorMapCompiled_t *stCompiled, float fVSensor)
+{
+    /*
+    *===========================================================================
+    *   sensor_map_compiled_lookup
+    *   Takes:   stCompiled - map from sensor_map_compile
+    *            fVSensor - sensor voltage (V)
+    *
+    *   Returns: Interpolated sensor value, or SENSOR_ERROR outside the limits
+    *            or the table. The same bits as sensor_map_lookup.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    const float *afVoltage = stCompiled->afVoltage;
+    /* Written so that NaN fails too */
+    if (!(fVSensor >= stCompiled->fLowerLimit && fVSensor <= stCompiled->fUpperLimit &&
+          fVSensor >= afVoltage[0] && fVSensor < afVoltage[SENSOR_MAP_POINTS - 1]))
+    {
+        return SENSOR_ERROR;
+    }
+
+    byte byIndex;
+    if (stCompiled->bUniform)
+    {
+        /* The guess can be a segment out from rounding or uneven spacing, one step puts it right */
+        sdword sdwGuess = (sdword)((fVSensor - afVoltage[0]) * stCompiled->fInverseStep);
+        byIndex = (byte)((sdwGuess < 0) ? 0 : (sdwGuess > SENSOR_MAP_POINTS - 2) ? SENSOR_MAP_POINTS - 2 : sdwGuess);
+        if (fVSensor < afVoltage[byIndex])
+        {
+            byIndex--;
+        }
+        else if (fVSensor >= afVoltage[byIndex + 1])
+        {
+            byIndex++;
+        }
+    }
+    else
+    {
+        /* Last segment starting at or below the voltage, a select per halving */
+        byIndex = 0;
+        byte byNSegments = SENSOR_MAP_POINTS - 1;
+        while (byNSegments > 1)
+        {
+            byte byHalf = byNSegments / 2;
+            byIndex = (afVoltage[byIndex + byHalf] <= fVSensor) ? byIndex + byHalf : byIndex;
+            byNSegments -= byHalf;
+        }
+    }
+
+    return stCompiled->afOutput[byIndex] + stCompiled->afSlope[byIndex] * (fVSensor - afVoltage[byIndex]);
+}
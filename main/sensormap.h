@@ -0,0 +1,44 @@
+#ifndef SFR_SENSORMAP
+#define SFR_SENSORMAP
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#include "sfrtypes.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SENSOR_MAP_POINTS 101
+#define SENSOR_ERROR -999.0f            // read_sensor and sensor_map_lookup, implausible input
+#define SENSOR_Q_SHIFT 16               // fixed point sensor values are Q16.16
+#define SENSOR_Q_ONE (1 << SENSOR_Q_SHIFT)
+#define SENSOR_Q_ERROR INT32_MIN        // fixed point implausible input
+#define SENSOR_SLOPE_SHIFT 16           // slopes carry this many more fraction bits than values
+#define SENSOR_Q_TO_FLOAT(sdwValue) ((float)(sdwValue) / (float)SENSOR_Q_ONE)
+
+/* --------------------------- Types ---------------------------------------- */
+typedef struct {
+    dword dwLowerLimituV;
+    dword dwUpperLimituV;
+    dword adwVoltageuV[SENSOR_MAP_POINTS];          // breakpoints finer than the mV input keep tight curves true
+    sdword asdwOutputQ[SENSOR_MAP_POINTS];          // Q16.16
+    sdword asdwSlopeQ[SENSOR_MAP_POINTS - 1];       // Q16.16 per uV, SENSOR_SLOPE_SHIFT more fraction bits
+} stSensorMapQ_t;
+
+typedef struct {
+    float fLowerLimit;
+    float fUpperLimit;
+    float afVoltage[SENSOR_MAP_POINTS];
+    float afOutput[SENSOR_MAP_POINTS];
+    float afSlope[SENSOR_MAP_POINTS - 1];           // as sensor_map_lookup works it out
+    boolean bUniform;                               // evenly spaced voltages, indexed directly
+    float fInverseStep;                             // segments per V when bUniform
+} stSensorMapCompiled_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+float sensor_map_lookup(const stSensorMap_t *stSensorMap, float fVSensor);
+esp_err_t sensor_map_q_init(const stSensorMap_t *stSensorMap, stSensorMapQ_t *stSensorMapQ);
+sdword sensor_map_q_lookup(const stSensorMapQ_t *stSensorMapQ, word wVSensormV);
+esp_err_t sensor_map_compile(const stSensorMap_t *stSensorMap, stSensorMapCompiled_t *stCompiled);
+float sensor_map_compiled_lookup(const stSensorMapCompiled_t *stCompiled, float fVSensor);
+
+#endif // SFR_SENSORMAP
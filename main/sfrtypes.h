@@ -6,6 +6,7 @@ Written by Cole Perera for Sheffield Formula Racing 2025
 */
 #define DEBUG
 #ifndef SFRTypes
+#include <stdint.h>
 #include "esp_adc/adc_oneshot.h"
 #include "esp_adc/adc_cali.h"
 #include "esp_adc/adc_cali_scheme.h"
@@ -21,8 +22,9 @@ typedef signed char sbyte;
 typedef unsigned short word;
 typedef signed short sword;
 
-typedef unsigned long dword;
-typedef signed long sdword;
+/* Same as unsigned long on the target, and still 32 bits in host builds */
+typedef uint32_t dword;
+typedef int32_t sdword;
 
 typedef unsigned long long qword;
 typedef signed long long sqword;
@@ -31,7 +33,10 @@ typedef struct {
     dword dwID;      // CAN ID (11- bit packed in 16-bit)
     byte  byDLC;      // 0-8 (Data Length Code)
     byte  abData[8];  // up to 8 bytes
+    qword qwtTimestampus; // time of reception (us since boot), 0 for frames built locally
+    byte  byBus;      // bus it was received on, CAN_BUS_NONE if it did not come from a bus here
 } CAN_frame_t;
+#define CAN_BUS_NONE 0xFF // CAN_frame_t.byBus of frames made here or received over ESP-NOW
 
 typedef struct {
     adc_cali_handle_t stCalibration;
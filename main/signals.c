@@ -0,0 +1,394 @@
+/*
+signals.c
+File contains the live signal store. Every received frame the CAN database
+knows is decoded in the RX ISR and its signals written to one flat array, so
+the latest value of any signal is an index away for the rest of the firmware.
+Values are the generator's fixed point, the physical value times the signal's
+DBC_<MSG>_<SIGNAL>_SCALE.
+
+Each message has a sequence counter, odd while its signals are being written.
+Readers copy the values and retry if the counter was odd or changed under
+them, so neither side ever blocks. A writer that finds the counter odd, the
+other bus's ISR or a nested one, drops its update rather than wait.
+
+A message is stale when it has never been received or when nothing has
+arrived for SIGNALS_STALE_CYCLES of its GenMsgCycleTime. Messages without a
+cycle time are event driven and only stale until the first frame.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#define DBC_MESSAGE_TABLE
+#include <string.h>
+#include "signals.h"
+#include "scheduler.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    _Atomic dword dwSequence;       // odd while a writer is in the message
+    qword qwtUpdatedus;             // 0 until the first frame
+    _Atomic dword dwNUpdates;
+    _Atomic dword dwNCollisions;
+    _Atomic dword dwNShortFrames;
+    dword dwNStale;
+    boolean bStale;
+} stSignalMessage_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SIGNALS_TAG "SIG"
+#define SIGNALS_STALE_CYCLES 3      // missed cycles before a message is stale
+#define SIGNALS_MAX_RETRIES 8       // reader attempts before giving up
+#define US_PER_MS 1000
+
+/* --------------------------- Local Variables ------------------------------ */
+static sqword asqwSignalValues[eDBC_SIG_TOTAL];
+static stSignalMessage_t astSignalMessages[eDBC_MSG_TOTAL];
+static byte abySignalMessage[eDBC_SIG_TOTAL];
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t signals_init(void);
+void signals_update(const CAN_frame_t *stFrame);
+esp_err_t signals_get(eDBCSignal_t eSignal, sqword *psqwValue, qword *pqwtAgeus);
+esp_err_t signals_snapshot(eDBCMessage_t eMessage, sqword *asqwValues, qword *pqwtUpdatedus);
+boolean signals_stale(eDBCSignal_t eSignal);
+void signals_service(void);
+esp_err_t signals_get_stats(eDBCMessage_t eMessage, stSignalStats_t *stStats);
+static esp_err_t signals_read(eDBCMessage_t eMessage, word wFirst, word wNSignals, sqword *asqwValues, qword *pqwtUpdatedus);
+static boolean signals_message_stale(eDBCMessage_t eMessage, qword qwtNowus);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t signals_init(void)
+{
+    /*
+    *===========================================================================
+    *   signals_init
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK.
+    *
+    *   Builds the signal to message lookup and registers the staleness
+    *   check. Call before CAN_init so the RX ISR never sees it half built.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Registers signals_service with the scheduler
+    *
+    *===========================================================================
+    */
+    static const stSchedRunnable_t astSignalRunnables[] =
+    {
+        { "signals", signals_service, 100, SCHED_OFFSET_AUTO, 300 },
+    };
+    for (byte i = 0; i < eDBC_MSG_TOTAL; i++)
+    {
+        for (byte j = 0; j < astDBCMessages[i].byNSignals; j++)
+        {
+            abySignalMessage[astDBCMessages[i].eFirstSignal + j] = i;
+        }
+        astSignalMessages[i].bStale = TRUE;
+    }
+    ESP_LOGI(SIGNALS_TAG, "%d signals in %d messages", eDBC_SIG_TOTAL, eDBC_MSG_TOTAL);
+    return scheduler_register(astSignalRunnables, sizeof(astSignalRunnables) / sizeof(astSignalRunnables[0]));
+}
+
+void signals_update(const CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   signals_update
+    *   Takes:   stFrame - a received frame
+    *
+    *   Returns: Nothing.
+    *
+    *   Called from the RX ISR. Decodes the frame if the database knows its ID
+    *   and publishes every signal of the message under its sequence counter.
+    *   A multiplexed message only publishes the signals the frame carries.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Multiplexed messages only write their present signals
+    *
+    *===========================================================================
+    */
+    sqword asqwValues[DBC_MAX_MESSAGE_SIGNALS];
+    qword qwWritten;
+    eDBCMessage_t eMessage = dbc_decode_values(stFrame->dwID, stFrame->abData, asqwValues, &qwWritten);
+    if (eMessage >= eDBC_MSG_TOTAL)
+    {
+        return;
+    }
+    const stDBCMessageInfo_t *stInfo = &astDBCMessages[eMessage];
+    stSignalMessage_t *stMessage = &astSignalMessages[eMessage];
+    if (stFrame->byDLC < stInfo->byDLC)
+    {
+        __atomic_fetch_add(&stMessage->dwNShortFrames, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    /* Claim the message, odd sequence, another writer means drop this one */
+    dword dwSequence = __atomic_load_n(&stMessage->dwSequence, __ATOMIC_RELAXED);
+    if ((dwSequence & 1) || !__atomic_compare_exchange_n(&stMessage->dwSequence, &dwSequence, dwSequence + 1,
+                                                         FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        __atomic_fetch_add(&stMessage->dwNCollisions, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (!stInfo->bMultiplexed)
+    {
+        memcpy(&asqwSignalValues[stInfo->eFirstSignal], asqwValues, stInfo->byNSignals * sizeof(sqword));
+    }
+    else
+    {
+        /* Only the signals this frame carries, the others keep their last value */
+        for (byte i = 0; i < stInfo->byNSignals; i++)
+        {
+            if (qwWritten & (1ULL << i))
+            {
+                asqwSignalValues[stInfo->eFirstSignal + i] = asqwValues[i];
+            }
+        }
+    }
+    stMessage->qwtUpdatedus = stFrame->qwtTimestampus;
+
+    /* Even again, publishes the values */
+    __atomic_store_n(&stMessage->dwSequence, dwSequence + 2, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&stMessage->dwNUpdates, 1, __ATOMIC_RELAXED);
+}
+
+esp_err_t signals_get(eDBCSignal_t eSignal, sqword *psqwValue, qword *pqwtAgeus)
+{
+    /*
+    *===========================================================================
+    *   signals_get
+    *   Takes:   eSignal - eDBC_SIG_<MSG>_<SIGNAL>
+    *            psqwValue - latest value in the signal's fixed point
+    *            pqwtAgeus - time since it was received, may be NULL
+    *
+    *   Returns: ESP_OK, ESP_ERR_NOT_FOUND if never received or
+    *            ESP_ERR_TIMEOUT if the writer kept it busy.
+    *
+    *   Latest value of one signal. Never blocks. Use signals_stale to tell if
+    *   the value is still current.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (eSignal >= eDBC_SIG_TOTAL || psqwValue == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    qword qwtUpdatedus;
+    esp_err_t NStatus = signals_read(abySignalMessage[eSignal], eSignal, 1, psqwValue, &qwtUpdatedus);
+    if (NStatus == ESP_OK && pqwtAgeus != NULL)
+    {
+        *pqwtAgeus = (qword)esp_timer_get_time() - qwtUpdatedus;
+    }
+    return NStatus;
+}
+
+esp_err_t signals_snapshot(eDBCMessage_t eMessage, sqword *asqwValues, qword *pqwtUpdatedus)
+{
+    /*
+    *===========================================================================
+    *   signals_snapshot
+    *   Takes:   eMessage - eDBC_MSG_<MSG>
+    *            asqwValues - every signal of the message, in DBC order,
+    *                         DBC_MAX_MESSAGE_SIGNALS is always room enough
+    *            pqwtUpdatedus - receive time of the frame, may be NULL
+    *
+    *   Returns: ESP_OK, ESP_ERR_NOT_FOUND if never received or
+    *            ESP_ERR_TIMEOUT if the writer kept it busy.
+    *
+    *   All signals of one message from the same frame. For a multiplexed
+    *   message the signals of other multiplexor values are from the last
+    *   frame that carried them.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (eMessage >= eDBC_MSG_TOTAL || asqwValues == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    qword qwtUpdatedus;
+    esp_err_t NStatus = signals_read(eMessage, astDBCMessages[eMessage].eFirstSignal,
+                                     astDBCMessages[eMessage].byNSignals, asqwValues, &qwtUpdatedus);
+    if (NStatus == ESP_OK && pqwtUpdatedus != NULL)
+    {
+        *pqwtUpdatedus = qwtUpdatedus;
+    }
+    return NStatus;
+}
+
+boolean signals_stale(eDBCSignal_t eSignal)
+{
+    /*
+    *===========================================================================
+    *   signals_stale
+    *   Takes:   eSignal - eDBC_SIG_<MSG>_<SIGNAL>
+    *
+    *   Returns: TRUE if the signal's message is stale.
+    *
+    *   Checked against the time now, not the last signals_service call.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (eSignal >= eDBC_SIG_TOTAL)
+    {
+        return TRUE;
+    }
+    return signals_message_stale(abySignalMessage[eSignal], (qword)esp_timer_get_time());
+}
+
+void signals_service(void)
+{
+    /*
+    *===========================================================================
+    *   signals_service
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Runs every 100 ms. Counts and logs messages going stale and coming
+    *   back.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    qword qwtNowus = (qword)esp_timer_get_time();
+
+    for (byte i = 0; i < eDBC_MSG_TOTAL; i++)
+    {
+        stSignalMessage_t *stMessage = &astSignalMessages[i];
+        boolean bStale = signals_message_stale(i, qwtNowus);
+        if (bStale == stMessage->bStale)
+        {
+            continue;
+        }
+        stMessage->bStale = bStale;
+        if (bStale)
+        {
+            stMessage->dwNStale++;
+            ESP_LOGW(SIGNALS_TAG, "%s stale", astDBCMessages[i].abyName);
+        }
+        #ifdef DEBUG
+        else
+        {
+            ESP_LOGI(SIGNALS_TAG, "%s received", astDBCMessages[i].abyName);
+        }
+        #endif
+    }
+}
+
+esp_err_t signals_get_stats(eDBCMessage_t eMessage, stSignalStats_t *stStats)
+{
+    /*
+    *===========================================================================
+    *   signals_get_stats
+    *   Takes:   eMessage - eDBC_MSG_<MSG>
+    *            stStats - filled with the message's counters
+    *
+    *   Returns: ESP_OK or ESP_ERR_INVALID_ARG.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (eMessage >= eDBC_MSG_TOTAL || stStats == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stSignalMessage_t *stMessage = &astSignalMessages[eMessage];
+    stStats->dwNUpdates = __atomic_load_n(&stMessage->dwNUpdates, __ATOMIC_RELAXED);
+    stStats->dwNCollisions = __atomic_load_n(&stMessage->dwNCollisions, __ATOMIC_RELAXED);
+    stStats->dwNShortFrames = __atomic_load_n(&stMessage->dwNShortFrames, __ATOMIC_RELAXED);
+    stStats->dwNStale = stMessage->dwNStale;
+    return ESP_OK;
+}
+
+static esp_err_t signals_read(eDBCMessage_t eMessage, word wFirst, word wNSignals, sqword *asqwValues, qword *pqwtUpdatedus)
+{
+    /*
+    *===========================================================================
+    *   signals_read
+    *   Takes:   eMessage - message the signals belong to
+    *            wFirst, wNSignals - signals to copy
+    *            asqwValues, pqwtUpdatedus - the copy
+    *
+    *   Returns: ESP_OK, ESP_ERR_NOT_FOUND or ESP_ERR_TIMEOUT.
+    *
+    *   Seqlock read, retries while a writer is in the message.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stSignalMessage_t *stMessage = &astSignalMessages[eMessage];
+
+    for (byte i = 0; i < SIGNALS_MAX_RETRIES; i++)
+    {
+        dword dwSequence = __atomic_load_n(&stMessage->dwSequence, __ATOMIC_ACQUIRE);
+        if (dwSequence & 1)
+        {
+            continue;
+        }
+        if (dwSequence == 0)
+        {
+            return ESP_ERR_NOT_FOUND;
+        }
+        memcpy(asqwValues, &asqwSignalValues[wFirst], wNSignals * sizeof(sqword));
+        *pqwtUpdatedus = stMessage->qwtUpdatedus;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&stMessage->dwSequence, __ATOMIC_RELAXED) == dwSequence)
+        {
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+static boolean signals_message_stale(eDBCMessage_t eMessage, qword qwtNowus)
+{
+    /*
+    *===========================================================================
+    *   signals_message_stale
+    *   Takes:   eMessage - message to check
+    *            qwtNowus - time now
+    *
+    *   Returns: TRUE if never received or overdue by SIGNALS_STALE_CYCLES.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    /* Only the timestamp, read under the sequence so it cannot tear */
+    sqword sqwUnused;
+    qword qwtUpdatedus;
+    esp_err_t NStatus = signals_read(eMessage, 0, 0, &sqwUnused, &qwtUpdatedus);
+    if (NStatus == ESP_ERR_NOT_FOUND)
+    {
+        return TRUE;
+    }
+    word wtCycleTimems = astDBCMessages[eMessage].wtCycleTimems;
+    if (wtCycleTimems == 0 || NStatus != ESP_OK)
+    {
+        /* Busy means a frame is arriving right now */
+        return FALSE;
+    }
+    return (qwtNowus > qwtUpdatedus) && (qwtNowus - qwtUpdatedus > (qword)wtCycleTimems * US_PER_MS * SIGNALS_STALE_CYCLES);
+}
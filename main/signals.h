@@ -0,0 +1,29 @@
+#ifndef SFR_SIGNALS
+#define SFR_SIGNALS
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sfrtypes.h"
+#include "can.h"
+#include "sfr_dbc.h"
+
+/* --------------------------- Types ---------------------------------------- */
+typedef struct {
+    dword dwNUpdates;
+    dword dwNCollisions;    // updates dropped while another writer held the message
+    dword dwNShortFrames;   // frames shorter than the DBC DLC, not stored
+    dword dwNStale;         // times the message went stale
+} stSignalStats_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t signals_init(void);
+void signals_update(const CAN_frame_t *stFrame);
+esp_err_t signals_get(eDBCSignal_t eSignal, sqword *psqwValue, qword *pqwtAgeus);
+esp_err_t signals_snapshot(eDBCMessage_t eMessage, sqword *asqwValues, qword *pqwtUpdatedus);
+boolean signals_stale(eDBCSignal_t eSignal);
+void signals_service(void);
+esp_err_t signals_get_stats(eDBCMessage_t eMessage, stSignalStats_t *stStats);
+
+#endif // SFR_SIGNALS
@@ -0,0 +1,303 @@
+/*
+supervisor.c
+File contains the heartbeat supervisor, the only thing that feeds the task
+watchdog. Every scheduler task and registered runnable is a heartbeat, its
+run count, and each SUPERVISOR_WINDOW_MS window the counts are checked
+against what its period says it should have done. One that is short for
+SUPERVISOR_FAULT_WINDOWS windows in a row is a fault: the offender, the
+last trace events and the CAN RX ring depth are written to RTC memory that
+survives the reset, then the watchdog is left to run out. If task_BG itself
+is starved the supervisor never runs, so the watchdog ISR writes the record
+instead.
+
+After the reset supervisor_init picks the record up, checks its CRC and
+keeps it for the NodeReset status frame.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include "supervisor.h"
+#include "can.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    dword dwNLast;              // count at the end of the last window
+    dword dwNExpected;
+    dword dwNSeen;
+    dword dwtQuietms;           // time since the count last moved
+    byte byNShortWindows;
+    boolean bPrimed;
+} stHeartbeat_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SUPERVISOR_TAG "SUPER"
+#define SUPERVISOR_MAGIC 0x53555052         // "SUPR"
+#define SUPERVISOR_WINDOW_MS 500            // well inside the 2 s watchdog
+#define SUPERVISOR_FAULT_WINDOWS 2          // short windows in a row before it is a fault
+#define SUPERVISOR_BG_PERIOD_MS 100         // heartbeat period taken for task_BG and its runnables
+#define US_PER_MS 1000
+
+/* --------------------------- Local Variables ------------------------------ */
+extern _Atomic word wRingBufHead;
+extern _Atomic word wRingBufTail;
+
+static RTC_NOINIT_ATTR stSupervisorRecord_t stSupervisorRecord;
+static stSupervisorRecord_t stSupervisorLastReset;
+static stHeartbeat_t astTaskHeartbeats[eSCHED_TOTAL];
+static stHeartbeat_t astRunnableHeartbeats[SCHED_MAX_RUNNABLES];
+static qword qwtWindowStartus = 0;
+static _Atomic boolean bSupervisorTripped = FALSE;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t supervisor_init(void);
+void supervisor_get_reset(stSupervisorRecord_t *stRecord);
+void esp_task_wdt_isr_user_handler(void);
+static void supervisor_service(void);
+static boolean supervisor_check(stHeartbeat_t *stBeat, dword dwNCount, word wtPeriodms, dword dwtWindowms);
+static void supervisor_trip(eSupervisorFault_t eFault, eSchedTask_t eTask, byte byRunnable, const char *abyName, const stHeartbeat_t *stBeat);
+static void supervisor_record(eSupervisorFault_t eFault, eSchedTask_t eTask, byte byRunnable, const char *abyName, dword dwNExpected, dword dwNSeen);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t supervisor_init(void)
+{
+    /*
+    *===========================================================================
+    *   supervisor_init
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK or the scheduler's error registering the supervisor.
+    *
+    *   Keeps the record from before the reset if it is intact, then starts
+    *   supervising. Call before scheduler_init, nothing else feeds the
+    *   watchdog.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    static const stSchedRunnable_t astSupervisorRunnables[] =
+    {
+        { "supervisor", supervisor_service, 0, 0, 200 },
+    };
+
+    /* RTC memory is random after power up, the magic and CRC tell */
+    esp_reset_reason_t eReason = esp_reset_reason();
+    memset(&stSupervisorLastReset, 0, sizeof(stSupervisorLastReset));
+    if (eReason != ESP_RST_POWERON && eReason != ESP_RST_BROWNOUT &&
+        stSupervisorRecord.dwMagic == SUPERVISOR_MAGIC &&
+        stSupervisorRecord.dwCRC == esp_crc32_le(0, (const uint8_t *)&stSupervisorRecord, offsetof(stSupervisorRecord_t, dwCRC)))
+    {
+        stSupervisorLastReset = stSupervisorRecord;
+        ESP_LOGW(SUPERVISOR_TAG, "Reset by %s missing heartbeats, %lu of %lu, at %lu ms, CAN ring %u",
+                 stSupervisorLastReset.abyName, (unsigned long)stSupervisorLastReset.dwNSeen,
+                 (unsigned long)stSupervisorLastReset.dwNExpected, (unsigned long)stSupervisorLastReset.dwtUptimems,
+                 (unsigned)stSupervisorLastReset.wCANRingDepth);
+        for (byte i = 0; i < stSupervisorLastReset.byNTraceEvents && i < SUPERVISOR_TRACE_EVENTS; i++)
+        {
+            const stTraceEvent_t *stEvent = &stSupervisorLastReset.astTraceEvents[i];
+            ESP_LOGW(SUPERVISOR_TAG, "  %10lu us event %u ID %u value %u", (unsigned long)stEvent->dwtTimestampus,
+                     (unsigned)stEvent->byEvent, (unsigned)stEvent->byID, (unsigned)stEvent->wValue);
+        }
+    }
+    stSupervisorRecord.dwMagic = 0;
+
+    qwtWindowStartus = (qword)esp_timer_get_time();
+    return scheduler_register(astSupervisorRunnables, sizeof(astSupervisorRunnables) / sizeof(astSupervisorRunnables[0]));
+}
+
+void supervisor_get_reset(stSupervisorRecord_t *stRecord)
+{
+    /*
+    *===========================================================================
+    *   supervisor_get_reset
+    *   Takes:   stRecord - filled with the record from before the last reset
+    *
+    *   Returns: Nothing. byFault is eSUPERVISOR_FAULT_NONE when the reset
+    *            was not the supervisor's or the record did not survive it.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    *stRecord = stSupervisorLastReset;
+}
+
+void IRAM_ATTR esp_task_wdt_isr_user_handler(void)
+{
+    /*
+    *===========================================================================
+    *   esp_task_wdt_isr_user_handler
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Called by the task watchdog ISR before it panics. Unless the
+    *   supervisor tripped and already wrote the record, task_BG never got
+    *   to check the heartbeats, so that is the fault.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (!__atomic_load_n(&bSupervisorTripped, __ATOMIC_ACQUIRE))
+    {
+        supervisor_record(eSUPERVISOR_FAULT_WATCHDOG, eSCHED_BG, SUPERVISOR_NO_RUNNABLE, "task_BG", 0, 0);
+    }
+}
+
+static void supervisor_service(void)
+{
+    /*
+    *===========================================================================
+    *   supervisor_service
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Background runnable. At the end of each window checks every task and
+    *   runnable and feeds the watchdog if they all kept up.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stSchedStats_t stTaskStats;
+    stRunnableStats_t stRunnableStats;
+
+    if (__atomic_load_n(&bSupervisorTripped, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    qword qwtNowus = (qword)esp_timer_get_time();
+    if (qwtNowus - qwtWindowStartus < (qword)SUPERVISOR_WINDOW_MS * US_PER_MS)
+    {
+        return;
+    }
+    dword dwtWindowms = (dword)((qwtNowus - qwtWindowStartus) / US_PER_MS);
+    qwtWindowStartus = qwtNowus;
+
+    for (byte i = 0; i < eSCHED_TOTAL; i++)
+    {
+        if (scheduler_get_stats(i, &stTaskStats) == ESP_OK &&
+            !supervisor_check(&astTaskHeartbeats[i], stTaskStats.dwNRuns, scheduler_task_period_ms(i), dwtWindowms))
+        {
+            supervisor_trip(eSUPERVISOR_FAULT_TASK, i, SUPERVISOR_NO_RUNNABLE, scheduler_task_name(i), &astTaskHeartbeats[i]);
+            return;
+        }
+    }
+    /* A release skipped after a budget overrun is the scheduler's choice, it still counts */
+    for (byte i = 0; i < SCHED_MAX_RUNNABLES && scheduler_get_runnable_stats(i, &stRunnableStats) == ESP_OK; i++)
+    {
+        if (!supervisor_check(&astRunnableHeartbeats[i], stRunnableStats.dwNRuns + stRunnableStats.dwNSkipped,
+                              stRunnableStats.wtPeriodms, dwtWindowms))
+        {
+            supervisor_trip(eSUPERVISOR_FAULT_RUNNABLE, stRunnableStats.eTask, i, stRunnableStats.abyName, &astRunnableHeartbeats[i]);
+            return;
+        }
+    }
+
+    (void)esp_task_wdt_reset();
+}
+
+static boolean supervisor_check(stHeartbeat_t *stBeat, dword dwNCount, word wtPeriodms, dword dwtWindowms)
+{
+    /*
+    *===========================================================================
+    *   supervisor_check
+    *   Takes:   stBeat - heartbeat state
+    *            dwNCount - its run count now
+    *            wtPeriodms - its period, 0 for the background task
+    *            dwtWindowms - length of the window just ended
+    *
+    *   Returns: FALSE once it has been short SUPERVISOR_FAULT_WINDOWS windows
+    *            in a row.
+    *
+    *   Short is under half the expected runs, or for periods longer than
+    *   the window, no run for two periods. The first window after a task or
+    *   runnable appears only takes its count.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (!stBeat->bPrimed)
+    {
+        *stBeat = (stHeartbeat_t){ .dwNLast = dwNCount, .bPrimed = TRUE };
+        return TRUE;
+    }
+
+    word wtBeatms = (wtPeriodms != 0) ? wtPeriodms : SUPERVISOR_BG_PERIOD_MS;
+    stBeat->dwNSeen = dwNCount - stBeat->dwNLast;
+    stBeat->dwNLast = dwNCount;
+    stBeat->dwNExpected = dwtWindowms / wtBeatms;
+    stBeat->dwtQuietms = (stBeat->dwNSeen != 0) ? 0 : stBeat->dwtQuietms + dwtWindowms;
+
+    boolean bShort = (stBeat->dwNSeen * 2 < stBeat->dwNExpected) || (stBeat->dwtQuietms > 2 * (dword)wtBeatms);
+    stBeat->byNShortWindows = bShort ? stBeat->byNShortWindows + 1 : 0;
+    return stBeat->byNShortWindows < SUPERVISOR_FAULT_WINDOWS;
+}
+
+static void supervisor_trip(eSupervisorFault_t eFault, eSchedTask_t eTask, byte byRunnable, const char *abyName, const stHeartbeat_t *stBeat)
+{
+    /*
+    *===========================================================================
+    *   supervisor_trip
+    *   Takes:   eFault, eTask, byRunnable, abyName - the offender
+    *            stBeat - its heartbeat state
+    *
+    *   Returns: Nothing.
+    *
+    *   Writes the record and stops feeding the watchdog, which resets the
+    *   chip within its timeout.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    supervisor_record(eFault, eTask, byRunnable, abyName, stBeat->dwNExpected, stBeat->dwNSeen);
+    __atomic_store_n(&bSupervisorTripped, TRUE, __ATOMIC_RELEASE);
+    ESP_LOGE(SUPERVISOR_TAG, "%s in %s ran %lu of %lu times, waiting for the watchdog", abyName,
+             scheduler_task_name(eTask), (unsigned long)stBeat->dwNSeen, (unsigned long)stBeat->dwNExpected);
+}
+
+static void IRAM_ATTR supervisor_record(eSupervisorFault_t eFault, eSchedTask_t eTask, byte byRunnable, const char *abyName, dword dwNExpected, dword dwNSeen)
+{
+    /*
+    *===========================================================================
+    *   supervisor_record
+    *   Takes:   eFault, eTask, byRunnable, abyName - the offender
+    *            dwNExpected, dwNSeen - its heartbeats in the window
+    *
+    *   Returns: Nothing.
+    *
+    *   Fills the RTC record. Runs from the watchdog ISR as well, so nothing
+    *   here may block or log.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    word wHead = __atomic_load_n(&wRingBufHead, __ATOMIC_ACQUIRE);
+    word wTail = __atomic_load_n(&wRingBufTail, __ATOMIC_ACQUIRE);
+
+    memset(&stSupervisorRecord, 0, sizeof(stSupervisorRecord));
+    stSupervisorRecord.byFault = (byte)eFault;
+    stSupervisorRecord.byTask = (byte)eTask;
+    stSupervisorRecord.byRunnable = byRunnable;
+    strncpy(stSupervisorRecord.abyName, abyName, sizeof(stSupervisorRecord.abyName) - 1);
+    stSupervisorRecord.dwNExpected = dwNExpected;
+    stSupervisorRecord.dwNSeen = dwNSeen;
+    stSupervisorRecord.dwtUptimems = (dword)((qword)esp_timer_get_time() / US_PER_MS);
+    stSupervisorRecord.wCANRingDepth = (wHead >= wTail) ? (wHead - wTail) : (wHead + CAN_QUEUE_LENGTH - wTail);
+    stSupervisorRecord.byNTraceEvents = trace_last_events(stSupervisorRecord.astTraceEvents, SUPERVISOR_TRACE_EVENTS);
+    stSupervisorRecord.dwMagic = SUPERVISOR_MAGIC;
+    stSupervisorRecord.dwCRC = esp_crc32_le(0, (const uint8_t *)&stSupervisorRecord, offsetof(stSupervisorRecord_t, dwCRC));
+}
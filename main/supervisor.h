@@ -0,0 +1,50 @@
+#ifndef SFR_SUPERVISOR
+#define SFR_SUPERVISOR
+
+#include <stddef.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_crc.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_task_wdt.h"
+#include "esp_timer.h"
+
+#include "sfrtypes.h"
+#include "scheduler.h"
+#include "trace.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SUPERVISOR_TRACE_EVENTS 16
+#define SUPERVISOR_NO_RUNNABLE 0xFF
+
+/* --------------------------- Types ---------------------------------------- */
+typedef enum {
+    eSUPERVISOR_FAULT_NONE = 0,
+    eSUPERVISOR_FAULT_TASK,         // a scheduler task missed its heartbeats
+    eSUPERVISOR_FAULT_RUNNABLE,     // a runnable missed its heartbeats
+    eSUPERVISOR_FAULT_WATCHDOG,     // the watchdog fired first, task_BG starved
+} eSupervisorFault_t;
+
+typedef struct {
+    dword dwMagic;
+    byte byFault;                   // eSupervisorFault_t
+    byte byTask;                    // eSchedTask_t
+    byte byRunnable;                // index in order of registration, SUPERVISOR_NO_RUNNABLE for a task
+    byte byNTraceEvents;
+    char abyName[16];               // task or runnable
+    dword dwNExpected;              // heartbeats expected in the window
+    dword dwNSeen;
+    dword dwtUptimems;
+    word wCANRingDepth;             // CAN RX ring buffer frames waiting
+    word wReserved;
+    stTraceEvent_t astTraceEvents[SUPERVISOR_TRACE_EVENTS]; // oldest first, empty unless tracing
+    dword dwCRC;
+} stSupervisorRecord_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t supervisor_init(void);
+void supervisor_get_reset(stSupervisorRecord_t *stRecord);
+
+#endif // SFR_SUPERVISOR
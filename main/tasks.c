@@ -1,11 +1,13 @@
 /*
 tasks.c
-File contains the tasks that run on the device. Tasks are called by interrupts at their specified rates.
+File contains the tasks that run on the device. Each runs in its own FreeRTOS task at its specified rate, see scheduler.c.
 Tasks are:
     task_BG: Background task that runs as often as processor time is available.
     task_1ms: Task that runs every 1ms.
     task_10ms: Task that runs every 10ms.
     task_100ms: Task that runs every 100ms.
+These only hold the work every device does. Modules add their own work with scheduler_register
+when they are initialised, so a device only runs what its role in main_init turns on.
 
 Written by Cole Perera for Sheffield Formula Racing 2025
 */
@@ -15,15 +17,11 @@ Written by Cole Perera for Sheffield Formula Racing 2025
 typedef enum {
     eTASK_BG = 0,
     eTASK_1MS,
+    eTASK_10MS,
     eTASK_100MS,
     eTASK_TOTAL,
 } eTasks_t;
 
-typedef enum {
-    eTASK_ACTIVE = 0,
-    eTASK_INACTIVE,
-} eTaskState_t;
-
 /* --------------------------- Local Variables ----------------------------- */
 extern twai_node_handle_t stCANBus0;
 extern uint8_t byMACAddress[6];
@@ -32,7 +30,6 @@ extern esp_reset_reason_t eResetReason;
 /* --------------------------- Global Variables ----------------------------- */
 dword adwMaxTaskTime[eTASK_TOTAL];
 dword adwLastTaskTime[eTASK_TOTAL];
-eTaskState_t astTaskState[eTASK_TOTAL];
 dword dwTimeSincePowerUpms = 0;
 
 /* --------------------------- Function prototypes ----------------------------- */
@@ -44,6 +41,7 @@ dword dwTimeSincePowerUpms = 0;
 void pin_toggle(gpio_num_t pin);
 void task_BG(void);
 void task_1ms(void);
+void task_10ms(void);
 void task_100ms(void);
 
 /* --------------------------- Functions ----------------------------- */
@@ -52,27 +50,8 @@ void task_BG(void)
     /* Background task that runs as often as processor time is available. */
     static qword qwtTaskTimer;
     qwtTaskTimer = esp_timer_get_time();
-    astTaskState[eTASK_BG] = eTASK_ACTIVE;
 
-    /* Service the watchdog if all task have been completed at least once */
-    word wNTaskCounter = 0;
-    boolean bTasksComplete = TRUE;
-    for (wNTaskCounter = 0; wNTaskCounter < eTASK_TOTAL; wNTaskCounter++)
-    {
-        if (astTaskState[wNTaskCounter] == eTASK_INACTIVE) {
-            bTasksComplete = FALSE;
-            break;
-        }
-    }
-    if (bTasksComplete) {
-        /* Reset the watchdog timer */
-        (void)esp_task_wdt_reset();           
-        
-        for (wNTaskCounter = 0; wNTaskCounter < eTASK_TOTAL; wNTaskCounter++)
-        {
-            astTaskState[wNTaskCounter] = eTASK_INACTIVE;
-        }
-    }
+    /* The watchdog is fed by the supervisor once every task and runnable has kept up, see supervisor.c */
 
     /* Update max task time */
     qwtTaskTimer = esp_timer_get_time() - qwtTaskTimer;
@@ -87,7 +66,6 @@ void task_1ms(void)
     /* Task that runs every 1ms. */
     qword qwtTaskTimer;
     qwtTaskTimer = esp_timer_get_time();
-    astTaskState[eTASK_1MS] = eTASK_ACTIVE;
 
     /* Update time since power up */
     dwTimeSincePowerUpms++;
@@ -101,6 +79,21 @@ void task_1ms(void)
     }
 }
 
+void task_10ms(void)
+{
+    /* Task that runs every 10ms. */
+    qword qwtTaskTimer;
+    qwtTaskTimer = esp_timer_get_time();
+
+    /* Update max task time */
+    qwtTaskTimer = esp_timer_get_time() - qwtTaskTimer;
+    adwLastTaskTime[eTASK_10MS] = (dword)qwtTaskTimer;
+    if (qwtTaskTimer > adwMaxTaskTime[eTASK_10MS]) 
+    {
+        adwMaxTaskTime[eTASK_10MS] = (dword)qwtTaskTimer;
+    }
+}
+
 void task_100ms(void)
 {
     /* Task that runs every 100ms. */
@@ -108,7 +101,6 @@ void task_100ms(void)
     static word wNCounter;
 
     qwtTaskTimer = esp_timer_get_time();
-    astTaskState[eTASK_100MS] = eTASK_ACTIVE;
 
     /* Every Second */
     if ( wNCounter % 10 == 0 ) 
@@ -116,22 +108,38 @@ void task_100ms(void)
         /* Toggle LED */
         pin_toggle(GPIO_ONBOARD_LED); 
 
-        /* Send Status Message */
-        CAN_transmit(stCANBus0, (CAN_frame_t)
+        /* Send Status Message, layout and ID from dbc/sfr.dbc, UPDATE THE ID FOR EACH DEVICE */
+        stDBCNodeStatus_t stStatus =
         {
-            .dwID = 0xFF, // UPDATE THIS FOR EACH DEVICE
-            .byDLC = 8,
-            .abData = {
-                (byte)(adwLastTaskTime[eTASK_1MS] / 50 & 0xFF),          
-                (byte)(adwMaxTaskTime[eTASK_1MS] / 50 & 0xFF),
-                (byte)(adwLastTaskTime[eTASK_100MS] / 500 & 0xFF),       
-                (byte)(adwMaxTaskTime[eTASK_100MS] / 500 & 0xFF),
-                (byte)(adwLastTaskTime[eTASK_BG] / 500 & 0xFF),        
-                (byte)(adwMaxTaskTime[eTASK_BG] / 500 & 0xFF),
-                (byte)((dwTimeSincePowerUpms/4000) >> 6 & 0xFF),
-                (byte)(((dwTimeSincePowerUpms/4000) << 2 | (eResetReason & 0x03)) & 0xFF)
-            }
-        });
+            .dwTask1msLast = adwLastTaskTime[eTASK_1MS],
+            .dwTask1msMax = adwMaxTaskTime[eTASK_1MS],
+            .dwTask100msLast = adwLastTaskTime[eTASK_100MS],
+            .dwTask100msMax = adwMaxTaskTime[eTASK_100MS],
+            .dwTaskBGLast = adwLastTaskTime[eTASK_BG],
+            .dwTaskBGMax = adwMaxTaskTime[eTASK_BG],
+            .dwUptime = dwTimeSincePowerUpms / 1000,
+            .dwResetReason = eResetReason & 0x03,
+        };
+        CAN_frame_t stStatusFrame = { .dwID = DBC_NODE_STATUS_ID, .byDLC = DBC_NODE_STATUS_DLC };
+        dbc_node_status_encode(&stStatus, stStatusFrame.abData);
+        (void)CAN_transmit_batch(stCANBus0, &stStatusFrame, 1, NULL);
+
+        /* Why the last reset happened, with the supervisor's record of the offender if it left one */
+        stSupervisorRecord_t stRecord;
+        supervisor_get_reset(&stRecord);
+        stDBCNodeReset_t stReset =
+        {
+            .dwResetReason = (dword)eResetReason,
+            .dwFaultKind = stRecord.byFault,
+            .dwFaultTask = stRecord.byTask,
+            .dwFaultRunnable = (stRecord.byFault == eSUPERVISOR_FAULT_NONE) ? SUPERVISOR_NO_RUNNABLE : stRecord.byRunnable,
+            .dwExpected = (stRecord.dwNExpected > 0xFFFF) ? 0xFFFF : stRecord.dwNExpected,
+            .dwSeen = (stRecord.dwNSeen > 0xFFFF) ? 0xFFFF : stRecord.dwNSeen,
+            .dwRingDepth = (stRecord.wCANRingDepth > 0xFF) ? 0xFF : stRecord.wCANRingDepth,
+        };
+        CAN_frame_t stResetFrame = { .dwID = DBC_NODE_RESET_ID, .byDLC = DBC_NODE_RESET_DLC };
+        dbc_node_reset_encode(&stReset, stResetFrame.abData);
+        (void)CAN_transmit_batch(stCANBus0, &stResetFrame, 1, NULL);
 
     };
 
@@ -140,22 +148,22 @@ void task_100ms(void)
     {
         /* Print the task times */
         #ifdef DEBUG
-        ESP_LOGI(SFR_TAG, "Max Task Time: %5d BG %5d 1ms %5d 100ms", 
+        ESP_LOGI(SFR_TAG, "Max Task Time: %5d BG %5d 1ms %5d 10ms %5d 100ms", 
             (int)adwMaxTaskTime[eTASK_BG],
             (int)adwMaxTaskTime[eTASK_1MS],
+            (int)adwMaxTaskTime[eTASK_10MS],
             (int)adwMaxTaskTime[eTASK_100MS]);
-        ESP_LOGI(SFR_TAG, "Last Task Time: %5d BG %5d 1ms %5d 100ms", 
+        ESP_LOGI(SFR_TAG, "Last Task Time: %5d BG %5d 1ms %5d 10ms %5d 100ms", 
             (int)adwLastTaskTime[eTASK_BG], 
             (int)adwLastTaskTime[eTASK_1MS],
+            (int)adwLastTaskTime[eTASK_10MS],
             (int)adwLastTaskTime[eTASK_100MS]);
+        scheduler_dump();
         wNCounter = 0;
         #endif
     }
     wNCounter++;
 
-    /* Check if the CAN bus is in error state and recover */
-    CAN_bus_diagnosics();
-
     /* Update max task time */
     qwtTaskTimer = esp_timer_get_time() - qwtTaskTimer;
     adwLastTaskTime[eTASK_100MS] = (dword)qwtTaskTimer;
@@ -9,15 +9,23 @@
 
 #include "pin.h"
 #include "can.h"
+#include "busload.h"
+#include "signals.h"
+#include "scheduler.h"
+#include "supervisor.h"
 #include "espnow.h"
 #include "sdcard.h"
+#include "replay.h"
+#include "gateway.h"
 #include "adc.h"
 #include "I2C.h"
 #include "NVHDisplay.h"
+#include "sfr_dbc.h"
 
 /* Function Definitions*/
 void task_BG(void);
 void task_1ms(void);
+void task_10ms(void);
 void task_100ms(void);
 void pin_toggle(gpio_num_t pin);
 
@@ -0,0 +1,494 @@
+/*
+trace.c
+File contains the execution trace recorder. Scheduler tasks and runnables,
+the CAN RX ISR, the ESP-NOW callbacks and SD card block writes add 8 byte
+events to a RAM ring, so when something stalls there is a timeline of how
+the CAN, radio and SD paths interleaved leading up to it.
+
+Adding an event is a fetch and add on the ring index and four stores, safe
+from ISRs and any task. The ring keeps the last TRACE_N_EVENTS events. Started
+with bStopOnStall, recording stops at the first deadline miss so the ring
+holds the run up to it, and the dump is written from the background task.
+
+Dump layout, little endian, read by tools/trace2json.py:
+    header  "SFRTRACE", word version, word names, dword events,
+            dword events lost to wrapping
+    names   16 bytes each: [0] kind (0 task, 1 runnable, 2 ISR),
+            [1] ID, [2] task a runnable runs in, [3-15] name
+    events  8 bytes each, oldest first: [0-3] time (us, wraps),
+            [4] eTraceEvent_t, [5] ID, [6-7] value
+Over serial the same bytes are printed as hex lines starting "TRACE:", a
+few lines per call of the background runnable so the watchdog is still fed.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <string.h>
+#include "trace.h"
+#include "scheduler.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    char abyMagic[8];
+    word wVersion;
+    word wNNames;
+    dword dwNEvents;
+    dword dwNLost;
+} stTraceHeader_t;
+
+typedef struct {
+    byte byKind;
+    byte byID;
+    byte byTrack;
+    char abyName[13];
+} stTraceName_t;
+
+typedef enum {
+    eTRACE_NAME_TASK = 0,
+    eTRACE_NAME_RUNNABLE,
+    eTRACE_NAME_ISR,
+} eTraceName_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define TRACE_TAG "TRACE"
+#define TRACE_N_EVENTS 4096         // power of two, 32 kB
+#define TRACE_VERSION 1
+#define TRACE_FILE_PATH "/sdcard/trace.bin"
+#define TRACE_SERIAL_LINE_BYTES 32
+#define TRACE_SERIAL_CHUNK_BYTES 256 // dump bytes printed per trace_service call, about 50 ms at 115200 baud
+#define TRACE_SERVICE_BUDGET_US 100000 // a chunk or the SD card dump
+#define TRACE_FILE_CHUNK_BYTES 512
+#define TRACE_SETTLE_MS 2           // lets writers that already had an index finish
+
+/* --------------------------- Local Variables ------------------------------ */
+static stTraceEvent_t astTraceEvents[TRACE_N_EVENTS];
+static _Atomic dword dwNTraceEvents = 0;
+static _Atomic boolean bTraceRunning = FALSE;
+static boolean bTraceStopOnStall = FALSE;
+static _Atomic boolean bTraceStalled = FALSE;
+static const char *aabyISRNames[eTRACE_ISR_TOTAL] = { "CAN0 RX", "CAN1 RX", "ESP-NOW RX", "ESP-NOW TX" };
+
+/* The dump being written, frozen by trace_snapshot */
+static stTraceHeader_t stTraceDumpHeader;
+static stTraceName_t astTraceDumpNames[eSCHED_TOTAL + SCHED_MAX_RUNNABLES + eTRACE_ISR_TOTAL];
+static dword dwTraceDumpFirst = 0;          // ring index of the oldest event
+static dword dwTraceDumpLength = 0;         // bytes in the dump
+static dword dwTraceSerialCursor = 0;       // dump bytes printed so far
+static boolean bTraceSerialDumping = FALSE;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t trace_start(boolean bStopOnStall);
+void trace_stop(void);
+void trace_event(eTraceEvent_t eEvent, byte byID, word wValue);
+void trace_stall(byte byTask);
+esp_err_t trace_dump_file(const char *abyPath);
+void trace_dump_serial(void);
+byte trace_last_events(stTraceEvent_t *astEvents, byte byMaxEvents);
+static void trace_service(void);
+static word trace_names(stTraceName_t *astNames, word wMaxNames);
+static void trace_snapshot(void);
+static size_t trace_dump_read(dword dwOffset, byte *abyOut, size_t NMax);
+static void trace_serial_chunk(void);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t trace_start(boolean bStopOnStall)
+{
+    /*
+    *===========================================================================
+    *   trace_start
+    *   Takes:   bStopOnStall - stop at the first deadline miss and dump
+    *
+    *   Returns: ESP_OK or the scheduler's error registering the dump.
+    *
+    *   Clears the ring and starts recording, ending any serial dump.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP The dump runnable has a budget
+    *
+    *===========================================================================
+    */
+    static const stSchedRunnable_t astTraceRunnables[] =
+    {
+        { "trace", trace_service, 0, 0, TRACE_SERVICE_BUDGET_US },
+    };
+    static boolean bRegistered = FALSE;
+    if (!bRegistered)
+    {
+        esp_err_t NStatus = scheduler_register(astTraceRunnables, sizeof(astTraceRunnables) / sizeof(astTraceRunnables[0]));
+        if (NStatus != ESP_OK)
+        {
+            return NStatus;
+        }
+        bRegistered = TRUE;
+    }
+
+    __atomic_store_n(&bTraceRunning, FALSE, __ATOMIC_RELAXED);
+    bTraceSerialDumping = FALSE;
+    __atomic_store_n(&dwNTraceEvents, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&bTraceStalled, FALSE, __ATOMIC_RELAXED);
+    bTraceStopOnStall = bStopOnStall;
+    __atomic_store_n(&bTraceRunning, TRUE, __ATOMIC_RELEASE);
+    ESP_LOGI(TRACE_TAG, "Recording%s", bStopOnStall ? ", stops on a deadline miss" : "");
+    return ESP_OK;
+}
+
+void trace_stop(void)
+{
+    /*
+    *===========================================================================
+    *   trace_stop
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Stops recording, the ring is kept for a dump.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    __atomic_store_n(&bTraceRunning, FALSE, __ATOMIC_RELEASE);
+}
+
+void IRAM_ATTR trace_event(eTraceEvent_t eEvent, byte byID, word wValue)
+{
+    /*
+    *===========================================================================
+    *   trace_event
+    *   Takes:   eEvent - what happened
+    *            byID - task, runnable or ISR it happened to
+    *            wValue - event dependent, see eTraceEvent_t
+    *
+    *   Returns: Nothing.
+    *
+    *   Safe from ISRs. Does nothing unless recording.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (!__atomic_load_n(&bTraceRunning, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    dword dwIndex = __atomic_fetch_add(&dwNTraceEvents, 1, __ATOMIC_RELAXED);
+    stTraceEvent_t *stEvent = &astTraceEvents[dwIndex & (TRACE_N_EVENTS - 1)];
+    stEvent->dwtTimestampus = (dword)esp_timer_get_time();
+    stEvent->byEvent = (byte)eEvent;
+    stEvent->byID = byID;
+    stEvent->wValue = wValue;
+}
+
+void trace_stall(byte byTask)
+{
+    /*
+    *===========================================================================
+    *   trace_stall
+    *   Takes:   byTask - eSchedTask_t that missed its deadline
+    *
+    *   Returns: Nothing.
+    *
+    *   Marks the miss, then stops recording if trace_start asked for it.
+    *   The background task writes the dump.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    trace_event(eTRACE_STALL, byTask, 0);
+    if (bTraceStopOnStall && __atomic_load_n(&bTraceRunning, __ATOMIC_RELAXED))
+    {
+        trace_stop();
+        __atomic_store_n(&bTraceStalled, TRUE, __ATOMIC_RELEASE);
+    }
+}
+
+esp_err_t trace_dump_file(const char *abyPath)
+{
+    /*
+    *===========================================================================
+    *   trace_dump_file
+    *   Takes:   abyPath - file to write, normally on the SD card
+    *
+    *   Returns: ESP_OK, ESP_ERR_NOT_FOUND if the file could not be opened or
+    *            ESP_FAIL if a write failed.
+    *
+    *   Stops recording and writes the ring. Takes tens of ms, call from
+    *   the background task.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Written from the snapshot
+    *
+    *===========================================================================
+    */
+    byte abyChunk[TRACE_FILE_CHUNK_BYTES];
+
+    FILE *stFile = fopen(abyPath, "wb");
+    if (stFile == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    trace_snapshot();
+    for (dword dwOffset = 0; dwOffset < dwTraceDumpLength; dwOffset += sizeof(abyChunk))
+    {
+        size_t NLength = trace_dump_read(dwOffset, abyChunk, sizeof(abyChunk));
+        (void)fwrite(abyChunk, 1, NLength, stFile);
+    }
+    boolean bFailed = ferror(stFile);
+    if (fclose(stFile) != 0 || bFailed)
+    {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TRACE_TAG, "Written to %s", abyPath);
+    return ESP_OK;
+}
+
+void trace_dump_serial(void)
+{
+    /*
+    *===========================================================================
+    *   trace_dump_serial
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Stops recording and starts printing the ring as hex lines. At 115200
+    *   baud 32 kB takes about 6 s, longer than the watchdog, so trace_service
+    *   prints TRACE_SERIAL_CHUNK_BYTES per call from the background task.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Printed in chunks by trace_service
+    *
+    *===========================================================================
+    */
+    trace_snapshot();
+    dwTraceSerialCursor = 0;
+    bTraceSerialDumping = TRUE;
+    printf("TRACE BEGIN\n");
+}
+
+byte IRAM_ATTR trace_last_events(stTraceEvent_t *astEvents, byte byMaxEvents)
+{
+    /*
+    *===========================================================================
+    *   trace_last_events
+    *   Takes:   astEvents - filled with the newest events, oldest first
+    *            byMaxEvents - room in astEvents
+    *
+    *   Returns: Events copied, 0 if nothing was ever recorded.
+    *
+    *   Safe from ISRs and panic handlers. Does not stop recording, so with
+    *   the trace running the oldest copied event can already be overwritten.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    dword dwNWritten = __atomic_load_n(&dwNTraceEvents, __ATOMIC_ACQUIRE);
+    dword dwNEvents = (dwNWritten > TRACE_N_EVENTS) ? TRACE_N_EVENTS : dwNWritten;
+    byte byNCopied = (dwNEvents > byMaxEvents) ? byMaxEvents : (byte)dwNEvents;
+    for (byte i = 0; i < byNCopied; i++)
+    {
+        astEvents[i] = astTraceEvents[(dwNWritten - byNCopied + i) & (TRACE_N_EVENTS - 1)];
+    }
+    return byNCopied;
+}
+
+static void trace_service(void)
+{
+    /*
+    *===========================================================================
+    *   trace_service
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Background runnable. After a stall writes the dump to the SD card, or
+    *   the serial port if there is no card, one chunk per call.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Serial dump a chunk at a time
+    *
+    *===========================================================================
+    */
+    if (bTraceSerialDumping)
+    {
+        trace_serial_chunk();
+        return;
+    }
+    boolean bExpected = TRUE;
+    if (!__atomic_compare_exchange_n(&bTraceStalled, &bExpected, FALSE, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    ESP_LOGW(TRACE_TAG, "Deadline missed, dumping trace");
+    if (trace_dump_file(TRACE_FILE_PATH) != ESP_OK)
+    {
+        trace_dump_serial();
+    }
+}
+
+static word trace_names(stTraceName_t *astNames, word wMaxNames)
+{
+    /*
+    *===========================================================================
+    *   trace_names
+    *   Takes:   astNames - filled with the name of every ID in the events
+    *            wMaxNames - room in astNames
+    *
+    *   Returns: Names filled.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    word wNNames = 0;
+    stRunnableStats_t stRunnable;
+
+    for (byte i = 0; i < eSCHED_TOTAL && wNNames < wMaxNames; i++)
+    {
+        astNames[wNNames] = (stTraceName_t){ .byKind = eTRACE_NAME_TASK, .byID = i, .byTrack = i };
+        strncpy(astNames[wNNames++].abyName, scheduler_task_name(i), sizeof(astNames[0].abyName) - 1);
+    }
+    for (byte i = 0; scheduler_get_runnable_stats(i, &stRunnable) == ESP_OK && wNNames < wMaxNames; i++)
+    {
+        astNames[wNNames] = (stTraceName_t){ .byKind = eTRACE_NAME_RUNNABLE, .byID = i, .byTrack = stRunnable.eTask };
+        strncpy(astNames[wNNames++].abyName, stRunnable.abyName, sizeof(astNames[0].abyName) - 1);
+    }
+    for (byte i = 0; i < eTRACE_ISR_TOTAL && wNNames < wMaxNames; i++)
+    {
+        astNames[wNNames] = (stTraceName_t){ .byKind = eTRACE_NAME_ISR, .byID = i, .byTrack = i };
+        strncpy(astNames[wNNames++].abyName, aabyISRNames[i], sizeof(astNames[0].abyName) - 1);
+    }
+    return wNNames;
+}
+
+static void trace_snapshot(void)
+{
+    /*
+    *===========================================================================
+    *   trace_snapshot
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Stops recording, waits for writers already in trace_event, then fixes
+    *   the header, names and oldest event of the dump.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version, from trace_write
+    *
+    *===========================================================================
+    */
+    trace_stop();
+    vTaskDelay(pdMS_TO_TICKS(TRACE_SETTLE_MS));
+
+    dword dwNWritten = __atomic_load_n(&dwNTraceEvents, __ATOMIC_ACQUIRE);
+    dword dwNEvents = (dwNWritten > TRACE_N_EVENTS) ? TRACE_N_EVENTS : dwNWritten;
+    stTraceDumpHeader = (stTraceHeader_t)
+    {
+        .abyMagic = { 'S', 'F', 'R', 'T', 'R', 'A', 'C', 'E' },
+        .wVersion = TRACE_VERSION,
+        .wNNames = trace_names(astTraceDumpNames, sizeof(astTraceDumpNames) / sizeof(astTraceDumpNames[0])),
+        .dwNEvents = dwNEvents,
+        .dwNLost = dwNWritten - dwNEvents,
+    };
+    /* Oldest first, the ring has wrapped once more events were written than fit */
+    dwTraceDumpFirst = (dwNWritten > TRACE_N_EVENTS) ? (dwNWritten & (TRACE_N_EVENTS - 1)) : 0;
+    dwTraceDumpLength = sizeof(stTraceDumpHeader) + stTraceDumpHeader.wNNames * sizeof(astTraceDumpNames[0]) +
+                        dwNEvents * sizeof(stTraceEvent_t);
+}
+
+static size_t trace_dump_read(dword dwOffset, byte *abyOut, size_t NMax)
+{
+    /*
+    *===========================================================================
+    *   trace_dump_read
+    *   Takes:   dwOffset - position in the dump
+    *            abyOut - filled with the dump from dwOffset
+    *            NMax - room in abyOut
+    *
+    *   Returns: Bytes copied, 0 at the end of the dump.
+    *
+    *   The dump is the header, the names then the events oldest first, read
+    *   from the snapshot so it can be written a piece at a time.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    const dword dwNamesStart = sizeof(stTraceDumpHeader);
+    const dword dwEventsStart = dwNamesStart + stTraceDumpHeader.wNNames * sizeof(astTraceDumpNames[0]);
+    const dword dwRingBytes = TRACE_N_EVENTS * sizeof(stTraceEvent_t);
+    size_t NCopied = 0;
+
+    while (NCopied < NMax && dwOffset < dwTraceDumpLength)
+    {
+        if (dwOffset < dwNamesStart)
+        {
+            abyOut[NCopied] = ((const byte *)&stTraceDumpHeader)[dwOffset];
+        }
+        else if (dwOffset < dwEventsStart)
+        {
+            abyOut[NCopied] = ((const byte *)astTraceDumpNames)[dwOffset - dwNamesStart];
+        }
+        else
+        {
+            dword dwRingOffset = (dwTraceDumpFirst * sizeof(stTraceEvent_t) + dwOffset - dwEventsStart) % dwRingBytes;
+            abyOut[NCopied] = ((const byte *)astTraceEvents)[dwRingOffset];
+        }
+        NCopied++;
+        dwOffset++;
+    }
+    return NCopied;
+}
+
+static void trace_serial_chunk(void)
+{
+    /*
+    *===========================================================================
+    *   trace_serial_chunk
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Prints the next TRACE_SERIAL_CHUNK_BYTES of the serial dump,
+    *   TRACE_SERIAL_LINE_BYTES of hex a line, and ends it after the last.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version, from trace_write_serial
+    *
+    *===========================================================================
+    */
+    byte abyLine[TRACE_SERIAL_LINE_BYTES];
+    char abyHex[TRACE_SERIAL_LINE_BYTES * 2 + 1];
+
+    for (word wNPrinted = 0; wNPrinted < TRACE_SERIAL_CHUNK_BYTES; wNPrinted += TRACE_SERIAL_LINE_BYTES)
+    {
+        size_t NLength = trace_dump_read(dwTraceSerialCursor, abyLine, sizeof(abyLine));
+        if (NLength == 0)
+        {
+            printf("TRACE END\n");
+            bTraceSerialDumping = FALSE;
+            return;
+        }
+        /* One printf a line so other tasks' logging lands between lines */
+        for (size_t i = 0; i < NLength; i++)
+        {
+            sprintf(&abyHex[i * 2], "%02X", abyLine[i]);
+        }
+        printf("TRACE:%s\n", abyHex);
+        dwTraceSerialCursor += NLength;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef SFR_TRACE
+#define SFR_TRACE
+
+#include <stdio.h>
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sfrtypes.h"
+
+/* --------------------------- Types ---------------------------------------- */
+typedef enum {
+    eTRACE_TASK_BEGIN = 0,      // id eSchedTask_t
+    eTRACE_TASK_END,
+    eTRACE_RUNNABLE_BEGIN,      // id runnable index
+    eTRACE_RUNNABLE_END,
+    eTRACE_ISR_BEGIN,           // id eTraceISR_t
+    eTRACE_ISR_END,             // value ring buffer depth for CAN RX, bytes for ESP-NOW RX, send status for ESP-NOW TX
+    eTRACE_SD_WRITE_BEGIN,      // value bytes
+    eTRACE_SD_WRITE_END,
+    eTRACE_STALL,               // id eSchedTask_t that missed its deadline
+} eTraceEvent_t;
+
+typedef enum {
+    eTRACE_ISR_CAN0_RX = 0,
+    eTRACE_ISR_CAN1_RX,
+    eTRACE_ISR_ESPNOW_RX,
+    eTRACE_ISR_ESPNOW_TX,
+    eTRACE_ISR_TOTAL,
+} eTraceISR_t;
+
+typedef struct {
+    dword dwtTimestampus;       // wraps every 71 minutes
+    byte byEvent;               // eTraceEvent_t
+    byte byID;
+    word wValue;
+} stTraceEvent_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t trace_start(boolean bStopOnStall);
+void trace_stop(void);
+void trace_event(eTraceEvent_t eEvent, byte byID, word wValue);
+void trace_stall(byte byTask);
+esp_err_t trace_dump_file(const char *abyPath);
+void trace_dump_serial(void);
+byte trace_last_events(stTraceEvent_t *astEvents, byte byMaxEvents);
+
+#endif // SFR_TRACE
@@ -0,0 +1,330 @@
+/*
+trigger.c
+File contains the event trigger for the SD card logger. Every frame leaving
+the CAN ring buffer goes into a circular pre-trigger history and is checked
+against the trigger conditions. When one fires the history from before the
+trigger and everything after it, up to the post-trigger window, is written at
+full rate to its own event file next to the main log.
+
+The history is sized to hold TRIGGER_PRE_TIME with both buses full. Without
+PSRAM it falls back to a shorter history, and each event file records how
+much pre-trigger time it actually holds.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include "trigger.h"
+#include "sdcard.h"
+#include "can.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef enum {
+    eTRIGGER_IDLE = 0,
+    eTRIGGER_DUMPING,
+    eTRIGGER_HOLDOFF,
+} eTriggerState_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define TRIGGER_PRE_TIME 2000000     // us of history written before the trigger
+#define TRIGGER_MAX_FRAME_RATE (CAN_N_BUSES * 8800)  // frames/s, 8 byte frames back to back at 1 Mbps
+#define TRIGGER_HISTORY_LENGTH ((dword)(TRIGGER_PRE_TIME / 1000) * TRIGGER_MAX_FRAME_RATE / 1000) // frames
+#define TRIGGER_HISTORY_INTERNAL 4096 // frames when there is no PSRAM, 128 KB
+#define TRIGGER_HISTORY_MIN 1024     // smallest history worth having
+#define TRIGGER_POST_TIME 2000000    // us written after the trigger
+#define TRIGGER_HOLDOFF_TIME 5000000 // us after an event before the next can fire
+#define TRIGGER_FRAMES_PER_CALL 64   // max frames written per trigger_service call
+#define TRIGGER_FILE_BUFFER 4096     // stdio buffer for the event file (bytes)
+
+/* --------------------------- Local Variables ------------------------------ */
+/*
+* Conditions that start an event capture. IDs and signal positions are
+* placeholders, UPDATE THESE to match the car.
+*/
+static const stTriggerCondition_t astTriggerConditions[] =
+{
+    { .abyName = "Inverter fault", .dwID = 0x181, .byStartByte = 0, .byNBytes = 1,
+      .dwMask = 0xFF, .eCompare = eTRIGGER_NOT_EQUAL, .dwValue = 0 },
+    { .abyName = "IMD fault",      .dwID = 0x300, .byStartByte = 0, .byNBytes = 1,
+      .dwMask = 0x01, .eCompare = eTRIGGER_BITS_SET, .dwValue = 0x01 },
+    { .abyName = "BMS error",      .dwID = 0x6B0, .byStartByte = 4, .byNBytes = 2,
+      .dwMask = 0xFFFF, .eCompare = eTRIGGER_NOT_EQUAL, .dwValue = 0 },
+};
+#define TRIGGER_N_CONDITIONS (sizeof(astTriggerConditions) / sizeof(astTriggerConditions[0]))
+
+static CAN_frame_t *astTriggerHistory = NULL;
+static dword dwHistoryLength = 0;           // frames allocated, TRIGGER_HISTORY_LENGTH with PSRAM
+static dword dwHistoryWrites = 0;           // total frames ever stored, index is this mod length
+static eTriggerState_t eTriggerState = eTRIGGER_IDLE;
+static qword qwtTriggerus = 0;              // time of the frame that fired
+static dword dwDumpPosition = 0;            // next history entry to write, same count as dwHistoryWrites
+static FILE *stEventFile = NULL;
+static word wNEvents = 0;
+static dword dwNDumpFramesLost = 0;         // frames overwritten before the dump reached them
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t trigger_init(void);
+void trigger_process_frame(const CAN_frame_t *stFrame);
+esp_err_t trigger_service(void);
+static boolean trigger_check(const stTriggerCondition_t *stCondition, const CAN_frame_t *stFrame);
+static void trigger_fire(const stTriggerCondition_t *stCondition, const CAN_frame_t *stFrame);
+
+/* --------------------------- Functions ------------------------------------ */
+
+esp_err_t trigger_init(void)
+{
+    /*
+    *===========================================================================
+    *   trigger_init
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Allocates the pre-trigger history, the full TRIGGER_PRE_TIME at
+    *   TRIGGER_MAX_FRAME_RATE in PSRAM if the chip has it. Otherwise a
+    *   shorter one goes in internal RAM, halved until it fits, and the
+    *   pre-trigger time it covers at full load is logged. Call after
+    *   SD_card_init.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Sized from the pre-trigger time, shorter without PSRAM
+    *
+    *===========================================================================
+    */
+    dwHistoryLength = TRIGGER_HISTORY_LENGTH;
+    astTriggerHistory = heap_caps_malloc(sizeof(CAN_frame_t) * dwHistoryLength, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (astTriggerHistory == NULL)
+    {
+        dwHistoryLength = TRIGGER_HISTORY_INTERNAL;
+        while (dwHistoryLength >= TRIGGER_HISTORY_MIN)
+        {
+            astTriggerHistory = heap_caps_malloc(sizeof(CAN_frame_t) * dwHistoryLength, MALLOC_CAP_8BIT);
+            if (astTriggerHistory != NULL)
+            {
+                ESP_LOGW("TRIGGER", "No PSRAM, history of %lu frames covers %lu of %lu ms at full load",
+                    (unsigned long)dwHistoryLength, (unsigned long)(dwHistoryLength * 1000 / TRIGGER_MAX_FRAME_RATE),
+                    (unsigned long)(TRIGGER_PRE_TIME / 1000));
+                break;
+            }
+            dwHistoryLength /= 2;
+        }
+    }
+    if (astTriggerHistory == NULL)
+    {
+        ESP_LOGE("TRIGGER", "Failed to allocate history (len=%u)", TRIGGER_HISTORY_MIN);
+        return ESP_ERR_NO_MEM;
+    }
+    dwHistoryWrites = 0;
+    eTriggerState = eTRIGGER_IDLE;
+    return ESP_OK;
+}
+
+void trigger_process_frame(const CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   trigger_process_frame
+    *   Takes:   stFrame - frame leaving the CAN ring buffer
+    *
+    *   Returns: Nothing.
+    *
+    *   Adds the frame to the history and checks it against the conditions.
+    *   Conditions are only checked when idle, a frame costs a store and a
+    *   handful of ID compares.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (astTriggerHistory == NULL)
+    {
+        return;
+    }
+    astTriggerHistory[dwHistoryWrites % dwHistoryLength] = *stFrame;
+    dwHistoryWrites++;
+
+    if (eTriggerState == eTRIGGER_HOLDOFF && stFrame->qwtTimestampus - qwtTriggerus >= TRIGGER_HOLDOFF_TIME)
+    {
+        eTriggerState = eTRIGGER_IDLE;
+    }
+    if (eTriggerState != eTRIGGER_IDLE)
+    {
+        return;
+    }
+    for (word wNCondition = 0; wNCondition < TRIGGER_N_CONDITIONS; wNCondition++)
+    {
+        if (trigger_check(&astTriggerConditions[wNCondition], stFrame))
+        {
+            trigger_fire(&astTriggerConditions[wNCondition], stFrame);
+            break;
+        }
+    }
+}
+
+static boolean trigger_check(const stTriggerCondition_t *stCondition, const CAN_frame_t *stFrame)
+{
+    if (stFrame->dwID != stCondition->dwID)
+    {
+        return FALSE;
+    }
+    if (stCondition->eCompare == eTRIGGER_ANY)
+    {
+        return TRUE;
+    }
+    if (stCondition->byStartByte + stCondition->byNBytes > stFrame->byDLC)
+    {
+        return FALSE;
+    }
+
+    dword dwSignal = 0;
+    for (byte i = 0; i < stCondition->byNBytes; i++)
+    {
+        dwSignal |= (dword)stFrame->abData[stCondition->byStartByte + i] << (8 * i);
+    }
+    dwSignal &= stCondition->dwMask;
+
+    switch (stCondition->eCompare)
+    {
+        case eTRIGGER_EQUAL:     return dwSignal == stCondition->dwValue;
+        case eTRIGGER_NOT_EQUAL: return dwSignal != stCondition->dwValue;
+        case eTRIGGER_GREATER:   return dwSignal > stCondition->dwValue;
+        case eTRIGGER_LESS:      return dwSignal < stCondition->dwValue;
+        case eTRIGGER_BITS_SET:  return (dwSignal & stCondition->dwValue) != 0;
+        default:                 return FALSE;
+    }
+}
+
+static void trigger_fire(const stTriggerCondition_t *stCondition, const CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   trigger_fire
+    *   Takes:   stCondition - condition that fired
+    *            stFrame - frame that fired it
+    *
+    *   Returns: Nothing.
+    *
+    *   Opens the event file and points the dump at the oldest frame in the
+    *   history that is inside the pre-trigger window. The writing itself is
+    *   done a bit at a time by trigger_service. The file header says how much
+    *   pre-trigger time the history held, and if it was cut short.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Pre-trigger span in the event header
+    *
+    *===========================================================================
+    */
+    char abyEventPath[64];
+
+    qwtTriggerus = stFrame->qwtTimestampus;
+    SD_card_event_path(abyEventPath, sizeof(abyEventPath), wNEvents);
+    stEventFile = fopen(abyEventPath, "w");
+    if (stEventFile == NULL)
+    {
+        ESP_LOGE("TRIGGER", "%s fired, failed to open %s", stCondition->abyName, abyEventPath);
+        eTriggerState = eTRIGGER_HOLDOFF;
+        return;
+    }
+    setvbuf(stEventFile, NULL, _IOFBF, TRIGGER_FILE_BUFFER);
+    wNEvents++;
+
+    /* Walk back from the trigger frame to the start of the pre-trigger window */
+    dword dwOldest = (dwHistoryWrites > dwHistoryLength) ? dwHistoryWrites - dwHistoryLength : 0;
+    dwDumpPosition = dwHistoryWrites - 1;
+    while (dwDumpPosition > dwOldest &&
+           qwtTriggerus - astTriggerHistory[(dwDumpPosition - 1) % dwHistoryLength].qwtTimestampus <= TRIGGER_PRE_TIME)
+    {
+        dwDumpPosition--;
+    }
+
+    /* Stopping at the oldest frame of a wrapped history means the window was cut short */
+    qword qwtPreus = qwtTriggerus - astTriggerHistory[dwDumpPosition % dwHistoryLength].qwtTimestampus;
+    boolean bTruncated = (dwDumpPosition == dwOldest && dwOldest > 0);
+    ESP_LOGW("TRIGGER", "%s fired, writing %s", stCondition->abyName, abyEventPath);
+    fprintf(stEventFile, "# %s ID %X at %llu us, timestamps in us\n", stCondition->abyName,
+            (unsigned)stFrame->dwID, (unsigned long long)qwtTriggerus);
+    fprintf(stEventFile, "# pre-trigger %llu of %lu us%s\n", (unsigned long long)qwtPreus,
+            (unsigned long)TRIGGER_PRE_TIME, bTruncated ? ", truncated, history full" : "");
+    if (bTruncated)
+    {
+        ESP_LOGW("TRIGGER", "History of %lu frames held %llu of %lu us before the trigger", (unsigned long)dwHistoryLength,
+            (unsigned long long)qwtPreus, (unsigned long)TRIGGER_PRE_TIME);
+    }
+    dwNDumpFramesLost = 0;
+    eTriggerState = eTRIGGER_DUMPING;
+}
+
+esp_err_t trigger_service(void)
+{
+    /*
+    *===========================================================================
+    *   trigger_service
+    *   Takes:   None
+    *
+    *   Returns: ESP_OK if successful, error code if not.
+    *
+    *   Writes the next part of an event, at most TRIGGER_FRAMES_PER_CALL frames
+    *   so the logging path is never held up for long. Post-trigger frames come
+    *   from the same history so the dump just chases the newest frame until the
+    *   post-trigger window has passed. Call after each batch of frames.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (eTriggerState != eTRIGGER_DUMPING)
+    {
+        return ESP_OK;
+    }
+
+    /* The history has wrapped past the dump, skip to the oldest frame left */
+    if (dwHistoryWrites - dwDumpPosition > dwHistoryLength)
+    {
+        dwNDumpFramesLost += dwHistoryWrites - dwHistoryLength - dwDumpPosition;
+        dwDumpPosition = dwHistoryWrites - dwHistoryLength;
+    }
+
+    boolean bWindowDone = FALSE;
+    word wNFrames = 0;
+    while (wNFrames < TRIGGER_FRAMES_PER_CALL && dwDumpPosition != dwHistoryWrites)
+    {
+        const CAN_frame_t *stFrame = &astTriggerHistory[dwDumpPosition % dwHistoryLength];
+        if (stFrame->qwtTimestampus > qwtTriggerus + TRIGGER_POST_TIME)
+        {
+            bWindowDone = TRUE;
+            break;
+        }
+        fprintf(stEventFile, "%llu: %d %X ", (unsigned long long)stFrame->qwtTimestampus,
+                (int)stFrame->dwID, (int)stFrame->byDLC);
+        for (byte i = 0; i < stFrame->byDLC && i < 8; i++)
+        {
+            fprintf(stEventFile, " %02X", (int)stFrame->abData[i]);
+        }
+        fprintf(stEventFile, "\n");
+        dwDumpPosition++;
+        wNFrames++;
+    }
+
+    /* A quiet bus may never deliver a frame past the window, use the clock too */
+    if (!bWindowDone && dwDumpPosition == dwHistoryWrites &&
+        (qword)esp_timer_get_time() > qwtTriggerus + TRIGGER_POST_TIME)
+    {
+        bWindowDone = TRUE;
+    }
+
+    if (bWindowDone)
+    {
+        if (dwNDumpFramesLost > 0)
+        {
+            fprintf(stEventFile, "# %lu frames lost, history overran the dump\n", (unsigned long)dwNDumpFramesLost);
+        }
+        fclose(stEventFile);
+        stEventFile = NULL;
+        eTriggerState = eTRIGGER_HOLDOFF;
+        ESP_LOGI("TRIGGER", "Event written, %lu frames lost", (unsigned long)dwNDumpFramesLost);
+    }
+    return ESP_OK;
+}
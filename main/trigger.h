@@ -0,0 +1,37 @@
+#ifndef SFR_TRIGGER
+#define SFR_TRIGGER
+
+#include <stdio.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#include "sfrtypes.h"
+
+/* --------------------------- Types ---------------------------------------- */
+typedef enum {
+    eTRIGGER_ANY = 0,       // any frame with the ID
+    eTRIGGER_EQUAL,
+    eTRIGGER_NOT_EQUAL,
+    eTRIGGER_GREATER,
+    eTRIGGER_LESS,
+    eTRIGGER_BITS_SET,      // any of dwValue's bits set in the signal
+} eTriggerCompare_t;
+
+typedef struct {
+    const char *abyName;
+    dword dwID;
+    byte byStartByte;       // first byte of the signal in abData
+    byte byNBytes;          // 1 to 4, little endian
+    dword dwMask;           // applied to the signal before comparing
+    eTriggerCompare_t eCompare;
+    dword dwValue;
+} stTriggerCondition_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+esp_err_t trigger_init(void);
+void trigger_process_frame(const CAN_frame_t *stFrame);
+esp_err_t trigger_service(void);
+
+#endif // SFR_TRIGGER
@@ -0,0 +1,515 @@
+#!/usr/bin/env python3
+"""
+dbc2c.py
+Turns a DBC file into a C header of signal decoders, run by the build for
+main/dbc/sfr.dbc. For every message it writes the ID, a struct with one field
+per signal and decode/encode functions. Every signal gets:
+
+    dbc_<message>_<signal>_raw(abData)     raw value, sign extended
+    dbc_<message>_<signal>(abData)         physical value in fixed point
+    dbc_<message>_<signal>_set(abData, x)  inverse of the above
+
+The physical value is raw * factor + offset held as an integer in units of
+1 / DBC_<MESSAGE>_<SIGNAL>_SCALE, the smallest power of ten that makes the
+factor and offset whole. All shifts, masks, factors and offsets are constants
+so each signal compiles down to a few instructions. dbc_decode dispatches on
+the ID. dbc_decode_values gives every signal of a message as a flat sqword
+array for the signal store, in the order of the eDBCSignal_t indices, with a
+bit per signal it wrote.
+
+A multiplexed message has one multiplexor signal (M) and signals that are only
+in the frame when the multiplexor has their value (mN). The struct has a field
+for every signal, decode and values only write the signals the frame carries
+and encode only sends the ones the multiplexor in the struct selects. The per
+signal functions cut the bits out whatever the multiplexor says.
+Defining DBC_MESSAGE_TABLE adds a table of every message (DLC, first signal,
+GenMsgCycleTime) and DBC_SIGNAL_TABLE one of every signal for host tools.
+
+Intel (@1) and Motorola (@0) byte order, signed and unsigned signals up to
+64 bits, simple multiplexing. Extended multiplexing, floats and value tables
+are not supported.
+
+Usage: python3 tools/dbc2c.py <in.dbc> <out.h>
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+"""
+
+import re
+import sys
+from decimal import Decimal
+from pathlib import Path
+
+MAX_SCALE_DIGITS = 6
+
+MESSAGE_RE = re.compile(r'^BO_\s+(\d+)\s+(\w+)\s*:\s*(\d+)\s+(\w+)')
+SIGNAL_RE = re.compile(
+    r'^SG_\s+(\w+)\s*(\w*)\s*:\s*(\d+)\|(\d+)@([01])([+-])\s*'
+    r'\(\s*([-+0-9.eE]+)\s*,\s*([-+0-9.eE]+)\s*\)\s*'
+    r'\[\s*([-+0-9.eE]+)\s*\|\s*([-+0-9.eE]+)\s*\]\s*"([^"]*)"')
+CYCLE_TIME_RE = re.compile(r'^BA_\s+"GenMsgCycleTime"\s+BO_\s+(\d+)\s+(\d+)\s*;')
+MUX_VALUE_RE = re.compile(r'^m(\d+)$')
+MAX_MUX_SIGNALS = 64            # the values mask is a qword
+
+
+class DBCError(Exception):
+    pass
+
+
+def snake(name):
+    """InverterTemps -> inverter_temps, IMDStatus -> imd_status"""
+    name = re.sub(r'([A-Z]+)([A-Z][a-z])', r'\1_\2', name)
+    name = re.sub(r'([a-z0-9])([A-Z])', r'\1_\2', name)
+    return name.lower()
+
+
+def parse_dbc(path):
+    messages = []
+    message = None
+    cycle_times = {}
+    for line_number, line in enumerate(Path(path).read_text(encoding='latin-1').splitlines(), 1):
+        line = line.strip()
+        match = CYCLE_TIME_RE.match(line)
+        if match:
+            cycle_times[int(match.group(1)) & 0x1FFFFFFF] = int(match.group(2))
+            continue
+        match = MESSAGE_RE.match(line)
+        if match:
+            frame_id = int(match.group(1))
+            extended = bool(frame_id & 0x80000000)
+            message = {
+                'id': frame_id & 0x1FFFFFFF,
+                'extended': extended,
+                'name': match.group(2),
+                'dlc': int(match.group(3)),
+                'signals': [],
+            }
+            messages.append(message)
+            continue
+        if not line.startswith('SG_'):
+            continue
+        match = SIGNAL_RE.match(line)
+        if message is None or not match:
+            raise DBCError(f'{path}:{line_number}: signal not understood')
+        mux = None
+        if match.group(2) == 'M':
+            mux = 'M'
+        elif match.group(2):
+            mux_match = MUX_VALUE_RE.match(match.group(2))
+            if not mux_match:
+                raise DBCError(f'{path}:{line_number}: extended multiplexing is not supported')
+            mux = int(mux_match.group(1))
+        message['signals'].append({
+            'name': match.group(1),
+            'start': int(match.group(3)),
+            'length': int(match.group(4)),
+            'intel': match.group(5) == '1',
+            'signed': match.group(6) == '-',
+            'factor': Decimal(match.group(7)),
+            'offset': Decimal(match.group(8)),
+            'unit': match.group(11),
+            'mux': mux,
+        })
+    for message in messages:
+        message['cycle_ms'] = cycle_times.get(message['id'], 0)
+        multiplexors = [s for s in message['signals'] if s['mux'] == 'M']
+        if len(multiplexors) > 1:
+            raise DBCError(f"{message['name']}: more than one multiplexor")
+        message['multiplexor'] = multiplexors[0] if multiplexors else None
+        if message['multiplexor'] is None and any(s['mux'] is not None for s in message['signals']):
+            raise DBCError(f"{message['name']}: multiplexed signals without a multiplexor")
+        if len(message['signals']) > MAX_MUX_SIGNALS:
+            raise DBCError(f"{message['name']}: more than {MAX_MUX_SIGNALS} signals")
+    return messages
+
+
+def signal_bits(signal, dlc):
+    """List of (byte, bit in byte, bit in raw value) for every bit of a signal"""
+    bits = []
+    length = signal['length']
+    if signal['intel']:
+        for raw_bit in range(length):
+            position = signal['start'] + raw_bit
+            bits.append((position // 8, position % 8, raw_bit))
+    else:
+        # Motorola: start is the MSB, counting down each byte then into the next
+        position = signal['start']
+        for raw_bit in range(length - 1, -1, -1):
+            bits.append((position // 8, position % 8, raw_bit))
+            position = position + 15 if position % 8 == 0 else position - 1
+    for byte_index, _, _ in bits:
+        if byte_index >= dlc:
+            raise DBCError(f"signal {signal['name']} runs past byte {dlc - 1}")
+    return bits
+
+
+def signal_runs(signal, dlc):
+    """Groups the bits into runs of adjacent bits within one byte: (byte, low bit, n bits, raw shift)"""
+    runs = []
+    for byte_index, bit, raw_bit in sorted(signal_bits(signal, dlc), key=lambda b: (b[0], b[1])):
+        if runs:
+            last = runs[-1]
+            if last[0] == byte_index and last[1] + last[2] == bit and last[3] + last[2] == raw_bit:
+                runs[-1] = (last[0], last[1], last[2] + 1, last[3])
+                continue
+        runs.append((byte_index, bit, 1, raw_bit))
+    return runs
+
+
+def fixed_point(signal):
+    """Scale, integer factor and integer offset for the fixed point value"""
+    for digits in range(MAX_SCALE_DIGITS + 1):
+        scale = 10 ** digits
+        factor = signal['factor'] * scale
+        offset = signal['offset'] * scale
+        if factor == factor.to_integral_value() and offset == offset.to_integral_value():
+            return scale, int(factor), int(offset)
+    raise DBCError(f"signal {signal['name']}: factor and offset need more than {MAX_SCALE_DIGITS} decimal places")
+
+
+def c_types(signal):
+    """(raw type, value type, value Hungarian prefix)"""
+    length = signal['length']
+    raw_type = 'dword' if length <= 32 else 'qword'
+    if signal['signed']:
+        raw_min, raw_max = -(1 << (length - 1)), (1 << (length - 1)) - 1
+    else:
+        raw_min, raw_max = 0, (1 << length) - 1
+    scale, factor, offset = fixed_point(signal)
+    ends = [raw_min * factor + offset, raw_max * factor + offset]
+    low, high = min(ends), max(ends)
+    if low >= 0 and high <= 0xFFFFFFFF:
+        return raw_type, 'dword', 'dw'
+    if low >= -(1 << 31) and high < (1 << 31):
+        return raw_type, 'sdword', 'sdw'
+    if low >= 0 and high <= 0xFFFFFFFFFFFFFFFF:
+        return raw_type, 'qword', 'qw'
+    return raw_type, 'sqword', 'sqw'
+
+
+def c_hex(value):
+    return f'0x{value:X}'
+
+
+def emit_signal(out, message, signal):
+    msg = snake(message['name'])
+    sig = snake(signal['name'])
+    macro = f"DBC_{msg.upper()}_{sig.upper()}"
+    function = f'dbc_{msg}_{sig}'
+    raw_type, value_type, _ = c_types(signal)
+    scale, factor, offset = fixed_point(signal)
+    length = signal['length']
+    runs = signal_runs(signal, message['dlc'])
+    signed_raw = 'sdword' if raw_type == 'dword' else 'sqword'
+    raw_name = 'dwRaw' if raw_type == 'dword' else 'qwRaw'
+    value_name = c_types(signal)[2] + 'Value'
+    full_mask = (1 << length) - 1
+
+    out.append(f"#define {macro}_SCALE {scale}")
+    out.append('')
+
+    # Extract
+    terms = []
+    for byte_index, low_bit, n_bits, raw_shift in runs:
+        term = f'abData[{byte_index}]'
+        if low_bit:
+            term = f'({term} >> {low_bit})'
+        if low_bit + n_bits < 8:
+            term = f'({term} & {c_hex((1 << n_bits) - 1)})'
+        term = f'(({raw_type}){term})'
+        if raw_shift:
+            term = f'({term} << {raw_shift})'
+        terms.append(term)
+    out.append(f'static inline {signed_raw if signal["signed"] else raw_type} {function}_raw(const byte *abData)')
+    out.append('{')
+    out.append(f'    {raw_type} {raw_name} = ' + '\n        | '.join(terms) + ';')
+    if signal['signed'] and length < 32:
+        sign_bit = 1 << (length - 1)
+        out.append(f'    return ({signed_raw})((sqword)({raw_name} ^ {c_hex(sign_bit)}U) - {c_hex(sign_bit)});')
+    elif signal['signed'] and length == 32:
+        out.append(f'    return ({signed_raw})(int32_t){raw_name};')
+    elif signal['signed']:
+        out.append(f'    return ({signed_raw}){raw_name};')
+    else:
+        out.append(f'    return {raw_name};')
+    out.append('}')
+    out.append('')
+
+    # Physical
+    expression = f'({value_type}){function}_raw(abData)'
+    if factor != 1:
+        expression = f'{expression} * {factor}'
+    if offset != 0:
+        expression = f'{expression} + ({offset})'
+    unit = f" ({signal['unit']})" if signal['unit'] else ''
+    scale_note = f' x {scale}' if scale != 1 else ''
+    out.append(f'/* {signal["name"]}{unit}{scale_note} */')
+    out.append(f'static inline {value_type} {function}(const byte *abData)')
+    out.append('{')
+    out.append(f'    return {expression};')
+    out.append('}')
+    out.append('')
+
+    # Insert
+    out.append(f'static inline void {function}_set(byte *abData, {value_type} {value_name})')
+    out.append('{')
+    raw_expression = value_name
+    if offset != 0:
+        raw_expression = f'({raw_expression} - ({offset}))'
+    if factor != 1:
+        raw_expression = f'{raw_expression} / {factor}'
+    out.append(f'    {raw_type} {raw_name} = ({raw_type})({raw_expression}) & {c_hex(full_mask)}U{"LL" if raw_type == "qword" else ""};')
+    for byte_index, low_bit, n_bits, raw_shift in runs:
+        mask = ((1 << n_bits) - 1) << low_bit
+        part = raw_name
+        if raw_shift:
+            part = f'({raw_name} >> {raw_shift})'
+        if low_bit:
+            part = f'({part} << {low_bit})'
+        if mask == 0xFF:
+            out.append(f'    abData[{byte_index}] = (byte){part};')
+        else:
+            out.append(f'    abData[{byte_index}] = (byte)((abData[{byte_index}] & {c_hex(~mask & 0xFF)}) | ({part} & {c_hex(mask)}));')
+    out.append('}')
+    out.append('')
+
+
+def mux_groups(message):
+    """(always present signals, {multiplexor value: signals}), with signal indices"""
+    always = []
+    groups = {}
+    for index, signal in enumerate(message['signals']):
+        if isinstance(signal['mux'], int):
+            groups.setdefault(signal['mux'], []).append((index, signal))
+        else:
+            always.append((index, signal))
+    return always, dict(sorted(groups.items()))
+
+
+def emit_mux_switch(out, message, selector, groups, line, done=None):
+    """switch on the multiplexor, line(index, signal) for the signals of each value"""
+    out.append(f'    switch ({selector})')
+    out.append('    {')
+    for value, signals in groups.items():
+        out.append(f'        case {value}:')
+        for index, signal in signals:
+            out.append('        ' + line(index, signal))
+        out.append(f'            {done(signals) if done else "break;"}')
+    out.append('        default:')
+    out.append(f'            {done([]) if done else "break;"}')
+    out.append('    }')
+
+
+def emit_message(out, message):
+    msg = snake(message['name'])
+    struct = f"stDBC{message['name']}_t"
+    out.append(f"/* --------------------------- {message['name']} {'-' * max(0, 46 - len(message['name']))} */")
+    out.append(f"#define DBC_{msg.upper()}_ID {c_hex(message['id'])}")
+    out.append(f"#define DBC_{msg.upper()}_DLC {message['dlc']}")
+    out.append('')
+    out.append('typedef struct {')
+    for signal in message['signals']:
+        _, value_type, prefix = c_types(signal)
+        scale, _, _ = fixed_point(signal)
+        unit = signal['unit'] or 'raw'
+        scale_note = f' x {scale}' if scale != 1 else ''
+        out.append(f"    {value_type} {prefix}{signal['name']}; // {unit}{scale_note}")
+    out.append(f'}} {struct};')
+    out.append('')
+    for signal in message['signals']:
+        emit_signal(out, message, signal)
+
+    always, groups = mux_groups(message)
+    multiplexor = message['multiplexor']
+    field = lambda signal: f"stMessage->{c_types(signal)[2]}{signal['name']}"
+    decode = lambda index, signal: f"    {field(signal)} = dbc_{msg}_{snake(signal['name'])}(abData);"
+    value = lambda index, signal: f"    asqwValues[{index}] = (sqword)dbc_{msg}_{snake(signal['name'])}(abData);"
+    encode = lambda index, signal: f"    dbc_{msg}_{snake(signal['name'])}_set(abData, {field(signal)});"
+    mask = lambda signals: c_hex(sum(1 << index for index, _ in always + signals)) + 'ULL'
+
+    if multiplexor:
+        out.append(f"/* Only the signals of {multiplexor['name']}'s value are written, the rest keep what they had */")
+    out.append(f'static inline void dbc_{msg}_decode(const byte *abData, {struct} *stMessage)')
+    out.append('{')
+    out.extend(decode(index, signal) for index, signal in always)
+    if multiplexor:
+        emit_mux_switch(out, message, field(multiplexor), groups, decode)
+    out.append('}')
+    out.append('')
+    out.append(f'/* Signals of the frame as sqword, in signal order, for the signal store.')
+    out.append(f'   Returns a bit per signal written */')
+    out.append(f'static inline qword dbc_{msg}_values(const byte *abData, sqword *asqwValues)')
+    out.append('{')
+    out.extend(value(index, signal) for index, signal in always)
+    if multiplexor:
+        emit_mux_switch(out, message, f"asqwValues[{message['signals'].index(multiplexor)}]", groups, value,
+                        lambda signals: f'return {mask(signals)};')
+    else:
+        out.append(f'    return {mask([])};')
+    out.append('}')
+    out.append('')
+    out.append(f'static inline void dbc_{msg}_encode(const {struct} *stMessage, byte *abData)')
+    out.append('{')
+    out.append(f"    memset(abData, 0, DBC_{msg.upper()}_DLC);")
+    out.extend(encode(index, signal) for index, signal in always)
+    if multiplexor:
+        emit_mux_switch(out, message, field(multiplexor), groups, encode)
+    out.append('}')
+    out.append('')
+
+
+def emit_header(messages, source_name):
+    guard = 'SFR_DBC_' + re.sub(r'\W', '_', Path(source_name).stem).upper()
+    out = [
+        '/*',
+        f'Generated by tools/dbc2c.py from {source_name}, DO NOT EDIT.',
+        'Change the DBC file, the build regenerates this header.',
+        '*/',
+        f'#ifndef {guard}',
+        f'#define {guard}',
+        '',
+        '#include <string.h>',
+        '#include "sfrtypes.h"',
+        '',
+    ]
+
+    # Indices, every signal of a message is consecutive
+    out.append('/* --------------------------- Indices -------------------------------------- */')
+    out.append('typedef enum {')
+    for index, message in enumerate(messages):
+        out.append(f"    eDBC_MSG_{snake(message['name']).upper()}{' = 0' if index == 0 else ''},")
+    out.append('    eDBC_MSG_TOTAL,')
+    out.append('} eDBCMessage_t;')
+    out.append('')
+    out.append('typedef enum {')
+    first = True
+    for message in messages:
+        for signal in message['signals']:
+            name = f"eDBC_SIG_{snake(message['name']).upper()}_{snake(signal['name']).upper()}"
+            out.append(f"    {name}{' = 0' if first else ''},")
+            first = False
+    out.append('    eDBC_SIG_TOTAL,')
+    out.append('} eDBCSignal_t;')
+    out.append('')
+    out.append(f"#define DBC_MAX_MESSAGE_SIGNALS {max(len(m['signals']) for m in messages)}")
+    out.append('')
+
+    for message in messages:
+        emit_message(out, message)
+
+    out.append('/* --------------------------- Dispatch ------------------------------------- */')
+    out.append('typedef union {')
+    for message in messages:
+        out.append(f"    stDBC{message['name']}_t st{message['name']};")
+    out.append('} uDBCMessage_t;')
+    out.append('')
+    out.append('/* Decodes any message in the database, FALSE if the ID is not in it */')
+    out.append('static inline boolean dbc_decode(dword dwID, const byte *abData, uDBCMessage_t *uMessage)')
+    out.append('{')
+    out.append('    switch (dwID)')
+    out.append('    {')
+    for message in messages:
+        msg = snake(message['name'])
+        out.append(f"        case DBC_{msg.upper()}_ID:")
+        out.append(f"            dbc_{msg}_decode(abData, &uMessage->st{message['name']});")
+        out.append('            return TRUE;')
+    out.append('        default:')
+    out.append('            return FALSE;')
+    out.append('    }')
+    out.append('}')
+    out.append('')
+    out.append('/* Signals of any message as sqword and a bit per signal written to pqwWritten,')
+    out.append('   eDBC_MSG_TOTAL if the ID is not in the database */')
+    out.append('static inline eDBCMessage_t dbc_decode_values(dword dwID, const byte *abData, sqword *asqwValues,')
+    out.append('                                              qword *pqwWritten)')
+    out.append('{')
+    out.append('    switch (dwID)')
+    out.append('    {')
+    for message in messages:
+        msg = snake(message['name'])
+        out.append(f"        case DBC_{msg.upper()}_ID:")
+        out.append(f"            *pqwWritten = dbc_{msg}_values(abData, asqwValues);")
+        out.append(f"            return eDBC_MSG_{msg.upper()};")
+    out.append('        default:')
+    out.append('            return eDBC_MSG_TOTAL;')
+    out.append('    }')
+    out.append('}')
+    out.append('')
+
+    # Per message table, for the signal store and tools
+    out.append('#ifdef DBC_MESSAGE_TABLE')
+    out.append('typedef struct {')
+    out.append('    dword dwID;')
+    out.append('    const char *abyName;')
+    out.append('    byte byDLC;')
+    out.append('    eDBCSignal_t eFirstSignal;')
+    out.append('    byte byNSignals;')
+    out.append('    word wtCycleTimems;     // GenMsgCycleTime, 0 for event messages')
+    out.append('    boolean bMultiplexed;   // a frame only carries some of the signals')
+    out.append('} stDBCMessageInfo_t;')
+    out.append('')
+    out.append('static const stDBCMessageInfo_t astDBCMessages[eDBC_MSG_TOTAL] =')
+    out.append('{')
+    for message in messages:
+        msg = snake(message['name']).upper()
+        first_signal = f"eDBC_SIG_{msg}_{snake(message['signals'][0]['name']).upper()}" if message['signals'] else 'eDBC_SIG_TOTAL'
+        out.append(f"    {{ DBC_{msg}_ID, \"{message['name']}\", {message['dlc']}, {first_signal}, "
+                   f"{len(message['signals'])}, {message['cycle_ms']}, "
+                   f"{'TRUE' if message['multiplexor'] else 'FALSE'} }},")
+    out.append('};')
+    out.append('#endif // DBC_MESSAGE_TABLE')
+    out.append('')
+
+    # Per signal table for host tools, costs flash so the firmware leaves it out
+    out.append('#ifdef DBC_SIGNAL_TABLE')
+    out.append('typedef struct {')
+    out.append('    dword dwID;')
+    out.append('    const char *abyName;')
+    out.append('    dword dwScale;')
+    out.append('    sqword (*pfValue)(const byte *abData);')
+    out.append('} stDBCSignalInfo_t;')
+    out.append('')
+    rows = []
+    for message in messages:
+        msg = snake(message['name'])
+        for signal in message['signals']:
+            function = f"dbc_{msg}_{snake(signal['name'])}"
+            out.append(f'static inline sqword {function}_value(const byte *abData) {{ return (sqword){function}(abData); }}')
+            rows.append(f"    {{ DBC_{msg.upper()}_ID, \"{message['name']}.{signal['name']}\", "
+                        f"DBC_{msg.upper()}_{snake(signal['name']).upper()}_SCALE, {function}_value }},")
+    out.append('')
+    out.append('static const stDBCSignalInfo_t astDBCSignals[] =')
+    out.append('{')
+    out.extend(rows)
+    out.append('};')
+    out.append('#define DBC_N_SIGNALS (sizeof(astDBCSignals) / sizeof(astDBCSignals[0]))')
+    out.append('#endif // DBC_SIGNAL_TABLE')
+    out.append('')
+    out.append(f'#endif // {guard}')
+    out.append('')
+    return '\n'.join(out)
+
+
+def main(argv):
+    if len(argv) != 3:
+        print('Usage: python3 tools/dbc2c.py <in.dbc> <out.h>', file=sys.stderr)
+        return 2
+    try:
+        messages = parse_dbc(argv[1])
+        ids = [m['id'] for m in messages]
+        if len(set(ids)) != len(ids):
+            raise DBCError('duplicate message IDs')
+        header = emit_header(messages, Path(argv[1]).name)
+    except (DBCError, OSError) as error:
+        print(f'dbc2c: {error}', file=sys.stderr)
+        return 1
+
+    # Only touch the output when it changes, so the build does not recompile for nothing
+    output = Path(argv[2])
+    if not output.exists() or output.read_text() != header:
+        output.parent.mkdir(parents=True, exist_ok=True)
+        output.write_text(header)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,278 @@
+/*
+dbc_bench.c | host tools
+Checks the decoders dbc2c.py generates against a generic runtime DBC parser
+and times the two. The generic parser is the usual approach: the DBC is read
+at run time, the message is found by ID and each signal is cut out of the
+payload as a 64 bit word with shifts and masks from the table, then scaled
+in floating point.
+
+Every signal of every random frame is decoded both ways and compared, then
+both decoders are timed over the same frames.
+
+Usage: dbc_bench <dbc file> [frames]
+
+Build: python3 tools/dbc2c.py main/dbc/sfr.dbc build/sfr_dbc.h
+       gcc -O2 -Itools/host -Imain -Ibuild tools/dbc_bench.c -lm -o dbc_bench
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#define DBC_SIGNAL_TABLE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "sfrtypes.h"
+#include "sfr_dbc.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    char abyName[64];
+    byte byStart;
+    byte byLength;
+    boolean bIntel;
+    boolean bSigned;
+    double fFactor;
+    double fOffset;
+} stBenchSignal_t;
+
+typedef struct {
+    dword dwID;
+    byte byDLC;
+    word wFirstSignal;
+    word wNSignals;
+} stBenchMessage_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define BENCH_MAX_MESSAGES 256
+#define BENCH_MAX_SIGNALS 2048
+#define BENCH_LINE_LENGTH 512
+#define BENCH_DEFAULT_FRAMES 1000000
+#define BENCH_PASSES 5
+#define BENCH_TOLERANCE 1e-6
+
+/* --------------------------- Local Variables ------------------------------ */
+static stBenchMessage_t astMessages[BENCH_MAX_MESSAGES];
+static stBenchSignal_t astSignals[BENCH_MAX_SIGNALS];
+static word wNMessages = 0;
+static word wNSignals = 0;
+/* Decoders write to globals so the compiler cannot drop signals nobody reads */
+static double afBenchValues[BENCH_MAX_SIGNALS];
+static uDBCMessage_t uBenchMessage;
+static volatile double fSink;
+static volatile sqword sqwSink;
+
+/* --------------------------- Function prototypes -------------------------- */
+static boolean bench_load_dbc(const char *abyPath);
+static int bench_compare_messages(const void *pvA, const void *pvB);
+static const stBenchMessage_t *bench_find_message(dword dwID);
+static word bench_generic_decode(dword dwID, const byte *abData, double *afValues);
+static double bench_seconds_since(const struct timespec *stStart);
+
+/* --------------------------- Functions ------------------------------------ */
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: dbc_bench <dbc file> [frames]\n");
+        return 2;
+    }
+    dword dwNFrames = (argc > 2) ? strtoul(argv[2], NULL, 0) : BENCH_DEFAULT_FRAMES;
+    if (!bench_load_dbc(argv[1]) || wNMessages == 0 || dwNFrames == 0)
+    {
+        fprintf(stderr, "dbc_bench: could not read messages from %s\n", argv[1]);
+        return 1;
+    }
+
+    /* Random frames of the database's IDs */
+    dword *adwIDs = malloc(dwNFrames * sizeof(dword));
+    byte (*aabyData)[8] = malloc(dwNFrames * 8);
+    if (adwIDs == NULL || aabyData == NULL)
+    {
+        fprintf(stderr, "dbc_bench: out of memory\n");
+        return 1;
+    }
+    srand(1);
+    for (dword i = 0; i < dwNFrames; i++)
+    {
+        adwIDs[i] = astMessages[rand() % wNMessages].dwID;
+        for (byte j = 0; j < 8; j++)
+        {
+            aabyData[i][j] = (byte)rand();
+        }
+    }
+
+    /* Check every signal against the generic parser */
+    qword qwNChecked = 0;
+    qword qwNWrong = 0;
+    for (dword i = 0; i < dwNFrames; i++)
+    {
+        word wNValues = bench_generic_decode(adwIDs[i], aabyData[i], afBenchValues);
+        word wNValue = 0;
+        for (word j = 0; j < DBC_N_SIGNALS; j++)
+        {
+            if (astDBCSignals[j].dwID != adwIDs[i])
+            {
+                continue;
+            }
+            double fGenerated = (double)astDBCSignals[j].pfValue(aabyData[i]) / astDBCSignals[j].dwScale;
+            double fGeneric = (wNValue < wNValues) ? afBenchValues[wNValue] : NAN;
+            if (!(fabs(fGenerated - fGeneric) <= BENCH_TOLERANCE * fmax(1.0, fabs(fGeneric))))
+            {
+                if (qwNWrong < 10)
+                {
+                    fprintf(stderr, "%s: generated %.6f, generic %.6f\n", astDBCSignals[j].abyName, fGenerated, fGeneric);
+                }
+                qwNWrong++;
+            }
+            wNValue++;
+            qwNChecked++;
+        }
+    }
+    printf("%llu signal values checked, %llu differ\n", (unsigned long long)qwNChecked, (unsigned long long)qwNWrong);
+
+    /* Time both, best of several passes */
+    double fBestGeneric = 1e9;
+    double fBestGenerated = 1e9;
+    for (int NPass = 0; NPass < BENCH_PASSES; NPass++)
+    {
+        struct timespec stStart;
+        double fSum = 0;
+        clock_gettime(CLOCK_MONOTONIC, &stStart);
+        for (dword i = 0; i < dwNFrames; i++)
+        {
+            word wNValues = bench_generic_decode(adwIDs[i], aabyData[i], afBenchValues);
+            fSum += (wNValues > 0) ? afBenchValues[0] : 0;
+        }
+        fSink = fSum;
+        fBestGeneric = fmin(fBestGeneric, bench_seconds_since(&stStart));
+
+        sqword sqwSum = 0;
+        clock_gettime(CLOCK_MONOTONIC, &stStart);
+        for (dword i = 0; i < dwNFrames; i++)
+        {
+            if (dbc_decode(adwIDs[i], aabyData[i], &uBenchMessage))
+            {
+                sqwSum += uBenchMessage.stInverterTemps.sdwModuleTemp;
+            }
+        }
+        sqwSink = sqwSum;
+        fBestGenerated = fmin(fBestGenerated, bench_seconds_since(&stStart));
+    }
+
+    double fSignalsPerFrame = (double)qwNChecked / dwNFrames;
+    printf("%lu frames, %.1f signals per frame\n", (unsigned long)dwNFrames, fSignalsPerFrame);
+    printf("generic   %7.1f ns/frame %6.2f ns/signal\n", fBestGeneric * 1e9 / dwNFrames,
+           fBestGeneric * 1e9 / dwNFrames / fSignalsPerFrame);
+    printf("generated %7.1f ns/frame %6.2f ns/signal  %.1fx faster\n", fBestGenerated * 1e9 / dwNFrames,
+           fBestGenerated * 1e9 / dwNFrames / fSignalsPerFrame, fBestGeneric / fBestGenerated);
+
+    free(adwIDs);
+    free(aabyData);
+    return (qwNWrong == 0) ? 0 : 1;
+}
+
+static boolean bench_load_dbc(const char *abyPath)
+{
+    /* Reads the BO_ and SG_ lines, enough of a DBC for the comparison */
+    char abyLine[BENCH_LINE_LENGTH];
+    FILE *stFile = fopen(abyPath, "r");
+    if (stFile == NULL)
+    {
+        return FALSE;
+    }
+    while (fgets(abyLine, sizeof(abyLine), stFile) != NULL)
+    {
+        char *pbyLine = abyLine + strspn(abyLine, " \t");
+        unsigned long dwID;
+        unsigned NDLC, NStart, NLength;
+        char byOrder, bySign;
+        stBenchSignal_t stSignal;
+
+        if (sscanf(pbyLine, "BO_ %lu %*[^:]: %u", &dwID, &NDLC) == 2 && wNMessages < BENCH_MAX_MESSAGES)
+        {
+            astMessages[wNMessages++] = (stBenchMessage_t){ .dwID = dwID & 0x1FFFFFFF, .byDLC = (byte)NDLC,
+                                                            .wFirstSignal = wNSignals, .wNSignals = 0 };
+        }
+        /* Plain or multiplexed, M or mN between the name and the colon */
+        else if ((sscanf(pbyLine, "SG_ %63s : %u|%u@%c%c (%lf,%lf)", stSignal.abyName, &NStart, &NLength,
+                         &byOrder, &bySign, &stSignal.fFactor, &stSignal.fOffset) == 7
+                  || sscanf(pbyLine, "SG_ %63s %*[^:]: %u|%u@%c%c (%lf,%lf)", stSignal.abyName, &NStart, &NLength,
+                            &byOrder, &bySign, &stSignal.fFactor, &stSignal.fOffset) == 7)
+                 && wNMessages > 0 && wNSignals < BENCH_MAX_SIGNALS)
+        {
+            stSignal.byStart = (byte)NStart;
+            stSignal.byLength = (byte)NLength;
+            stSignal.bIntel = (byOrder == '1');
+            stSignal.bSigned = (bySign == '-');
+            astSignals[wNSignals++] = stSignal;
+            astMessages[wNMessages - 1].wNSignals++;
+        }
+    }
+    fclose(stFile);
+    qsort(astMessages, wNMessages, sizeof(astMessages[0]), bench_compare_messages);
+    return TRUE;
+}
+
+static int bench_compare_messages(const void *pvA, const void *pvB)
+{
+    dword dwA = ((const stBenchMessage_t *)pvA)->dwID;
+    dword dwB = ((const stBenchMessage_t *)pvB)->dwID;
+    return (dwA > dwB) - (dwA < dwB);
+}
+
+static const stBenchMessage_t *bench_find_message(dword dwID)
+{
+    stBenchMessage_t stKey = { .dwID = dwID };
+    return bsearch(&stKey, astMessages, wNMessages, sizeof(astMessages[0]), bench_compare_messages);
+}
+
+static word bench_generic_decode(dword dwID, const byte *abData, double *afValues)
+{
+    /* Decodes every signal of a frame from the table, returns how many */
+    const stBenchMessage_t *stMessage = bench_find_message(dwID);
+    if (stMessage == NULL)
+    {
+        return 0;
+    }
+    qword qwLittle = 0;
+    qword qwBig = 0;
+    for (byte i = 0; i < 8; i++)
+    {
+        qwLittle |= (qword)abData[i] << (8 * i);
+        qwBig = (qwBig << 8) | abData[i];
+    }
+
+    for (word i = 0; i < stMessage->wNSignals; i++)
+    {
+        const stBenchSignal_t *stSignal = &astSignals[stMessage->wFirstSignal + i];
+        qword qwMask = (stSignal->byLength >= 64) ? ~0ULL : (1ULL << stSignal->byLength) - 1;
+        qword qwRaw;
+        if (stSignal->bIntel)
+        {
+            qwRaw = (qwLittle >> stSignal->byStart) & qwMask;
+        }
+        else
+        {
+            /* Start is the MSB, numbered within its byte */
+            word wMSB = (stSignal->byStart / 8) * 8 + (7 - stSignal->byStart % 8);
+            qwRaw = (qwBig >> (63 - (wMSB + stSignal->byLength - 1))) & qwMask;
+        }
+        double fRaw = (double)qwRaw;
+        if (stSignal->bSigned && (qwRaw >> (stSignal->byLength - 1)) & 1)
+        {
+            fRaw = (double)(sqword)(qwRaw | ~qwMask);
+        }
+        afValues[i] = fRaw * stSignal->fFactor + stSignal->fOffset;
+    }
+    return stMessage->wNSignals;
+}
+
+static double bench_seconds_since(const struct timespec *stStart)
+{
+    struct timespec stNow;
+    clock_gettime(CLOCK_MONOTONIC, &stNow);
+    return (double)(stNow.tv_sec - stStart->tv_sec) + (double)(stNow.tv_nsec - stStart->tv_nsec) * 1e-9;
+}
@@ -0,0 +1,31 @@
+/*
+gpio.h | host build
+GPIO for the SIL build, levels are ignored.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_DRIVER_GPIO
+#define SFR_HOST_DRIVER_GPIO
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef int gpio_num_t;
+
+#define GPIO_MODE_OUTPUT 2
+#define GPIO_INTR_DISABLE 0
+#define GPIO_PULLUP_DISABLE 0
+#define GPIO_PULLDOWN_DISABLE 0
+
+typedef struct {
+    uint64_t pin_bit_mask;
+    int mode;
+    int pull_up_en;
+    int pull_down_en;
+    int intr_type;
+} gpio_config_t;
+
+static inline esp_err_t gpio_config(const gpio_config_t *stConfig) { (void)stConfig; return ESP_OK; }
+static inline esp_err_t gpio_set_level(gpio_num_t NPin, uint32_t dwLevel) { (void)NPin; (void)dwLevel; return ESP_OK; }
+
+#endif // SFR_HOST_DRIVER_GPIO
@@ -0,0 +1,13 @@
+/*
+i2c_master.h | host build
+Just the I2C handle types I2C.h refers to.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_DRIVER_I2C_MASTER
+#define SFR_HOST_DRIVER_I2C_MASTER
+
+typedef struct stSILI2CBus_t *i2c_master_bus_handle_t;
+typedef struct stSILI2CDevice_t *i2c_master_dev_handle_t;
+
+#endif // SFR_HOST_DRIVER_I2C_MASTER
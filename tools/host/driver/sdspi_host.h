@@ -0,0 +1,26 @@
+/*
+sdspi_host.h | host build
+SD over SPI host and slot configuration for the SIL build.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_DRIVER_SDSPI_HOST
+#define SFR_HOST_DRIVER_SDSPI_HOST
+
+#include "driver/spi_master.h"
+
+typedef struct {
+    int slot;
+    int max_freq_khz;
+} sdmmc_host_t;
+
+typedef struct {
+    int gpio_cs;
+    int host_id;
+} sdspi_device_config_t;
+
+#define SDSPI_HOST_DEFAULT() { .slot = 1, .max_freq_khz = 20000 }
+#define SDSPI_DEVICE_CONFIG_DEFAULT() { .gpio_cs = -1, .host_id = 1 }
+#define SDSPI_DEFAULT_DMA SPI_DMA_CH_AUTO
+
+#endif // SFR_HOST_DRIVER_SDSPI_HOST
@@ -0,0 +1,48 @@
+/*
+spi_master.h | host build
+Just the SPI types the display and SD card headers refer to.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_DRIVER_SPI_MASTER
+#define SFR_HOST_DRIVER_SPI_MASTER
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef struct stSILSPIDevice_t *spi_device_handle_t;
+
+typedef struct {
+    int length;
+    int rxlength;
+    int flags;
+    uint8_t tx_data[4];
+    uint8_t rx_data[4];
+    const void *tx_buffer;
+    void *rx_buffer;
+} spi_transaction_t;
+
+typedef struct {
+    int mosi_io_num;
+    int miso_io_num;
+    int sclk_io_num;
+    int quadwp_io_num;
+    int quadhd_io_num;
+    int max_transfer_sz;
+} spi_bus_config_t;
+
+#define SPI_TRANS_USE_TXDATA 1
+#define SPI_TRANS_USE_RXDATA 2
+#define SPI_DMA_CH_AUTO 3
+
+static inline esp_err_t spi_bus_initialize(int NHost, const spi_bus_config_t *stConfig, int NDMA)
+{
+    (void)NHost; (void)stConfig; (void)NDMA;
+    return ESP_OK;
+}
+static inline esp_err_t spi_device_acquire_bus(spi_device_handle_t stDevice, TickType_t wtWait) { (void)stDevice; (void)wtWait; return ESP_OK; }
+static inline void spi_device_release_bus(spi_device_handle_t stDevice) { (void)stDevice; }
+static inline esp_err_t spi_device_polling_transmit(spi_device_handle_t stDevice, spi_transaction_t *stTrans) { (void)stDevice; (void)stTrans; return ESP_OK; }
+
+#endif // SFR_HOST_DRIVER_SPI_MASTER
@@ -0,0 +1,12 @@
+/*
+adc_cali.h | host build
+Just the calibration handle type sfrtypes.h refers to.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ADC_CALI
+#define SFR_HOST_ADC_CALI
+
+typedef struct adc_cali_scheme_t *adc_cali_handle_t;
+
+#endif // SFR_HOST_ADC_CALI
@@ -0,0 +1,12 @@
+/*
+adc_cali_scheme.h | host build
+Empty, sfrtypes.h includes it.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ADC_CALI_SCHEME
+#define SFR_HOST_ADC_CALI_SCHEME
+
+#include "adc_cali.h"
+
+#endif // SFR_HOST_ADC_CALI_SCHEME
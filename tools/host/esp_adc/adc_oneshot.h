@@ -0,0 +1,15 @@
+/*
+adc_oneshot.h | host build
+Just the ADC handle types sfrtypes.h refers to.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ADC_ONESHOT
+#define SFR_HOST_ADC_ONESHOT
+
+typedef int adc_channel_t;
+typedef int adc_unit_t;
+typedef int adc_atten_t;
+typedef struct adc_oneshot_unit_ctx_t *adc_oneshot_unit_handle_t;
+
+#endif // SFR_HOST_ADC_ONESHOT
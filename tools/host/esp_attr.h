@@ -0,0 +1,15 @@
+/*
+esp_attr.h | host build
+Placement attributes mean nothing on the host.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_ATTR
+#define SFR_HOST_ESP_ATTR
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define EXT_RAM_BSS_ATTR
+
+#endif // SFR_HOST_ESP_ATTR
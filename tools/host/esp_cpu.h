@@ -0,0 +1,14 @@
+/*
+esp_cpu.h | host build
+Cycle counter derived from the SIL virtual clock.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_CPU
+#define SFR_HOST_ESP_CPU
+
+#include <stdint.h>
+
+uint32_t esp_cpu_get_cycle_count(void);
+
+#endif // SFR_HOST_ESP_CPU
@@ -0,0 +1,39 @@
+/*
+esp_crc.h | host build
+Table driven CRC32 matching esp_crc32_le (IEEE 802.3, same as zlib).
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_CRC
+#define SFR_HOST_ESP_CRC
+
+#include <stdint.h>
+
+#define CRC32_POLYNOMIAL 0xEDB88320u
+
+static inline uint32_t esp_crc32_le(uint32_t dwCRC, const uint8_t *abyData, uint32_t dwLength)
+{
+    static uint32_t adwTable[256];
+    static int bTableReady = 0;
+    if (!bTableReady)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t dwEntry = i;
+            for (int j = 0; j < 8; j++)
+            {
+                dwEntry = (dwEntry & 1) ? (dwEntry >> 1) ^ CRC32_POLYNOMIAL : dwEntry >> 1;
+            }
+            adwTable[i] = dwEntry;
+        }
+        bTableReady = 1;
+    }
+    dwCRC = ~dwCRC;
+    for (uint32_t i = 0; i < dwLength; i++)
+    {
+        dwCRC = adwTable[(dwCRC ^ abyData[i]) & 0xFF] ^ (dwCRC >> 8);
+    }
+    return ~dwCRC;
+}
+
+#endif // SFR_HOST_ESP_CRC
@@ -0,0 +1,56 @@
+/*
+esp_err.h | host build
+Minimal stand in for the ESP-IDF header so firmware sources that only need
+error codes can be built into the host tools.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_ERR
+#define SFR_HOST_ESP_ERR
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK                  0
+#define ESP_FAIL                -1
+#define ESP_ERR_NO_MEM          0x101
+#define ESP_ERR_INVALID_ARG     0x102
+#define ESP_ERR_INVALID_STATE   0x103
+#define ESP_ERR_INVALID_SIZE    0x104
+#define ESP_ERR_NOT_FOUND       0x105
+#define ESP_ERR_NOT_SUPPORTED   0x106
+#define ESP_ERR_TIMEOUT         0x107
+#define ESP_ERR_INVALID_CRC     0x109
+#define ESP_ERR_NVS_NO_FREE_PAGES       0x110d
+#define ESP_ERR_NVS_NEW_VERSION_FOUND   0x1110
+
+/* Aborts like the firmware does, so a SIL run stops where the target would */
+#define ESP_ERROR_CHECK(x) do {                                                 \
+        esp_err_t NCheckStatus = (x);                                           \
+        if (NCheckStatus != ESP_OK) {                                           \
+            fprintf(stderr, "ESP_ERROR_CHECK failed: %s at %s:%d\n",            \
+                    esp_err_to_name(NCheckStatus), __FILE__, __LINE__);         \
+            abort();                                                            \
+        }                                                                       \
+    } while (0)
+
+static inline const char *esp_err_to_name(esp_err_t NStatus)
+{
+    switch (NStatus) {
+        case ESP_OK:                return "ESP_OK";
+        case ESP_FAIL:              return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:        return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:   return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:  return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:     return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:       return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_CRC:   return "ESP_ERR_INVALID_CRC";
+        default:                    return "UNKNOWN_ERROR";
+    }
+}
+
+#endif // SFR_HOST_ESP_ERR
@@ -0,0 +1,14 @@
+/*
+esp_event.h | host build
+Default event loop does nothing in the SIL build.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_EVENT
+#define SFR_HOST_ESP_EVENT
+
+#include "esp_err.h"
+
+static inline esp_err_t esp_event_loop_create_default(void) { return ESP_OK; }
+
+#endif // SFR_HOST_ESP_EVENT
@@ -0,0 +1,30 @@
+/*
+esp_heap_caps.h | host build
+Every capability is plain malloc on the host.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_HEAP_CAPS
+#define SFR_HOST_ESP_HEAP_CAPS
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+static inline void *heap_caps_malloc(size_t NSize, uint32_t dwCaps)
+{
+    (void)dwCaps;
+    return malloc(NSize);
+}
+
+static inline void *heap_caps_calloc(size_t NCount, size_t NSize, uint32_t dwCaps)
+{
+    (void)dwCaps;
+    return calloc(NCount, NSize);
+}
+
+#endif // SFR_HOST_ESP_HEAP_CAPS
@@ -0,0 +1,24 @@
+/*
+esp_mac.h | host build
+A fixed MAC address for the SIL build.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_MAC
+#define SFR_HOST_ESP_MAC
+
+#include <stdint.h>
+#include <string.h>
+#include "esp_err.h"
+
+#define ESP_MAC_WIFI_STA 0
+
+static inline esp_err_t esp_read_mac(uint8_t *abyMAC, int NType)
+{
+    static const uint8_t abySILMAC[6] = { 0x02, 0x53, 0x49, 0x4C, 0x00, 0x01 };
+    (void)NType;
+    memcpy(abyMAC, abySILMAC, sizeof(abySILMAC));
+    return ESP_OK;
+}
+
+#endif // SFR_HOST_ESP_MAC
@@ -0,0 +1,14 @@
+/*
+esp_netif.h | host build
+Network interface start up does nothing in the SIL build.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_NETIF
+#define SFR_HOST_ESP_NETIF
+
+#include "esp_err.h"
+
+static inline esp_err_t esp_netif_init(void) { return ESP_OK; }
+
+#endif // SFR_HOST_ESP_NETIF
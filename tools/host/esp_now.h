@@ -0,0 +1,42 @@
+/*
+esp_now.h | host build
+ESP-NOW for the SIL build, tools/sil.c captures every packet sent.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_NOW
+#define SFR_HOST_ESP_NOW
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_wifi.h"
+
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_SEND_SUCCESS 0
+#define ESP_NOW_SEND_FAIL 1
+
+typedef int esp_now_send_status_t;
+
+typedef struct {
+    uint8_t *src_addr;
+    uint8_t *des_addr;
+} esp_now_recv_info_t;
+
+typedef struct {
+    uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+    int channel;
+    bool encrypt;
+} esp_now_peer_info_t;
+
+typedef void (*esp_now_send_cb_t)(const wifi_tx_info_t *stInfo, esp_now_send_status_t NStatus);
+typedef void (*esp_now_recv_cb_t)(const esp_now_recv_info_t *stInfo, const uint8_t *abyData, int NLength);
+
+esp_err_t esp_now_init(void);
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *stPeer);
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t pfCallback);
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t pfCallback);
+esp_err_t esp_now_send(const uint8_t *abyPeer, const uint8_t *abyData, size_t NLength);
+
+#endif // SFR_HOST_ESP_NOW
@@ -0,0 +1,14 @@
+/*
+esp_random.h | host build
+Seeded so a SIL run is repeatable.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_RANDOM
+#define SFR_HOST_ESP_RANDOM
+
+#include <stdint.h>
+
+uint32_t esp_random(void);
+
+#endif // SFR_HOST_ESP_RANDOM
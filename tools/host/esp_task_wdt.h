@@ -0,0 +1,27 @@
+/*
+esp_task_wdt.h | host build
+Task watchdog on the SIL virtual clock, a timeout ends the run.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_TASK_WDT
+#define SFR_HOST_ESP_TASK_WDT
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/task.h"
+
+typedef struct {
+    uint32_t timeout_ms;
+    uint32_t idle_core_mask;
+    bool trigger_panic;
+} esp_task_wdt_config_t;
+
+esp_err_t esp_task_wdt_init(const esp_task_wdt_config_t *stConfig);
+esp_err_t esp_task_wdt_deinit(void);
+esp_err_t esp_task_wdt_add(TaskHandle_t stTask);
+esp_err_t esp_task_wdt_reset(void);
+void esp_task_wdt_isr_user_handler(void);
+
+#endif // SFR_HOST_ESP_TASK_WDT
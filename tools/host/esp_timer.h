@@ -0,0 +1,32 @@
+/*
+esp_timer.h | host build
+esp_timer on the SIL virtual clock, see tools/sil_idf.c.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_TIMER
+#define SFR_HOST_ESP_TIMER
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef struct stSILTimer_t *esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void *pvArg);
+typedef enum { ESP_TIMER_TASK, ESP_TIMER_ISR } esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void *arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char *name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+int64_t esp_timer_get_time(void);
+esp_err_t esp_timer_create(const esp_timer_create_args_t *stArgs, esp_timer_handle_t *pstTimer);
+esp_err_t esp_timer_start_once(esp_timer_handle_t stTimer, uint64_t qwtTimeoutus);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t stTimer, uint64_t qwtPeriodus);
+esp_err_t esp_timer_stop(esp_timer_handle_t stTimer);
+
+#endif // SFR_HOST_ESP_TIMER
@@ -0,0 +1,82 @@
+/*
+esp_twai.h | host build
+TWAI node API for the SIL build. tools/sil.c injects received frames
+through the registered callbacks and captures transmitted ones.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_TWAI
+#define SFR_HOST_ESP_TWAI
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef struct stSILCANNode_t *twai_node_handle_t;
+
+typedef enum {
+    TWAI_ERROR_ACTIVE,
+    TWAI_ERROR_WARNING,
+    TWAI_ERROR_PASSIVE,
+    TWAI_ERROR_BUS_OFF,
+} twai_error_state_t;
+
+typedef struct {
+    uint32_t id:29;
+    uint32_t ide:1;
+    uint32_t rtr:1;
+    uint32_t fdf:1;
+    uint32_t brs:1;
+    uint32_t esi:1;
+    uint32_t dlc:4;
+    uint64_t timestamp;
+} twai_frame_header_t;
+
+typedef struct {
+    twai_frame_header_t header;
+    uint8_t *buffer;
+    size_t buffer_len;
+} twai_frame_t;
+
+typedef struct {
+    twai_error_state_t state;
+    uint16_t tx_error_count;
+    uint16_t rx_error_count;
+} twai_node_status_t;
+
+typedef struct {
+    uint32_t bus_err_num;
+} twai_node_record_t;
+
+typedef union {
+    struct {
+        uint32_t arb_lost:1;
+        uint32_t bit_err:1;
+        uint32_t form_err:1;
+        uint32_t stuff_err:1;
+        uint32_t ack_err:1;
+    };
+    uint32_t val;
+} twai_error_flags_t;
+
+typedef struct { int NUnused; } twai_rx_done_event_data_t;
+typedef struct { bool is_tx_success; const twai_frame_t *done_tx_frame; } twai_tx_done_event_data_t;
+typedef struct { twai_error_flags_t err_flags; } twai_error_event_data_t;
+typedef struct { twai_error_state_t old_sta; twai_error_state_t new_sta; } twai_state_change_event_data_t;
+
+typedef struct {
+    bool (*on_tx_done)(twai_node_handle_t stNode, const twai_tx_done_event_data_t *stData, void *pvArg);
+    bool (*on_rx_done)(twai_node_handle_t stNode, const twai_rx_done_event_data_t *stData, void *pvArg);
+    bool (*on_state_change)(twai_node_handle_t stNode, const twai_state_change_event_data_t *stData, void *pvArg);
+    bool (*on_error)(twai_node_handle_t stNode, const twai_error_event_data_t *stData, void *pvArg);
+} twai_event_callbacks_t;
+
+esp_err_t twai_node_register_event_callbacks(twai_node_handle_t stNode, const twai_event_callbacks_t *stCallbacks, void *pvArg);
+esp_err_t twai_node_enable(twai_node_handle_t stNode);
+esp_err_t twai_node_transmit(twai_node_handle_t stNode, const twai_frame_t *stFrame, int NTimeoutms);
+esp_err_t twai_node_receive_from_isr(twai_node_handle_t stNode, twai_frame_t *stFrame);
+esp_err_t twai_node_get_info(twai_node_handle_t stNode, twai_node_status_t *stStatus, twai_node_record_t *stRecord);
+esp_err_t twai_node_recover(twai_node_handle_t stNode);
+
+#endif // SFR_HOST_ESP_TWAI
@@ -0,0 +1,21 @@
+/*
+esp_twai_onchip.h | host build
+On chip TWAI node creation for the SIL build.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_TWAI_ONCHIP
+#define SFR_HOST_ESP_TWAI_ONCHIP
+
+#include "esp_twai.h"
+
+typedef struct {
+    struct { int tx; int rx; } io_cfg;
+    struct { uint32_t bitrate; } bit_timing;
+    uint32_t tx_queue_depth;
+    int intr_priority;
+} twai_onchip_node_config_t;
+
+esp_err_t twai_new_node_onchip(const twai_onchip_node_config_t *stConfig, twai_node_handle_t *pstNode);
+
+#endif // SFR_HOST_ESP_TWAI_ONCHIP
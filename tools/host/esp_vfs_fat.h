@@ -0,0 +1,27 @@
+/*
+esp_vfs_fat.h | host build
+FAT mount for the SIL build. The card is a directory, tools/sil_idf.c maps
+paths under the mount point into it.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_VFS_FAT
+#define SFR_HOST_ESP_VFS_FAT
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdmmc_cmd.h"
+#include "driver/sdspi_host.h"
+
+typedef struct {
+    bool format_if_mount_failed;
+    int max_files;
+    size_t allocation_unit_size;
+} esp_vfs_fat_sdmmc_mount_config_t;
+
+esp_err_t esp_vfs_fat_sdspi_mount(const char *abyBasePath, const sdmmc_host_t *stHost, const sdspi_device_config_t *stSlot,
+                                  const esp_vfs_fat_sdmmc_mount_config_t *stConfig, sdmmc_card_t **pstCard);
+esp_err_t esp_vfs_fat_sdcard_format(const char *abyBasePath, sdmmc_card_t *stCard);
+
+#endif // SFR_HOST_ESP_VFS_FAT
@@ -0,0 +1,29 @@
+/*
+esp_wifi.h | host build
+WiFi start up does nothing in the SIL build, ESP-NOW is in esp_now.h.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_ESP_WIFI
+#define SFR_HOST_ESP_WIFI
+
+#include "esp_err.h"
+
+typedef struct { int NUnused; } wifi_init_config_t;
+typedef struct { uint8_t *des_addr; } wifi_tx_info_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT() { 0 }
+#define WIFI_MODE_STA 1
+#define WIFI_STORAGE_RAM 1
+#define WIFI_PS_NONE 0
+#define WIFI_SECOND_CHAN_NONE 0
+#define ESP_IF_WIFI_AP 1
+
+static inline esp_err_t esp_wifi_init(const wifi_init_config_t *stConfig) { (void)stConfig; return ESP_OK; }
+static inline esp_err_t esp_wifi_set_mode(int NMode) { (void)NMode; return ESP_OK; }
+static inline esp_err_t esp_wifi_set_storage(int NStorage) { (void)NStorage; return ESP_OK; }
+static inline esp_err_t esp_wifi_set_ps(int NPowerSave) { (void)NPowerSave; return ESP_OK; }
+static inline esp_err_t esp_wifi_start(void) { return ESP_OK; }
+static inline esp_err_t esp_wifi_set_channel(int NPrimary, int NSecondary) { (void)NPrimary; (void)NSecondary; return ESP_OK; }
+
+#endif // SFR_HOST_ESP_WIFI
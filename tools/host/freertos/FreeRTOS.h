@@ -0,0 +1,41 @@
+/*
+FreeRTOS.h | host build
+FreeRTOS types and macros for the SIL build. The tasks themselves run on
+the virtual kernel in tools/sil_idf.c, one at a time, so critical sections
+have nothing to guard.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_FREERTOS
+#define SFR_HOST_FREERTOS
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+typedef struct { int NUnused; } portMUX_TYPE;
+
+#define configTICK_RATE_HZ 1000
+#define configMAX_PRIORITIES 25
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define taskENTER_CRITICAL(mux) (void)(mux)
+#define taskEXIT_CRITICAL(mux) (void)(mux)
+#define taskENTER_CRITICAL_ISR(mux) (void)(mux)
+#define taskEXIT_CRITICAL_ISR(mux) (void)(mux)
+#define portYIELD_FROM_ISR(woken) (void)(woken)
+
+#endif // SFR_HOST_FREERTOS
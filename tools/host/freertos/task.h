@@ -0,0 +1,28 @@
+/*
+task.h | host build
+Task calls the firmware makes, implemented by the virtual kernel in tools/sil_idf.c.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_FREERTOS_TASK
+#define SFR_HOST_FREERTOS_TASK
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct stSILTask_t *TaskHandle_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pfTask, const char *abyName, uint32_t dwStackBytes, void *pvArg,
+                                   UBaseType_t NPriority, TaskHandle_t *pstHandle, BaseType_t NCore);
+void vTaskDelay(TickType_t wtTicks);
+BaseType_t xTaskDelayUntil(TickType_t *pwtPreviousWake, TickType_t wtIncrement);
+TickType_t xTaskGetTickCount(void);
+uint32_t ulTaskNotifyTake(BaseType_t bClearOnExit, TickType_t wtTimeout);
+BaseType_t xTaskNotifyGive(TaskHandle_t stTask);
+
+static inline BaseType_t xTaskCreate(TaskFunction_t pfTask, const char *abyName, uint32_t dwStackBytes, void *pvArg,
+                                     UBaseType_t NPriority, TaskHandle_t *pstHandle)
+{
+    return xTaskCreatePinnedToCore(pfTask, abyName, dwStackBytes, pvArg, NPriority, pstHandle, tskNO_AFFINITY);
+}
+
+#endif // SFR_HOST_FREERTOS_TASK
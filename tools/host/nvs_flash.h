@@ -0,0 +1,15 @@
+/*
+nvs_flash.h | host build
+NVS always starts clean in the SIL build.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_NVS_FLASH
+#define SFR_HOST_NVS_FLASH
+
+#include "esp_err.h"
+
+static inline esp_err_t nvs_flash_init(void) { return ESP_OK; }
+static inline esp_err_t nvs_flash_erase(void) { return ESP_OK; }
+
+#endif // SFR_HOST_NVS_FLASH
@@ -0,0 +1,22 @@
+/*
+sdmmc_cmd.h | host build
+SD card handle for the SIL build.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+#ifndef SFR_HOST_SDMMC_CMD
+#define SFR_HOST_SDMMC_CMD
+
+#include <stdio.h>
+
+typedef struct {
+    int NUnused;
+} sdmmc_card_t;
+
+static inline void sdmmc_card_print_info(FILE *stStream, const sdmmc_card_t *stCard)
+{
+    (void)stCard;
+    fprintf(stStream, "SIL card\n");
+}
+
+#endif // SFR_HOST_SDMMC_CMD
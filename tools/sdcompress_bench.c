@@ -0,0 +1,354 @@
+/*
+sdcompress_bench.c | host tools
+Measures the SD log compressor the way the logger uses it. Records are
+added one at a time to 4 KB journal blocks, a block is sealed when the next
+record does not fit, and a block that did not shrink is stored raw, as
+SD_card_commit_block does. Every compressed block is decompressed and checked
+against its records.
+
+Four streams are run:
+    can         CAN frame lines as SD_card_format_CAN writes them, from a
+                schedule of 1 ms to 1 s frames with counters, slow signals
+                and a noisy byte, the bulk of a real log
+    log         the records of an existing .sfr log, given on the command line
+    random      64 byte records of random bytes, nothing to find
+    oversize    4000 byte text records, too long for the compressor's fit
+                check, each goes in a raw block of its own
+
+For each stream the ratio, the blocks stored raw and the compress and
+decompress speeds are printed. The host is far faster than the C6, the logger
+reports its own cycles per byte every LOG_STATS_PERIOD blocks.
+
+Usage: sdcompress_bench [log.sfr]
+
+Build: gcc -O2 -Itools/host -Imain -Itools tools/sdcompress_bench.c tools/sfrlogread.c
+       main/sdcompress.c main/sdlog.c -lm -o sdcompress_bench
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "sfrlogread.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define BENCH_STREAM_BYTES (8 * 1024 * 1024)   // raw bytes generated per synthetic stream
+#define BENCH_MAX_RECORD 4000
+#define BENCH_RANDOM_RECORD 64
+
+/* --------------------------- Local Types ---------------------------------- */
+typedef struct {
+    byte *abyData;                  // records back to back
+    word *awLengths;
+    dword dwNRecords;
+    dword dwNBytes;
+} stBenchStream_t;
+
+typedef struct {
+    dword dwID;
+    byte byDLC;
+    word wPeriodms;
+} stBenchFrame_t;
+
+typedef struct {
+    qword qwRawBytes;
+    qword qwStoredBytes;
+    dword dwNBlocks;
+    dword dwNRawBlocks;
+    dword dwNBad;                   // blocks that did not decompress to their records
+    double fCompressSeconds;
+    double fDecompressSeconds;
+} stBenchResult_t;
+
+/* --------------------------- Local Variables ------------------------------ */
+/* Roughly the car's CAN0 traffic, see main/dbc/sfr.dbc */
+static const stBenchFrame_t astBenchSchedule[] =
+{
+    { 0x0B0, 8, 1 },                // APPS status
+    { 0x100, 8, 10 },               // inverter
+    { 0x101, 8, 10 },
+    { 0x120, 8, 10 },               // wheel speeds
+    { 0x200, 8, 20 },               // BMS
+    { 0x201, 6, 100 },
+    { 0x300, 8, 100 },              // temperatures
+    { 0x301, 4, 100 },
+    { 0x400, 2, 1000 },             // node status
+    { 0x7F1, 8, 1000 },             // bus load report
+};
+static stSDCompressor_t stBenchCompressor;
+static byte abyBenchOutput[SDLOG_PAYLOAD_SIZE];
+static byte abyBenchCheck[SDCOMPRESS_RAW_SIZE];
+
+/* --------------------------- Function prototypes -------------------------- */
+static boolean bench_add(stBenchStream_t *stStream, const byte *abyRecord, word wLength);
+static void bench_make_can(stBenchStream_t *stStream);
+static void bench_make_random(stBenchStream_t *stStream);
+static void bench_make_oversize(stBenchStream_t *stStream);
+static int bench_load_log(stBenchStream_t *stStream, const char *abyPath);
+static void bench_run(const stBenchStream_t *stStream, stBenchResult_t *stResult);
+static void bench_seal(stBenchResult_t *stResult);
+static void bench_print(const char *abyName, const stBenchResult_t *stResult);
+static double bench_seconds_since(const struct timespec *stStart);
+
+/* --------------------------- Functions ------------------------------------ */
+
+int main(int argc, char **argv)
+{
+    static stBenchStream_t astStreams[4];
+    static const char *abyNames[4] = { "can", "log", "random", "oversize" };
+    boolean bFailed = FALSE;
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "Usage: sdcompress_bench [log.sfr]\n");
+        return 2;
+    }
+    bench_make_can(&astStreams[0]);
+    if (argc > 1 && bench_load_log(&astStreams[1], argv[1]) != 0)
+    {
+        fprintf(stderr, "sdcompress_bench: cannot read %s\n", argv[1]);
+        return 1;
+    }
+    bench_make_random(&astStreams[2]);
+    bench_make_oversize(&astStreams[3]);
+
+    printf("%-9s %9s %7s %12s %13s %15s\n", "stream", "raw KB", "ratio", "raw blocks", "compress", "decompress");
+    for (int i = 0; i < 4; i++)
+    {
+        if (astStreams[i].dwNRecords == 0)
+        {
+            continue;
+        }
+        stBenchResult_t stResult;
+        bench_run(&astStreams[i], &stResult);
+        bench_print(abyNames[i], &stResult);
+        bFailed |= (stResult.dwNBad != 0);
+        free(astStreams[i].abyData);
+        free(astStreams[i].awLengths);
+    }
+    return bFailed ? 1 : 0;
+}
+
+static boolean bench_add(stBenchStream_t *stStream, const byte *abyRecord, word wLength)
+{
+    /* Grows the stream, FALSE once it holds BENCH_STREAM_BYTES */
+    if (stStream->abyData == NULL)
+    {
+        stStream->abyData = malloc(BENCH_STREAM_BYTES + BENCH_MAX_RECORD);
+        stStream->awLengths = malloc((BENCH_STREAM_BYTES / 16 + 1) * sizeof(word));
+        if (stStream->abyData == NULL || stStream->awLengths == NULL)
+        {
+            fprintf(stderr, "sdcompress_bench: out of memory\n");
+            exit(1);
+        }
+    }
+    if (stStream->dwNBytes + wLength > BENCH_STREAM_BYTES || stStream->dwNRecords >= BENCH_STREAM_BYTES / 16)
+    {
+        return FALSE;
+    }
+    memcpy(&stStream->abyData[stStream->dwNBytes], abyRecord, wLength);
+    stStream->awLengths[stStream->dwNRecords++] = wLength;
+    stStream->dwNBytes += wLength;
+    return TRUE;
+}
+
+static void bench_make_can(stBenchStream_t *stStream)
+{
+    /* Same line as SD_card_format_CAN, one record per frame */
+    char abyLine[64];
+    byte abyData[8];
+    srand(1);
+    for (dword dwTimems = 0; ; dwTimems++)
+    {
+        for (size_t i = 0; i < sizeof(astBenchSchedule) / sizeof(astBenchSchedule[0]); i++)
+        {
+            const stBenchFrame_t *stFrame = &astBenchSchedule[i];
+            if (dwTimems % stFrame->wPeriodms != 0)
+            {
+                continue;
+            }
+            dword dwCount = dwTimems / stFrame->wPeriodms;
+            word wSignal = (word)(32768.0 + 30000.0 * sin((double)dwTimems / (200.0 * (double)(i + 1))));
+            abyData[0] = (byte)dwCount;
+            abyData[1] = (byte)(wSignal & 0xFF);
+            abyData[2] = (byte)(wSignal >> 8);
+            abyData[3] = (byte)(rand() & 0x0F);
+            abyData[4] = (byte)(i * 17);
+            abyData[5] = 0;
+            abyData[6] = (byte)(wSignal >> 10);
+            abyData[7] = 0xFF;
+
+            int NOffset = snprintf(abyLine, sizeof(abyLine), "%d: %d %X ", (int)dwTimems / 1000,
+                                   (int)stFrame->dwID, (int)stFrame->byDLC);
+            for (byte j = 0; j < stFrame->byDLC; j++)
+            {
+                NOffset += snprintf(abyLine + NOffset, sizeof(abyLine) - NOffset, " %02X", (int)abyData[j]);
+            }
+            NOffset += snprintf(abyLine + NOffset, sizeof(abyLine) - NOffset, "\n");
+            if (!bench_add(stStream, (const byte *)abyLine, (word)NOffset))
+            {
+                return;
+            }
+        }
+    }
+}
+
+static void bench_make_random(stBenchStream_t *stStream)
+{
+    byte abyRecord[BENCH_RANDOM_RECORD];
+    srand(2);
+    do
+    {
+        for (int i = 0; i < BENCH_RANDOM_RECORD; i++)
+        {
+            abyRecord[i] = (byte)rand();
+        }
+    } while (bench_add(stStream, abyRecord, BENCH_RANDOM_RECORD));
+}
+
+static void bench_make_oversize(stBenchStream_t *stStream)
+{
+    /* Long text, eg a config dump, that compresses well but could never be accepted */
+    static byte abyRecord[BENCH_MAX_RECORD];
+    dword dwNRecord = 0;
+    do
+    {
+        word wLength = 0;
+        while (wLength + 40 < BENCH_MAX_RECORD)
+        {
+            wLength += (word)snprintf((char *)&abyRecord[wLength], 40, "record %lu field %u = %u\n",
+                                      (unsigned long)dwNRecord, (unsigned)wLength, (unsigned)(wLength * 7));
+        }
+        memset(&abyRecord[wLength], '.', BENCH_MAX_RECORD - 1 - wLength);
+        abyRecord[BENCH_MAX_RECORD - 1] = '\n';
+        dwNRecord++;
+    } while (bench_add(stStream, abyRecord, BENCH_MAX_RECORD));
+}
+
+static int bench_load_log(stBenchStream_t *stStream, const char *abyPath)
+{
+    /* The log's lines, the logger wrote one record per line */
+    static stSFRLogReader_t stReader;
+    static byte abyRaw[SDCOMPRESS_RAW_SIZE];
+    if (sfrlog_open(&stReader, abyPath) != 0)
+    {
+        return -1;
+    }
+    for (dword dwBlock = 0; dwBlock < stReader.dwNBlocks; dwBlock++)
+    {
+        int NLength = sfrlog_read_block(&stReader, dwBlock, abyRaw, NULL);
+        int NStart = 0;
+        for (int i = 0; i < NLength; i++)
+        {
+            if (abyRaw[i] == '\n' || i - NStart + 1 == BENCH_MAX_RECORD)
+            {
+                if (!bench_add(stStream, &abyRaw[NStart], (word)(i - NStart + 1)))
+                {
+                    sfrlog_close(&stReader);
+                    return 0;
+                }
+                NStart = i + 1;
+            }
+        }
+    }
+    sfrlog_close(&stReader);
+    return 0;
+}
+
+static void bench_run(const stBenchStream_t *stStream, stBenchResult_t *stResult)
+{
+    /* The logger's block policy, see SD_card_append and SD_card_commit_block */
+    struct timespec stStart;
+    dword dwOffset = 0;
+
+    memset(stResult, 0, sizeof(*stResult));
+    sdcompress_reset(&stBenchCompressor, abyBenchOutput, SDLOG_PAYLOAD_SIZE);
+    for (dword i = 0; i < stStream->dwNRecords; i++)
+    {
+        const byte *abyRecord = &stStream->abyData[dwOffset];
+        word wLength = stStream->awLengths[i];
+        dwOffset += wLength;
+
+        if (SDCOMPRESS_WORST_CASE(wLength) > SDLOG_PAYLOAD_SIZE)
+        {
+            bench_seal(stResult);
+            stResult->qwRawBytes += wLength;
+            stResult->qwStoredBytes += wLength;
+            stResult->dwNBlocks++;
+            stResult->dwNRawBlocks++;
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stStart);
+        esp_err_t NStatus = sdcompress_append(&stBenchCompressor, abyRecord, wLength);
+        stResult->fCompressSeconds += bench_seconds_since(&stStart);
+        if (NStatus == ESP_ERR_NO_MEM)
+        {
+            bench_seal(stResult);
+            clock_gettime(CLOCK_MONOTONIC, &stStart);
+            (void)sdcompress_append(&stBenchCompressor, abyRecord, wLength);
+            stResult->fCompressSeconds += bench_seconds_since(&stStart);
+        }
+    }
+    bench_seal(stResult);
+}
+
+static void bench_seal(stBenchResult_t *stResult)
+{
+    /* Stores the block compressed if that is smaller, else raw, and checks it */
+    word wRawLength = stBenchCompressor.wRawLength;
+    word wOutputLength = stBenchCompressor.wOutputLength;
+    if (wRawLength == 0)
+    {
+        return;
+    }
+    stResult->dwNBlocks++;
+    stResult->qwRawBytes += wRawLength;
+    if (wOutputLength >= wRawLength)
+    {
+        stResult->dwNRawBlocks++;
+        stResult->qwStoredBytes += wRawLength;
+    }
+    else
+    {
+        struct timespec stStart;
+        clock_gettime(CLOCK_MONOTONIC, &stStart);
+        int NLength = sdcompress_decompress(abyBenchOutput, wOutputLength, abyBenchCheck, SDCOMPRESS_RAW_SIZE);
+        stResult->fDecompressSeconds += bench_seconds_since(&stStart);
+        if (NLength != wRawLength || memcmp(abyBenchCheck, stBenchCompressor.abyRaw, wRawLength) != 0)
+        {
+            stResult->dwNBad++;
+        }
+        stResult->qwStoredBytes += wOutputLength;
+    }
+    sdcompress_reset(&stBenchCompressor, abyBenchOutput, SDLOG_PAYLOAD_SIZE);
+}
+
+static void bench_print(const char *abyName, const stBenchResult_t *stResult)
+{
+    /* Speeds are of the bytes that went through, a dash if none did */
+    double fRawMB = (double)stResult->qwRawBytes / (1024.0 * 1024.0);
+    char abyCompress[16] = "-";
+    char abyDecompress[16] = "-";
+    if (stResult->fCompressSeconds > 0.0)
+    {
+        snprintf(abyCompress, sizeof(abyCompress), "%.0f MB/s", fRawMB / stResult->fCompressSeconds);
+    }
+    if (stResult->fDecompressSeconds > 0.0)
+    {
+        snprintf(abyDecompress, sizeof(abyDecompress), "%.0f MB/s", fRawMB / stResult->fDecompressSeconds);
+    }
+    printf("%-9s %9.0f %6.2fx %5lu / %-6lu %13s %15s%s\n", abyName, fRawMB * 1024.0,
+           (double)stResult->qwRawBytes / (double)stResult->qwStoredBytes,
+           (unsigned long)stResult->dwNRawBlocks, (unsigned long)stResult->dwNBlocks, abyCompress, abyDecompress,
+           (stResult->dwNBad != 0) ? "  ROUND TRIP FAILED" : "");
+}
+
+static double bench_seconds_since(const struct timespec *stStart)
+{
+    struct timespec stNow;
+    clock_gettime(CLOCK_MONOTONIC, &stNow);
+    return (double)(stNow.tv_sec - stStart->tv_sec) + (double)(stNow.tv_nsec - stStart->tv_nsec) * 1e-9;
+}
@@ -0,0 +1,201 @@
+/*
+sensor_bench.c | host tools
+Checks the compiled and fixed point sensor maps against the float one and
+times the three. Two maps are used: a linear APPS pedal map (0.5 V to 4.5 V
+is 0 to 100 %), which the compiled map indexes directly, and a thermistor
+style curve with uneven breakpoints, which it searches. Every millivolt from
+0 to 5 V and random voltages between go through the lookups. The compiled
+map must give the same bits as the float one, the fixed point map's
+largest difference is reported. All three are then timed over random
+voltages.
+
+The host has an FPU, so the timings here are the lookups' own work and not
+the target's soft float cost; adc_benchmark in main/adc.c gives cycles per
+conversion on the C6.
+
+Usage: sensor_bench [conversions]
+
+Build: gcc -O2 -Itools/host -Imain tools/sensor_bench.c main/sensormap.c -lm -o sensor_bench
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "sensormap.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define BENCH_DEFAULT_CONVERSIONS 10000000
+#define BENCH_PASSES 5
+#define BENCH_MAX_MV 5000
+#define BENCH_TOLERANCE 0.001       // largest fixed point difference allowed, sensor units
+
+/* --------------------------- Local Variables ------------------------------ */
+static stSensorMap_t astMaps[2];
+static const char *abyMapNames[2] = { "APPS", "thermistor" };
+static volatile float fSink;
+static volatile sdword sdwSink;
+
+/* --------------------------- Function prototypes -------------------------- */
+static void bench_build_maps(void);
+static double bench_seconds_since(const struct timespec *stStart);
+
+/* --------------------------- Functions ------------------------------------ */
+
+int main(int argc, char **argv)
+{
+    dword dwNConversions = (argc > 1) ? strtoul(argv[1], NULL, 0) : BENCH_DEFAULT_CONVERSIONS;
+    if (dwNConversions == 0)
+    {
+        fprintf(stderr, "Usage: sensor_bench [conversions]\n");
+        return 2;
+    }
+    bench_build_maps();
+
+    word *awVoltagemV = malloc(dwNConversions * sizeof(word));
+    float *afVoltage = malloc(dwNConversions * sizeof(float));
+    if (awVoltagemV == NULL || afVoltage == NULL)
+    {
+        fprintf(stderr, "sensor_bench: out of memory\n");
+        return 1;
+    }
+    srand(1);
+    for (dword i = 0; i < dwNConversions; i++)
+    {
+        awVoltagemV[i] = (word)(rand() % (BENCH_MAX_MV + 1));
+        afVoltage[i] = (float)awVoltagemV[i] / 1000.0f;
+    }
+
+    boolean bFailed = FALSE;
+    for (byte byMap = 0; byMap < 2; byMap++)
+    {
+        stSensorMapQ_t stMapQ;
+        stSensorMapCompiled_t stCompiled;
+        if (sensor_map_q_init(&astMaps[byMap], &stMapQ) != ESP_OK || sensor_map_compile(&astMaps[byMap], &stCompiled) != ESP_OK)
+        {
+            fprintf(stderr, "%s: map does not convert\n", abyMapNames[byMap]);
+            return 1;
+        }
+
+        /* Compiled, bit for bit at every mV and the random voltages */
+        dword dwNDifferent = 0;
+        for (dword i = 0; i <= BENCH_MAX_MV + dwNConversions; i++)
+        {
+            float fVoltage = (i <= BENCH_MAX_MV) ? (float)i / 1000.0f : (float)rand() / (float)RAND_MAX * BENCH_MAX_MV / 1000.0f;
+            float fFloat = sensor_map_lookup(&astMaps[byMap], fVoltage);
+            float fCompiled = sensor_map_compiled_lookup(&stCompiled, fVoltage);
+            if (memcmp(&fFloat, &fCompiled, sizeof(float)) != 0)
+            {
+                if (dwNDifferent < 5)
+                {
+                    fprintf(stderr, "%s %.9f V: float %.9g, compiled %.9g\n", abyMapNames[byMap], fVoltage, fFloat, fCompiled);
+                }
+                dwNDifferent++;
+            }
+        }
+
+        /* Every millivolt both ways, errors must agree */
+        double fMaxError = 0.0;
+        dword dwNMismatched = 0;
+        for (word wVoltagemV = 0; wVoltagemV <= BENCH_MAX_MV; wVoltagemV++)
+        {
+            float fFloat = sensor_map_lookup(&astMaps[byMap], (float)wVoltagemV / 1000.0f);
+            sdword sdwFixed = sensor_map_q_lookup(&stMapQ, wVoltagemV);
+            if ((fFloat == SENSOR_ERROR) != (sdwFixed == SENSOR_Q_ERROR))
+            {
+                if (dwNMismatched < 5)
+                {
+                    fprintf(stderr, "%s %u mV: float %.4f, fixed %s\n", abyMapNames[byMap], (unsigned)wVoltagemV,
+                            fFloat, (sdwFixed == SENSOR_Q_ERROR) ? "error" : "a value");
+                }
+                dwNMismatched++;
+            }
+            else if (fFloat != SENSOR_ERROR)
+            {
+                fMaxError = fmax(fMaxError, fabs((double)fFloat - (double)SENSOR_Q_TO_FLOAT(sdwFixed)));
+            }
+        }
+
+        /* Time both, best of several passes */
+        double fBestFloat = 1e9;
+        double fBestCompiled = 1e9;
+        double fBestFixed = 1e9;
+        for (int NPass = 0; NPass < BENCH_PASSES; NPass++)
+        {
+            struct timespec stStart;
+            float fSum = 0.0f;
+            clock_gettime(CLOCK_MONOTONIC, &stStart);
+            for (dword i = 0; i < dwNConversions; i++)
+            {
+                fSum += sensor_map_lookup(&astMaps[byMap], afVoltage[i]);
+            }
+            fSink = fSum;
+            fBestFloat = fmin(fBestFloat, bench_seconds_since(&stStart));
+
+            fSum = 0.0f;
+            clock_gettime(CLOCK_MONOTONIC, &stStart);
+            for (dword i = 0; i < dwNConversions; i++)
+            {
+                fSum += sensor_map_compiled_lookup(&stCompiled, afVoltage[i]);
+            }
+            fSink = fSum;
+            fBestCompiled = fmin(fBestCompiled, bench_seconds_since(&stStart));
+
+            sdword sdwSum = 0;
+            clock_gettime(CLOCK_MONOTONIC, &stStart);
+            for (dword i = 0; i < dwNConversions; i++)
+            {
+                sdwSum += sensor_map_q_lookup(&stMapQ, awVoltagemV[i]);
+            }
+            sdwSink = sdwSum;
+            fBestFixed = fmin(fBestFixed, bench_seconds_since(&stStart));
+        }
+
+        printf("%-10s compiled (%s) %lu of %lu differ, fixed max difference %.6f, %lu error mismatches\n",
+               abyMapNames[byMap], stCompiled.bUniform ? "indexed" : "searched", (unsigned long)dwNDifferent,
+               (unsigned long)(BENCH_MAX_MV + 1 + dwNConversions), fMaxError, (unsigned long)dwNMismatched);
+        printf("%-10s float %6.2f ns, compiled %6.2f ns (%.1fx), fixed %6.2f ns (%.1fx) per conversion\n", abyMapNames[byMap],
+               fBestFloat * 1e9 / dwNConversions, fBestCompiled * 1e9 / dwNConversions, fBestFloat / fBestCompiled,
+               fBestFixed * 1e9 / dwNConversions, fBestFloat / fBestFixed);
+        bFailed |= (dwNDifferent != 0 || dwNMismatched != 0 || fMaxError > BENCH_TOLERANCE);
+    }
+
+    free(awVoltagemV);
+    free(afVoltage);
+    return bFailed ? 1 : 0;
+}
+
+static void bench_build_maps(void)
+{
+    /* APPS, linear over 0.5 V to 4.5 V, plausible from 0.3 V to 4.7 V */
+    astMaps[0].fLowerLimit = 0.3f;
+    astMaps[0].fUpperLimit = 4.7f;
+    for (int i = 0; i < SENSOR_MAP_POINTS; i++)
+    {
+        astMaps[0].afLookupTable[0][i] = 0.5f + 4.0f * (float)i / (SENSOR_MAP_POINTS - 1);
+        astMaps[0].afLookupTable[1][i] = 100.0f * (float)i / (SENSOR_MAP_POINTS - 1);
+    }
+
+    /* Thermistor divider, breakpoints bunched where the curve bends, -40 to 150 C */
+    astMaps[1].fLowerLimit = 0.1f;
+    astMaps[1].fUpperLimit = 3.2f;
+    for (int i = 0; i < SENSOR_MAP_POINTS; i++)
+    {
+        double fPosition = (double)i / (SENSOR_MAP_POINTS - 1);
+        double fVoltage = 0.1 + 3.1 * (0.5 - 0.5 * cos(M_PI * fPosition));
+        double fResistance = 10000.0 * (3.3 - fVoltage) / fVoltage;
+        double fKelvin = 1.0 / (1.0 / 298.15 + log(fResistance / 10000.0) / 3950.0);
+        astMaps[1].afLookupTable[0][i] = (float)fVoltage;
+        astMaps[1].afLookupTable[1][i] = (float)(fKelvin - 273.15);
+    }
+}
+
+static double bench_seconds_since(const struct timespec *stStart)
+{
+    struct timespec stNow;
+    clock_gettime(CLOCK_MONOTONIC, &stNow);
+    return (double)(stNow.tv_sec - stStart->tv_sec) + (double)(stNow.tv_nsec - stStart->tv_nsec) * 1e-9;
+}
@@ -0,0 +1,808 @@
+/*
+sfrlog_convert.c | host tools
+Converts SD card logs to CSV, candump, Vector ASC or MDF4. Reads any log the
+logger has written: the text log ("%d: %d %X  %02X..." lines, also the event
+files), the block journal (logNNN.sfr) and MDF4 (logNNN.mf4). The block format,
+decompressor and MDF4 layout are the firmware's own sources.
+
+The input is memory mapped and cut into chunks on record boundaries, each
+thread decodes and formats its own chunk and the results are written in
+order. Input is processed a round of chunks at a time so memory use does not
+grow with the file.
+
+Usage: sfrlog_convert [-f csv|candump|asc|mf4] [-j threads] <input> <output|->
+       sfrlog_convert -b [-f format] <input>      throughput benchmark
+
+Build: gcc -O2 -pthread -Itools/host -Imain -Itools tools/sfrlog_convert.c tools/sfrlogread.c
+       main/sdlog.c main/sdcompress.c main/mdf4.c -o sfrlog_convert
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sfrlogread.h"
+#include "mdf4.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef enum {
+    eINPUT_TEXT = 0,
+    eINPUT_JOURNAL,
+    eINPUT_MDF4,
+} eInputFormat_t;
+
+typedef enum {
+    eOUTPUT_CSV = 0,
+    eOUTPUT_CANDUMP,
+    eOUTPUT_ASC,
+    eOUTPUT_MDF4,
+    eOUTPUT_TOTAL,
+} eOutputFormat_t;
+
+typedef struct {
+    /* Input, a byte range for text and MDF4, a block range for the journal */
+    const byte *pbyStart;
+    size_t NLength;
+    dword dwFirstBlock;
+    dword dwNBlocks;
+    /* Output */
+    byte *abyOutput;
+    size_t NOutputLength;
+    size_t NOutputSize;
+    qword qwNFrames;
+    qword qwNBad;           // lines, blocks or records that could not be decoded
+} stConvertChunk_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define CONVERT_CHUNK_SIZE (8 * 1024 * 1024) // input bytes per thread per round
+#define CONVERT_MAX_THREADS 64
+#define CONVERT_MAX_LINE 128                 // longest output line of any format (bytes)
+#define CONVERT_US_PER_S 1000000ULL
+#define CONVERT_STANDARD_ID_MAX 0x7FF
+#define CONVERT_BUS_CHANNEL 1
+#define CONVERT_BENCH_PASSES 3
+#define CONVERT_ASC_ID_WIDTH 15              // ID column width in ASC files
+
+static const char *CONVERT_FORMAT_NAMES[eOUTPUT_TOTAL] = { "csv", "candump", "asc", "mf4" };
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+/* --------------------------- Local Variables ------------------------------ */
+static eInputFormat_t eInputFormat;
+static eOutputFormat_t eOutputFormat = eOUTPUT_CSV;
+static qword qwTextTimeScaleus = CONVERT_US_PER_S;  // text logs carry s, event files us
+static dword dwJournalSessionID = 0;
+static stConvertChunk_t astChunks[CONVERT_MAX_THREADS];
+
+/* --------------------------- Function prototypes -------------------------- */
+static int convert_file(const byte *pbyInput, size_t NInputLength, dword dwNJournalBlocks, FILE *stOutput,
+                        int NThreads, qword *pqwNFrames, qword *pqwNBad);
+static void *convert_chunk(void *pvChunk);
+static void convert_text(stConvertChunk_t *stChunk, const char *pbyText, size_t NLength);
+static boolean convert_parse_line(const char *pbyLine, const char *pbyEnd, CAN_frame_t *stFrame);
+static void convert_emit(stConvertChunk_t *stChunk, const CAN_frame_t *stFrame);
+static char *convert_put_decimal(char *pbyOut, qword qwValue, byte byMinDigits);
+static char *convert_put_hex(char *pbyOut, dword dwValue, byte byMinDigits);
+static char *convert_put_time(char *pbyOut, qword qwTimeus, byte byWidth);
+static char *convert_put_data(char *pbyOut, const byte *abyData, byte byLength, char bySeparator);
+static void convert_reserve(stConvertChunk_t *stChunk, size_t NBytes);
+static void convert_write_header(FILE *stOutput, stMDF4Layout_t *stLayout);
+static void convert_write_footer(FILE *stOutput, const stMDF4Layout_t *stLayout, qword qwNFrames);
+static double convert_seconds_since(const struct timespec *stStart);
+
+/* --------------------------- Functions ------------------------------------ */
+
+int main(int NArgs, char **abyArgs)
+{
+    int NThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    boolean bBenchmark = FALSE;
+    int NOption;
+
+    while ((NOption = getopt(NArgs, abyArgs, "f:j:b")) != -1)
+    {
+        if (NOption == 'f')
+        {
+            eOutputFormat = eOUTPUT_TOTAL;
+            for (int i = 0; i < eOUTPUT_TOTAL; i++)
+            {
+                if (strcmp(optarg, CONVERT_FORMAT_NAMES[i]) == 0)
+                {
+                    eOutputFormat = (eOutputFormat_t)i;
+                }
+            }
+        }
+        else if (NOption == 'j')
+        {
+            NThreads = atoi(optarg);
+        }
+        else if (NOption == 'b')
+        {
+            bBenchmark = TRUE;
+        }
+    }
+    if (eOutputFormat == eOUTPUT_TOTAL || NArgs - optind != (bBenchmark ? 1 : 2))
+    {
+        fprintf(stderr, "Usage: %s [-f csv|candump|asc|mf4] [-j threads] <input> <output|->\n"
+                        "       %s -b [-f format] <input>\n", abyArgs[0], abyArgs[0]);
+        return 1;
+    }
+    NThreads = (NThreads < 1) ? 1 : (NThreads > CONVERT_MAX_THREADS) ? CONVERT_MAX_THREADS : NThreads;
+    const char *abyInputPath = abyArgs[optind];
+
+    /* Map the input */
+    int NFile = open(abyInputPath, O_RDONLY);
+    struct stat stStat;
+    if (NFile < 0 || fstat(NFile, &stStat) != 0 || stStat.st_size == 0)
+    {
+        fprintf(stderr, "Cannot read %s\n", abyInputPath);
+        return 1;
+    }
+    size_t NInputLength = (size_t)stStat.st_size;
+    const byte *pbyInput = mmap(NULL, NInputLength, PROT_READ, MAP_PRIVATE, NFile, 0);
+    close(NFile);
+    if (pbyInput == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map %s\n", abyInputPath);
+        return 1;
+    }
+    madvise((void *)pbyInput, NInputLength, MADV_SEQUENTIAL);
+
+    /* Work out what it is */
+    dword dwNJournalBlocks = 0;
+    uint32_t dwMagic = 0;
+    memcpy(&dwMagic, pbyInput, (NInputLength < sizeof(dwMagic)) ? NInputLength : sizeof(dwMagic));
+    if (NInputLength >= MDF4_HEADER_SIZE && memcmp(pbyInput, "MDF     ", 8) == 0)
+    {
+        if (memcmp(&pbyInput[16], "SFR     ", 8) != 0 ||
+            memcmp(&pbyInput[MDF4_HEADER_SIZE - 24], "##DT", 4) != 0)
+        {
+            fprintf(stderr, "%s is MDF4 but not written by the logger\n", abyInputPath);
+            return 1;
+        }
+        qword qwDataLength;
+        memcpy(&qwDataLength, &pbyInput[MDF4_HEADER_SIZE - 16], sizeof(qwDataLength));
+        qword qwRecordBytes = ((qwDataLength - 24) / MDF4_RECORD_SIZE) * MDF4_RECORD_SIZE;
+        if (qwRecordBytes > NInputLength - MDF4_HEADER_SIZE)
+        {
+            qwRecordBytes = ((NInputLength - MDF4_HEADER_SIZE) / MDF4_RECORD_SIZE) * MDF4_RECORD_SIZE;
+        }
+        eInputFormat = eINPUT_MDF4;
+        pbyInput += MDF4_HEADER_SIZE;
+        NInputLength = (size_t)qwRecordBytes;
+    }
+    else if (dwMagic == SDLOG_BLOCK_MAGIC)
+    {
+        stSFRLogReader_t *stReader = malloc(sizeof(stSFRLogReader_t));
+        if (stReader == NULL || sfrlog_open(stReader, abyInputPath) != 0)
+        {
+            fprintf(stderr, "%s is not a readable log\n", abyInputPath);
+            return 1;
+        }
+        eInputFormat = eINPUT_JOURNAL;
+        dwJournalSessionID = stReader->dwSessionID;
+        dwNJournalBlocks = stReader->dwNBlocks;
+        sfrlog_close(stReader);
+        free(stReader);
+    }
+    else
+    {
+        /* Event files say their timestamps are in us on the first line */
+        const char *pbyNewline = memchr(pbyInput, '\n', NInputLength);
+        size_t NFirstLine = (pbyNewline != NULL) ? (size_t)(pbyNewline - (const char *)pbyInput) : NInputLength;
+        eInputFormat = eINPUT_TEXT;
+        if (pbyInput[0] == '#' && memmem(pbyInput, NFirstLine, "in us", 5) != NULL)
+        {
+            qwTextTimeScaleus = 1;
+        }
+    }
+
+    qword qwNFrames = 0;
+    qword qwNBad = 0;
+    if (bBenchmark)
+    {
+        /* Same conversion with the output thrown away, to see the decode rate on its own */
+        fprintf(stderr, "%.1f MB of %s to %s\n", NInputLength / 1e6,
+                (eInputFormat == eINPUT_TEXT) ? "text" : (eInputFormat == eINPUT_JOURNAL) ? "journal" : "MDF4",
+                CONVERT_FORMAT_NAMES[eOutputFormat]);
+        int NBenchThreads = 1;
+        while (TRUE)
+        {
+            double tBest = 0;
+            for (int NPass = 0; NPass < CONVERT_BENCH_PASSES; NPass++)
+            {
+                struct timespec stStart;
+                clock_gettime(CLOCK_MONOTONIC, &stStart);
+                convert_file(pbyInput, NInputLength, dwNJournalBlocks, NULL, NBenchThreads, &qwNFrames, &qwNBad);
+                double tPass = convert_seconds_since(&stStart);
+                tBest = (NPass == 0 || tPass < tBest) ? tPass : tBest;
+            }
+            fprintf(stderr, "%2d threads: %8.1f MB/s %8.2f Mframes/s\n", NBenchThreads,
+                    NInputLength / tBest / 1e6, qwNFrames / tBest / 1e6);
+            if (NBenchThreads == NThreads)
+            {
+                break;
+            }
+            NBenchThreads = (NBenchThreads * 2 > NThreads) ? NThreads : NBenchThreads * 2;
+        }
+        return 0;
+    }
+
+    const char *abyOutputPath = abyArgs[optind + 1];
+    if (eOutputFormat == eOUTPUT_MDF4 && strcmp(abyOutputPath, "-") == 0)
+    {
+        fprintf(stderr, "MDF4 output needs a file, the header is updated at the end\n");
+        return 1;
+    }
+    FILE *stOutput = (strcmp(abyOutputPath, "-") == 0) ? stdout : fopen(abyOutputPath, "w+b");
+    if (stOutput == NULL)
+    {
+        fprintf(stderr, "Cannot write %s\n", abyOutputPath);
+        return 1;
+    }
+
+    struct timespec stStart;
+    clock_gettime(CLOCK_MONOTONIC, &stStart);
+    int NStatus = convert_file(pbyInput, NInputLength, dwNJournalBlocks, stOutput, NThreads, &qwNFrames, &qwNBad);
+    if (stOutput != stdout && fclose(stOutput) != 0)
+    {
+        NStatus = -1;
+    }
+    double tElapsed = convert_seconds_since(&stStart);
+
+    fprintf(stderr, "%llu frames, %llu undecodable, %.1f MB in %.2f s (%.1f MB/s, %d threads)\n",
+            (unsigned long long)qwNFrames, (unsigned long long)qwNBad, NInputLength / 1e6, tElapsed,
+            NInputLength / tElapsed / 1e6, NThreads);
+    if (NStatus != 0)
+    {
+        fprintf(stderr, "Failed writing %s\n", abyOutputPath);
+        return 1;
+    }
+    return 0;
+}
+
+static int convert_file(const byte *pbyInput, size_t NInputLength, dword dwNJournalBlocks, FILE *stOutput,
+                        int NThreads, qword *pqwNFrames, qword *pqwNBad)
+{
+    /*
+    *===========================================================================
+    *   convert_file
+    *   Takes:   pbyInput, NInputLength - mapped input, records only for MDF4
+    *            dwNJournalBlocks - good blocks in a journal input
+    *            stOutput - output file, NULL to discard
+    *            NThreads - threads to decode with
+    *            pqwNFrames, pqwNBad - returns the frame and error counts
+    *
+    *   Returns: 0 if successful, -1 if the output could not be written.
+    *
+    *   Each round hands every thread one chunk, waits for them all then
+    *   writes the chunks in file order.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    pthread_t astThreads[CONVERT_MAX_THREADS];
+    stMDF4Layout_t stLayout;
+    size_t NPosition = 0;
+    dword dwNextBlock = 0;
+    int NStatus = 0;
+
+    *pqwNFrames = 0;
+    *pqwNBad = 0;
+    if (stOutput != NULL)
+    {
+        convert_write_header(stOutput, &stLayout);
+    }
+
+    boolean bMore = TRUE;
+    while (bMore)
+    {
+        int NChunks = 0;
+        while (NChunks < NThreads && bMore)
+        {
+            stConvertChunk_t *stChunk = &astChunks[NChunks];
+            stChunk->NOutputLength = 0;
+            stChunk->qwNFrames = 0;
+            stChunk->qwNBad = 0;
+            if (eInputFormat == eINPUT_JOURNAL)
+            {
+                stChunk->dwFirstBlock = dwNextBlock;
+                stChunk->dwNBlocks = CONVERT_CHUNK_SIZE / SDLOG_BLOCK_SIZE;
+                if (stChunk->dwNBlocks > dwNJournalBlocks - dwNextBlock)
+                {
+                    stChunk->dwNBlocks = dwNJournalBlocks - dwNextBlock;
+                }
+                stChunk->pbyStart = pbyInput;
+                dwNextBlock += stChunk->dwNBlocks;
+                bMore = dwNextBlock < dwNJournalBlocks;
+            }
+            else
+            {
+                size_t NLength = CONVERT_CHUNK_SIZE;
+                if (eInputFormat == eINPUT_MDF4)
+                {
+                    NLength -= NLength % MDF4_RECORD_SIZE;
+                }
+                if (NLength >= NInputLength - NPosition)
+                {
+                    NLength = NInputLength - NPosition;
+                }
+                else if (eInputFormat == eINPUT_TEXT)
+                {
+                    /* End the chunk after a whole line */
+                    const byte *pbyNewline = memchr(&pbyInput[NPosition + NLength], '\n',
+                                                    NInputLength - NPosition - NLength);
+                    NLength = (pbyNewline != NULL) ? (size_t)(pbyNewline - &pbyInput[NPosition]) + 1
+                                                   : NInputLength - NPosition;
+                }
+                stChunk->pbyStart = &pbyInput[NPosition];
+                stChunk->NLength = NLength;
+                NPosition += NLength;
+                bMore = NPosition < NInputLength;
+            }
+            NChunks++;
+        }
+
+        for (int i = 1; i < NChunks; i++)
+        {
+            pthread_create(&astThreads[i], NULL, convert_chunk, &astChunks[i]);
+        }
+        convert_chunk(&astChunks[0]);
+        for (int i = 1; i < NChunks; i++)
+        {
+            pthread_join(astThreads[i], NULL);
+        }
+
+        for (int i = 0; i < NChunks; i++)
+        {
+            *pqwNFrames += astChunks[i].qwNFrames;
+            *pqwNBad += astChunks[i].qwNBad;
+            if (stOutput != NULL && NStatus == 0 &&
+                fwrite(astChunks[i].abyOutput, 1, astChunks[i].NOutputLength, stOutput) != astChunks[i].NOutputLength)
+            {
+                NStatus = -1;
+            }
+        }
+    }
+
+    if (stOutput != NULL && NStatus == 0)
+    {
+        convert_write_footer(stOutput, &stLayout, *pqwNFrames);
+        if (ferror(stOutput))
+        {
+            NStatus = -1;
+        }
+    }
+    return NStatus;
+}
+
+static void *convert_chunk(void *pvChunk)
+{
+    /*
+    *===========================================================================
+    *   convert_chunk
+    *   Takes:   pvChunk - the stConvertChunk_t to decode
+    *
+    *   Returns: NULL.
+    *
+    *   Thread body, decodes every frame in the chunk into its output buffer.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stConvertChunk_t *stChunk = pvChunk;
+
+    if (eInputFormat == eINPUT_TEXT)
+    {
+        convert_text(stChunk, (const char *)stChunk->pbyStart, stChunk->NLength);
+    }
+    else if (eInputFormat == eINPUT_MDF4)
+    {
+        for (size_t NOffset = 0; NOffset + MDF4_RECORD_SIZE <= stChunk->NLength; NOffset += MDF4_RECORD_SIZE)
+        {
+            CAN_frame_t stFrame;
+            if (mdf4_unpack_record(&stChunk->pbyStart[NOffset], &stFrame, NULL))
+            {
+                convert_emit(stChunk, &stFrame);
+            }
+            else
+            {
+                stChunk->qwNBad++;
+            }
+        }
+    }
+    else
+    {
+        byte *abyRaw = malloc(SDCOMPRESS_RAW_SIZE);
+        for (dword dwBlock = stChunk->dwFirstBlock; abyRaw != NULL && dwBlock < stChunk->dwFirstBlock + stChunk->dwNBlocks; dwBlock++)
+        {
+            const byte *abyBlock = &stChunk->pbyStart[(size_t)dwBlock * SDLOG_BLOCK_SIZE];
+            stSDLogBlockHeader_t stHeader;
+            if (!sdlog_block_valid(abyBlock, dwJournalSessionID, dwBlock))
+            {
+                stChunk->qwNBad++;
+                continue;
+            }
+            memcpy(&stHeader, abyBlock, sizeof(stHeader));
+            if (stHeader.wFlags & SDLOG_FLAG_INDEX)
+            {
+                continue;
+            }
+            const byte *abyPayload = &abyBlock[sizeof(stSDLogBlockHeader_t)];
+            int NLength = stHeader.wPayloadLength;
+            if (stHeader.wFlags & SDLOG_FLAG_COMPRESSED)
+            {
+                NLength = sdcompress_decompress(abyPayload, stHeader.wPayloadLength, abyRaw, SDCOMPRESS_RAW_SIZE);
+                abyPayload = abyRaw;
+            }
+            if (NLength < 0)
+            {
+                stChunk->qwNBad++;
+                continue;
+            }
+            convert_text(stChunk, (const char *)abyPayload, (size_t)NLength);
+        }
+        free(abyRaw);
+    }
+    return NULL;
+}
+
+static void convert_text(stConvertChunk_t *stChunk, const char *pbyText, size_t NLength)
+{
+    const char *pbyEnd = pbyText + NLength;
+    while (pbyText < pbyEnd)
+    {
+        const char *pbyNewline = memchr(pbyText, '\n', (size_t)(pbyEnd - pbyText));
+        const char *pbyLineEnd = (pbyNewline != NULL) ? pbyNewline : pbyEnd;
+        CAN_frame_t stFrame;
+        if (pbyText < pbyLineEnd && *pbyText != '#')
+        {
+            if (convert_parse_line(pbyText, pbyLineEnd, &stFrame))
+            {
+                convert_emit(stChunk, &stFrame);
+            }
+            else
+            {
+                stChunk->qwNBad++;
+            }
+        }
+        pbyText = pbyLineEnd + 1;
+    }
+}
+
+static boolean convert_parse_line(const char *pbyLine, const char *pbyEnd, CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   convert_parse_line
+    *   Takes:   pbyLine, pbyEnd - one line, without the newline
+    *            stFrame - filled with the frame
+    *
+    *   Returns: TRUE if the line is a frame.
+    *
+    *   Parses the line SD_card_format_CAN writes: time, ID in decimal, DLC in
+    *   hex then the data bytes in hex. Hand rolled, sscanf is the slowest
+    *   part of a conversion otherwise.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    qword qwTime = 0;
+    dword dwID = 0;
+    byte byDLC = 0;
+    const char *pbyChar = pbyLine;
+
+    if (pbyChar >= pbyEnd || *pbyChar < '0' || *pbyChar > '9')
+    {
+        return FALSE;
+    }
+    while (pbyChar < pbyEnd && *pbyChar >= '0' && *pbyChar <= '9')
+    {
+        qwTime = qwTime * 10 + (qword)(*pbyChar++ - '0');
+    }
+    if (pbyChar >= pbyEnd || *pbyChar++ != ':')
+    {
+        return FALSE;
+    }
+    while (pbyChar < pbyEnd && *pbyChar == ' ')
+    {
+        pbyChar++;
+    }
+    if (pbyChar >= pbyEnd || *pbyChar < '0' || *pbyChar > '9')
+    {
+        return FALSE;
+    }
+    while (pbyChar < pbyEnd && *pbyChar >= '0' && *pbyChar <= '9')
+    {
+        dwID = dwID * 10 + (dword)(*pbyChar++ - '0');
+    }
+    while (pbyChar < pbyEnd && *pbyChar == ' ')
+    {
+        pbyChar++;
+    }
+    if (pbyChar >= pbyEnd)
+    {
+        return FALSE;
+    }
+    byDLC = (byte)((*pbyChar <= '9') ? *pbyChar - '0' : (*pbyChar | 0x20) - 'a' + 10);
+    pbyChar++;
+    if (byDLC > 15)
+    {
+        return FALSE;
+    }
+
+    memset(stFrame->abData, 0, sizeof(stFrame->abData));
+    for (byte i = 0; i < byDLC && i < 8; i++)
+    {
+        while (pbyChar < pbyEnd && *pbyChar == ' ')
+        {
+            pbyChar++;
+        }
+        if (pbyEnd - pbyChar < 2)
+        {
+            return FALSE;
+        }
+        byte byValue = 0;
+        for (byte j = 0; j < 2; j++)
+        {
+            char byDigit = *pbyChar++;
+            byValue = (byte)(byValue << 4);
+            if (byDigit >= '0' && byDigit <= '9')
+            {
+                byValue |= (byte)(byDigit - '0');
+            }
+            else if ((byDigit | 0x20) >= 'a' && (byDigit | 0x20) <= 'f')
+            {
+                byValue |= (byte)((byDigit | 0x20) - 'a' + 10);
+            }
+            else
+            {
+                return FALSE;
+            }
+        }
+        stFrame->abData[i] = byValue;
+    }
+    stFrame->dwID = dwID;
+    stFrame->byDLC = byDLC;
+    stFrame->qwtTimestampus = qwTime * qwTextTimeScaleus;
+    return TRUE;
+}
+
+static void convert_emit(stConvertChunk_t *stChunk, const CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   convert_emit
+    *   Takes:   stChunk - chunk being decoded
+    *            stFrame - frame to add to its output
+    *
+    *   Returns: Nothing.
+    *
+    *   Formats one frame in the output format. Formatted by hand, printf
+    *   costs more than the whole decode.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    byte byLength = (stFrame->byDLC > 8) ? 8 : stFrame->byDLC;
+    boolean bExtended = stFrame->dwID > CONVERT_STANDARD_ID_MAX;
+
+    convert_reserve(stChunk, CONVERT_MAX_LINE);
+    char *pbyOut = (char *)&stChunk->abyOutput[stChunk->NOutputLength];
+    char *pbyStart = pbyOut;
+    stChunk->qwNFrames++;
+
+    switch (eOutputFormat)
+    {
+        case eOUTPUT_CSV:
+            pbyOut = convert_put_time(pbyOut, stFrame->qwtTimestampus, 0);
+            *pbyOut++ = ',';
+            *pbyOut++ = '0' + CONVERT_BUS_CHANNEL;
+            *pbyOut++ = ',';
+            pbyOut = convert_put_hex(pbyOut, stFrame->dwID, 1);
+            *pbyOut++ = ',';
+            *pbyOut++ = bExtended ? '1' : '0';
+            *pbyOut++ = ',';
+            pbyOut = convert_put_decimal(pbyOut, stFrame->byDLC, 1);
+            *pbyOut++ = ',';
+            pbyOut = convert_put_data(pbyOut, stFrame->abData, byLength, ' ');
+            break;
+        case eOUTPUT_CANDUMP:
+            *pbyOut++ = '(';
+            pbyOut = convert_put_time(pbyOut, stFrame->qwtTimestampus, 0);
+            memcpy(pbyOut, ") can", 5);
+            pbyOut += 5;
+            *pbyOut++ = '0' + CONVERT_BUS_CHANNEL - 1;
+            *pbyOut++ = ' ';
+            pbyOut = convert_put_hex(pbyOut, stFrame->dwID, bExtended ? 8 : 3);
+            *pbyOut++ = '#';
+            pbyOut = convert_put_data(pbyOut, stFrame->abData, byLength, '\0');
+            break;
+        case eOUTPUT_ASC:
+            pbyOut = convert_put_time(pbyOut, stFrame->qwtTimestampus, 4);
+            *pbyOut++ = ' ';
+            *pbyOut++ = '0' + CONVERT_BUS_CHANNEL;
+            *pbyOut++ = ' ';
+            *pbyOut++ = ' ';
+            char *pbyID = pbyOut;
+            pbyOut = convert_put_hex(pbyOut, stFrame->dwID, 1);
+            if (bExtended)
+            {
+                *pbyOut++ = 'x';
+            }
+            while (pbyOut - pbyID < CONVERT_ASC_ID_WIDTH)
+            {
+                *pbyOut++ = ' ';
+            }
+            memcpy(pbyOut, " Rx   d ", 8);
+            pbyOut += 8;
+            pbyOut = convert_put_decimal(pbyOut, stFrame->byDLC, 1);
+            *pbyOut++ = ' ';
+            pbyOut = convert_put_data(pbyOut, stFrame->abData, byLength, ' ');
+            break;
+        case eOUTPUT_MDF4:
+            mdf4_pack_record((byte *)pbyOut, stFrame, CONVERT_BUS_CHANNEL);
+            stChunk->NOutputLength += MDF4_RECORD_SIZE;
+            return;
+        default:
+            break;
+    }
+    *pbyOut++ = '\n';
+    stChunk->NOutputLength += (size_t)(pbyOut - pbyStart);
+}
+
+static char *convert_put_decimal(char *pbyOut, qword qwValue, byte byMinDigits)
+{
+    /* Writes qwValue with at least byMinDigits, zero padded, returns the end */
+    char abyDigits[20];
+    byte byNDigits = 0;
+    do
+    {
+        abyDigits[byNDigits++] = (char)('0' + qwValue % 10);
+        qwValue /= 10;
+    } while (qwValue != 0);
+    while (byNDigits < byMinDigits)
+    {
+        abyDigits[byNDigits++] = '0';
+    }
+    while (byNDigits > 0)
+    {
+        *pbyOut++ = abyDigits[--byNDigits];
+    }
+    return pbyOut;
+}
+
+static char *convert_put_hex(char *pbyOut, dword dwValue, byte byMinDigits)
+{
+    /* Upper case hex with at least byMinDigits, zero padded, returns the end */
+    byte byNDigits = 8;
+    while (byNDigits > byMinDigits && ((dwValue >> (4 * (byNDigits - 1))) & 0x0F) == 0)
+    {
+        byNDigits--;
+    }
+    while (byNDigits > 0)
+    {
+        byNDigits--;
+        *pbyOut++ = HEX_DIGITS[(dwValue >> (4 * byNDigits)) & 0x0F];
+    }
+    return pbyOut;
+}
+
+static char *convert_put_time(char *pbyOut, qword qwTimeus, byte byWidth)
+{
+    /* Seconds with 6 decimals, the whole part space padded to byWidth, returns the end */
+    char *pbyStart = pbyOut;
+    pbyOut = convert_put_decimal(pbyOut, qwTimeus / CONVERT_US_PER_S, 1);
+    if (pbyOut - pbyStart < byWidth)
+    {
+        size_t NPad = byWidth - (size_t)(pbyOut - pbyStart);
+        memmove(pbyStart + NPad, pbyStart, (size_t)(pbyOut - pbyStart));
+        memset(pbyStart, ' ', NPad);
+        pbyOut += NPad;
+    }
+    *pbyOut++ = '.';
+    return convert_put_decimal(pbyOut, qwTimeus % CONVERT_US_PER_S, 6);
+}
+
+static char *convert_put_data(char *pbyOut, const byte *abyData, byte byLength, char bySeparator)
+{
+    /* Data bytes in hex, bySeparator between them unless it is '\0', returns the end */
+    for (byte i = 0; i < byLength; i++)
+    {
+        if (i > 0 && bySeparator != '\0')
+        {
+            *pbyOut++ = bySeparator;
+        }
+        *pbyOut++ = HEX_DIGITS[abyData[i] >> 4];
+        *pbyOut++ = HEX_DIGITS[abyData[i] & 0x0F];
+    }
+    return pbyOut;
+}
+
+static void convert_reserve(stConvertChunk_t *stChunk, size_t NBytes)
+{
+    if (stChunk->NOutputLength + NBytes <= stChunk->NOutputSize)
+    {
+        return;
+    }
+    size_t NNewSize = (stChunk->NOutputSize == 0) ? CONVERT_CHUNK_SIZE : stChunk->NOutputSize * 2;
+    byte *abyNew = realloc(stChunk->abyOutput, NNewSize);
+    if (abyNew == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    stChunk->abyOutput = abyNew;
+    stChunk->NOutputSize = NNewSize;
+}
+
+static void convert_write_header(FILE *stOutput, stMDF4Layout_t *stLayout)
+{
+    /*
+    *===========================================================================
+    *   convert_write_header
+    *   Takes:   stOutput - output file
+    *            stLayout - filled with the MDF4 layout for the footer
+    *
+    *   Returns: Nothing.
+    *
+    *   Logs have no wall clock time, the ASC date is the epoch to match the
+    *   MDF4 start time of 0.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    static byte abyHeader[MDF4_HEADER_SIZE];
+
+    switch (eOutputFormat)
+    {
+        case eOUTPUT_CSV:
+            fputs("timestamp_s,bus,id,extended,dlc,data\n", stOutput);
+            break;
+        case eOUTPUT_ASC:
+            fputs("date Thu Jan 1 00:00:00.000 1970\nbase hex  timestamps absolute\nno internal events logged\n"
+                  "Begin TriggerBlock Thu Jan 1 00:00:00.000 1970\n   0.000000 Start of measurement\n", stOutput);
+            break;
+        case eOUTPUT_MDF4:
+            mdf4_build_header(abyHeader, stLayout);
+            fwrite(abyHeader, 1, MDF4_HEADER_SIZE, stOutput);
+            break;
+        default:
+            break;
+    }
+}
+
+static void convert_write_footer(FILE *stOutput, const stMDF4Layout_t *stLayout, qword qwNFrames)
+{
+    if (eOutputFormat == eOUTPUT_ASC)
+    {
+        fputs("End TriggerBlock\n", stOutput);
+    }
+    else if (eOutputFormat == eOUTPUT_MDF4 && mdf4_update_length(stOutput, stLayout, qwNFrames) != ESP_OK)
+    {
+        fprintf(stderr, "Failed to write the MDF4 record count\n");
+    }
+}
+
+static double convert_seconds_since(const struct timespec *stStart)
+{
+    struct timespec stNow;
+    clock_gettime(CLOCK_MONOTONIC, &stNow);
+    return (stNow.tv_sec - stStart->tv_sec) + (stNow.tv_nsec - stStart->tv_nsec) / 1e9;
+}
@@ -0,0 +1,91 @@
+/*
+sfrlog_extract.c | host tools
+Prints the records of a logNNN.sfr file that fall in a time window, seeking
+with the time index trailer and the block headers instead of reading the file
+from the start.
+
+Usage: sfrlog_extract <logNNN.sfr> <start s> <end s>
+
+Build: gcc -O2 -Itools/host -Imain -Itools tools/sfrlog_extract.c tools/sfrlogread.c
+       main/sdlog.c main/sdcompress.c -o sfrlog_extract
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sfrlogread.h"
+
+/* --------------------------- Definitions ---------------------------------- */
+#define MS_PER_S 1000
+
+/* --------------------------- Local Variables ------------------------------ */
+static stSFRLogReader_t stReader;
+static byte abyRaw[SDCOMPRESS_RAW_SIZE];
+
+/* --------------------------- Functions ------------------------------------ */
+
+int main(int NArgs, char **abyArgs)
+{
+    struct timespec stStart, stEnd;
+
+    if (NArgs != 4)
+    {
+        fprintf(stderr, "Usage: %s <logNNN.sfr> <start s> <end s>\n", abyArgs[0]);
+        return 1;
+    }
+    double tStart = atof(abyArgs[2]);
+    double tEnd = atof(abyArgs[3]);
+    dword dwStartms = (tStart > 0) ? (dword)(tStart * MS_PER_S) : 0;
+    dword dwEndms = (dword)(tEnd * MS_PER_S);
+
+    clock_gettime(CLOCK_MONOTONIC, &stStart);
+    if (sfrlog_open(&stReader, abyArgs[1]) != 0)
+    {
+        fprintf(stderr, "%s is not a readable log\n", abyArgs[1]);
+        return 1;
+    }
+
+    dword dwBlock = sfrlog_find_time(&stReader, dwStartms);
+    dword dwNBlocksRead = 0;
+    dword dwNLines = 0;
+    stSDLogBlockHeader_t stHeader;
+    for (; dwBlock < stReader.dwNBlocks; dwBlock++)
+    {
+        int NLength = sfrlog_read_block(&stReader, dwBlock, abyRaw, &stHeader);
+        if (NLength < 0)
+        {
+            fprintf(stderr, "Block %lu damaged, skipped\n", (unsigned long)dwBlock);
+            continue;
+        }
+        if (stHeader.dwTimestampms > dwEndms)
+        {
+            break;
+        }
+        dwNBlocksRead++;
+
+        /* Lines carry whole seconds, keep the ones inside the window */
+        char *pbyLine = (char *)abyRaw;
+        char *pbyEnd = (char *)abyRaw + NLength;
+        while (pbyLine < pbyEnd)
+        {
+            char *pbyNewline = memchr(pbyLine, '\n', (size_t)(pbyEnd - pbyLine));
+            size_t NLineLength = (pbyNewline != NULL) ? (size_t)(pbyNewline - pbyLine) + 1 : (size_t)(pbyEnd - pbyLine);
+            long sdwLineTimes = strtol(pbyLine, NULL, 10);
+            if (sdwLineTimes >= (long)(dwStartms / MS_PER_S) && sdwLineTimes <= (long)(dwEndms / MS_PER_S))
+            {
+                fwrite(pbyLine, 1, NLineLength, stdout);
+                dwNLines++;
+            }
+            pbyLine += NLineLength;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stEnd);
+
+    fprintf(stderr, "%lu lines from %lu blocks (%lu in file) in %.2f ms\n",
+        (unsigned long)dwNLines, (unsigned long)dwNBlocksRead, (unsigned long)stReader.dwNBlocks,
+        (stEnd.tv_sec - stStart.tv_sec) * 1e3 + (stEnd.tv_nsec - stStart.tv_nsec) / 1e6);
+    sfrlog_close(&stReader);
+    return 0;
+}
@@ -0,0 +1,266 @@
+/*
+sfrlogread.c | host tools
+File contains the host side reader for logNNN.sfr files written by the SD card
+logger. Built from the same block format and decompressor sources as the
+firmware (main/sdlog.c, main/sdcompress.c).
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#define _FILE_OFFSET_BITS 64
+#include <string.h>
+#include <sys/types.h>
+#include "sfrlogread.h"
+
+/* --------------------------- Function prototypes -------------------------- */
+int sfrlog_open(stSFRLogReader_t *stReader, const char *abyPath);
+void sfrlog_close(stSFRLogReader_t *stReader);
+int sfrlog_read_block(stSFRLogReader_t *stReader, dword dwBlock, byte *abyRaw, stSDLogBlockHeader_t *stHeader);
+dword sfrlog_find_time(stSFRLogReader_t *stReader, dword dwTimems);
+static boolean sfrlog_load_block(stSFRLogReader_t *stReader, dword dwBlock);
+static boolean sfrlog_block_time(stSFRLogReader_t *stReader, dword dwBlock, dword *pdwTimems);
+static void sfrlog_load_index(stSFRLogReader_t *stReader);
+
+/* --------------------------- Functions ------------------------------------ */
+
+int sfrlog_open(stSFRLogReader_t *stReader, const char *abyPath)
+{
+    /*
+    *===========================================================================
+    *   sfrlog_open
+    *   Takes:   stReader - reader state
+    *            abyPath - path of the .sfr log
+    *
+    *   Returns: 0 if successful, -1 if the file cannot be read as a log.
+    *
+    *   Opens the log and finds the end of the good data. The end is found the
+    *   same way as the recovery on the logger so a log that was never
+    *   recovered still reads. Then loads the time index trailer.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Time index trailer
+    *
+    *===========================================================================
+    */
+    stSDLogBlockHeader_t stHeader;
+
+    memset(stReader, 0, sizeof(*stReader));
+    stReader->stFile = fopen(abyPath, "rb");
+    if (stReader->stFile == NULL)
+    {
+        return -1;
+    }
+    if (!sfrlog_load_block(stReader, 0))
+    {
+        sfrlog_close(stReader);
+        return -1;
+    }
+    memcpy(&stHeader, stReader->abyBlock, sizeof(stHeader));
+    if (!sdlog_block_valid(stReader->abyBlock, stHeader.dwSessionID, 0))
+    {
+        sfrlog_close(stReader);
+        return -1;
+    }
+    stReader->dwSessionID = stHeader.dwSessionID;
+
+    /* Good blocks are a prefix of the file, binary search for the end */
+    fseeko(stReader->stFile, 0, SEEK_END);
+    dword dwLow = 0;
+    dword dwHigh = (dword)(ftello(stReader->stFile) / SDLOG_BLOCK_SIZE);
+    while (dwHigh - dwLow > 1)
+    {
+        dword dwMid = dwLow + (dwHigh - dwLow) / 2;
+        if (sfrlog_load_block(stReader, dwMid) &&
+            sdlog_block_valid(stReader->abyBlock, stReader->dwSessionID, dwMid))
+        {
+            dwLow = dwMid;
+        }
+        else
+        {
+            dwHigh = dwMid;
+        }
+    }
+    stReader->dwNBlocks = dwLow + 1;
+    sfrlog_load_index(stReader);
+    return 0;
+}
+
+void sfrlog_close(stSFRLogReader_t *stReader)
+{
+    if (stReader->stFile != NULL)
+    {
+        fclose(stReader->stFile);
+    }
+    memset(stReader, 0, sizeof(*stReader));
+}
+
+int sfrlog_read_block(stSFRLogReader_t *stReader, dword dwBlock, byte *abyRaw, stSDLogBlockHeader_t *stHeader)
+{
+    /*
+    *===========================================================================
+    *   sfrlog_read_block
+    *   Takes:   stReader - reader state
+    *            dwBlock - block to read
+    *            abyRaw - SDCOMPRESS_RAW_SIZE buffer for the records
+    *            stHeader - returns the block header, may be NULL
+    *
+    *   Returns: Number of record bytes in abyRaw, 0 for an index block, -1
+    *            if the block is damaged.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Index blocks hold no records
+    *
+    *===========================================================================
+    */
+    stSDLogBlockHeader_t stBlockHeader;
+
+    if (dwBlock >= stReader->dwNBlocks || !sfrlog_load_block(stReader, dwBlock) ||
+        !sdlog_block_valid(stReader->abyBlock, stReader->dwSessionID, dwBlock))
+    {
+        return -1;
+    }
+    memcpy(&stBlockHeader, stReader->abyBlock, sizeof(stBlockHeader));
+    if (stHeader != NULL)
+    {
+        *stHeader = stBlockHeader;
+    }
+
+    const byte *abyPayload = &stReader->abyBlock[sizeof(stSDLogBlockHeader_t)];
+    if (stBlockHeader.wFlags & SDLOG_FLAG_INDEX)
+    {
+        return 0;
+    }
+    if (stBlockHeader.wFlags & SDLOG_FLAG_COMPRESSED)
+    {
+        return sdcompress_decompress(abyPayload, stBlockHeader.wPayloadLength, abyRaw, SDCOMPRESS_RAW_SIZE);
+    }
+    memcpy(abyRaw, abyPayload, stBlockHeader.wPayloadLength);
+    return stBlockHeader.wPayloadLength;
+}
+
+dword sfrlog_find_time(stSFRLogReader_t *stReader, dword dwTimems)
+{
+    /*
+    *===========================================================================
+    *   sfrlog_find_time
+    *   Takes:   stReader - reader state
+    *            dwTimems - time since power up to seek to
+    *
+    *   Returns: First block that can hold records at or after dwTimems.
+    *
+    *   The time index narrows the search to the blocks between two entries,
+    *   then the block headers in that range are binary searched, one header
+    *   read each. Blocks past the last index block, or a log with no index,
+    *   are searched by their headers alone.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *   18/10/26 CP Narrowed by the time index
+    *
+    *===========================================================================
+    */
+    dword dwLow = 0;
+    dword dwHigh = stReader->dwNBlocks;
+    dword dwBlockTimems;
+
+    /* Last entry at or before the time and the one after it bound the search */
+    if (stReader->wNIndex > 0 && stReader->astIndex[0].dwTimestampms <= dwTimems)
+    {
+        word wEntry = 0;
+        while (wEntry + 1 < stReader->wNIndex && stReader->astIndex[wEntry + 1].dwTimestampms <= dwTimems)
+        {
+            wEntry++;
+        }
+        dwLow = stReader->astIndex[wEntry].dwBlock;
+        if (wEntry + 1 < stReader->wNIndex)
+        {
+            dwHigh = stReader->astIndex[wEntry + 1].dwBlock;
+        }
+    }
+
+    /* Last block starting at or before the time, its records may run past it */
+    if (!sfrlog_block_time(stReader, dwLow, &dwBlockTimems) || dwBlockTimems > dwTimems)
+    {
+        return dwLow;
+    }
+    while (dwHigh - dwLow > 1)
+    {
+        dword dwMid = dwLow + (dwHigh - dwLow) / 2;
+        if (sfrlog_block_time(stReader, dwMid, &dwBlockTimems) && dwBlockTimems <= dwTimems)
+        {
+            dwLow = dwMid;
+        }
+        else
+        {
+            dwHigh = dwMid;
+        }
+    }
+    return dwLow;
+}
+
+static boolean sfrlog_load_block(stSFRLogReader_t *stReader, dword dwBlock)
+{
+    if (fseeko(stReader->stFile, (off_t)dwBlock * SDLOG_BLOCK_SIZE, SEEK_SET) != 0)
+    {
+        return FALSE;
+    }
+    return fread(stReader->abyBlock, 1, SDLOG_BLOCK_SIZE, stReader->stFile) == SDLOG_BLOCK_SIZE;
+}
+
+static void sfrlog_load_index(stSFRLogReader_t *stReader)
+{
+    /*
+    *===========================================================================
+    *   sfrlog_load_index
+    *   Takes:   stReader - reader state, dwNBlocks already found
+    *
+    *   Returns: Nothing, wNIndex is 0 if the log has no usable index.
+    *
+    *   Index blocks sit at n * SDLOG_INDEX_INTERVAL - 1, the last one whole
+    *   is the trailer. A slot whose index write failed holds records, the
+    *   one before it is tried instead.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stSDLogBlockHeader_t stHeader;
+
+    stReader->wNIndex = 0;
+    for (dword dwSlot = stReader->dwNBlocks / SDLOG_INDEX_INTERVAL; dwSlot > 0; dwSlot--)
+    {
+        dword dwBlock = dwSlot * SDLOG_INDEX_INTERVAL - 1;
+        if (!sfrlog_load_block(stReader, dwBlock) ||
+            !sdlog_block_valid(stReader->abyBlock, stReader->dwSessionID, dwBlock))
+        {
+            continue;
+        }
+        memcpy(&stHeader, stReader->abyBlock, sizeof(stHeader));
+        if (stHeader.wFlags & SDLOG_FLAG_INDEX)
+        {
+            stReader->wNIndex = stHeader.wPayloadLength / sizeof(stSDLogIndexEntry_t);
+            memcpy(stReader->astIndex, &stReader->abyBlock[sizeof(stHeader)],
+                   stReader->wNIndex * sizeof(stSDLogIndexEntry_t));
+            return;
+        }
+    }
+}
+
+static boolean sfrlog_block_time(stSFRLogReader_t *stReader, dword dwBlock, dword *pdwTimems)
+{
+    /* Header only, the search does not need the CRC of every block it touches */
+    stSDLogBlockHeader_t stHeader;
+
+    if (dwBlock >= stReader->dwNBlocks ||
+        fseeko(stReader->stFile, (off_t)dwBlock * SDLOG_BLOCK_SIZE, SEEK_SET) != 0 ||
+        fread(&stHeader, sizeof(stHeader), 1, stReader->stFile) != 1 ||
+        stHeader.dwMagic != SDLOG_BLOCK_MAGIC || stHeader.dwSequence != dwBlock)
+    {
+        return FALSE;
+    }
+    *pdwTimems = stHeader.dwTimestampms;
+    return TRUE;
+}
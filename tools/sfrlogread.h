@@ -0,0 +1,25 @@
+#ifndef SFR_LOGREAD
+#define SFR_LOGREAD
+
+#include <stdio.h>
+#include "sfrtypes.h"
+#include "sdlog.h"
+#include "sdcompress.h"
+
+/* --------------------------- Types ---------------------------------------- */
+typedef struct {
+    FILE *stFile;
+    dword dwSessionID;
+    dword dwNBlocks;                    // good blocks at the start of the file
+    stSDLogIndexEntry_t astIndex[SDLOG_INDEX_ENTRIES];  // from the last index block, oldest first
+    word wNIndex;
+    byte abyBlock[SDLOG_BLOCK_SIZE];
+} stSFRLogReader_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+int sfrlog_open(stSFRLogReader_t *stReader, const char *abyPath);
+void sfrlog_close(stSFRLogReader_t *stReader);
+int sfrlog_read_block(stSFRLogReader_t *stReader, dword dwBlock, byte *abyRaw, stSDLogBlockHeader_t *stHeader);
+dword sfrlog_find_time(stSFRLogReader_t *stReader, dword dwTimems);
+
+#endif // SFR_LOGREAD
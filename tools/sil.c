@@ -0,0 +1,428 @@
+/*
+sil.c | host tools
+Runs the firmware's task loop on a virtual clock: app_main starts the
+scheduler, task_1ms, task_10ms, task_100ms and task_BG run at their rates
+on the kernel in tools/sil_idf.c, and frames from a candump log go into
+CAN_receive_callback at their logged times. Everything the firmware sends
+is captured in the output directory: cantx.log (candump), espnow.log (one
+hex line per packet) and sdcard/ (the card as written, read it with
+sfrlog_convert).
+
+Tasks run one at a time and code takes no virtual time, so the same log
+always gives the same outputs and a race-length session runs in seconds.
+That makes it the place to check flush deadlines, decimation and triggers,
+not run times: the scheduler's stats show releases and overruns only.
+SD card logs are turned into candump input with sfrlog_convert -f candump.
+Log interfaces can0 and can1 go to CAN0 and CAN1, a frame for a bus the
+firmware did not start is counted and dropped.
+
+Usage: sil [-d seconds] [-o dir] [-s] [-e] [-t] [-g] [-l start_ms] [-r seed] [candump.log]
+       -s SD card logging, -e ESP-NOW (TX side), -t event trigger (needs -s),
+       -g CAN gateway. -s, -e and -g each drain the CAN RX ring, pick one.
+       Without -d the run ends 1 s after the last frame.
+       Exit code 2 if the task watchdog fired.
+
+Build: python3 tools/dbc2c.py main/dbc/sfr.dbc build/sfr_dbc.h
+       gcc -O2 -DTX_SIDE -Itools/host -Imain -Ibuild -Itools tools/sil.c tools/sil_idf.c
+       main/main.c main/tasks.c main/scheduler.c main/can.c main/busload.c main/signals.c
+       main/espnow.c main/sdcard.c main/sdlog.c main/sdcompress.c main/mdf4.c main/logfilter.c
+       main/trigger.c main/trace.c main/supervisor.c main/gateway.c main/replay.c main/blaster.c
+       -Wl,--wrap=fopen,--wrap=opendir -o sil
+       adcscan.c, adcfilter.c and apps.c need the DMA ADC and stay out, their
+       headers build here so main.c and tasks.c do.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "sil.h"
+#include "can.h"
+#include "sdcard.h"
+#include "espnow.h"
+#include "trigger.h"
+#include "gateway.h"
+#include "scheduler.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef struct {
+    qword qwtTimeus;                // as logged
+    byte byBus;
+    CAN_frame_t stFrame;
+} stSILLogFrame_t;
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SIL_US_PER_S 1000000ULL
+#define SIL_TAIL_US SIL_US_PER_S            // run on after the last frame
+#define SIL_NO_LOG_US (10 * SIL_US_PER_S)   // run length with no log
+#define SIL_MAX_LINE 256
+#define SIL_STANDARD_ID_DIGITS 3
+
+/* --------------------------- Local Variables ------------------------------ */
+static boolean bSILSD = FALSE;
+static boolean bSILESPNOW = FALSE;
+static boolean bSILTrigger = FALSE;
+static boolean bSILGateway = FALSE;
+
+/* --------------------------- Function prototypes -------------------------- */
+void app_main(void);
+static boolean sil_parse_line(const char *abyLine, stSILLogFrame_t *stLogFrame);
+static int sil_hex_digit(char byDigit);
+static void sil_start_modules(void);
+static void sil_report(const char *abySDDirectory, double dWallSeconds);
+
+/* --------------------------- Functions ------------------------------------ */
+
+int main(int NArgs, char **abyArgs)
+{
+    double dDurationSeconds = 0.0;
+    const char *abyOutputDirectory = "sil_out";
+    qword qwtStartus = 0;
+    dword dwSeed = 1;
+    int NOption;
+
+    while ((NOption = getopt(NArgs, abyArgs, "d:o:setgl:r:")) != -1)
+    {
+        switch (NOption)
+        {
+            case 'd': dDurationSeconds = atof(optarg); break;
+            case 'o': abyOutputDirectory = optarg; break;
+            case 's': bSILSD = TRUE; break;
+            case 'e': bSILESPNOW = TRUE; break;
+            case 't': bSILTrigger = TRUE; break;
+            case 'g': bSILGateway = TRUE; break;
+            case 'l': qwtStartus = (qword)atoll(optarg) * 1000; break;
+            case 'r': dwSeed = (dword)strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "Usage: %s [-d seconds] [-o dir] [-s] [-e] [-t] [-g] [-l start_ms] [-r seed] [candump.log]\n",
+                        abyArgs[0]);
+                return 1;
+        }
+    }
+    if (NArgs - optind > 1)
+    {
+        fprintf(stderr, "Usage: %s [-d seconds] [-o dir] [-s] [-e] [-t] [-g] [-l start_ms] [-r seed] [candump.log]\n",
+                abyArgs[0]);
+        return 1;
+    }
+
+    /* Inputs and outputs */
+    FILE *stLog = NULL;
+    if (optind < NArgs)
+    {
+        stLog = fopen(abyArgs[optind], "r");
+        if (stLog == NULL)
+        {
+            fprintf(stderr, "Cannot read %s\n", abyArgs[optind]);
+            return 1;
+        }
+    }
+    stSILConfig_t stConfig = { .eResetReason = ESP_RST_POWERON, .dwRandomSeed = dwSeed };
+    char abyPath[512];
+    if (mkdir(abyOutputDirectory, 0777) != 0 && access(abyOutputDirectory, W_OK) != 0)
+    {
+        fprintf(stderr, "Cannot create %s\n", abyOutputDirectory);
+        return 1;
+    }
+    snprintf(abyPath, sizeof(abyPath), "%s/cantx.log", abyOutputDirectory);
+    stConfig.stCANTx = fopen(abyPath, "w");
+    snprintf(abyPath, sizeof(abyPath), "%s/espnow.log", abyOutputDirectory);
+    stConfig.stESPNOW = fopen(abyPath, "w");
+    snprintf(stConfig.abySDDirectory, sizeof(stConfig.abySDDirectory), "%s/sdcard", abyOutputDirectory);
+    if (stConfig.stCANTx == NULL || stConfig.stESPNOW == NULL)
+    {
+        fprintf(stderr, "Cannot write to %s\n", abyOutputDirectory);
+        return 1;
+    }
+    sil_configure(&stConfig);
+
+    struct timespec stWallStart, stWallEnd;
+    clock_gettime(CLOCK_MONOTONIC, &stWallStart);
+
+    /* Boot, then the modules main_init leaves commented out */
+    app_main();
+    sil_start_modules();
+
+    /* Play the log, the firmware runs up to each frame's time */
+    qword qwtEndus = (qword)(dDurationSeconds * SIL_US_PER_S);
+    qword qwtLastFrameus = qwtStartus;
+    qword qwNBadLines = 0;
+    if (stLog != NULL)
+    {
+        char abyLine[SIL_MAX_LINE];
+        boolean bFirst = TRUE;
+        qword qwtFirstus = 0;
+        stSILLogFrame_t stLogFrame;
+        while (!sil_stopped() && fgets(abyLine, sizeof(abyLine), stLog) != NULL)
+        {
+            if (!sil_parse_line(abyLine, &stLogFrame))
+            {
+                qwNBadLines += (abyLine[0] != '\n' && abyLine[0] != '#');
+                continue;
+            }
+            if (bFirst)
+            {
+                qwtFirstus = stLogFrame.qwtTimeus;
+                bFirst = FALSE;
+            }
+            /* Out of order stamps are taken as simultaneous */
+            qword qwtFrameus = qwtStartus + ((stLogFrame.qwtTimeus > qwtFirstus) ? stLogFrame.qwtTimeus - qwtFirstus : 0);
+            qwtFrameus = (qwtFrameus < sil_now()) ? sil_now() : qwtFrameus;
+            if (qwtEndus != 0 && qwtFrameus > qwtEndus)
+            {
+                break;
+            }
+            sil_run_until(qwtFrameus);
+            if (!sil_stopped())
+            {
+                stLogFrame.stFrame.qwtTimestampus = qwtFrameus;
+                (void)sil_can_receive(stLogFrame.byBus, &stLogFrame.stFrame);
+            }
+            qwtLastFrameus = qwtFrameus;
+        }
+        fclose(stLog);
+    }
+    if (qwtEndus == 0)
+    {
+        qwtEndus = (stLog != NULL) ? qwtLastFrameus + SIL_TAIL_US : SIL_NO_LOG_US;
+    }
+    sil_run_until(qwtEndus);
+
+    clock_gettime(CLOCK_MONOTONIC, &stWallEnd);
+    double dWallSeconds = (double)(stWallEnd.tv_sec - stWallStart.tv_sec) + (double)(stWallEnd.tv_nsec - stWallStart.tv_nsec) / 1e9;
+
+    /* Flush what the firmware holds open so the files can be read */
+    if (bSILSD)
+    {
+        (void)SD_card_flush();
+    }
+    fclose(stConfig.stCANTx);
+    fclose(stConfig.stESPNOW);
+    if (qwNBadLines != 0)
+    {
+        fprintf(stderr, "%llu log lines not understood\n", (unsigned long long)qwNBadLines);
+    }
+    sil_report(stConfig.abySDDirectory, dWallSeconds);
+    return sil_counters()->bWatchdogFired ? 2 : 0;
+}
+
+static boolean sil_parse_line(const char *abyLine, stSILLogFrame_t *stLogFrame)
+{
+    /*
+    *===========================================================================
+    *   sil_parse_line
+    *   Takes:   abyLine - one candump -l line, "(seconds.micros) can0 123#DEADBEEF"
+    *            stLogFrame - where the frame goes
+    *
+    *   Returns: TRUE if the line is a frame.
+    *
+    *   IDs written with 8 digits are extended as candump writes them. The bus
+    *   is the interface's last digit, 0 if it has none.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    unsigned long long qwSeconds, qwMicros;
+    char abyInterface[32], abyFrame[64];
+    if (sscanf(abyLine, " (%llu.%llu) %31s %63s", &qwSeconds, &qwMicros, abyInterface, abyFrame) != 4)
+    {
+        return FALSE;
+    }
+    char *pbyHash = strchr(abyFrame, '#');
+    if (pbyHash == NULL || pbyHash == abyFrame)
+    {
+        return FALSE;
+    }
+
+    *stLogFrame = (stSILLogFrame_t){ 0 };
+    stLogFrame->qwtTimeus = qwSeconds * SIL_US_PER_S + qwMicros;
+    size_t NInterfaceLength = strlen(abyInterface);
+    char byLast = abyInterface[NInterfaceLength - 1];
+    stLogFrame->byBus = (byLast >= '0' && byLast <= '9') ? (byte)(byLast - '0') : 0;
+
+    size_t NIDDigits = (size_t)(pbyHash - abyFrame);
+    dword dwID = 0;
+    for (size_t i = 0; i < NIDDigits; i++)
+    {
+        int NDigit = sil_hex_digit(abyFrame[i]);
+        if (NDigit < 0)
+        {
+            return FALSE;
+        }
+        dwID = (dwID << 4) | (dword)NDigit;
+    }
+    if ((NIDDigits <= SIL_STANDARD_ID_DIGITS && dwID > 0x7FF) || dwID > 0x1FFFFFFF)
+    {
+        return FALSE;
+    }
+    stLogFrame->stFrame.dwID = dwID;
+
+    /* Data, remote frames ("R") carry none */
+    const char *pbyData = pbyHash + 1;
+    byte byDLC = 0;
+    while (pbyData[0] != '\0' && pbyData[0] != 'R' && byDLC < 8)
+    {
+        int NHigh = sil_hex_digit(pbyData[0]);
+        int NLow = sil_hex_digit(pbyData[1]);
+        if (NHigh < 0 || NLow < 0)
+        {
+            return FALSE;
+        }
+        stLogFrame->stFrame.abData[byDLC++] = (byte)((NHigh << 4) | NLow);
+        pbyData += 2;
+    }
+    stLogFrame->stFrame.byDLC = byDLC;
+    stLogFrame->stFrame.byBus = stLogFrame->byBus;
+    return TRUE;
+}
+
+static int sil_hex_digit(char byDigit)
+{
+    /*
+    *===========================================================================
+    *   sil_hex_digit
+    *   Takes:   byDigit - character
+    *
+    *   Returns: Its value, -1 if it is not a hex digit.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (byDigit >= '0' && byDigit <= '9')
+    {
+        return byDigit - '0';
+    }
+    if (byDigit >= 'A' && byDigit <= 'F')
+    {
+        return byDigit - 'A' + 10;
+    }
+    if (byDigit >= 'a' && byDigit <= 'f')
+    {
+        return byDigit - 'a' + 10;
+    }
+    return -1;
+}
+
+static void sil_start_modules(void)
+{
+    /*
+    *===========================================================================
+    *   sil_start_modules
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Starts the modules asked for on the command line, in main_init's
+    *   order. They register runnables so the scheduler picks them up.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    esp_err_t NStatus;
+    if (bSILESPNOW)
+    {
+        NStatus = ESPNOW_init();
+        if (NStatus != ESP_OK)
+        {
+            fprintf(stderr, "ESPNOW_init: %s\n", esp_err_to_name(NStatus));
+        }
+    }
+    if (bSILSD)
+    {
+        NStatus = SD_card_init();
+        if (NStatus != ESP_OK)
+        {
+            fprintf(stderr, "SD_card_init: %s\n", esp_err_to_name(NStatus));
+        }
+    }
+    if (bSILTrigger)
+    {
+        NStatus = trigger_init();
+        if (NStatus != ESP_OK)
+        {
+            fprintf(stderr, "trigger_init: %s\n", esp_err_to_name(NStatus));
+        }
+    }
+    if (bSILGateway)
+    {
+        NStatus = gateway_init();
+        if (NStatus != ESP_OK)
+        {
+            fprintf(stderr, "gateway_init: %s\n", esp_err_to_name(NStatus));
+        }
+    }
+}
+
+static void sil_report(const char *abySDDirectory, double dWallSeconds)
+{
+    /*
+    *===========================================================================
+    *   sil_report
+    *   Takes:   abySDDirectory - the card
+    *            dWallSeconds - host time the run took
+    *
+    *   Returns: Nothing.
+    *
+    *   Prints the run, the captured outputs and the scheduler's view of it.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    const stSILCounters_t *stCounters = sil_counters();
+    double dVirtualSeconds = (double)sil_now() / SIL_US_PER_S;
+    printf("%.3f s simulated in %.3f s (%.0fx)%s%s\n", dVirtualSeconds, dWallSeconds,
+           (dWallSeconds > 0.0) ? dVirtualSeconds / dWallSeconds : 0.0,
+           stCounters->abyStopReason[0] ? ", stopped: " : "", stCounters->abyStopReason);
+    printf("CAN RX %llu (%llu for a bus not started), CAN TX %llu, ESP-NOW %llu packets %llu bytes\n",
+           (unsigned long long)stCounters->qwNCANRx, (unsigned long long)stCounters->qwNCANRxNoNode,
+           (unsigned long long)stCounters->qwNCANTx, (unsigned long long)stCounters->qwNESPNOWPackets,
+           (unsigned long long)stCounters->qwNESPNOWBytes);
+    printf("%llu task switches, %llu timer callbacks\n", (unsigned long long)stCounters->qwNContextSwitches,
+           (unsigned long long)stCounters->qwNTimerCallbacks);
+
+    DIR *stDirectory = opendir(abySDDirectory);
+    if (stDirectory != NULL)
+    {
+        struct dirent *stEntry;
+        char abyPath[512];
+        struct stat stInfo;
+        while ((stEntry = readdir(stDirectory)) != NULL)
+        {
+            snprintf(abyPath, sizeof(abyPath), "%s/%s", abySDDirectory, stEntry->d_name);
+            if (stat(abyPath, &stInfo) == 0 && S_ISREG(stInfo.st_mode))
+            {
+                printf("SD %s %lld bytes\n", stEntry->d_name, (long long)stInfo.st_size);
+            }
+        }
+        closedir(stDirectory);
+    }
+
+    stSchedStats_t stStats;
+    for (byte i = 0; i < eSCHED_TOTAL; i++)
+    {
+        if (scheduler_get_stats((eSchedTask_t)i, &stStats) == ESP_OK)
+        {
+            printf("%-10s runs %8lu overruns %lu misses %lu\n", scheduler_task_name((eSchedTask_t)i),
+                   (unsigned long)stStats.dwNRuns, (unsigned long)stStats.dwNOverruns, (unsigned long)stStats.dwNDeadlineMisses);
+        }
+    }
+    stRunnableStats_t stRunnable;
+    for (byte i = 0; scheduler_get_runnable_stats(i, &stRunnable) == ESP_OK; i++)
+    {
+        printf("  %-14s in %-10s every %4u ms runs %8lu skipped %lu\n", stRunnable.abyName,
+               scheduler_task_name(stRunnable.eTask), (unsigned)stRunnable.wtPeriodms,
+               (unsigned long)stRunnable.dwNRuns, (unsigned long)stRunnable.dwNSkipped);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef SFR_SIL
+#define SFR_SIL
+
+#include <stdio.h>
+#include "sfrtypes.h"
+#include "esp_system.h"
+
+/* --------------------------- Types ---------------------------------------- */
+typedef struct {
+    FILE *stCANTx;                  // candump log of every frame sent, NULL to discard
+    FILE *stESPNOW;                 // one line per packet sent, NULL to discard
+    char abySDDirectory[256];       // the card, paths under the mount point land here
+    esp_reset_reason_t eResetReason;
+    dword dwRandomSeed;
+} stSILConfig_t;
+
+typedef struct {
+    qword qwNCANRx;                 // frames handed to the RX callbacks
+    qword qwNCANRxNoNode;           // frames for a bus the firmware did not start
+    qword qwNCANTx;
+    qword qwNESPNOWPackets;
+    qword qwNESPNOWBytes;
+    qword qwNContextSwitches;
+    qword qwNTimerCallbacks;
+    boolean bWatchdogFired;
+    boolean bRestarted;
+    char abyStopReason[96];
+} stSILCounters_t;
+
+/* --------------------------- Function prototypes -------------------------- */
+void sil_configure(const stSILConfig_t *stConfig);
+qword sil_now(void);
+void sil_run_until(qword qwtUntilus);
+boolean sil_stopped(void);
+boolean sil_can_receive(byte byBus, const CAN_frame_t *stFrame);
+const stSILCounters_t *sil_counters(void);
+
+#endif // SFR_SIL
@@ -0,0 +1,929 @@
+/*
+sil_idf.c | host tools
+The ESP-IDF and FreeRTOS calls the firmware makes, on a virtual clock, for
+the software in the loop harness in sil.c.
+
+Every FreeRTOS task is a ucontext coroutine. The kernel runs the highest
+priority ready task until it blocks in xTaskDelayUntil, vTaskDelay or
+ulTaskNotifyTake, then the next, and when nothing is ready moves the clock
+straight to the next wake up, esp_timer expiry or task watchdog deadline.
+Code takes no virtual time, so a run does not depend on the host and the
+same inputs always give the same outputs. A task woken by another keeps
+waiting until the running one blocks, there is no preemption. esp_timer
+callbacks run before tasks due at the same time, as the timer task is the
+higher priority.
+
+CAN nodes hand frames from sil_can_receive to the firmware's RX callback
+and write everything sent to a candump log. ESP-NOW packets are written as
+hex lines. The SD card is a directory: fopen and opendir are wrapped at link
+time (-Wl,--wrap=fopen,--wrap=opendir) and paths under the mount point are
+moved into it. The task watchdog ends the run, calling the firmware's
+esp_task_wdt_isr_user_handler first like the target does.
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <ucontext.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_task_wdt.h"
+#include "esp_system.h"
+#include "esp_random.h"
+#include "esp_cpu.h"
+#include "esp_twai_onchip.h"
+#include "esp_now.h"
+#include "esp_vfs_fat.h"
+#include "sil.h"
+
+/* --------------------------- Local Types ----------------------------- */
+typedef enum {
+    eSIL_TASK_READY = 0,
+    eSIL_TASK_SLEEPING,             // until qwtWakeus
+    eSIL_TASK_WAITING,              // for a notification or qwtWakeus
+    eSIL_TASK_DONE,
+} eSILTaskState_t;
+
+struct stSILTask_t {
+    ucontext_t stContext;
+    void *pvStack;
+    TaskFunction_t pfTask;
+    void *pvArg;
+    const char *abyName;
+    UBaseType_t NPriority;
+    eSILTaskState_t eState;
+    qword qwtWakeus;
+    uint32_t dwNNotifications;
+    boolean bWatched;               // subscribed to the task watchdog
+    qword qwtLastFeedus;
+};
+
+struct stSILTimer_t {
+    esp_timer_create_args_t stArgs;
+    boolean bActive;
+    qword qwtDueus;
+    qword qwtPeriodus;              // 0 for one shot
+};
+
+struct stSILCANNode_t {
+    byte byBus;
+    boolean bEnabled;
+    twai_event_callbacks_t stCallbacks;
+    void *pvArg;
+    boolean bPending;
+    twai_frame_header_t stPendingHeader;
+    byte abyPending[8];
+};
+
+/* --------------------------- Definitions ---------------------------------- */
+#define SIL_MAX_TASKS 16
+#define SIL_MAX_TIMERS 16
+#define SIL_MAX_CAN_NODES 2
+#define SIL_STACK_BYTES (512 * 1024)    // host code wants far more stack than the target sizes
+#define SIL_FOREVER UINT64_MAX
+#define SIL_US_PER_TICK (1000000 / configTICK_RATE_HZ)
+#define SIL_CPU_MHZ 160                 // esp_cpu_get_cycle_count rate
+
+/* --------------------------- Local Variables ------------------------------ */
+static stSILConfig_t stSILConfig = { .eResetReason = ESP_RST_POWERON, .dwRandomSeed = 1 };
+static stSILCounters_t stSILCounters;
+static qword qwtSILNowus = 0;
+static boolean bSILStopped = FALSE;
+static ucontext_t stSILKernelContext;
+static struct stSILTask_t astSILTasks[SIL_MAX_TASKS];
+static byte bySILNTasks = 0;
+static struct stSILTask_t *stSILCurrent = NULL;
+static struct stSILTimer_t astSILTimers[SIL_MAX_TIMERS];
+static byte bySILNTimers = 0;
+static struct stSILCANNode_t astSILCANNodes[SIL_MAX_CAN_NODES];
+static byte bySILNCANNodes = 0;
+static esp_now_send_cb_t pfSILESPNOWSent = NULL;
+static qword qwtSILWatchdogus = 0;      // 0 with the watchdog off
+static char abySILMountPoint[32] = "";
+static dword dwSILRandom = 1;
+
+/* --------------------------- Function prototypes -------------------------- */
+void sil_configure(const stSILConfig_t *stConfig);
+qword sil_now(void);
+void sil_run_until(qword qwtUntilus);
+boolean sil_stopped(void);
+boolean sil_can_receive(byte byBus, const CAN_frame_t *stFrame);
+const stSILCounters_t *sil_counters(void);
+FILE *__real_fopen(const char *abyPath, const char *abyMode);
+DIR *__real_opendir(const char *abyPath);
+FILE *__wrap_fopen(const char *abyPath, const char *abyMode);
+DIR *__wrap_opendir(const char *abyPath);
+static void sil_task_entry(void);
+static void sil_block(eSILTaskState_t eState, qword qwtWakeus);
+static void sil_stop(const char *abyReason);
+static qword sil_next_event(void);
+static void sil_fire_timers(void);
+static void sil_check_watchdog(void);
+static void sil_put_time(FILE *stFile);
+static const char *sil_map_path(const char *abyPath, char *abyMapped, size_t NMappedSize);
+
+/* --------------------------- Functions ------------------------------------ */
+
+void sil_configure(const stSILConfig_t *stConfig)
+{
+    /*
+    *===========================================================================
+    *   sil_configure
+    *   Takes:   stConfig - outputs, reset reason and random seed
+    *
+    *   Returns: Nothing.
+    *
+    *   Call before app_main.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stSILConfig = *stConfig;
+    dwSILRandom = stConfig->dwRandomSeed ? stConfig->dwRandomSeed : 1;
+}
+
+qword sil_now(void)
+{
+    /*
+    *===========================================================================
+    *   sil_now
+    *   Takes:   None
+    *
+    *   Returns: Virtual time since boot (us).
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    return qwtSILNowus;
+}
+
+boolean sil_stopped(void)
+{
+    /*
+    *===========================================================================
+    *   sil_stopped
+    *   Takes:   None
+    *
+    *   Returns: TRUE once the watchdog fired or the firmware restarted.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    return bSILStopped;
+}
+
+const stSILCounters_t *sil_counters(void)
+{
+    /*
+    *===========================================================================
+    *   sil_counters
+    *   Takes:   None
+    *
+    *   Returns: What the run has done so far.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    return &stSILCounters;
+}
+
+void sil_run_until(qword qwtUntilus)
+{
+    /*
+    *===========================================================================
+    *   sil_run_until
+    *   Takes:   qwtUntilus - virtual time to stop at
+    *
+    *   Returns: Nothing.
+    *
+    *   Runs timers and tasks in time order up to qwtUntilus and leaves the
+    *   clock there, or where the run stopped.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    while (!bSILStopped)
+    {
+        sil_fire_timers();
+        sil_check_watchdog();
+        if (bSILStopped)
+        {
+            return;
+        }
+
+        /* Highest priority ready task, the first created wins a tie */
+        struct stSILTask_t *stNext = NULL;
+        for (byte i = 0; i < bySILNTasks; i++)
+        {
+            struct stSILTask_t *stTask = &astSILTasks[i];
+            if ((stTask->eState == eSIL_TASK_SLEEPING || stTask->eState == eSIL_TASK_WAITING) &&
+                stTask->qwtWakeus <= qwtSILNowus)
+            {
+                stTask->eState = eSIL_TASK_READY;
+            }
+            if (stTask->eState == eSIL_TASK_READY && (stNext == NULL || stTask->NPriority > stNext->NPriority))
+            {
+                stNext = stTask;
+            }
+        }
+        if (stNext != NULL)
+        {
+            stSILCurrent = stNext;
+            stSILCounters.qwNContextSwitches++;
+            swapcontext(&stSILKernelContext, &stNext->stContext);
+            stSILCurrent = NULL;
+            continue;
+        }
+
+        qword qwtNextus = sil_next_event();
+        if (qwtNextus > qwtUntilus)
+        {
+            qwtSILNowus = qwtUntilus;
+            return;
+        }
+        qwtSILNowus = qwtNextus;
+    }
+}
+
+boolean sil_can_receive(byte byBus, const CAN_frame_t *stFrame)
+{
+    /*
+    *===========================================================================
+    *   sil_can_receive
+    *   Takes:   byBus - bus the frame arrives on
+    *            stFrame - ID, DLC and data
+    *
+    *   Returns: TRUE if a started node took it.
+    *
+    *   Runs the node's RX callback now, as the RX interrupt would.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    for (byte i = 0; i < bySILNCANNodes; i++)
+    {
+        struct stSILCANNode_t *stNode = &astSILCANNodes[i];
+        if (stNode->byBus != byBus || !stNode->bEnabled || stNode->stCallbacks.on_rx_done == NULL)
+        {
+            continue;
+        }
+        byte byDLC = (stFrame->byDLC > 8) ? 8 : stFrame->byDLC;
+        stNode->stPendingHeader = (twai_frame_header_t){ .id = stFrame->dwID, .dlc = byDLC, .ide = stFrame->dwID > 0x7FF };
+        memcpy(stNode->abyPending, stFrame->abData, byDLC);
+        stNode->bPending = TRUE;
+        twai_rx_done_event_data_t stData = { 0 };
+        (void)stNode->stCallbacks.on_rx_done(stNode, &stData, stNode->pvArg);
+        stNode->bPending = FALSE;
+        stSILCounters.qwNCANRx++;
+        return TRUE;
+    }
+    stSILCounters.qwNCANRxNoNode++;
+    return FALSE;
+}
+
+static void sil_task_entry(void)
+{
+    /*
+    *===========================================================================
+    *   sil_task_entry
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   First thing every task coroutine runs. FreeRTOS tasks must not
+    *   return, one that does is parked for good.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    stSILCurrent->pfTask(stSILCurrent->pvArg);
+    sil_block(eSIL_TASK_DONE, SIL_FOREVER);
+}
+
+static void sil_block(eSILTaskState_t eState, qword qwtWakeus)
+{
+    /*
+    *===========================================================================
+    *   sil_block
+    *   Takes:   eState - what the running task waits for
+    *            qwtWakeus - when it wakes regardless, SIL_FOREVER for never
+    *
+    *   Returns: Nothing, once the task runs again.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    struct stSILTask_t *stTask = stSILCurrent;
+    stTask->eState = eState;
+    stTask->qwtWakeus = qwtWakeus;
+    swapcontext(&stTask->stContext, &stSILKernelContext);
+}
+
+static void sil_stop(const char *abyReason)
+{
+    /*
+    *===========================================================================
+    *   sil_stop
+    *   Takes:   abyReason - why the run ended
+    *
+    *   Returns: Nothing.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (!bSILStopped)
+    {
+        bSILStopped = TRUE;
+        snprintf(stSILCounters.abyStopReason, sizeof(stSILCounters.abyStopReason), "%s", abyReason);
+    }
+}
+
+static qword sil_next_event(void)
+{
+    /*
+    *===========================================================================
+    *   sil_next_event
+    *   Takes:   None
+    *
+    *   Returns: Earliest task wake up, timer expiry or watchdog deadline,
+    *            SIL_FOREVER if there is none.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    qword qwtNextus = SIL_FOREVER;
+    for (byte i = 0; i < bySILNTasks; i++)
+    {
+        const struct stSILTask_t *stTask = &astSILTasks[i];
+        if ((stTask->eState == eSIL_TASK_SLEEPING || stTask->eState == eSIL_TASK_WAITING) && stTask->qwtWakeus < qwtNextus)
+        {
+            qwtNextus = stTask->qwtWakeus;
+        }
+        if (stTask->bWatched && qwtSILWatchdogus != 0 && stTask->qwtLastFeedus + qwtSILWatchdogus < qwtNextus)
+        {
+            qwtNextus = stTask->qwtLastFeedus + qwtSILWatchdogus;
+        }
+    }
+    for (byte i = 0; i < bySILNTimers; i++)
+    {
+        if (astSILTimers[i].bActive && astSILTimers[i].qwtDueus < qwtNextus)
+        {
+            qwtNextus = astSILTimers[i].qwtDueus;
+        }
+    }
+    return qwtNextus;
+}
+
+static void sil_fire_timers(void)
+{
+    /*
+    *===========================================================================
+    *   sil_fire_timers
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Runs every timer due by now, earliest first. A callback may start
+    *   timers again.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    for (;;)
+    {
+        struct stSILTimer_t *stDue = NULL;
+        for (byte i = 0; i < bySILNTimers; i++)
+        {
+            struct stSILTimer_t *stTimer = &astSILTimers[i];
+            if (stTimer->bActive && stTimer->qwtDueus <= qwtSILNowus && (stDue == NULL || stTimer->qwtDueus < stDue->qwtDueus))
+            {
+                stDue = stTimer;
+            }
+        }
+        if (stDue == NULL)
+        {
+            return;
+        }
+        if (stDue->qwtPeriodus != 0)
+        {
+            stDue->qwtDueus += stDue->qwtPeriodus;
+        }
+        else
+        {
+            stDue->bActive = FALSE;
+        }
+        stSILCounters.qwNTimerCallbacks++;
+        stDue->stArgs.callback(stDue->stArgs.arg);
+    }
+}
+
+static void sil_check_watchdog(void)
+{
+    /*
+    *===========================================================================
+    *   sil_check_watchdog
+    *   Takes:   None
+    *
+    *   Returns: Nothing.
+    *
+    *   Ends the run if a subscribed task has not fed the watchdog within its
+    *   timeout, after the firmware's ISR hook has had its go.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    if (qwtSILWatchdogus == 0)
+    {
+        return;
+    }
+    for (byte i = 0; i < bySILNTasks; i++)
+    {
+        const struct stSILTask_t *stTask = &astSILTasks[i];
+        if (stTask->bWatched && qwtSILNowus - stTask->qwtLastFeedus >= qwtSILWatchdogus)
+        {
+            char abyReason[96];
+            esp_task_wdt_isr_user_handler();
+            stSILCounters.bWatchdogFired = TRUE;
+            snprintf(abyReason, sizeof(abyReason), "task watchdog, %s not fed for %llu ms", stTask->abyName,
+                     (unsigned long long)(qwtSILWatchdogus / 1000));
+            sil_stop(abyReason);
+            return;
+        }
+    }
+}
+
+static void sil_put_time(FILE *stFile)
+{
+    /*
+    *===========================================================================
+    *   sil_put_time
+    *   Takes:   stFile - output
+    *
+    *   Returns: Nothing.
+    *
+    *   Writes the candump style "(seconds.micros) " virtual time stamp.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    fprintf(stFile, "(%llu.%06llu) ", (unsigned long long)(qwtSILNowus / 1000000), (unsigned long long)(qwtSILNowus % 1000000));
+}
+
+static const char *sil_map_path(const char *abyPath, char *abyMapped, size_t NMappedSize)
+{
+    /*
+    *===========================================================================
+    *   sil_map_path
+    *   Takes:   abyPath - path the firmware used
+    *            abyMapped, NMappedSize - room for the host path
+    *
+    *   Returns: The host path, abyPath itself unless it is on the card.
+    *===========================================================================
+    *   Revision History:
+    *   18/10/26 CP Initial Version
+    *
+    *===========================================================================
+    */
+    size_t NMountLength = strlen(abySILMountPoint);
+    if (NMountLength == 0 || strncmp(abyPath, abySILMountPoint, NMountLength) != 0 ||
+        (abyPath[NMountLength] != '/' && abyPath[NMountLength] != '\0'))
+    {
+        return abyPath;
+    }
+    snprintf(abyMapped, NMappedSize, "%s%s", stSILConfig.abySDDirectory, &abyPath[NMountLength]);
+    return abyMapped;
+}
+
+FILE *__wrap_fopen(const char *abyPath, const char *abyMode)
+{
+    char abyMapped[512];
+    return __real_fopen(sil_map_path(abyPath, abyMapped, sizeof(abyMapped)), abyMode);
+}
+
+DIR *__wrap_opendir(const char *abyPath)
+{
+    char abyMapped[512];
+    return __real_opendir(sil_map_path(abyPath, abyMapped, sizeof(abyMapped)));
+}
+
+/* --------------------------- FreeRTOS ------------------------------------- */
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pfTask, const char *abyName, uint32_t dwStackBytes, void *pvArg,
+                                   UBaseType_t NPriority, TaskHandle_t *pstHandle, BaseType_t NCore)
+{
+    (void)dwStackBytes;
+    (void)NCore;
+    if (bySILNTasks >= SIL_MAX_TASKS)
+    {
+        return pdFAIL;
+    }
+    struct stSILTask_t *stTask = &astSILTasks[bySILNTasks++];
+    *stTask = (struct stSILTask_t){ .pfTask = pfTask, .pvArg = pvArg, .abyName = abyName, .NPriority = NPriority,
+                                    .eState = eSIL_TASK_READY };
+    stTask->pvStack = malloc(SIL_STACK_BYTES);
+    if (stTask->pvStack == NULL)
+    {
+        bySILNTasks--;
+        return pdFAIL;
+    }
+    getcontext(&stTask->stContext);
+    stTask->stContext.uc_stack.ss_sp = stTask->pvStack;
+    stTask->stContext.uc_stack.ss_size = SIL_STACK_BYTES;
+    stTask->stContext.uc_link = &stSILKernelContext;
+    makecontext(&stTask->stContext, sil_task_entry, 0);
+    if (pstHandle != NULL)
+    {
+        *pstHandle = stTask;
+    }
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t wtTicks)
+{
+    /* Outside a task (init code) there is nothing to wait for */
+    if (stSILCurrent != NULL)
+    {
+        sil_block(eSIL_TASK_SLEEPING, qwtSILNowus + (qword)wtTicks * SIL_US_PER_TICK);
+    }
+}
+
+BaseType_t xTaskDelayUntil(TickType_t *pwtPreviousWake, TickType_t wtIncrement)
+{
+    *pwtPreviousWake += wtIncrement;
+    qword qwtWakeus = (qword)*pwtPreviousWake * SIL_US_PER_TICK;
+    if (stSILCurrent == NULL || qwtWakeus <= qwtSILNowus)
+    {
+        return pdFALSE;
+    }
+    sil_block(eSIL_TASK_SLEEPING, qwtWakeus);
+    return pdTRUE;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(qwtSILNowus / SIL_US_PER_TICK);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t bClearOnExit, TickType_t wtTimeout)
+{
+    struct stSILTask_t *stTask = stSILCurrent;
+    if (stTask == NULL)
+    {
+        return 0;
+    }
+    if (stTask->dwNNotifications == 0 && wtTimeout != 0)
+    {
+        sil_block(eSIL_TASK_WAITING, (wtTimeout == portMAX_DELAY) ? SIL_FOREVER : qwtSILNowus + (qword)wtTimeout * SIL_US_PER_TICK);
+    }
+    uint32_t dwNTaken = stTask->dwNNotifications;
+    if (dwNTaken != 0)
+    {
+        stTask->dwNNotifications = bClearOnExit ? 0 : dwNTaken - 1;
+    }
+    return dwNTaken;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t stTask)
+{
+    stTask->dwNNotifications++;
+    if (stTask->eState == eSIL_TASK_WAITING)
+    {
+        stTask->eState = eSIL_TASK_READY;
+    }
+    return pdPASS;
+}
+
+/* --------------------------- esp_timer ------------------------------------ */
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)qwtSILNowus;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *stArgs, esp_timer_handle_t *pstTimer)
+{
+    if (stArgs == NULL || stArgs->callback == NULL || pstTimer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (bySILNTimers >= SIL_MAX_TIMERS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    struct stSILTimer_t *stTimer = &astSILTimers[bySILNTimers++];
+    *stTimer = (struct stSILTimer_t){ .stArgs = *stArgs };
+    *pstTimer = stTimer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t stTimer, uint64_t qwtTimeoutus)
+{
+    if (stTimer->bActive)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    stTimer->bActive = TRUE;
+    stTimer->qwtDueus = qwtSILNowus + qwtTimeoutus;
+    stTimer->qwtPeriodus = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t stTimer, uint64_t qwtPeriodus)
+{
+    if (stTimer->bActive)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (qwtPeriodus == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stTimer->bActive = TRUE;
+    stTimer->qwtDueus = qwtSILNowus + qwtPeriodus;
+    stTimer->qwtPeriodus = qwtPeriodus;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t stTimer)
+{
+    if (!stTimer->bActive)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    stTimer->bActive = FALSE;
+    return ESP_OK;
+}
+
+/* --------------------------- Watchdog, system ----------------------------- */
+
+esp_err_t esp_task_wdt_init(const esp_task_wdt_config_t *stConfig)
+{
+    qwtSILWatchdogus = (qword)stConfig->timeout_ms * 1000;
+    return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_deinit(void)
+{
+    qwtSILWatchdogus = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_add(TaskHandle_t stTask)
+{
+    stTask = (stTask != NULL) ? stTask : stSILCurrent;
+    if (stTask == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    stTask->bWatched = TRUE;
+    stTask->qwtLastFeedus = qwtSILNowus;
+    return ESP_OK;
+}
+
+esp_err_t esp_task_wdt_reset(void)
+{
+    if (stSILCurrent == NULL || !stSILCurrent->bWatched)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    stSILCurrent->qwtLastFeedus = qwtSILNowus;
+    return ESP_OK;
+}
+
+__attribute__((weak)) void esp_task_wdt_isr_user_handler(void)
+{
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return stSILConfig.eResetReason;
+}
+
+void esp_restart(void)
+{
+    stSILCounters.bRestarted = TRUE;
+    sil_stop("esp_restart");
+    if (stSILCurrent != NULL)
+    {
+        sil_block(eSIL_TASK_DONE, SIL_FOREVER);
+    }
+}
+
+uint32_t esp_random(void)
+{
+    /* xorshift32, repeatable for a given seed */
+    dwSILRandom ^= dwSILRandom << 13;
+    dwSILRandom ^= dwSILRandom >> 17;
+    dwSILRandom ^= dwSILRandom << 5;
+    dwSILRandom &= 0xFFFFFFFF;
+    return (uint32_t)dwSILRandom;
+}
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    return (uint32_t)(qwtSILNowus * SIL_CPU_MHZ);
+}
+
+/* --------------------------- TWAI ----------------------------------------- */
+
+esp_err_t twai_new_node_onchip(const twai_onchip_node_config_t *stConfig, twai_node_handle_t *pstNode)
+{
+    (void)stConfig;
+    if (bySILNCANNodes >= SIL_MAX_CAN_NODES)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    struct stSILCANNode_t *stNode = &astSILCANNodes[bySILNCANNodes];
+    *stNode = (struct stSILCANNode_t){ .byBus = bySILNCANNodes };
+    bySILNCANNodes++;
+    *pstNode = stNode;
+    return ESP_OK;
+}
+
+esp_err_t twai_node_register_event_callbacks(twai_node_handle_t stNode, const twai_event_callbacks_t *stCallbacks, void *pvArg)
+{
+    stNode->stCallbacks = *stCallbacks;
+    stNode->pvArg = pvArg;
+    return ESP_OK;
+}
+
+esp_err_t twai_node_enable(twai_node_handle_t stNode)
+{
+    stNode->bEnabled = TRUE;
+    return ESP_OK;
+}
+
+esp_err_t twai_node_transmit(twai_node_handle_t stNode, const twai_frame_t *stFrame, int NTimeoutms)
+{
+    (void)NTimeoutms;
+    if (!stNode->bEnabled)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    stSILCounters.qwNCANTx++;
+    if (stSILConfig.stCANTx != NULL)
+    {
+        sil_put_time(stSILConfig.stCANTx);
+        fprintf(stSILConfig.stCANTx, "can%u %0*lX#", (unsigned)stNode->byBus, stFrame->header.ide ? 8 : 3,
+                (unsigned long)stFrame->header.id);
+        for (size_t i = 0; i < stFrame->header.dlc && i < stFrame->buffer_len; i++)
+        {
+            fprintf(stSILConfig.stCANTx, "%02X", stFrame->buffer[i]);
+        }
+        fputc('\n', stSILConfig.stCANTx);
+    }
+    if (stNode->stCallbacks.on_tx_done != NULL)
+    {
+        twai_tx_done_event_data_t stData = { .is_tx_success = true, .done_tx_frame = stFrame };
+        (void)stNode->stCallbacks.on_tx_done(stNode, &stData, stNode->pvArg);
+    }
+    return ESP_OK;
+}
+
+esp_err_t twai_node_receive_from_isr(twai_node_handle_t stNode, twai_frame_t *stFrame)
+{
+    if (!stNode->bPending)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    stFrame->header = stNode->stPendingHeader;
+    size_t NLength = (stNode->stPendingHeader.dlc < stFrame->buffer_len) ? stNode->stPendingHeader.dlc : stFrame->buffer_len;
+    memcpy(stFrame->buffer, stNode->abyPending, NLength);
+    stNode->bPending = FALSE;
+    return ESP_OK;
+}
+
+esp_err_t twai_node_get_info(twai_node_handle_t stNode, twai_node_status_t *stStatus, twai_node_record_t *stRecord)
+{
+    (void)stNode;
+    if (stStatus != NULL)
+    {
+        *stStatus = (twai_node_status_t){ .state = TWAI_ERROR_ACTIVE };
+    }
+    if (stRecord != NULL)
+    {
+        *stRecord = (twai_node_record_t){ 0 };
+    }
+    return ESP_OK;
+}
+
+esp_err_t twai_node_recover(twai_node_handle_t stNode)
+{
+    (void)stNode;
+    return ESP_OK;
+}
+
+/* --------------------------- ESP-NOW -------------------------------------- */
+
+esp_err_t esp_now_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *stPeer)
+{
+    (void)stPeer;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t pfCallback)
+{
+    pfSILESPNOWSent = pfCallback;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t pfCallback)
+{
+    (void)pfCallback;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_send(const uint8_t *abyPeer, const uint8_t *abyData, size_t NLength)
+{
+    if (NLength == 0 || NLength > 250)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stSILCounters.qwNESPNOWPackets++;
+    stSILCounters.qwNESPNOWBytes += NLength;
+    if (stSILConfig.stESPNOW != NULL)
+    {
+        sil_put_time(stSILConfig.stESPNOW);
+        fprintf(stSILConfig.stESPNOW, "%02X:%02X:%02X:%02X:%02X:%02X %3zu ", abyPeer[0], abyPeer[1], abyPeer[2],
+                abyPeer[3], abyPeer[4], abyPeer[5], NLength);
+        for (size_t i = 0; i < NLength; i++)
+        {
+            fprintf(stSILConfig.stESPNOW, "%02X", abyData[i]);
+        }
+        fputc('\n', stSILConfig.stESPNOW);
+    }
+    if (pfSILESPNOWSent != NULL)
+    {
+        wifi_tx_info_t stInfo = { .des_addr = (uint8_t *)abyPeer };
+        pfSILESPNOWSent(&stInfo, ESP_NOW_SEND_SUCCESS);
+    }
+    return ESP_OK;
+}
+
+/* --------------------------- SD card ------------------------------------- */
+
+esp_err_t esp_vfs_fat_sdspi_mount(const char *abyBasePath, const sdmmc_host_t *stHost, const sdspi_device_config_t *stSlot,
+                                  const esp_vfs_fat_sdmmc_mount_config_t *stConfig, sdmmc_card_t **pstCard)
+{
+    static sdmmc_card_t stCard;
+    (void)stHost;
+    (void)stSlot;
+    (void)stConfig;
+    if (stSILConfig.abySDDirectory[0] == '\0')
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (mkdir(stSILConfig.abySDDirectory, 0777) != 0)
+    {
+        struct stat stInfo;
+        if (stat(stSILConfig.abySDDirectory, &stInfo) != 0 || !S_ISDIR(stInfo.st_mode))
+        {
+            return ESP_FAIL;
+        }
+    }
+    snprintf(abySILMountPoint, sizeof(abySILMountPoint), "%s", abyBasePath);
+    *pstCard = &stCard;
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_sdcard_format(const char *abyBasePath, sdmmc_card_t *stCard)
+{
+    (void)abyBasePath;
+    (void)stCard;
+    return ESP_OK;
+}
@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+"""
+trace2json.py
+Turns an execution trace dump from main/trace.c into Chrome trace event JSON
+that opens in Perfetto (ui.perfetto.dev) or chrome://tracing. The input is
+either the binary file written to the SD card or a serial log holding the
+"TRACE:" hex lines, anything else in the log is skipped.
+
+Each scheduler task gets a track with its runnables nested inside it, each
+ISR and the SD card writes get their own track. The CAN RX ring depth is a
+counter track and deadline misses are instant events on the task that
+missed. Timestamps are 32 bit microseconds on the target and are unwrapped,
+so a dump is good for any length of run.
+
+Usage: python3 tools/trace2json.py <trace.bin | serial.log> <out.json>
+
+Written by Cole Perera for Sheffield Formula Racing 2025
+"""
+
+import json
+import struct
+import sys
+from pathlib import Path
+
+MAGIC = b'SFRTRACE'
+VERSION = 1
+HEADER = struct.Struct('<8sHHII')
+NAME = struct.Struct('<BBB13s')
+EVENT = struct.Struct('<IBBH')
+
+# eTraceEvent_t
+TASK_BEGIN, TASK_END, RUNNABLE_BEGIN, RUNNABLE_END, ISR_BEGIN, ISR_END, \
+    SD_WRITE_BEGIN, SD_WRITE_END, STALL = range(9)
+# eTraceName_t
+NAME_TASK, NAME_RUNNABLE, NAME_ISR = range(3)
+# eTraceISR_t IDs whose end carries the CAN RX ring depth
+CAN_RX_ISRS = (0, 1)
+
+PID = 1
+TASK_TID_BASE = 1
+ISR_TID_BASE = 100
+SD_TID = 200
+
+
+class TraceError(Exception):
+    pass
+
+
+def read_dump(path):
+    raw = Path(path).read_bytes()
+    if raw.startswith(MAGIC):
+        return raw
+
+    # Serial log, the hex after "TRACE:" between the begin and end markers
+    text = raw.decode('ascii', errors='replace')
+    hex_digits = []
+    for line in text.splitlines():
+        marker = line.find('TRACE:')
+        if marker >= 0:
+            hex_digits.append(line[marker + len('TRACE:'):].strip())
+    if not hex_digits:
+        raise TraceError(f'{path} is not a trace dump and has no TRACE: lines')
+    try:
+        return bytes.fromhex(''.join(hex_digits))
+    except ValueError as error:
+        raise TraceError(f'bad hex in serial log: {error}')
+
+
+def parse_dump(data):
+    if len(data) < HEADER.size:
+        raise TraceError('dump shorter than its header')
+    magic, version, n_names, n_events, n_lost = HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise TraceError('bad magic')
+    if version != VERSION:
+        raise TraceError(f'version {version}, expected {VERSION}')
+    expected = HEADER.size + n_names * NAME.size + n_events * EVENT.size
+    if len(data) < expected:
+        raise TraceError(f'dump is {len(data)} bytes, header says {expected}')
+
+    names = {}
+    offset = HEADER.size
+    for _ in range(n_names):
+        kind, ident, track, name = NAME.unpack_from(data, offset)
+        names[(kind, ident)] = (track, name.split(b'\0', 1)[0].decode('ascii', errors='replace'))
+        offset += NAME.size
+
+    events = []
+    for _ in range(n_events):
+        events.append(EVENT.unpack_from(data, offset))
+        offset += EVENT.size
+    return names, events, n_lost
+
+
+def unwrap(events):
+    """Yields (time_us, event, id, value) with the 32 bit time made monotonic.
+    Events are added in index order but timed just after, so neighbours can be
+    a few us out of order, hence a signed difference rather than a wrap test."""
+    time_us = None
+    previous = 0
+    for timestamp, event, ident, value in events:
+        if time_us is None:
+            time_us = timestamp
+        else:
+            delta = (timestamp - previous) & 0xFFFFFFFF
+            if delta >= 0x80000000:
+                delta -= 0x100000000
+            time_us += delta
+        previous = timestamp
+        yield time_us, event, ident, value
+
+
+def name_of(names, kind, ident, fallback):
+    return names.get((kind, ident), (ident, f'{fallback} {ident}'))
+
+
+def to_chrome(names, events, n_lost):
+    out = []
+    open_slices = {}
+
+    def slice_event(phase, tid, name, time_us, args=None):
+        # Drop ends whose begin was lost to the ring wrapping
+        stack = open_slices.setdefault(tid, [])
+        if phase == 'B':
+            stack.append(name)
+        elif not stack:
+            return
+        else:
+            stack.pop()
+        entry = {'name': name, 'ph': phase, 'ts': time_us, 'pid': PID, 'tid': tid}
+        if args:
+            entry['args'] = args
+        out.append(entry)
+
+    start_us = None
+    for time_us, event, ident, value in unwrap(events):
+        if start_us is None:
+            start_us = time_us
+        time_us -= start_us
+
+        if event in (TASK_BEGIN, TASK_END):
+            _, name = name_of(names, NAME_TASK, ident, 'task')
+            slice_event('B' if event == TASK_BEGIN else 'E', TASK_TID_BASE + ident, name, time_us)
+        elif event in (RUNNABLE_BEGIN, RUNNABLE_END):
+            task, name = name_of(names, NAME_RUNNABLE, ident, 'runnable')
+            slice_event('B' if event == RUNNABLE_BEGIN else 'E', TASK_TID_BASE + task, name, time_us)
+        elif event in (ISR_BEGIN, ISR_END):
+            _, name = name_of(names, NAME_ISR, ident, 'ISR')
+            if event == ISR_BEGIN:
+                slice_event('B', ISR_TID_BASE + ident, name, time_us)
+            else:
+                slice_event('E', ISR_TID_BASE + ident, name, time_us, {'value': value})
+                if ident in CAN_RX_ISRS:
+                    out.append({'name': 'CAN RX ring depth', 'ph': 'C', 'ts': time_us, 'pid': PID,
+                                'args': {'frames': value}})
+        elif event in (SD_WRITE_BEGIN, SD_WRITE_END):
+            slice_event('B' if event == SD_WRITE_BEGIN else 'E', SD_TID, 'SD write', time_us,
+                        {'bytes': value} if event == SD_WRITE_BEGIN else None)
+        elif event == STALL:
+            _, name = name_of(names, NAME_TASK, ident, 'task')
+            out.append({'name': f'{name} deadline miss', 'ph': 'i', 's': 't', 'ts': time_us,
+                        'pid': PID, 'tid': TASK_TID_BASE + ident})
+
+    # Track names, tasks sorted by priority as they are numbered
+    metadata = [{'name': 'process_name', 'ph': 'M', 'pid': PID, 'args': {'name': 'SFR'}}]
+    for (kind, ident), (_, name) in sorted(names.items()):
+        if kind == NAME_TASK:
+            tid = TASK_TID_BASE + ident
+        elif kind == NAME_ISR:
+            tid = ISR_TID_BASE + ident
+        else:
+            continue
+        metadata.append({'name': 'thread_name', 'ph': 'M', 'pid': PID, 'tid': tid, 'args': {'name': name}})
+        metadata.append({'name': 'thread_sort_index', 'ph': 'M', 'pid': PID, 'tid': tid,
+                         'args': {'sort_index': tid}})
+    metadata.append({'name': 'thread_name', 'ph': 'M', 'pid': PID, 'tid': SD_TID, 'args': {'name': 'SD card'}})
+
+    return {'traceEvents': metadata + out, 'displayTimeUnit': 'ms',
+            'otherData': {'events': len(events), 'events_lost': n_lost}}
+
+
+def main(argv):
+    if len(argv) != 3:
+        print('Usage: python3 tools/trace2json.py <trace.bin | serial.log> <out.json>', file=sys.stderr)
+        return 2
+    try:
+        names, events, n_lost = parse_dump(read_dump(argv[1]))
+    except (TraceError, OSError) as error:
+        print(f'trace2json: {error}', file=sys.stderr)
+        return 1
+
+    Path(argv[2]).write_text(json.dumps(to_chrome(names, events, n_lost)))
+    print(f'{len(events)} events, {n_lost} lost to wrapping')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))